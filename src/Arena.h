@@ -0,0 +1,187 @@
+#ifndef ARENA_H_GUARD
+#define ARENA_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+/**
+ * Arena allocator for trees and feature matrices. Memory is mapped in
+ * large regions and handed out in cache-line-aligned pieces by bumping a
+ * pointer, so the nodes of a tree and the rows of a matrix end up next to
+ * each other instead of scattered across the heap. Pieces are never freed
+ * individually: destroyArena unmaps all regions at once, which replaces
+ * walking every tree to free its nodes.
+ *
+ * With huge pages, regions are multiples of 2 MB and mapped with
+ * MAP_HUGETLB. If no huge pages are reserved, regions are aligned to 2 MB
+ * and marked with MADV_HUGEPAGE, so that transparent huge pages can back
+ * them. Either way, a large ensemble or matrix needs far fewer TLB entries.
+ *
+ * Memory returned by an arena is zero-filled. An arena is not thread-safe;
+ * threads may fill memory that was allocated before they start.
+ */
+
+// Alignment of every allocation (one cache line)
+#define ARENA_ALIGNMENT 64
+
+#define ARENA_HUGE_PAGE_SIZE (2L << 20)
+
+// Size of a region; larger allocations get a region of their own
+#define ARENA_REGION_SIZE (4L << 20)
+
+typedef struct ArenaRegion ArenaRegion;
+
+// Header at the start of every region, padded to ARENA_ALIGNMENT
+struct ArenaRegion {
+  ArenaRegion* next; // Region mapped before this one
+  void* mapping; // Start of the mapping, before alignment
+  long mappingSize; // Bytes mapped
+  long size; // Usable bytes from the start of this header
+};
+
+typedef struct Arena Arena;
+
+struct Arena {
+  int hugePages; // Whether regions are backed by huge pages
+  ArenaRegion* regions; // Most recent region first
+  char* next; // Next free byte of the current region
+  char* end; // End of the current region
+  long allocated; // Bytes handed out
+  long mapped; // Bytes mapped
+  int numberOfRegions;
+  int hugeTlbRegions; // Regions mapped with MAP_HUGETLB
+};
+
+/**
+ * @param hugePages Whether to back the arena with huge pages
+ */
+Arena* createArena(int hugePages) {
+  Arena* arena = (Arena*) calloc(1, sizeof(Arena));
+  arena->hugePages = hugePages;
+  return arena;
+}
+
+/**
+ * Maps a region of at least the given size.
+ *
+ * @return Region, or 0 if it could not be mapped
+ */
+ArenaRegion* mapArenaRegion(Arena* arena, long bytes) {
+  long unit = arena->hugePages ? ARENA_HUGE_PAGE_SIZE : 4096;
+  long size = (bytes + unit - 1) / unit * unit;
+  void* mapping = MAP_FAILED;
+  long mappingSize = size;
+  char* start;
+  int hugeTlb = 0;
+#ifdef MAP_HUGETLB
+  if(arena->hugePages) {
+    mapping = mmap(0, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    hugeTlb = mapping != MAP_FAILED;
+  }
+#endif
+  if(mapping == MAP_FAILED) {
+    // Transparent huge pages need 2 MB alignment
+    mappingSize = arena->hugePages ? size + ARENA_HUGE_PAGE_SIZE : size;
+    mapping = mmap(0, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mapping == MAP_FAILED) {
+      return 0;
+    }
+  }
+  start = (char*) mapping;
+  if(arena->hugePages && !hugeTlb) {
+    start = (char*) (((uintptr_t) mapping + ARENA_HUGE_PAGE_SIZE - 1) &
+                     ~(uintptr_t) (ARENA_HUGE_PAGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+    madvise(start, size, MADV_HUGEPAGE);
+#endif
+  }
+
+  ArenaRegion* region = (ArenaRegion*) start;
+  region->next = arena->regions;
+  region->mapping = mapping;
+  region->mappingSize = mappingSize;
+  region->size = size;
+  arena->regions = region;
+  arena->mapped += mappingSize;
+  arena->numberOfRegions++;
+  arena->hugeTlbRegions += hugeTlb;
+  return region;
+}
+
+/**
+ * Allocates zero-filled memory, aligned to ARENA_ALIGNMENT.
+ *
+ * @return Memory that lives until destroyArena, or 0 if no region could
+ *         be mapped
+ */
+void* allocateInArena(Arena* arena, long bytes) {
+  bytes = (bytes + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT * ARENA_ALIGNMENT;
+  if(bytes > arena->end - arena->next) {
+    long header = (sizeof(ArenaRegion) + ARENA_ALIGNMENT - 1) / ARENA_ALIGNMENT *
+      ARENA_ALIGNMENT;
+    if(header + bytes > ARENA_REGION_SIZE / 2) {
+      // A region of its own, so the current region keeps its free space
+      ArenaRegion* region = mapArenaRegion(arena, header + bytes);
+      if(!region) {
+        return 0;
+      }
+      arena->allocated += bytes;
+      return (char*) region + header;
+    }
+    ArenaRegion* region = mapArenaRegion(arena, ARENA_REGION_SIZE);
+    if(!region) {
+      return 0;
+    }
+    arena->next = (char*) region + header;
+    arena->end = (char*) region + region->size;
+  }
+  void* memory = arena->next;
+  arena->next += bytes;
+  arena->allocated += bytes;
+  return memory;
+}
+
+/**
+ * Copies memory into an arena.
+ *
+ * @return The copy, or 0 if it could not be allocated
+ */
+void* copyToArena(Arena* arena, const void* source, long bytes) {
+  void* copy = allocateInArena(arena, bytes);
+  if(copy) {
+    memcpy(copy, source, bytes);
+  }
+  return copy;
+}
+
+/**
+ * Unmaps all regions, which frees everything allocated in the arena.
+ */
+void destroyArena(Arena* arena) {
+  ArenaRegion* region = arena->regions;
+  while(region) {
+    ArenaRegion* next = region->next;
+    munmap(region->mapping, region->mappingSize);
+    region = next;
+  }
+  free(arena);
+}
+
+/**
+ * Prints the size of an arena and how its regions are backed.
+ */
+void printArenaStats(const Arena* arena) {
+  printf("Arena: %.1f MB allocated in %d regions (%.1f MB mapped)", arena->allocated / 1048576.0,
+         arena->numberOfRegions, arena->mapped / 1048576.0);
+  if(arena->hugePages) {
+    printf(", %d with reserved huge pages, %d with transparent huge pages",
+           arena->hugeTlbRegions, arena->numberOfRegions - arena->hugeTlbRegions);
+  }
+  printf("\n");
+}
+
+#endif
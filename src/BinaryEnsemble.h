@@ -0,0 +1,286 @@
+#ifndef BINARY_ENSEMBLE_H_GUARD
+#define BINARY_ENSEMBLE_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Node.h"
+
+/**
+ * Compiled ensemble file, created by CompileEnsemble. The file holds the
+ * final VPred arrays so that it can be memory-mapped and used for scoring
+ * without parsing or copying:
+ *
+ *   header
+ *   offsets[numberOfTrees] (long) Index of the root of each tree in nodes
+ *   depths[numberOfTrees] (long) Depth of each tree
+ *   nodes[numberOfNodes] (Node) All trees, leaves hold the regression values
+ *
+ * Every section starts at a multiple of BINARY_ENSEMBLE_ALIGNMENT bytes.
+ * Files are only readable on machines with the same byte order and type
+ * sizes as the machine that wrote them, which the header records.
+ */
+
+#define BINARY_ENSEMBLE_MAGIC "OPTTREES"
+#define BINARY_ENSEMBLE_VERSION 1
+#define BINARY_ENSEMBLE_ALIGNMENT 64
+#define BINARY_ENSEMBLE_BYTE_ORDER 0x01020304
+
+typedef struct BinaryEnsembleHeader BinaryEnsembleHeader;
+
+struct BinaryEnsembleHeader {
+  char magic[8];
+  unsigned int version;
+  unsigned int byteOrder;
+  unsigned int longSize; // sizeof(long)
+  unsigned int nodeSize; // sizeof(Node)
+  long numberOfTrees;
+  long numberOfNodes;
+  long maxLeaves;
+  long offsetsStart; // Byte offset of each section from the start of the file
+  long depthsStart;
+  long nodesStart;
+  long fileSize;
+};
+
+typedef struct BinaryEnsemble BinaryEnsemble;
+
+// A mapped ensemble file; the arrays point into the mapping.
+struct BinaryEnsemble {
+  void* mapping;
+  size_t size;
+  long numberOfTrees;
+  long numberOfNodes;
+  long maxLeaves;
+  int numberOfFeatures; // 1 + the largest feature id of any node
+  long* offsets;
+  long* depths;
+  Node* nodes;
+};
+
+long alignSection(long position) {
+  return (position + BINARY_ENSEMBLE_ALIGNMENT - 1) /
+    BINARY_ENSEMBLE_ALIGNMENT * BINARY_ENSEMBLE_ALIGNMENT;
+}
+
+/**
+ * Checks whether a file starts with the compiled ensemble magic string.
+ *
+ * @param path Path to the file
+ * @return 1 if the file is a compiled ensemble, 0 otherwise
+ */
+int isBinaryEnsemble(const char* path) {
+  char magic[8];
+  FILE* fp = fopen(path, "rb");
+  if(!fp) {
+    return 0;
+  }
+  int found = fread(magic, 1, 8, fp) == 8 &&
+    memcmp(magic, BINARY_ENSEMBLE_MAGIC, 8) == 0;
+  fclose(fp);
+  return found;
+}
+
+/**
+ * Writes a compiled ensemble file.
+ *
+ * @param path Output path
+ * @param numberOfTrees Number of trees
+ * @param offsets Index of the root of each tree in nodes
+ * @param depths Depth of each tree
+ * @param nodes All trees
+ * @param numberOfNodes Total number of nodes
+ * @param maxLeaves Maximum number of leaves in a tree
+ * @return 0 on success, -1 on error
+ */
+int writeBinaryEnsemble(const char* path, long numberOfTrees, long* offsets,
+                        long* depths, Node* nodes, long numberOfNodes,
+                        long maxLeaves) {
+  BinaryEnsembleHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, BINARY_ENSEMBLE_MAGIC, 8);
+  header.version = BINARY_ENSEMBLE_VERSION;
+  header.byteOrder = BINARY_ENSEMBLE_BYTE_ORDER;
+  header.longSize = sizeof(long);
+  header.nodeSize = sizeof(Node);
+  header.numberOfTrees = numberOfTrees;
+  header.numberOfNodes = numberOfNodes;
+  header.maxLeaves = maxLeaves;
+  header.offsetsStart = alignSection(sizeof(header));
+  header.depthsStart = alignSection(header.offsetsStart + numberOfTrees * sizeof(long));
+  header.nodesStart = alignSection(header.depthsStart + numberOfTrees * sizeof(long));
+  header.fileSize = header.nodesStart + numberOfNodes * sizeof(Node);
+
+  FILE* fp = fopen(path, "wb");
+  if(!fp) {
+    return -1;
+  }
+  char padding[BINARY_ENSEMBLE_ALIGNMENT] = {0};
+  int ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+  ok = ok && fwrite(padding, 1, header.offsetsStart - sizeof(header), fp) ==
+    (size_t) (header.offsetsStart - sizeof(header));
+  ok = ok && fwrite(offsets, sizeof(long), numberOfTrees, fp) == (size_t) numberOfTrees;
+  long position = header.offsetsStart + numberOfTrees * sizeof(long);
+  ok = ok && fwrite(padding, 1, header.depthsStart - position, fp) ==
+    (size_t) (header.depthsStart - position);
+  ok = ok && fwrite(depths, sizeof(long), numberOfTrees, fp) == (size_t) numberOfTrees;
+  position = header.depthsStart + numberOfTrees * sizeof(long);
+  ok = ok && fwrite(padding, 1, header.nodesStart - position, fp) ==
+    (size_t) (header.nodesStart - position);
+  ok = ok && fwrite(nodes, sizeof(Node), numberOfNodes, fp) == (size_t) numberOfNodes;
+  if(fclose(fp) != 0) {
+    ok = 0;
+  }
+  return ok ? 0 : -1;
+}
+
+/**
+ * Computes the length that feature vectors need for an ensemble. Leaves
+ * count too, as the VPred kernels read their feature.
+ *
+ * @return 1 + the largest feature id of any node
+ */
+int getRequiredFeatures(const Node* nodes, long numberOfNodes) {
+  int numberOfFeatures = 1;
+  long n;
+  for(n = 0; n < numberOfNodes; n++) {
+    if(nodes[n].fid >= numberOfFeatures) {
+      numberOfFeatures = nodes[n].fid + 1;
+    }
+  }
+  return numberOfFeatures;
+}
+
+/**
+ * Checks the arrays of an ensemble, so that engines can traverse it without
+ * bounds checks: the trees must follow each other from index 0, every
+ * node must have a non-negative feature id, an internal node must point to
+ * two children after it in its own tree, a leaf must point to itself, and
+ * the depth of a tree must be at least its longest path and at most its
+ * number of nodes. Children that follow their parent rule out cycles.
+ *
+ * @return 1 if the ensemble is consistent, 0 otherwise
+ */
+int isValidEnsemble(const long* offsets, const long* depths, const Node* nodes,
+                    long numberOfTrees, long numberOfNodes) {
+  long tindex, n;
+  long* nodeDepths = (long*) calloc(numberOfNodes + 1, sizeof(long));
+  int valid = numberOfTrees == 0 ? numberOfNodes == 0 : offsets[0] == 0;
+  for(tindex = 0; tindex < numberOfTrees && valid; tindex++) {
+    long begin = offsets[tindex];
+    long end = tindex + 1 < numberOfTrees ? offsets[tindex + 1] : numberOfNodes;
+    if(end <= begin || end > numberOfNodes || end - begin > 0x7fffffff) {
+      valid = 0;
+      break;
+    }
+    long size = end - begin, longest = 0;
+    const Node* tree = &nodes[begin];
+    long* depth = &nodeDepths[begin];
+    for(n = 0; n < size && valid; n++) {
+      if(tree[n].fid < 0) {
+        valid = 0;
+      } else if(tree[n].children[0] == n) {
+        valid = tree[n].children[1] == n;
+        longest = depth[n] > longest ? depth[n] : longest;
+      } else {
+        int c;
+        for(c = 0; c < 2 && valid; c++) {
+          long child = tree[n].children[c];
+          valid = child > n && child < size;
+          if(valid) {
+            // Pre-order: the parent is visited first, so its depth is known
+            depth[child] = depth[n] + 1;
+          }
+        }
+      }
+    }
+    valid = valid && depths[tindex] >= longest && depths[tindex] <= size;
+  }
+  free(nodeDepths);
+  return valid;
+}
+
+/**
+ * Memory-maps a compiled ensemble file.
+ *
+ * @param path Path to the file
+ * @return Mapped ensemble, or 0 if the file is missing, truncated,
+ *         inconsistent (see isValidEnsemble), or was written with a
+ *         different version or on an incompatible machine
+ */
+BinaryEnsemble* mapBinaryEnsemble(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(BinaryEnsembleHeader)) {
+    close(fd);
+    return 0;
+  }
+  void* mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    return 0;
+  }
+
+  BinaryEnsembleHeader* header = (BinaryEnsembleHeader*) mapping;
+  if(memcmp(header->magic, BINARY_ENSEMBLE_MAGIC, 8) != 0 ||
+     header->version != BINARY_ENSEMBLE_VERSION ||
+     header->byteOrder != BINARY_ENSEMBLE_BYTE_ORDER ||
+     header->longSize != sizeof(long) ||
+     header->nodeSize != sizeof(Node) ||
+     header->fileSize != st.st_size ||
+     header->numberOfTrees < 0 || header->numberOfTrees > 0x7fffffff ||
+     header->numberOfNodes < 0 ||
+     header->offsetsStart % BINARY_ENSEMBLE_ALIGNMENT != 0 ||
+     header->depthsStart % BINARY_ENSEMBLE_ALIGNMENT != 0 ||
+     header->nodesStart % BINARY_ENSEMBLE_ALIGNMENT != 0 ||
+     header->offsetsStart < (long) sizeof(BinaryEnsembleHeader) ||
+     header->depthsStart < header->offsetsStart + header->numberOfTrees * (long) sizeof(long) ||
+     header->nodesStart < header->depthsStart + header->numberOfTrees * (long) sizeof(long) ||
+     header->fileSize < header->nodesStart + header->numberOfNodes * (long) sizeof(Node)) {
+    munmap(mapping, st.st_size);
+    return 0;
+  }
+
+  BinaryEnsemble* ensemble = (BinaryEnsemble*) malloc(sizeof(BinaryEnsemble));
+  ensemble->mapping = mapping;
+  ensemble->size = st.st_size;
+  ensemble->numberOfTrees = header->numberOfTrees;
+  ensemble->numberOfNodes = header->numberOfNodes;
+  ensemble->maxLeaves = header->maxLeaves;
+  ensemble->offsets = (long*) ((char*) mapping + header->offsetsStart);
+  ensemble->depths = (long*) ((char*) mapping + header->depthsStart);
+  ensemble->nodes = (Node*) ((char*) mapping + header->nodesStart);
+  if(!isValidEnsemble(ensemble->offsets, ensemble->depths, ensemble->nodes,
+                      ensemble->numberOfTrees, ensemble->numberOfNodes)) {
+    munmap(mapping, st.st_size);
+    free(ensemble);
+    return 0;
+  }
+  ensemble->numberOfFeatures = getRequiredFeatures(ensemble->nodes, ensemble->numberOfNodes);
+  return ensemble;
+}
+
+/**
+ * Unmaps a compiled ensemble. Ensembles that were built in memory rather
+ * than mapped (mapping is 0, see JforestsEnsemble.h) own their arrays,
+ * which are freed instead.
+ */
+void unmapBinaryEnsemble(BinaryEnsemble* ensemble) {
+  if(ensemble->mapping) {
+    munmap(ensemble->mapping, ensemble->size);
+  } else {
+    free(ensemble->offsets);
+    free(ensemble->depths);
+    free(ensemble->nodes);
+  }
+  free(ensemble);
+}
+
+#endif
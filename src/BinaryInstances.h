@@ -0,0 +1,273 @@
+#ifndef BINARY_INSTANCES_H_GUARD
+#define BINARY_INSTANCES_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Arena.h"
+
+/**
+ * Binary instance file, created by ConvertInstances from an SVM Light file.
+ * The file is memory-mapped by the drivers (-instancesBinary), so an input
+ * is only parsed once:
+ *
+ *   header
+ *   featureIds[numberOfColumns] (int) Only in projected files, see below
+ *   features[numberOfRows * numberOfColumns] (float)
+ *   labels[numberOfInstances] (int) Relevance labels
+ *   qids[numberOfInstances] (int) Query ids
+ *
+ * Features are stored in one of two layouts:
+ *   row-major: the value of column f for instance i is at
+ *     features[i * numberOfColumns + f]
+ *   column-block: instances are grouped in blocks of blockSize rows, and
+ *     within a block the values of a column are contiguous, i.e., the
+ *     value of column f for instance b * blockSize + i is at
+ *     features[b * blockSize * numberOfColumns + f * blockSize + i]
+ *
+ * Usually, every feature is a column. A projected file (see
+ * FeatureProjection.h) only stores the columns of the features that an
+ * ensemble uses: column f holds feature featureIds[f], and numberOfColumns
+ * is less than numberOfFeatures.
+ *
+ * The feature matrix is padded with zero rows to numberOfRows (a multiple
+ * of 64 rows, or of blockSize for the column-block layout), and every
+ * section starts at a multiple of 64 bytes. Feature "k:" of the SVM Light
+ * file is stored at index k - 1, and missing features are zero.
+ */
+
+#define BINARY_INSTANCES_MAGIC "OPTINSTS"
+#define BINARY_INSTANCES_VERSION 2
+#define BINARY_INSTANCES_ALIGNMENT 64
+#define BINARY_INSTANCES_BYTE_ORDER 0x01020304
+#define BINARY_INSTANCES_ROW_PADDING 64
+
+#define ROW_MAJOR 0
+#define COLUMN_BLOCK 1
+
+typedef struct BinaryInstancesHeader BinaryInstancesHeader;
+
+struct BinaryInstancesHeader {
+  char magic[8];
+  unsigned int version;
+  unsigned int byteOrder;
+  unsigned int layout; // ROW_MAJOR or COLUMN_BLOCK
+  unsigned int blockSize; // Rows per block in the column-block layout
+  long numberOfInstances;
+  long numberOfFeatures;
+  long numberOfRows; // Number of instances including padding
+  long numberOfColumns; // Number of stored features
+  long featureIdsStart; // Byte offset of each section from the start of the file
+  long featuresStart;
+  long labelsStart;
+  long qidsStart;
+  long fileSize;
+};
+
+typedef struct BinaryInstances BinaryInstances;
+
+// A mapped instance file; the arrays point into the mapping.
+struct BinaryInstances {
+  void* mapping;
+  size_t size;
+  int layout;
+  int blockSize;
+  long numberOfInstances;
+  long numberOfFeatures;
+  long numberOfRows;
+  long numberOfColumns;
+  int* featureIds; // Feature of each column, or 0 if every feature is a column
+  float* features;
+  int* labels;
+  int* qids;
+};
+
+long alignInstancesSection(long position) {
+  return (position + BINARY_INSTANCES_ALIGNMENT - 1) /
+    BINARY_INSTANCES_ALIGNMENT * BINARY_INSTANCES_ALIGNMENT;
+}
+
+/**
+ * Computes the padded number of rows for a layout.
+ */
+long getNumberOfRows(long numberOfInstances, int layout, int blockSize) {
+  long padding = layout == COLUMN_BLOCK ? blockSize : BINARY_INSTANCES_ROW_PADDING;
+  return (numberOfInstances + padding - 1) / padding * padding;
+}
+
+/**
+ * Fills in a header and computes the position of every section.
+ *
+ * @param numberOfColumns Number of stored features; less than
+ *        numberOfFeatures for a projected file
+ */
+void initBinaryInstancesHeader(BinaryInstancesHeader* header, long numberOfInstances,
+                               long numberOfFeatures, long numberOfColumns,
+                               int layout, int blockSize) {
+  memset(header, 0, sizeof(BinaryInstancesHeader));
+  memcpy(header->magic, BINARY_INSTANCES_MAGIC, 8);
+  header->version = BINARY_INSTANCES_VERSION;
+  header->byteOrder = BINARY_INSTANCES_BYTE_ORDER;
+  header->layout = layout;
+  header->blockSize = layout == COLUMN_BLOCK ? blockSize : 1;
+  header->numberOfInstances = numberOfInstances;
+  header->numberOfFeatures = numberOfFeatures;
+  header->numberOfRows = getNumberOfRows(numberOfInstances, layout, blockSize);
+  header->numberOfColumns = numberOfColumns;
+  header->featureIdsStart = alignInstancesSection(sizeof(BinaryInstancesHeader));
+  header->featuresStart = numberOfColumns < numberOfFeatures ?
+    alignInstancesSection(header->featureIdsStart + numberOfColumns * sizeof(int)) :
+    header->featureIdsStart;
+  header->labelsStart = alignInstancesSection(header->featuresStart +
+    header->numberOfRows * numberOfColumns * sizeof(float));
+  header->qidsStart = alignInstancesSection(header->labelsStart +
+    numberOfInstances * sizeof(int));
+  header->fileSize = header->qidsStart + numberOfInstances * sizeof(int);
+}
+
+void unmapBinaryInstances(BinaryInstances* instances) {
+  munmap(instances->mapping, instances->size);
+  free(instances);
+}
+
+/**
+ * Memory-maps a binary instance file.
+ *
+ * @param path Path to the file
+ * @return Mapped instances, or 0 if the file is missing, truncated, or was
+ *         written with a different version or on an incompatible machine
+ */
+BinaryInstances* mapBinaryInstances(const char* path) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(BinaryInstancesHeader)) {
+    close(fd);
+    return 0;
+  }
+  void* mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    return 0;
+  }
+
+  // The section positions follow from the sizes, so a valid header is
+  // exactly the one that initBinaryInstancesHeader computes
+  BinaryInstancesHeader* header = (BinaryInstancesHeader*) mapping;
+  BinaryInstancesHeader expected;
+  int ok = memcmp(header->magic, BINARY_INSTANCES_MAGIC, 8) == 0 &&
+    header->version == BINARY_INSTANCES_VERSION &&
+    header->byteOrder == BINARY_INSTANCES_BYTE_ORDER &&
+    header->numberOfInstances >= 0 && header->numberOfInstances <= 0x7fffffff &&
+    header->numberOfFeatures > 0 && header->numberOfFeatures <= 0x7fffffff &&
+    header->numberOfColumns > 0 && header->numberOfColumns <= header->numberOfFeatures &&
+    (header->layout == ROW_MAJOR || header->layout == COLUMN_BLOCK) &&
+    header->blockSize >= 1 && header->blockSize <= 0xffff;
+  if(ok) {
+    initBinaryInstancesHeader(&expected, header->numberOfInstances,
+                              header->numberOfFeatures, header->numberOfColumns,
+                              header->layout, header->blockSize);
+    ok = memcmp(header, &expected, sizeof(BinaryInstancesHeader)) == 0 &&
+      header->fileSize == st.st_size;
+  }
+  if(!ok) {
+    munmap(mapping, st.st_size);
+    return 0;
+  }
+
+  BinaryInstances* instances = (BinaryInstances*) malloc(sizeof(BinaryInstances));
+  instances->mapping = mapping;
+  instances->size = st.st_size;
+  instances->layout = header->layout;
+  instances->blockSize = header->blockSize;
+  instances->numberOfInstances = header->numberOfInstances;
+  instances->numberOfFeatures = header->numberOfFeatures;
+  instances->numberOfRows = header->numberOfRows;
+  instances->numberOfColumns = header->numberOfColumns;
+  instances->featureIds = header->numberOfColumns < header->numberOfFeatures ?
+    (int*) ((char*) mapping + header->featureIdsStart) : 0;
+  instances->features = (float*) ((char*) mapping + header->featuresStart);
+  instances->labels = (int*) ((char*) mapping + header->labelsStart);
+  instances->qids = (int*) ((char*) mapping + header->qidsStart);
+  long c;
+  for(c = 0; instances->featureIds && c < instances->numberOfColumns; c++) {
+    if(instances->featureIds[c] < 0 || instances->featureIds[c] >= instances->numberOfFeatures) {
+      unmapBinaryInstances(instances);
+      return 0;
+    }
+  }
+  return instances;
+}
+
+/**
+ * @return Value of column c of instance i
+ */
+float getStoredFeature(const BinaryInstances* instances, long i, long c) {
+  if(instances->layout == ROW_MAJOR) {
+    return instances->features[i * instances->numberOfColumns + c];
+  }
+  long blockSize = instances->blockSize;
+  return instances->features[(i / blockSize) * blockSize * instances->numberOfColumns +
+                             c * blockSize + i % blockSize];
+}
+
+/**
+ * Returns the features as a row-major matrix with at least
+ * numberOfInstances rows, padded with zero rows to a multiple of
+ * "multiple". Row-major files are used in place when their padding
+ * suffices; otherwise the features are copied. Projected files are
+ * expanded to numberOfFeatures columns, with zeros for the features that
+ * are not stored.
+ *
+ * @param instances Mapped instances
+ * @param multiple Required row padding (e.g., V for VPred)
+ * @param arena Arena that holds the copy, if any
+ * @return Row-major feature matrix
+ */
+float* getRowMajorFeatures(BinaryInstances* instances, int multiple, Arena* arena) {
+  long numberOfFeatures = instances->numberOfFeatures;
+  if(instances->layout == ROW_MAJOR && !instances->featureIds &&
+     instances->numberOfRows % multiple == 0) {
+    return instances->features;
+  }
+
+  long rows = (instances->numberOfInstances + multiple - 1) / multiple * multiple;
+  float* matrix = (float*) allocateInArena(arena, rows * numberOfFeatures * sizeof(float));
+  long i, c;
+  if(instances->layout == ROW_MAJOR && !instances->featureIds) {
+    memcpy(matrix, instances->features,
+           instances->numberOfInstances * numberOfFeatures * sizeof(float));
+  } else {
+    for(i = 0; i < instances->numberOfInstances; i++) {
+      for(c = 0; c < instances->numberOfColumns; c++) {
+        long f = instances->featureIds ? instances->featureIds[c] : c;
+        matrix[i * numberOfFeatures + f] = getStoredFeature(instances, i, c);
+      }
+    }
+  }
+  return matrix;
+}
+
+/**
+ * Creates one pointer per instance into a row-major feature matrix, for
+ * implementations that take a float** of feature vectors.
+ *
+ * @param arena Arena that holds the pointers
+ */
+float** getFeatureRows(float* matrix, long numberOfInstances, long numberOfFeatures,
+                       Arena* arena) {
+  float** rows = (float**) allocateInArena(arena, numberOfInstances * sizeof(float*));
+  long i;
+  for(i = 0; i < numberOfInstances; i++) {
+    rows[i] = &matrix[i * numberOfFeatures];
+  }
+  return rows;
+}
+
+#endif
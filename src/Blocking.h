@@ -0,0 +1,96 @@
+#ifndef BLOCKING_H_GUARD
+#define BLOCKING_H_GUARD
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Two-dimensional blocking of trees and instances. Scoring every tree for
+ * one instance (or one block of V instances) before moving on streams the
+ * whole ensemble from memory for every instance once the ensemble does not
+ * fit in cache. Instead, trees are split into blocks that fit in L2, and a
+ * block of instances whose features fit in L3 is run through one block of
+ * trees after another, accumulating into a buffer of partial scores.
+ *
+ * Trees are still added to every score in ensemble order, so scores are
+ * identical to those of unblocked evaluation.
+ */
+
+// Used when the cache sizes are not reported by the system
+#define DEFAULT_L2_CACHE_SIZE (256 * 1024)
+#define DEFAULT_L3_CACHE_SIZE (8 * 1024 * 1024)
+
+/**
+ * @param level 2 or 3
+ * @return Size of the cache of the given level in bytes
+ */
+long getCacheSize(int level) {
+  long size = -1;
+#if defined(_SC_LEVEL2_CACHE_SIZE) && defined(_SC_LEVEL3_CACHE_SIZE)
+  size = sysconf(level == 2 ? _SC_LEVEL2_CACHE_SIZE : _SC_LEVEL3_CACHE_SIZE);
+#endif
+  if(size <= 0) {
+    size = level == 2 ? DEFAULT_L2_CACHE_SIZE : DEFAULT_L3_CACHE_SIZE;
+  }
+  return size;
+}
+
+/**
+ * Splits consecutive trees into blocks of at most maxBytes of nodes. A
+ * tree that is larger than maxBytes forms a block of its own.
+ *
+ * @param offsets Index of the root of each tree in the node array
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ * @param nodeSize Bytes per node
+ * @param maxBytes Maximum size of a block, or 0 for a single block
+ * @param firstTrees Output, nbTrees + 1 entries: block k holds trees
+ *                   [firstTrees[k], firstTrees[k + 1])
+ * @return Number of blocks
+ */
+int partitionTrees(const long* offsets, int nbTrees, long numberOfNodes, long nodeSize,
+                   long maxBytes, int* firstTrees) {
+  int numberOfBlocks = 0;
+  int tindex;
+  long blockStart = 0;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    if(tindex == 0 ||
+       (maxBytes > 0 && (end - offsets[blockStart]) * nodeSize > maxBytes)) {
+      firstTrees[numberOfBlocks++] = tindex;
+      blockStart = tindex;
+    }
+  }
+  firstTrees[numberOfBlocks] = nbTrees;
+  return numberOfBlocks;
+}
+
+/**
+ * Picks the number of instances per block such that the features of every
+ * thread's block fit in half of L3, and every thread gets several blocks.
+ *
+ * @param numberOfInstances Number of instances
+ * @param numberOfFeatures Length of a feature vector
+ * @param numberOfThreads Number of threads, at least 1
+ * @param multiple Block sizes are rounded up to a multiple of this value
+ * @return Number of instances per block
+ */
+int getInstanceBlockSize(int numberOfInstances, int numberOfFeatures,
+                         int numberOfThreads, int multiple) {
+  long bytes = getCacheSize(3) / 2 / numberOfThreads;
+  long blockSize = bytes / (numberOfFeatures * (long) sizeof(float));
+  long perThread = (numberOfInstances + 4L * numberOfThreads - 1) / (4L * numberOfThreads);
+  if(numberOfThreads == 1) {
+    // Without a pool, a single block is as good as any
+    perThread = numberOfInstances;
+  }
+  if(blockSize > perThread) {
+    blockSize = perThread;
+  }
+  if(blockSize < 1) {
+    blockSize = 1;
+  }
+  return (int) ((blockSize + multiple - 1) / multiple * multiple);
+}
+
+#endif
@@ -0,0 +1,293 @@
+#ifndef COMPACT_H_GUARD
+#define COMPACT_H_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "Node.h"
+
+/**
+ * Compact node layout, 8 bytes per node. Compared to StructPlus (32
+ * bytes: two pointers, an id, fid and threshold) and VPred (16 bytes: two
+ * child indexes), a node only holds its threshold, a 16-bit feature id and
+ * the 16-bit index of its left child. The two children of a node are
+ * always stored next to each other, so the right child is left + 1, and a
+ * traversal step is
+ *
+ *   idx = nodes[idx].left + (x > nodes[idx].threshold)
+ *
+ * Leaves have an infinite threshold and point to themselves, so that a
+ * traversal of "depth" steps ends at a leaf as in VPred. Their regression
+ * values are kept in a separate array that is only read once per tree.
+ *
+ * Within a tree, nodes are stored in one of two orders:
+ *
+ *   COMPACT_BREADTH_FIRST: level by level, so that the top three levels
+ *     share the first cache line of the tree.
+ *   COMPACT_VAN_EMDE_BOAS: the tree of sibling pairs is split at half its
+ *     height; the top half is stored first, followed by each bottom
+ *     subtree, and both halves are laid out the same way recursively. Deep
+ *     paths then touch one cache line every few levels instead of one per
+ *     level.
+ *
+ * Every tree starts on a 64-byte boundary. Blocks of V instances are
+ * scored by the VPred kernels (see NodeTraits<CompactNode> in
+ * VPredKernels.h).
+ */
+
+#define COMPACT_BREADTH_FIRST 0
+#define COMPACT_VAN_EMDE_BOAS 1
+
+// Trees are padded to a multiple of this many nodes (one cache line)
+#define COMPACT_NODES_PER_LINE 8
+
+typedef struct CompactNode CompactNode;
+
+struct CompactNode {
+  float threshold; // Infinite for leaves
+  unsigned short fid; // Feature id
+  unsigned short left; // Index of the left child relative to the root; the
+                       // right child is left + 1. Leaves point to themselves
+};
+
+typedef struct CompactEnsemble CompactEnsemble;
+
+struct CompactEnsemble {
+  int numberOfTrees;
+  int order; // COMPACT_BREADTH_FIRST or COMPACT_VAN_EMDE_BOAS
+  long numberOfNodes; // Including the padding of every tree
+  CompactNode* nodes; // All trees, 64-byte aligned
+  float* values; // Regression value of each leaf, at the index of the leaf in nodes
+  long* offsets; // Index of the root of each tree in nodes
+  long* depths; // Depth of each tree
+};
+
+/**
+ * @param name "bfs" or "veb"
+ * @return COMPACT_BREADTH_FIRST, COMPACT_VAN_EMDE_BOAS, or -1
+ */
+int parseCompactOrder(const char* name) {
+  if(!strcmp(name, "bfs")) {
+    return COMPACT_BREADTH_FIRST;
+  }
+  if(!strcmp(name, "veb")) {
+    return COMPACT_VAN_EMDE_BOAS;
+  }
+  return -1;
+}
+
+/**
+ * Assigns the next positions to the nodes of a sibling pair: the root of
+ * the tree if parent is -1, and the children of parent otherwise.
+ */
+void placeCompactPair(Node* nodes, int parent, int* positions, int* next) {
+  if(parent < 0) {
+    positions[0] = (*next)++;
+  } else {
+    positions[nodes[parent].children[0]] = (*next)++;
+    positions[nodes[parent].children[1]] = (*next)++;
+  }
+}
+
+/**
+ * Returns the nodes of a sibling pair that have children.
+ *
+ * @return Number of nodes written to members, at most 2
+ */
+int getCompactParents(Node* nodes, int parent, int* members) {
+  int candidates[2];
+  int count = 0, m;
+  if(parent < 0) {
+    candidates[0] = 0;
+    candidates[1] = -1;
+  } else {
+    candidates[0] = nodes[parent].children[0];
+    candidates[1] = nodes[parent].children[1];
+  }
+  for(m = 0; m < 2; m++) {
+    if(candidates[m] >= 0 && nodes[candidates[m]].children[0] != candidates[m]) {
+      members[count++] = candidates[m];
+    }
+  }
+  return count;
+}
+
+void placeVanEmdeBoas(Node* nodes, int parent, int height, int* positions, int* next);
+
+/**
+ * Lays out the subtrees rooted "levels" pairs below the pair of parent,
+ * from left to right, each with the given height.
+ */
+void placeVanEmdeBoasBottom(Node* nodes, int parent, int levels, int height,
+                            int* positions, int* next) {
+  if(levels == 0) {
+    placeVanEmdeBoas(nodes, parent, height, positions, next);
+    return;
+  }
+  int members[2];
+  int count = getCompactParents(nodes, parent, members);
+  int m;
+  for(m = 0; m < count; m++) {
+    placeVanEmdeBoasBottom(nodes, members[m], levels - 1, height, positions, next);
+  }
+}
+
+/**
+ * Lays out the top "height" levels of the tree of sibling pairs below the
+ * pair of parent in van Emde Boas order.
+ */
+void placeVanEmdeBoas(Node* nodes, int parent, int height, int* positions, int* next) {
+  if(height == 1) {
+    placeCompactPair(nodes, parent, positions, next);
+    return;
+  }
+  int top = height / 2;
+  placeVanEmdeBoas(nodes, parent, top, positions, next);
+  placeVanEmdeBoasBottom(nodes, parent, top, height - top, positions, next);
+}
+
+/**
+ * Computes the position of every node of a tree in the compact layout.
+ *
+ * @param nodes Tree in the VPred layout
+ * @param size Number of nodes in the tree
+ * @param order COMPACT_BREADTH_FIRST or COMPACT_VAN_EMDE_BOAS
+ * @param positions Output, position of every node
+ * @return Depth of the tree
+ */
+long placeCompactNodes(Node* nodes, int size, int order, int* positions) {
+  // Breadth-first pass, which also computes the depth of every node
+  int* queue = (int*) malloc(size * sizeof(int));
+  int* levels = (int*) malloc(size * sizeof(int));
+  int head = 0, tail = 0;
+  long depth = 0;
+  queue[tail++] = 0;
+  levels[0] = 0;
+  while(head < tail) {
+    int n = queue[head++];
+    positions[n] = head - 1;
+    if(levels[n] > depth) {
+      depth = levels[n];
+    }
+    if(nodes[n].children[0] != n) {
+      int c;
+      for(c = 0; c < 2; c++) {
+        levels[nodes[n].children[c]] = levels[n] + 1;
+        queue[tail++] = nodes[n].children[c];
+      }
+    }
+  }
+  if(order == COMPACT_VAN_EMDE_BOAS) {
+    int next = 0;
+    placeVanEmdeBoas(nodes, -1, (int) depth + 1, positions, &next);
+  }
+  free(levels);
+  free(queue);
+  return depth;
+}
+
+void destroyCompactEnsemble(CompactEnsemble* e) {
+  free(e->nodes);
+  free(e->values);
+  free(e->offsets);
+  free(e->depths);
+  free(e);
+}
+
+/**
+ * Creates the compact layout from trees in the VPred layout.
+ *
+ * @param nodes All trees (see packTrees in VPred.h)
+ * @param offsets Index of the root of each tree in nodes
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ * @param order COMPACT_BREADTH_FIRST or COMPACT_VAN_EMDE_BOAS
+ * @return Compact ensemble, or 0 if a feature id or the size of a tree
+ *         does not fit in 16 bits
+ */
+CompactEnsemble* createCompactEnsemble(Node* nodes, long* offsets, int nbTrees,
+                                       long numberOfNodes, int order) {
+  CompactEnsemble* e = (CompactEnsemble*) calloc(1, sizeof(CompactEnsemble));
+  e->numberOfTrees = nbTrees;
+  e->order = order;
+  e->offsets = (long*) malloc((nbTrees + 1) * sizeof(long));
+  e->depths = (long*) malloc((nbTrees + 1) * sizeof(long));
+  int ok = 1;
+  int tindex;
+  long n;
+
+  // Every tree starts on a cache line
+  long total = 0;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    long size = end - offsets[tindex];
+    e->offsets[tindex] = total;
+    total += (size + COMPACT_NODES_PER_LINE - 1) / COMPACT_NODES_PER_LINE *
+      COMPACT_NODES_PER_LINE;
+    ok = ok && size <= 0x10000;
+  }
+  for(n = 0; n < numberOfNodes; n++) {
+    ok = ok && nodes[n].fid <= 0xffff;
+  }
+  e->numberOfNodes = total;
+  if(!ok || posix_memalign((void**) &e->nodes, 64, (total + 1) * sizeof(CompactNode)) != 0) {
+    e->nodes = 0;
+    destroyCompactEnsemble(e);
+    return 0;
+  }
+  memset(e->nodes, 0, (total + 1) * sizeof(CompactNode));
+  e->values = (float*) calloc(total + 1, sizeof(float));
+
+  int* positions = (int*) malloc(0x10000 * sizeof(int));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    int size = (int) (end - offsets[tindex]);
+    Node* tree = &nodes[offsets[tindex]];
+    CompactNode* compact = &e->nodes[e->offsets[tindex]];
+    float* values = &e->values[e->offsets[tindex]];
+    e->depths[tindex] = placeCompactNodes(tree, size, order, positions);
+    for(n = 0; n < size; n++) {
+      CompactNode* node = &compact[positions[n]];
+      if(tree[n].children[0] == n) {
+        node->threshold = INFINITY;
+        node->fid = 0;
+        node->left = (unsigned short) positions[n];
+        values[positions[n]] = tree[n].theta;
+      } else {
+        node->threshold = tree[n].theta;
+        node->fid = (unsigned short) tree[n].fid;
+        node->left = (unsigned short) positions[tree[n].children[0]];
+      }
+    }
+  }
+  free(positions);
+  return e;
+}
+
+/**
+ * Walks a single instance down a tree until it reaches a leaf.
+ *
+ * @return Index of the leaf relative to the root
+ */
+int findLeafCompact(const CompactNode* nodes, const float* features) {
+  int idx = 0;
+  while(nodes[idx].left != idx) {
+    idx = nodes[idx].left + (features[nodes[idx].fid] > nodes[idx].threshold);
+  }
+  return idx;
+}
+
+/**
+ * Computes the score of one instance.
+ */
+float getCompactScore(const CompactEnsemble* e, const float* features) {
+  float score = 0;
+  int tindex;
+  for(tindex = 0; tindex < e->numberOfTrees; tindex++) {
+    long offset = e->offsets[tindex];
+    score += e->values[offset + findLeafCompact(&e->nodes[offset], features)];
+  }
+  return score;
+}
+
+#endif
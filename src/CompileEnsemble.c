@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Struct.h"
+#include "VPred.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "ParseCommandLine.h"
+
+/**
+ * Compiles a text ensemble into the binary format of BinaryEnsemble.h,
+ * which the drivers and libopttrees memory-map instead of parsing.
+ * Use the following command to run this tool:
+ *
+ * ./CompileEnsemble -ensemble <ensemble-path> -maxLeaves <max-number-of-leaves> \
+ *                   -output <compiled-ensemble-path> [-threads <number-of-threads>]
+ *
+ * A jforests XML ensemble may be given in place of a text ensemble, in
+ * which case its trees are imported by -threads threads (all online CPUs
+ * by default, see JforestsEnsemble.h).
+ */
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves") ||
+     !isPresentCL(argc, args, (char*) "-output")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  char* outputFile = getValueCL(argc, args, (char*) "-output");
+  int numberOfThreads = isPresentCL(argc, args, (char*) "-threads") ?
+    atoi(getValueCL(argc, args, (char*) "-threads")) : (int) sysconf(_SC_NPROCESSORS_ONLN);
+
+  int nbTrees;
+  long* treeDepths;
+  long* offsets;
+  long totalNodes;
+  Node* nodes;
+  if(isJforestsEnsemble(configFile)) {
+    BinaryEnsemble* imported = importJforestsEnsemble(configFile, maxNumberOfLeaves,
+                                                      numberOfThreads);
+    if(!imported) {
+      fprintf(stderr, "Could not import jforests ensemble %s\n", configFile);
+      return -1;
+    }
+    // Take over the arrays of the imported ensemble
+    nbTrees = imported->numberOfTrees;
+    treeDepths = imported->depths;
+    offsets = imported->offsets;
+    totalNodes = imported->numberOfNodes;
+    nodes = imported->nodes;
+    free(imported);
+  } else {
+    Struct** trees;
+    Arena* arena = createArena(0);
+    nbTrees = readEnsemble(configFile, maxNumberOfLeaves, arena, &trees, &treeDepths);
+    if(nbTrees < 0) {
+      fprintf(stderr, "Could not read ensemble %s\n", configFile);
+      return -1;
+    }
+
+    offsets = (long*) malloc(nbTrees * sizeof(long));
+    nodes = packTrees(trees, nbTrees, offsets, &totalNodes, 0);
+    destroyArena(arena);
+    free(trees);
+  }
+
+  int status = writeBinaryEnsemble(outputFile, nbTrees, offsets, treeDepths,
+                                   nodes, totalNodes, maxNumberOfLeaves);
+  if(status != 0) {
+    fprintf(stderr, "Could not write %s\n", outputFile);
+  } else {
+    printf("Compiled %d trees, %ld nodes\n", nbTrees, totalNodes);
+  }
+
+  free(nodes);
+  free(offsets);
+  free(treeDepths);
+  return status;
+}
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Struct.h"
+#include "VPred.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
+#include "FeatureProjection.h"
+#include "ParseCommandLine.h"
+
+/**
+ * Converts test instances from SVM Light format into the binary format of
+ * BinaryInstances.h, which the drivers memory-map with -instancesBinary.
+ * Use the following command to run this tool:
+ *
+ * ./ConvertInstances -instances <test-instances-path> \
+ *                    -output <binary-instances-path> \
+ *                    [-columnBlock <rows-per-block>]
+ *                    [-ensemble <ensemble-path> -maxLeaves <max-number-of-leaves>]
+ *
+ * Without -columnBlock, features are stored row-major. The input is read
+ * one line at a time, so only the labels and query ids are kept in memory.
+ *
+ * With -ensemble, only the features that the ensemble splits on are
+ * stored (see FeatureProjection.h), for drivers that run with
+ * -projectFeatures. Other drivers expand the columns back on load.
+ */
+
+/**
+ * Collects the features used by an ensemble file of any format.
+ *
+ * @return Projection, or 0 if the ensemble could not be read
+ */
+FeatureProjection* loadFeatureProjection(const char* path, int maxLeaves) {
+  FeatureProjection* projection;
+  if(isBinaryEnsemble(path) || isJforestsEnsemble(path)) {
+    BinaryEnsemble* ensemble = loadPackedEnsemble(path, maxLeaves, 0);
+    if(!ensemble) {
+      return 0;
+    }
+    projection = createFeatureProjection(ensemble->nodes, ensemble->offsets,
+                                         ensemble->numberOfTrees, ensemble->numberOfNodes);
+    unmapBinaryEnsemble(ensemble);
+    return projection;
+  }
+
+  Struct** trees;
+  long* depths;
+  Arena* arena = createArena(0);
+  int nbTrees = readEnsemble(path, maxLeaves, arena, &trees, &depths);
+  if(nbTrees < 0) {
+    destroyArena(arena);
+    return 0;
+  }
+  long numberOfNodes;
+  long* offsets = (long*) malloc((nbTrees + 1) * sizeof(long));
+  Node* nodes = packTrees(trees, nbTrees, offsets, &numberOfNodes, 0);
+  projection = createFeatureProjection(nodes, offsets, nbTrees, numberOfNodes);
+  destroyArena(arena);
+  free(trees);
+  free(depths);
+  free(offsets);
+  free(nodes);
+  return projection;
+}
+
+int writePadding(FILE* fp, long position, long sectionStart) {
+  char padding[BINARY_INSTANCES_ALIGNMENT] = {0};
+  return fwrite(padding, 1, sectionStart - position, fp) == (size_t) (sectionStart - position);
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-instances") ||
+     !isPresentCL(argc, args, (char*) "-output")) {
+    return -1;
+  }
+
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* outputFile = getValueCL(argc, args, (char*) "-output");
+  int layout = ROW_MAJOR;
+  int blockSize = 1;
+  if(isPresentCL(argc, args, (char*) "-columnBlock")) {
+    layout = COLUMN_BLOCK;
+    blockSize = atoi(getValueCL(argc, args, (char*) "-columnBlock"));
+    if(blockSize < 1 || blockSize > 0xffff) {
+      fprintf(stderr, "Invalid block size %d\n", blockSize);
+      return -1;
+    }
+  }
+
+  FeatureProjection* projection = 0;
+  if(isPresentCL(argc, args, (char*) "-ensemble")) {
+    char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+    int maxNumberOfLeaves = isPresentCL(argc, args, (char*) "-maxLeaves") ?
+      atoi(getValueCL(argc, args, (char*) "-maxLeaves")) : 0;
+    projection = loadFeatureProjection(configFile, maxNumberOfLeaves);
+    if(!projection) {
+      fprintf(stderr, "Could not read ensemble %s\n", configFile);
+      return -1;
+    }
+  }
+
+  FILE* fp = fopen(featureFile, "r");
+  if(!fp) {
+    fprintf(stderr, "Could not read %s\n", featureFile);
+    return -1;
+  }
+  long numberOfInstances = 0;
+  long numberOfFeatures = 0;
+  if(fscanf(fp, "%ld %ld", &numberOfInstances, &numberOfFeatures) != 2 ||
+     numberOfInstances < 0 || numberOfFeatures <= 0) {
+    fprintf(stderr, "Invalid header in %s\n", featureFile);
+    fclose(fp);
+    return -1;
+  }
+
+  // Stored columns; a projection may refer to features beyond the file's,
+  // which are zero
+  long numberOfColumns = numberOfFeatures;
+  const int* columns = 0;
+  long numberOfMapped = numberOfFeatures;
+  if(projection) {
+    numberOfColumns = projection->numberOfColumns;
+    columns = projection->columns;
+    if(projection->numberOfMapped < numberOfFeatures) {
+      numberOfMapped = projection->numberOfMapped;
+    }
+    if(projection->numberOfMapped > numberOfFeatures) {
+      numberOfFeatures = projection->numberOfMapped;
+    }
+  }
+  BinaryInstancesHeader header;
+  initBinaryInstancesHeader(&header, numberOfInstances, numberOfFeatures, numberOfColumns,
+                            layout, blockSize);
+
+  FILE* out = fopen(outputFile, "wb");
+  if(!out) {
+    fprintf(stderr, "Could not write %s\n", outputFile);
+    fclose(fp);
+    return -1;
+  }
+  int ok = fwrite(&header, sizeof(header), 1, out) == 1;
+  if(header.featuresStart > header.featureIdsStart) {
+    ok = ok && writePadding(out, sizeof(header), header.featureIdsStart);
+    ok = ok && fwrite(projection->features, sizeof(int), numberOfColumns, out) ==
+      (size_t) numberOfColumns;
+    ok = ok && writePadding(out, header.featureIdsStart + numberOfColumns * sizeof(int),
+                            header.featuresStart);
+  } else {
+    ok = ok && writePadding(out, sizeof(header), header.featuresStart);
+  }
+
+  int* labels = (int*) malloc(numberOfInstances * sizeof(int));
+  int* qids = (int*) malloc(numberOfInstances * sizeof(int));
+  float* row = (float*) malloc(numberOfColumns * sizeof(float));
+  // Rows of the current block, stored column by column
+  float* block = (float*) calloc(blockSize * numberOfColumns, sizeof(float));
+
+  char* line = 0;
+  size_t capacity = 0;
+  long iIndex = 0, fIndex;
+  while(ok && iIndex < header.numberOfRows) {
+    if(iIndex < numberOfInstances) {
+      ssize_t length = getline(&line, &capacity, fp);
+      if(length < 0) {
+        fprintf(stderr, "Expected %ld instances, found %ld\n", numberOfInstances, iIndex);
+        ok = 0;
+        break;
+      }
+      if(strspn(line, " \t\r\n") == (size_t) length) {
+        // Skip blank lines, including the rest of the header line
+        continue;
+      }
+      memset(row, 0, numberOfColumns * sizeof(float));
+      if(parseSvmLightLine(line, line + length, row, numberOfMapped, columns,
+                           &labels[iIndex], &qids[iIndex]) != 0) {
+        fprintf(stderr, "Malformed instance %ld\n", iIndex);
+        ok = 0;
+        break;
+      }
+    } else {
+      // Padding
+      memset(row, 0, numberOfColumns * sizeof(float));
+    }
+
+    if(layout == ROW_MAJOR) {
+      ok = fwrite(row, sizeof(float), numberOfColumns, out) == (size_t) numberOfColumns;
+    } else {
+      int r = iIndex % blockSize;
+      for(fIndex = 0; fIndex < numberOfColumns; fIndex++) {
+        block[fIndex * blockSize + r] = row[fIndex];
+      }
+      if(r == blockSize - 1) {
+        ok = fwrite(block, sizeof(float), blockSize * numberOfColumns, out) ==
+          (size_t) (blockSize * numberOfColumns);
+      }
+    }
+    iIndex++;
+  }
+
+  long position = header.featuresStart + header.numberOfRows * numberOfColumns * sizeof(float);
+  ok = ok && writePadding(out, position, header.labelsStart);
+  ok = ok && fwrite(labels, sizeof(int), numberOfInstances, out) == (size_t) numberOfInstances;
+  position = header.labelsStart + numberOfInstances * sizeof(int);
+  ok = ok && writePadding(out, position, header.qidsStart);
+  ok = ok && fwrite(qids, sizeof(int), numberOfInstances, out) == (size_t) numberOfInstances;
+  if(fclose(out) != 0) {
+    ok = 0;
+  }
+
+  if(ok) {
+    printf("Converted %ld instances, %ld features, %ld stored\n", numberOfInstances,
+           numberOfFeatures, numberOfColumns);
+  } else {
+    fprintf(stderr, "Could not convert %s\n", featureFile);
+    remove(outputFile);
+  }
+
+  free(line);
+  free(block);
+  free(row);
+  free(qids);
+  free(labels);
+  if(projection) {
+    destroyFeatureProjection(projection);
+  }
+  fclose(fp);
+  return ok ? 0 : -1;
+}
@@ -0,0 +1,111 @@
+#ifndef EPOCH_H_GUARD
+#define EPOCH_H_GUARD
+
+#include <sched.h>
+
+/**
+ * Epoch-based reclamation of a shared pointer, so that readers never take
+ * a lock while a writer replaces the value they read.
+ *
+ * Every reader owns a slot. Before reading the pointer, a reader stores the
+ * current global epoch in its slot; when it is done, it clears the slot.
+ * A writer swaps in the new value, advances the epoch, and waits until no
+ * slot holds an older epoch. A reader that entered before the swap may
+ * still use the old value until then; a reader that enters afterwards,
+ * including one whose slot was still clear during the writer's scan, is
+ * guaranteed to read the new value, because all these accesses are
+ * sequentially consistent. After the wait, the old value is unreachable
+ * and may be freed.
+ *
+ * Readers do not write shared state other than their own slot, which sits
+ * on a cache line of its own, so an EpochPointer must be allocated with
+ * 64-byte alignment.
+ */
+
+// Maximum number of readers registered at the same time
+#define MAX_EPOCH_READERS 128
+
+typedef struct EpochSlot EpochSlot;
+
+struct EpochSlot {
+  unsigned long long epoch; // Epoch the reader entered in, or 0 when quiescent
+  int registered;
+} __attribute__((aligned(64)));
+
+typedef struct EpochPointer EpochPointer;
+
+struct EpochPointer {
+  void* value;
+  unsigned long long epoch; // Starts at 1
+  EpochSlot slots[MAX_EPOCH_READERS];
+};
+
+void initEpochPointer(EpochPointer* p, void* value) {
+  int r;
+  p->value = value;
+  p->epoch = 1;
+  for(r = 0; r < MAX_EPOCH_READERS; r++) {
+    p->slots[r].epoch = 0;
+    p->slots[r].registered = 0;
+  }
+}
+
+/**
+ * @return Slot of a new reader, or -1 if all slots are taken
+ */
+int registerEpochReader(EpochPointer* p) {
+  int r;
+  for(r = 0; r < MAX_EPOCH_READERS; r++) {
+    int expected = 0;
+    if(__atomic_compare_exchange_n(&p->slots[r].registered, &expected, 1, 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+      return r;
+    }
+  }
+  return -1;
+}
+
+void unregisterEpochReader(EpochPointer* p, int reader) {
+  __atomic_store_n(&p->slots[reader].epoch, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&p->slots[reader].registered, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Enters a read-side critical section.
+ *
+ * @return Current value, which remains valid until exitEpoch
+ */
+void* enterEpoch(EpochPointer* p, int reader) {
+  unsigned long long epoch = __atomic_load_n(&p->epoch, __ATOMIC_SEQ_CST);
+  __atomic_store_n(&p->slots[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&p->value, __ATOMIC_SEQ_CST);
+}
+
+void exitEpoch(EpochPointer* p, int reader) {
+  __atomic_store_n(&p->slots[reader].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Publishes a new value and waits until no reader can still use the old
+ * one. Writers must be serialized by the caller, and must not call this
+ * from inside a read-side critical section.
+ *
+ * @return Old value, which the caller may now free
+ */
+void* publishEpochPointer(EpochPointer* p, void* value) {
+  void* old = __atomic_exchange_n(&p->value, value, __ATOMIC_SEQ_CST);
+  unsigned long long epoch = __atomic_add_fetch(&p->epoch, 1, __ATOMIC_SEQ_CST);
+  int r;
+  for(r = 0; r < MAX_EPOCH_READERS; r++) {
+    while(1) {
+      unsigned long long entered = __atomic_load_n(&p->slots[r].epoch, __ATOMIC_SEQ_CST);
+      if(entered == 0 || entered >= epoch) {
+        break;
+      }
+      sched_yield();
+    }
+  }
+  return old;
+}
+
+#endif
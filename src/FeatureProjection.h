@@ -0,0 +1,169 @@
+#ifndef FEATURE_PROJECTION_H_GUARD
+#define FEATURE_PROJECTION_H_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+#include "Node.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
+
+/**
+ * Projection of feature vectors onto the features that an ensemble uses.
+ * An ensemble typically splits on a fraction of the features of its
+ * training data, yet every engine strides over full feature vectors. The
+ * projection collects the feature ids of all internal nodes, renumbers
+ * them densely as 0..k-1 (in ascending order of the original id), and
+ * rewrites the nodes accordingly, so that instances only need to store k
+ * columns. Scores are unchanged, since a node reads the same value
+ * through its new id.
+ */
+
+typedef struct FeatureProjection FeatureProjection;
+
+struct FeatureProjection {
+  int numberOfColumns; // k, the number of features in use (at least 1)
+  int* features; // Original id of each column, ascending
+  int numberOfMapped; // 1 + the largest feature id in use
+  int* columns; // Column of each original id below numberOfMapped, or -1
+};
+
+/**
+ * Collects the features used by the internal nodes of packed VPred trees.
+ *
+ * @param nodes All trees (see Node.h)
+ * @param offsets Index of the root of each tree in nodes
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ */
+FeatureProjection* createFeatureProjection(const Node* nodes, const long* offsets, int nbTrees,
+                                           long numberOfNodes) {
+  int numberOfMapped = 1;
+  int tindex;
+  long n;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    for(n = offsets[tindex]; n < end; n++) {
+      // Leaves point to themselves and do not read a feature
+      if(nodes[n].children[0] != n - offsets[tindex] && nodes[n].fid >= numberOfMapped) {
+        numberOfMapped = nodes[n].fid + 1;
+      }
+    }
+  }
+
+  FeatureProjection* projection = (FeatureProjection*) malloc(sizeof(FeatureProjection));
+  projection->numberOfMapped = numberOfMapped;
+  projection->columns = (int*) malloc(numberOfMapped * sizeof(int));
+  for(n = 0; n < numberOfMapped; n++) {
+    projection->columns[n] = -1;
+  }
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    for(n = offsets[tindex]; n < end; n++) {
+      if(nodes[n].children[0] != n - offsets[tindex]) {
+        projection->columns[nodes[n].fid] = 0;
+      }
+    }
+  }
+  // An ensemble without internal nodes still gets one column for its leaves
+  if(numberOfMapped == 1) {
+    projection->columns[0] = 0;
+  }
+
+  projection->numberOfColumns = 0;
+  projection->features = (int*) malloc(numberOfMapped * sizeof(int));
+  for(n = 0; n < numberOfMapped; n++) {
+    if(projection->columns[n] == 0) {
+      projection->columns[n] = projection->numberOfColumns;
+      projection->features[projection->numberOfColumns++] = (int) n;
+    }
+  }
+  return projection;
+}
+
+void destroyFeatureProjection(FeatureProjection* projection) {
+  free(projection->features);
+  free(projection->columns);
+  free(projection);
+}
+
+/**
+ * Copies packed VPred trees with their feature ids replaced by columns.
+ * Leaves read column 0.
+ *
+ * @return New node array
+ */
+Node* projectNodes(const FeatureProjection* projection, const Node* nodes, const long* offsets,
+                   int nbTrees, long numberOfNodes) {
+  Node* projected = (Node*) malloc((numberOfNodes + 1) * sizeof(Node));
+  memcpy(projected, nodes, numberOfNodes * sizeof(Node));
+  int tindex;
+  long n;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    for(n = offsets[tindex]; n < end; n++) {
+      projected[n].fid = projected[n].children[0] != n - offsets[tindex] ?
+        projection->columns[projected[n].fid] : 0;
+    }
+  }
+  return projected;
+}
+
+/**
+ * Reads the columns of a projection from an instance file in SVM Light
+ * format (see readInstances).
+ */
+Instances* readProjectedInstances(const char* path, const FeatureProjection* projection,
+                                  int multiple, int numberOfThreads, Arena* arena) {
+  return readSelectedInstances(path, multiple, numberOfThreads, projection->columns,
+                               projection->numberOfMapped, projection->numberOfColumns, arena);
+}
+
+/**
+ * Returns the columns of a projection as a row-major matrix (see
+ * getRowMajorFeatures). A file that was projected the same way is used in
+ * place when its layout and padding allow it; otherwise the columns are
+ * gathered into a copy, with zeros for features the file does not store.
+ *
+ * @param instances Mapped instances
+ * @param projection Projection
+ * @param multiple Required row padding (e.g., V for VPred)
+ * @param arena Arena that holds the copy, if any
+ */
+float* getProjectedFeatures(BinaryInstances* instances, const FeatureProjection* projection,
+                            int multiple, Arena* arena) {
+  long k = projection->numberOfColumns;
+  int same = instances->numberOfColumns == k;
+  long c;
+  for(c = 0; c < k && same; c++) {
+    same = (instances->featureIds ? instances->featureIds[c] : c) == projection->features[c];
+  }
+  if(same && instances->layout == ROW_MAJOR && instances->numberOfRows % multiple == 0) {
+    return instances->features;
+  }
+
+  // Column of the file that holds each column of the projection, or -1
+  int* sources = (int*) malloc(k * sizeof(int));
+  for(c = 0; c < k; c++) {
+    sources[c] = -1;
+  }
+  for(c = 0; c < instances->numberOfColumns; c++) {
+    long f = instances->featureIds ? instances->featureIds[c] : c;
+    if(f < projection->numberOfMapped && projection->columns[f] >= 0) {
+      sources[projection->columns[f]] = (int) c;
+    }
+  }
+  long rows = (instances->numberOfInstances + multiple - 1) / multiple * multiple;
+  float* matrix = (float*) allocateInArena(arena, (rows * k + 1) * sizeof(float));
+  long i;
+  for(i = 0; i < instances->numberOfInstances; i++) {
+    for(c = 0; c < k; c++) {
+      if(sources[c] >= 0) {
+        matrix[i * k + c] = getStoredFeature(instances, i, sources[c]);
+      }
+    }
+  }
+  free(sources);
+  return matrix;
+}
+
+#endif
@@ -0,0 +1,311 @@
+#ifndef FIXED_POINT_H_GUARD
+#define FIXED_POINT_H_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include "Node.h"
+#include "VPredKernels.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Fixed-point leaf values. The leaves of an ensemble are scaled by a
+ * shared power of two and rounded to 16- or 32-bit integers, which are
+ * kept in a dense array, tree by tree, with one entry per leaf. A leaf
+ * node holds the ordinal of its leaf within its tree in place of its
+ * value (theta), so the entry of the leaf at which the VPred kernels stop
+ * is the first leaf of the tree plus that ordinal. Scores are accumulated
+ * as 32-bit integers and converted to float once, so they do not depend
+ * on the order in which trees are added: scoring with any number of
+ * threads, tree blocks or tree order gives the same bits.
+ *
+ * The scale is the largest power of two for which the leaves fit their
+ * width and the sum of the largest absolute leaf of every tree fits in 32
+ * bits, so no score can overflow. Each leaf is off by at most half a unit
+ * of the scale, so a score is off by at most nbTrees / 2 units (see
+ * getFixedPointError).
+ */
+
+// Ordinals are stored as floats, exact up to this number of leaves per tree
+#define FIXED_POINT_MAX_LEAVES (1L << 24)
+
+typedef struct FixedPointLeaves FixedPointLeaves;
+
+struct FixedPointLeaves {
+  int bits; // 16 or 32
+  int shift; // Leaf values are multiplied by 2^shift before rounding
+  int numberOfTrees;
+  long numberOfLeaves;
+  long* leafOffsets; // Index of the first leaf of each tree in the values
+  int16_t* values16; // Value of every leaf if bits is 16, by tree and ordinal
+  int32_t* values32; // Value of every leaf if bits is 32
+};
+
+/**
+ * Picks the scale of the leaves of packed VPred trees.
+ *
+ * @param bits 16 or 32
+ * @return Shift, the exponent of the scale
+ */
+int getFixedPointShift(const Node* nodes, const long* offsets, int nbTrees,
+                       long numberOfNodes, int bits) {
+  double total = 0, largest = 0;
+  int tindex;
+  long n;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    double treeLargest = 0;
+    for(n = offsets[tindex]; n < end; n++) {
+      if(nodes[n].children[0] == n - offsets[tindex] && fabs(nodes[n].theta) > treeLargest) {
+        treeLargest = fabs(nodes[n].theta);
+      }
+    }
+    total += treeLargest;
+    if(treeLargest > largest) {
+      largest = treeLargest;
+    }
+  }
+
+  // Rounding may add half a unit per tree
+  double sumLimit = INT32_MAX - 0.5 * nbTrees;
+  double leafLimit = bits == 16 ? INT16_MAX - 0.5 : INT32_MAX - 0.5;
+  int shift = 30;
+  while(shift > -126 && (ldexp(total, shift) > sumLimit || ldexp(largest, shift) > leafLimit)) {
+    shift--;
+  }
+  return shift;
+}
+
+/**
+ * @return Value rounded to fixed point at the scale of the leaves
+ */
+int32_t toFixedPoint(const FixedPointLeaves* f, float value) {
+  return (int32_t) lrint(ldexp(value, f->shift));
+}
+
+void destroyFixedPointLeaves(FixedPointLeaves* f) {
+  free(f->leafOffsets);
+  free(f->values16);
+  free(f->values32);
+  free(f);
+}
+
+/**
+ * Converts the leaves of packed VPred trees to fixed point. The value of
+ * every leaf node is replaced by its ordinal within its tree, in
+ * pre-order, so the nodes must be a copy that only the fixed-point path
+ * scores.
+ *
+ * @param nodes All trees (see packTrees in VPred.h), modified
+ * @param offsets Index of the root of each tree in nodes
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ * @param bits 16 or 32
+ * @return Leaves, or 0 if bits is neither 16 nor 32 or a tree has
+ *         FIXED_POINT_MAX_LEAVES leaves or more
+ */
+FixedPointLeaves* createFixedPointLeaves(Node* nodes, const long* offsets, int nbTrees,
+                                         long numberOfNodes, int bits) {
+  if(bits != 16 && bits != 32) {
+    return 0;
+  }
+  FixedPointLeaves* f = (FixedPointLeaves*) calloc(1, sizeof(FixedPointLeaves));
+  f->bits = bits;
+  f->numberOfTrees = nbTrees;
+  f->shift = getFixedPointShift(nodes, offsets, nbTrees, numberOfNodes, bits);
+  f->leafOffsets = (long*) malloc((nbTrees + 1) * sizeof(long));
+  int tindex;
+  long n;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    f->leafOffsets[tindex] = f->numberOfLeaves;
+    for(n = offsets[tindex]; n < end; n++) {
+      f->numberOfLeaves += nodes[n].children[0] == n - offsets[tindex];
+    }
+    if(f->numberOfLeaves - f->leafOffsets[tindex] >= FIXED_POINT_MAX_LEAVES) {
+      destroyFixedPointLeaves(f);
+      return 0;
+    }
+  }
+  f->leafOffsets[nbTrees] = f->numberOfLeaves;
+
+  // One more value, as the 16-bit gathers read 4 bytes at a time
+  if(bits == 16) {
+    f->values16 = (int16_t*) calloc(f->numberOfLeaves + 1, sizeof(int16_t));
+  } else {
+    f->values32 = (int32_t*) calloc(f->numberOfLeaves, sizeof(int32_t));
+  }
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    long leaf = f->leafOffsets[tindex];
+    for(n = offsets[tindex]; n < end; n++) {
+      if(nodes[n].children[0] != n - offsets[tindex]) {
+        continue;
+      }
+      if(bits == 16) {
+        f->values16[leaf] = (int16_t) toFixedPoint(f, nodes[n].theta);
+      } else {
+        f->values32[leaf] = toFixedPoint(f, nodes[n].theta);
+      }
+      nodes[n].theta = (float) (leaf - f->leafOffsets[tindex]);
+      leaf++;
+    }
+  }
+  return f;
+}
+
+/**
+ * @param tindex Index of a tree
+ * @param leaf Leaf node of the tree, as converted by createFixedPointLeaves
+ * @return Fixed-point value of the leaf
+ */
+int32_t getFixedPointLeaf(const FixedPointLeaves* f, int tindex, const Node* leaf) {
+  long index = f->leafOffsets[tindex] + (long) leaf->theta;
+  return f->bits == 16 ? f->values16[index] : f->values32[index];
+}
+
+/**
+ * Converts an accumulated fixed-point score to float.
+ */
+float getFixedPointScore(const FixedPointLeaves* f, int32_t score) {
+  return (float) ldexp((double) score, -f->shift);
+}
+
+/**
+ * @return Largest difference between a fixed-point score and the exact sum
+ *         of the original leaves
+ */
+double getFixedPointError(const FixedPointLeaves* f) {
+  return ldexp(0.5 * f->numberOfTrees, -f->shift);
+}
+
+/**
+ * Adds the leaves that V instances reached in one tree to their scores.
+ *
+ * @param tindex Index of the tree
+ * @param tree Nodes of the tree, as converted by createFixedPointLeaves
+ * @param leaves Index of the leaf of every instance, relative to the root
+ * @param scores Fixed-point scores of the V instances
+ */
+void addFixedPointLeaves(const FixedPointLeaves* f, int tindex, const Node* tree,
+                         const int* leaves, int32_t* scores) {
+  int j;
+  long first = f->leafOffsets[tindex];
+  if(f->bits == 16) {
+    for(j = 0; j < V; j++) {
+      scores[j] += f->values16[first + (long) tree[leaves[j]].theta];
+    }
+  } else {
+    for(j = 0; j < V; j++) {
+      scores[j] += f->values32[first + (long) tree[leaves[j]].theta];
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * AVX2 variant of addFixedPointLeaves, 8 instances per instruction. The
+ * ordinals are gathered from the leaf nodes, whose theta is the second
+ * float of a node, then a 16-bit leaf is gathered as the low half of 4
+ * bytes and sign-extended.
+ */
+__attribute__((target("avx2")))
+void addFixedPointLeavesAvx2(const FixedPointLeaves* f, int tindex, const Node* tree,
+                             const int* leaves, int32_t* scores) {
+  const float* thetas = (const float*) tree + 1;
+  const int stride = sizeof(Node) / sizeof(float);
+  long first = f->leafOffsets[tindex];
+  int j;
+  for(j = 0; j < V; j += 8) {
+    __m256i node = _mm256_mullo_epi32(_mm256_loadu_si256((const __m256i*) &leaves[j]),
+                                      _mm256_set1_epi32(stride));
+    __m256i idx = _mm256_cvttps_epi32(_mm256_i32gather_ps(thetas, node, 4));
+    __m256i value;
+    if(f->bits == 16) {
+      value = _mm256_i32gather_epi32((const int*) &f->values16[first], idx, 2);
+      value = _mm256_srai_epi32(_mm256_slli_epi32(value, 16), 16);
+    } else {
+      value = _mm256_i32gather_epi32((const int*) &f->values32[first], idx, 4);
+    }
+    __m256i sum = _mm256_add_epi32(_mm256_loadu_si256((const __m256i*) &scores[j]), value);
+    _mm256_storeu_si256((__m256i*) &scores[j], sum);
+  }
+}
+
+/**
+ * AVX-512 variant of addFixedPointLeaves, 16 instances per instruction.
+ */
+__attribute__((target("avx512f")))
+void addFixedPointLeavesAvx512(const FixedPointLeaves* f, int tindex, const Node* tree,
+                               const int* leaves, int32_t* scores) {
+  const float* thetas = (const float*) tree + 1;
+  const int stride = sizeof(Node) / sizeof(float);
+  long first = f->leafOffsets[tindex];
+  int j;
+  for(j = 0; j < V; j += 16) {
+    __m512i node = _mm512_mullo_epi32(_mm512_loadu_si512((const void*) &leaves[j]),
+                                      _mm512_set1_epi32(stride));
+    __m512i idx = _mm512_cvttps_epi32(_mm512_i32gather_ps(node, thetas, 4));
+    __m512i value;
+    if(f->bits == 16) {
+      value = _mm512_i32gather_epi32(idx, (const int*) &f->values16[first], 2);
+      value = _mm512_srai_epi32(_mm512_slli_epi32(value, 16), 16);
+    } else {
+      value = _mm512_i32gather_epi32(idx, (const int*) &f->values32[first], 4);
+    }
+    __m512i sum = _mm512_add_epi32(_mm512_loadu_si512((const void*) &scores[j]), value);
+    _mm512_storeu_si512((void*) &scores[j], sum);
+  }
+}
+
+#endif
+
+// Signature of addFixedPointLeaves and its vectorized variants
+typedef void (*AddFixedPointLeaves)(const FixedPointLeaves* f, int tindex, const Node* tree,
+                                    const int* leaves, int32_t* scores);
+
+/**
+ * Picks the addFixedPointLeaves kernel for an instruction set.
+ *
+ * @param isa KERNEL_SCALAR, KERNEL_AVX2 or KERNEL_AVX512 (see selectKernelIsa)
+ */
+AddFixedPointLeaves selectAddFixedPointLeaves(int isa) {
+#if defined(__x86_64__) || defined(__i386__)
+  if(isa == KERNEL_AVX512) {
+    return &addFixedPointLeavesAvx512;
+  }
+  if(isa == KERNEL_AVX2) {
+    return &addFixedPointLeavesAvx2;
+  }
+#endif
+  return &addFixedPointLeaves;
+}
+
+/**
+ * Adds the fixed-point leaves of trees [first, last) to the scores of V
+ * consecutive instances.
+ *
+ * @param kernels VPred kernels (see initKernelTable)
+ * @param kernel Accumulation kernel (see selectAddFixedPointLeaves)
+ * @param nodes All trees, as converted by createFixedPointLeaves
+ * @param scores Fixed-point scores of the V instances
+ */
+void addFixedPointScores(const KernelTable<Node>* kernels, AddFixedPointLeaves kernel,
+                         const FixedPointLeaves* f, const Node* nodes, const long* offsets,
+                         const long* depths, int first, int last, const float* features,
+                         int numberOfFeatures, int32_t* scores) {
+  int leaf[V];
+  int tindex;
+  for(tindex = first; tindex < last; tindex++) {
+    long offset = offsets[tindex];
+    getFindLeaves(kernels, depths[tindex])((int) depths[tindex], leaf, features,
+                                           numberOfFeatures, &nodes[offset]);
+    kernel(f, tindex, &nodes[offset], leaf, scores);
+  }
+}
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef INTERLEAVE_H_GUARD
+#define INTERLEAVE_H_GUARD
+
+/**
+ * Interleaved traversal of the pointer-based layouts (Struct and
+ * StructPlus), in the style of asynchronous memory access chaining. In one
+ * tree, every level loads a node whose address comes from the previous
+ * load, so with large trees the core waits for one cache miss after
+ * another. Instead, a group of traversals of different trees is kept in
+ * flight, each one a pointer to its current node: a step moves one
+ * traversal down one level and prefetches the node it moved to, then the
+ * next traversal in the group takes a step, so the misses of the group
+ * overlap. A traversal that reaches a leaf records its value and starts
+ * the next tree.
+ *
+ * Trees finish out of order, so leaf values wait in a window of
+ * INTERLEAVE_WINDOW trees and are added in tree order: scores have the
+ * same bits as with a traversal of one tree after another.
+ */
+
+// Largest number of traversals in flight
+#define INTERLEAVE_MAX_GROUP 32
+
+#define INTERLEAVE_DEFAULT_GROUP 8
+
+// Trees that may be started past the first tree whose leaf is not added
+#define INTERLEAVE_WINDOW 256
+
+/**
+ * @return Group size clamped to [1, INTERLEAVE_MAX_GROUP]
+ */
+int clampInterleaveGroup(int groupSize) {
+  if(groupSize < 1) {
+    return 1;
+  }
+  return groupSize < INTERLEAVE_MAX_GROUP ? groupSize : INTERLEAVE_MAX_GROUP;
+}
+
+#endif
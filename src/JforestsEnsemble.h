@@ -0,0 +1,435 @@
+#ifndef JFORESTS_ENSEMBLE_H_GUARD
+#define JFORESTS_ENSEMBLE_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "Node.h"
+#include "BinaryEnsemble.h"
+#include "ThreadPool.h"
+
+/**
+ * Native importer for jforests ensembles, which replaces the conversion
+ * with util/TreeUtility.java and the parsing of the text format. The XML
+ * file is mapped and scanned once for its <Tree> elements, and the trees
+ * are then parsed in parallel directly into the packed VPred arrays that
+ * every layout is created from (see BinaryEnsemble.h):
+ *
+ *   <Ensemble>
+ *     <Tree leaves="3" weight="1.0">
+ *       <SplitFeatures>5 2</SplitFeatures>
+ *       <LeftChildren>1 -1</LeftChildren>
+ *       <RightChildren>-3 -2</RightChildren>
+ *       <OriginalThresholds>0.5 1.25</OriginalThresholds>
+ *       <LeafOutputs>-0.1 0.2 0.3</LeafOutputs>
+ *     </Tree>
+ *   </Ensemble>
+ *
+ * Internal node i splits on feature SplitFeatures[i] at OriginalThresholds[i].
+ * Children that are not negative are internal nodes; a negative child c
+ * is leaf ~c. Node 0 is the root. Leaf outputs are multiplied by the
+ * weight of their tree, and leaves use feature 0. The arrays are identical
+ * to those packed from the output of TreeUtility -mode tree, except for
+ * the feature ids of leaves, which traversals do not depend on.
+ */
+
+/**
+ * Checks whether a file starts with an <Ensemble> element, possibly after
+ * an XML declaration.
+ *
+ * @param path Path to the file
+ * @return 1 if the file is a jforests ensemble, 0 otherwise
+ */
+int isJforestsEnsemble(const char* path) {
+  char text[256];
+  FILE* fp = fopen(path, "rb");
+  if(!fp) {
+    return 0;
+  }
+  size_t length = fread(text, 1, sizeof(text) - 1, fp);
+  fclose(fp);
+  text[length] = 0;
+  char* p = text;
+  while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+    p++;
+  }
+  if(strncmp(p, "<?xml", 5) == 0) {
+    p = strstr(p, "?>");
+    if(!p) {
+      return 0;
+    }
+    p += 2;
+    while(*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') {
+      p++;
+    }
+  }
+  return strncmp(p, "<Ensemble", 9) == 0;
+}
+
+/**
+ * Finds the next start tag of an element.
+ *
+ * @param p Start of the search
+ * @param end End of the text
+ * @param name Element name
+ * @return Position right after the name, or 0 if there is no such tag
+ */
+const char* findStartTag(const char* p, const char* end, const char* name) {
+  size_t length = strlen(name);
+  while((p = (const char*) memchr(p, '<', end - p)) != 0) {
+    p++;
+    if((size_t) (end - p) > length && memcmp(p, name, length) == 0 &&
+       (p[length] == '>' || p[length] == ' ' || p[length] == '\t' ||
+        p[length] == '\r' || p[length] == '\n' || p[length] == '/')) {
+      return p + length;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Finds the text content of a child element, e.g., <LeafOutputs>.
+ *
+ * @return Start of the content, which ends at the next '<', or 0
+ */
+const char* findElementText(const char* p, const char* end, const char* name) {
+  p = findStartTag(p, end, name);
+  if(!p) {
+    return 0;
+  }
+  p = (const char*) memchr(p, '>', end - p);
+  return p ? p + 1 : 0;
+}
+
+/**
+ * Counts the numbers in the text content of an element.
+ */
+int countValues(const char* p, const char* end) {
+  int count = 0;
+  while(p < end && *p != '<') {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')) {
+      p++;
+    }
+    if(p == end || *p == '<') {
+      break;
+    }
+    count++;
+    while(p < end && *p != '<' && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+      p++;
+    }
+  }
+  return count;
+}
+
+/**
+ * Parses the integers of an element into values[0..count).
+ *
+ * @return 1 if all values were read, 0 otherwise
+ */
+int parseInts(const char* p, int count, int* values) {
+  int i;
+  for(i = 0; i < count; i++) {
+    char* next;
+    long value = strtol(p, &next, 10);
+    if(next == p) {
+      return 0;
+    }
+    values[i] = (int) value;
+    p = next;
+  }
+  return 1;
+}
+
+/**
+ * Parses the numbers of an element into values[0..count). Values are
+ * rounded to float directly, as the text parsers do, unless they are
+ * scaled by a weight other than 1.
+ */
+int parseFloats(const char* p, int count, double weight, float* values) {
+  int i;
+  for(i = 0; i < count; i++) {
+    char* next;
+    if(weight == 1.0) {
+      values[i] = strtof(p, &next);
+    } else {
+      values[i] = (float) (weight * strtod(p, &next));
+    }
+    if(next == p) {
+      return 0;
+    }
+    p = next;
+  }
+  return 1;
+}
+
+typedef struct JforestsTree JforestsTree;
+
+// A tree being imported, and its VPred nodes once parsed
+struct JforestsTree {
+  const char* start; // Content of the <Tree> element, up to the next <Tree>
+  const char* end;
+  Node* nodes;
+  long numberOfNodes;
+  long depth;
+};
+
+/**
+ * Places a subtree in pre-order, left subtree first (see createNodes in
+ * VPred.h).
+ *
+ * @param child Index of an internal node, or ~leaf
+ * @param i Index of the subtree's root in "nodes"
+ * @param level Depth of the subtree's root
+ * @param maxNodes Size of "nodes"; every index is placed at most once
+ * @param depth Output, the largest number of internal nodes on a path
+ * @return Index of the last node of the subtree, or -1 if the tree is malformed
+ */
+long placeJforestsNodes(int child, long i, long level, const int* splitFeatures,
+                        const int* leftChildren, const int* rightChildren,
+                        const float* thresholds, const float* leafOutputs,
+                        int numberOfInternal, long maxNodes, Node* nodes, long* depth) {
+  if(i >= maxNodes || level > numberOfInternal) {
+    return -1;
+  }
+  if(child < 0) {
+    if(~child > numberOfInternal) {
+      return -1;
+    }
+    nodes[i].fid = 0;
+    nodes[i].theta = leafOutputs[~child];
+    nodes[i].children[0] = i;
+    nodes[i].children[1] = i;
+    if(level > *depth) {
+      *depth = level;
+    }
+    return i;
+  }
+  if(child >= numberOfInternal || splitFeatures[child] < 0) {
+    return -1;
+  }
+  nodes[i].fid = splitFeatures[child];
+  nodes[i].theta = thresholds[child];
+  nodes[i].children[0] = i + 1;
+  long last = placeJforestsNodes(leftChildren[child], i + 1, level + 1, splitFeatures,
+                                 leftChildren, rightChildren, thresholds, leafOutputs,
+                                 numberOfInternal, maxNodes, nodes, depth);
+  if(last < 0) {
+    return -1;
+  }
+  nodes[i].children[1] = last + 1;
+  return placeJforestsNodes(rightChildren[child], last + 1, level + 1, splitFeatures,
+                            leftChildren, rightChildren, thresholds, leafOutputs,
+                            numberOfInternal, maxNodes, nodes, depth);
+}
+
+/**
+ * Parses one <Tree> element.
+ *
+ * @return 1 on success, 0 if the tree is malformed or has more than maxLeaves leaves
+ */
+int parseJforestsTree(JforestsTree* tree, int maxLeaves) {
+  const char* p = tree->start;
+  const char* end = tree->end;
+
+  // The weight attribute is in the start tag
+  double weight = 1.0;
+  const char* tagEnd = (const char*) memchr(p, '>', end - p);
+  if(!tagEnd) {
+    return 0;
+  }
+  const char* attribute = p;
+  while((attribute = (const char*) memchr(attribute, 'w', tagEnd - attribute)) != 0) {
+    if(tagEnd - attribute > 7 && memcmp(attribute, "weight=", 7) == 0 &&
+       (attribute[7] == '"' || attribute[7] == '\'')) {
+      weight = strtod(attribute + 8, 0);
+      break;
+    }
+    attribute++;
+  }
+
+  const char* features = findElementText(tagEnd, end, "SplitFeatures");
+  const char* lefts = findElementText(tagEnd, end, "LeftChildren");
+  const char* rights = findElementText(tagEnd, end, "RightChildren");
+  const char* thresholdText = findElementText(tagEnd, end, "OriginalThresholds");
+  const char* outputs = findElementText(tagEnd, end, "LeafOutputs");
+  if(!features || !lefts || !rights || !thresholdText || !outputs) {
+    return 0;
+  }
+  int numberOfInternal = countValues(features, end);
+  int numberOfLeaves = numberOfInternal + 1;
+  if(numberOfLeaves > maxLeaves ||
+     countValues(lefts, end) != numberOfInternal ||
+     countValues(rights, end) != numberOfInternal ||
+     countValues(thresholdText, end) != numberOfInternal ||
+     countValues(outputs, end) != numberOfLeaves) {
+    return 0;
+  }
+
+  int* splitFeatures = (int*) malloc((3 * (long) numberOfInternal + 1) * sizeof(int));
+  int* leftChildren = &splitFeatures[numberOfInternal];
+  int* rightChildren = &splitFeatures[2 * numberOfInternal];
+  float* thresholds = (float*) malloc((2 * (long) numberOfInternal + 2) * sizeof(float));
+  float* leafOutputs = &thresholds[numberOfInternal];
+  int ok = parseInts(features, numberOfInternal, splitFeatures) &&
+    parseInts(lefts, numberOfInternal, leftChildren) &&
+    parseInts(rights, numberOfInternal, rightChildren) &&
+    parseFloats(thresholdText, numberOfInternal, 1.0, thresholds) &&
+    parseFloats(outputs, numberOfLeaves, weight, leafOutputs);
+
+  // A tree with a single leaf has no internal nodes
+  tree->numberOfNodes = 2L * numberOfInternal + 1;
+  tree->nodes = (Node*) malloc(tree->numberOfNodes * sizeof(Node));
+  tree->depth = 0;
+  ok = ok && placeJforestsNodes(numberOfInternal > 0 ? 0 : ~0, 0, 0, splitFeatures,
+                                leftChildren, rightChildren, thresholds, leafOutputs,
+                                numberOfInternal, tree->numberOfNodes, tree->nodes,
+                                &tree->depth) == tree->numberOfNodes - 1;
+  if(tree->depth < 1) {
+    // Traversals take at least one step
+    tree->depth = 1;
+  }
+  free(splitFeatures);
+  free(thresholds);
+  return ok;
+}
+
+// Arguments of parseJforestsTrees
+typedef struct JforestsImport JforestsImport;
+
+struct JforestsImport {
+  JforestsTree* trees;
+  int maxLeaves;
+  int* failed;
+};
+
+/**
+ * Parses trees [begin, end) (see ScoreBlock in ThreadPool.h).
+ */
+void parseJforestsTrees(void* context, int begin, int end, int thread) {
+  JforestsImport* import = (JforestsImport*) context;
+  int tindex;
+  for(tindex = begin; tindex < end; tindex++) {
+    if(!parseJforestsTree(&import->trees[tindex], import->maxLeaves)) {
+      __atomic_store_n(import->failed, 1, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+/**
+ * Imports a jforests ensemble into the packed VPred arrays.
+ *
+ * @param path Path to the XML file
+ * @param maxLeaves Maximum number of leaves in a tree
+ * @param numberOfThreads Number of threads that parse trees, or 0 to
+ *                        parse them in the calling thread
+ * @return An ensemble whose arrays are owned by it (mapping is 0; free it
+ *         with unmapBinaryEnsemble), or 0 if the file could not be read or
+ *         a tree is malformed
+ */
+BinaryEnsemble* importJforestsEnsemble(const char* path, int maxLeaves, int numberOfThreads) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  void* mapping = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED) {
+    return 0;
+  }
+  const char* text = (const char*) mapping;
+  const char* end = text + st.st_size;
+
+  // Find the trees in a single pass; each tree extends to the next one
+  int capacity = 1024;
+  int nbTrees = 0;
+  JforestsTree* trees = (JforestsTree*) malloc(capacity * sizeof(JforestsTree));
+  const char* p = text;
+  while((p = findStartTag(p, end, "Tree")) != 0) {
+    if(nbTrees == capacity) {
+      capacity *= 2;
+      trees = (JforestsTree*) realloc(trees, capacity * sizeof(JforestsTree));
+    }
+    trees[nbTrees].start = p;
+    trees[nbTrees].end = end;
+    trees[nbTrees].nodes = 0;
+    if(nbTrees > 0) {
+      trees[nbTrees - 1].end = p;
+    }
+    nbTrees++;
+  }
+
+  int failed = 0;
+  JforestsImport import;
+  import.trees = trees;
+  import.maxLeaves = maxLeaves;
+  import.failed = &failed;
+  if(numberOfThreads > 1 && nbTrees > 1) {
+    ThreadStats* stats = (ThreadStats*) malloc(numberOfThreads * sizeof(ThreadStats));
+    int blockSize = (nbTrees + 4 * numberOfThreads - 1) / (4 * numberOfThreads);
+    scoreInParallel(numberOfThreads, nbTrees, blockSize, &parseJforestsTrees, &import, stats);
+    free(stats);
+  } else {
+    parseJforestsTrees(&import, 0, nbTrees, 0);
+  }
+  munmap(mapping, st.st_size);
+
+  BinaryEnsemble* ensemble = 0;
+  int tindex;
+  if(!failed) {
+    ensemble = (BinaryEnsemble*) malloc(sizeof(BinaryEnsemble));
+    ensemble->mapping = 0;
+    ensemble->size = 0;
+    ensemble->numberOfTrees = nbTrees;
+    ensemble->maxLeaves = maxLeaves;
+    ensemble->offsets = (long*) malloc((nbTrees + 1) * sizeof(long));
+    ensemble->depths = (long*) malloc((nbTrees + 1) * sizeof(long));
+    long numberOfNodes = 0;
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      ensemble->offsets[tindex] = numberOfNodes;
+      ensemble->depths[tindex] = trees[tindex].depth;
+      numberOfNodes += trees[tindex].numberOfNodes;
+    }
+    ensemble->numberOfNodes = numberOfNodes;
+    ensemble->nodes = (Node*) malloc((numberOfNodes + 1) * sizeof(Node));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      memcpy(&ensemble->nodes[ensemble->offsets[tindex]], trees[tindex].nodes,
+             trees[tindex].numberOfNodes * sizeof(Node));
+    }
+    ensemble->numberOfFeatures = getRequiredFeatures(ensemble->nodes, numberOfNodes);
+  }
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    free(trees[tindex].nodes);
+  }
+  free(trees);
+  return ensemble;
+}
+
+/**
+ * Loads the packed VPred arrays of a compiled or a jforests ensemble.
+ *
+ * @param path Path to the ensemble file
+ * @param maxLeaves Maximum number of leaves in a tree, for jforests ensembles
+ * @param numberOfThreads Number of threads for jforests ensembles
+ * @return Ensemble to free with unmapBinaryEnsemble, or 0 if the file is
+ *         neither or could not be loaded
+ */
+BinaryEnsemble* loadPackedEnsemble(const char* path, int maxLeaves, int numberOfThreads) {
+  if(isBinaryEnsemble(path)) {
+    return mapBinaryEnsemble(path);
+  }
+  if(isJforestsEnsemble(path)) {
+    return importJforestsEnsemble(path, maxLeaves, numberOfThreads);
+  }
+  return 0;
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef NODE_H_GUARD
+#define NODE_H_GUARD
+
+typedef struct Node Node;
+
+/**
+ * A node of a tree in the VPred layout. The nodes of a tree are stored
+ * in pre-order, left subtree first, or hotter subtree first when packed
+ * with a branch profile (see Profile.h). Leaves point to themselves, so
+ * that a traversal of "depth" steps always ends at a leaf.
+ * For leaves, "theta" holds the regression value.
+ */
+struct Node {
+  int fid; // Feature id
+  float theta; // Threshold/Regression value
+  int children[2]; // Index of the left and right child, relative to the root
+};
+
+#endif
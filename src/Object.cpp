@@ -6,7 +6,12 @@
 #include <math.h>
 #include <stdlib.h>
 #include "Object.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
 #include "ParseCommandLine.h"
+#include "ThreadPool.h"
 
 using namespace std;
 
@@ -17,140 +22,211 @@ using namespace std;
  *
  * ./Object -ensemble <ensemble-path> -instances <test-instances-path> \
  *          -maxLeaves <max-number-of-leaves> [-print]
+ *          [-threads <number-of-threads>] [-hugePages]
  *
+ * -instancesBinary <binary-instances-path> may replace -instances to
+ * memory-map instances converted by ConvertInstances.
+ *
+ * With -threads, instances are scored in blocks by a pool of threads.
+ */
+
+// Arguments of scoreInstances
+struct ScoreContext {
+  Object** root;
+  int numberOfTrees;
+  float** features;
+  int numberOfFeatures;
+  float* scores; // Output, one score per instance
+};
+
+/**
+ * Scores instances [begin, end) (see ScoreBlock in ThreadPool.h).
  */
+void scoreInstances(void* context, int begin, int end, int thread) {
+  ScoreContext* c = (ScoreContext*) context;
+  for(int i = begin; i < end; i++) {
+    float score = 0;
+    for(int t = 0; t < c->numberOfTrees; t++) {
+      score += c->root[t]->getLeaf(c->features[i], c->numberOfFeatures);
+    }
+    c->scores[i] = score;
+  }
+}
 
 int main(int argc, char** args) {
   if(!isPresentCL(argc, args, (char*) "-ensemble") ||
-     !isPresentCL(argc, args, (char*) "-instances") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
      !isPresentCL(argc, args, (char*) "-maxLeaves")) {
     return -1;
   }
 
   char* configFile = getValueCL(argc, args, (char*) "-ensemble");
   char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
   int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
   int printScores = isPresentCL(argc, args, (char*) "-print");
+  int numberOfThreads = 0;
+  if(isPresentCL(argc, args, (char*) "-threads")) {
+    numberOfThreads = atoi(getValueCL(argc, args, (char*) "-threads"));
+  }
+  // Trees and features are allocated in one arena, freed at once
+  Arena* arena = createArena(isPresentCL(argc, args, (char*) "-hugePages"));
 
-  // Open ensemble file
-  ifstream file (configFile);
-
-  // Read ensemble
   int numberOfTrees;
-  file >> numberOfTrees;
-
+  // Features read by a compiled or jforests ensemble, not checked for text ones
+  int ensembleFeatures = 0;
   // Array of pointers to tree roots, one per tree in the ensemble
-  Object** root = new Object*[numberOfTrees];
+  Object** root;
 
-  // Number of nodes in a tree does not exceed (maxLeaves * 2)
-  int treeSize = 2 * maxNumberOfLeaves;
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    // Create the trees from a compiled or jforests ensemble, without parsing
+    // the text format
+    BinaryEnsemble* binaryEnsemble =
+      loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      cerr << "Could not load " << configFile << endl;
+      return -1;
+    }
+    numberOfTrees = binaryEnsemble->numberOfTrees;
+    root = new Object*[numberOfTrees];
+    for(int t = 0; t < numberOfTrees; t++) {
+      root[t] = createObjectFromNodes(arena, &binaryEnsemble->nodes[binaryEnsemble->offsets[t]],
+                                      0);
+    }
+    ensembleFeatures = binaryEnsemble->numberOfFeatures;
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    // Open ensemble file
+    ifstream file (configFile);
 
-  for(int t = 0; t < numberOfTrees; t++) {
-    long size;
-    file >> size;
+    // Read ensemble
+    file >> numberOfTrees;
 
-    Object** pointers = new Object*[treeSize];
-    for(long i = 0 ; i < treeSize; i++) {
-      pointers[i] = 0;
-    }
+    root = new Object*[numberOfTrees];
 
-    // There are three types of nodes in the ensemble file:
-    //   root
-    //   node (intermediate node)
-    //   leaf (terminal node)
-    // "end" indicates the end of a tree
-    string type;
-    file >> type;
-    int curIndex = 0;
-
-    while(type != "end") {
-      //read node id
-      long id;
-      file >> id;
-
-      // A "root" node contains a feature id and a threshold
-      if(type == "root") {
-        int fid;
-        float threshold;
-        file >> fid;
-        file >> threshold;
-        root[t] = new Object(id, fid, threshold);
-        // Set the root pointer
-        pointers[curIndex++] = root[t];
-      } else if(type == "node") {
-        int fid;
-        long pid;
-        float threshold;
-        bool left = false;
-        string token;
-        file >> pid; // Id of the parent node
-        file >> fid; // Feature id
-        file >> token; // Whether it's a left or right child
-        if(token == "1") {
-          left = true;
-        }
-        file >> threshold; // Threshold/Regression value
+    // Number of nodes in a tree does not exceed (maxLeaves * 2)
+    int treeSize = 2 * maxNumberOfLeaves;
+
+    for(int t = 0; t < numberOfTrees; t++) {
+      long size;
+      file >> size;
+
+      Object** pointers = new Object*[treeSize];
+      for(long i = 0 ; i < treeSize; i++) {
+        pointers[i] = 0;
+      }
+
+      // There are three types of nodes in the ensemble file:
+      //   root
+      //   node (intermediate node)
+      //   leaf (terminal node)
+      // "end" indicates the end of a tree
+      string type;
+      file >> type;
+      int curIndex = 0;
 
-        // Find the parent node, based in parent id
-        int parentIndex = 0;
-        for(parentIndex = 0; parentIndex < treeSize; parentIndex++) {
-          if(pointers[parentIndex]->id == pid) {
-            break;
+      while(type != "end") {
+        //read node id
+        long id;
+        file >> id;
+
+        // A "root" node contains a feature id and a threshold
+        if(type == "root") {
+          int fid;
+          float threshold;
+          file >> fid;
+          file >> threshold;
+          root[t] = new (arena) Object(id, fid, threshold);
+          // Set the root pointer
+          pointers[curIndex++] = root[t];
+        } else if(type == "node") {
+          int fid;
+          long pid;
+          float threshold;
+          bool left = false;
+          string token;
+          file >> pid; // Id of the parent node
+          file >> fid; // Feature id
+          file >> token; // Whether it's a left or right child
+          if(token == "1") {
+            left = true;
           }
-        }
-        // Add the new node
-        if(pointers[pid]->fid >= 0) {
-          pointers[curIndex++] = pointers[parentIndex]->addNode(id, left, fid, threshold);
-        }
-      } else if(type == "leaf") {
-        long pid;
-        bool left = false;
-        string token;
-        float value;
-        file >> pid;
-        file >> token;
-        if(token == "1") {
-          left = true;
-        }
-        file >> value;
+          file >> threshold; // Threshold/Regression value
 
-        int parentIndex = 0;
-        for(parentIndex = 0; parentIndex < treeSize; parentIndex++) {
-          if(pointers[parentIndex]->id == pid) {
-            break;
+          // Find the parent node, based in parent id
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < treeSize; parentIndex++) {
+            if(pointers[parentIndex]->id == pid) {
+              break;
+            }
+          }
+          // Add the new node
+          if(pointers[pid]->fid >= 0) {
+            pointers[curIndex++] = pointers[parentIndex]->addNode(arena, id, left, fid, threshold);
+          }
+        } else if(type == "leaf") {
+          long pid;
+          bool left = false;
+          string token;
+          float value;
+          file >> pid;
+          file >> token;
+          if(token == "1") {
+            left = true;
+          }
+          file >> value;
+
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < treeSize; parentIndex++) {
+            if(pointers[parentIndex]->id == pid) {
+              break;
+            }
+          }
+          if(pointers[pid]->fid >= 0) {
+            pointers[curIndex++] = pointers[parentIndex]->addNode(arena, id, left, 0, value);
           }
         }
-        if(pointers[pid]->fid >= 0) {
-          pointers[curIndex++] = pointers[parentIndex]->addNode(id, left, 0, value);
-        }
+        file >> type;
       }
-      file >> type;
+      delete[] pointers;
     }
-    delete(pointers);
+    file.close();
   }
-  file.close();
 
-  // Read instances (SVM Light format)
+  // Read instances, either mapped from a binary instance file (see
+  // BinaryInstances.h) or parsed from SVM Light format (see SvmLight.h)
   int numberOfInstances, numberOfFeatures;
-  ifstream ffile (featureFile);
-  ffile >> numberOfInstances;
-  ffile >> numberOfFeatures;
-  float** features = new float*[numberOfInstances];
-  int id = 0;
-  for(int i = 0; i < numberOfInstances; i++) {
-    features[i] = new float[numberOfFeatures];
-    string token;
-    char text[20];
-    ffile >> token;
-    ffile >> token;
-
-    int index = 0;
-    while(index < numberOfFeatures) {
-      ffile >> token;
-      sscanf(token.c_str(), "%[^:]:%f", text, &features[i][index++]);
+  float** features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      cerr << "Could not map " << binaryFeatureFile << endl;
+      return -1;
     }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    float* matrix = getRowMajorFeatures(binaryInstances, 1, arena);
+    features = getFeatureRows(matrix, numberOfInstances, numberOfFeatures, arena);
+  } else {
+    instances = readInstances(featureFile, 1, numberOfThreads, arena);
+    if(!instances) {
+      cerr << "Could not read " << featureFile << endl;
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = getFeatureRows(instances->features, numberOfInstances, numberOfFeatures, arena);
+  }
+
+  // Rows must hold every feature that a compiled or jforests ensemble reads
+  if(numberOfFeatures < ensembleFeatures) {
+    cerr << "Instances have " << numberOfFeatures << " features, but the ensemble reads "
+         << ensembleFeatures << endl;
+    return -1;
   }
-  ffile.close();
 
   // Compute scores for instances using the ensemble and
   // measure elapsed time
@@ -158,28 +234,60 @@ int main(int argc, char** args) {
   float sum = 0; // Dummy value just so gcc wouldn't optimize the loop out
   struct timeval start, end;
 
-  gettimeofday(&start, NULL);
-  for(int i = 0; i < numberOfInstances; i++) {
-    score = 0;
-    for(int t = 0; t < numberOfTrees; t++) {
-      score += root[t]->getLeaf(features[i], numberOfFeatures);
+  if(numberOfThreads > 0) {
+    // Score blocks of instances in parallel into a preallocated array
+    ScoreContext context;
+    context.root = root;
+    context.numberOfTrees = numberOfTrees;
+    context.features = features;
+    context.numberOfFeatures = numberOfFeatures;
+    context.scores = new float[numberOfInstances];
+    ThreadStats* stats = new ThreadStats[numberOfThreads];
+    int blockSize = getBlockSize(numberOfInstances, numberOfFeatures, numberOfThreads, 1);
+
+    gettimeofday(&start, NULL);
+    scoreInParallel(numberOfThreads, numberOfInstances, blockSize,
+                    &scoreInstances, &context, stats);
+    gettimeofday(&end, NULL);
+
+    for(int i = 0; i < numberOfInstances; i++) {
+      if(printScores) {
+        cout << context.scores[i] << endl;
+      }
+      sum += context.scores[i];
     }
-    if(printScores) {
-      cout << score << endl;
+    printThreadStats(stats, numberOfThreads, numberOfInstances,
+                     (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    delete[] stats;
+    delete[] context.scores;
+  } else {
+    gettimeofday(&start, NULL);
+    for(int i = 0; i < numberOfInstances; i++) {
+      score = 0;
+      for(int t = 0; t < numberOfTrees; t++) {
+        score += root[t]->getLeaf(features[i], numberOfFeatures);
+      }
+      if(printScores) {
+        cout << score << endl;
+      }
+      sum += score;
     }
-    sum += score;
+    gettimeofday(&end, NULL);
   }
-  gettimeofday(&end, NULL);
 
   cout << "Time per instance (ns): " <<
     (((end.tv_sec * 1000000 + end.tv_usec) -
       (start.tv_sec * 1000000 + start.tv_usec))*1000/((float) numberOfInstances)) << endl;
   cout << "Ignore this number: " << sum << endl;
+  if(arena->hugePages) {
+    cout << flush;
+    printArenaStats(arena);
+  }
 
-  delete(root);
-  for(int i = 0; i < numberOfInstances; i++) {
-    delete(features[i]);
+  delete[] root;
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
   }
-  delete(features);
+  destroyArena(arena);
   return 0;
 }
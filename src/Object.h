@@ -3,6 +3,8 @@
 
 #include <math.h>
 #include <stdlib.h>
+#include "Node.h"
+#include "Arena.h"
 
 /*
  * An instance of the Object class represents a node in the
@@ -12,6 +14,9 @@
  *
  * For terminal nodes, "threshold" is used to hold the regression
  * value associated with the node.
+ *
+ * Nodes are created with "new (arena) Object(...)" in an arena (see
+ * Arena.h) and freed with it; they are never deleted.
  */
 class Object {
  public:
@@ -22,19 +27,24 @@ class Object {
 
  public:
   unsigned long id; // Node id
-  ~Object();
   Object(unsigned long id, int fid, float threshold); // Constructor
 
+  // Allocates a node in an arena
+  static void* operator new(size_t size, Arena* arena);
+  // Only called if a constructor throws; the arena keeps the memory
+  static void operator delete(void* node, Arena* arena) {}
+
   /*
    * Inserts a new node to the left or right of a node
    *
+   * @param arena Arena that holds the new node
    * @param id Id of the new node
    * @param left Inserts the node to the left of this node if set to 1, right otherwise
    * @param featureId Fid of the new node
    * @param threshold Threshold/Regression value of the new node
    * @return A new node
    */
-  Object* addNode(unsigned long id, bool left, int featureId, float threshold);
+  Object* addNode(Arena* arena, unsigned long id, bool left, int featureId, float threshold);
 
   /*
    * Traverses the tree starting from this node using the input feature vector
@@ -46,15 +56,8 @@ class Object {
   float getLeaf(float* featureVector, int featureVectorSize);
 };
 
-Object::~Object() {
-  if(right != 0) {
-    right->~Object();
-    delete right;
-  }
-  if(left != 0) {
-    left->~Object();
-    delete left;
-  }
+void* Object::operator new(size_t size, Arena* arena) {
+  return allocateInArena(arena, size);
 }
 
 Object::Object(unsigned long id, int fid, float threshold) {
@@ -65,12 +68,13 @@ Object::Object(unsigned long id, int fid, float threshold) {
   this->right = 0;
 }
 
-Object* Object::addNode(unsigned long id, bool left, int featureId, float threshold) {
+Object* Object::addNode(Arena* arena, unsigned long id, bool left, int featureId,
+                        float threshold) {
   if(left) {
-    this->left = new Object(id, featureId, threshold);
+    this->left = new (arena) Object(id, featureId, threshold);
     return this->left;
   } else {
-    this->right = new Object(id, featureId, threshold);
+    this->right = new (arena) Object(id, featureId, threshold);
     return this->right;
   }
 }
@@ -86,4 +90,22 @@ float Object::getLeaf(float* featureVector, int featureVectorSize) {
   }
 }
 
+/*
+ * Creates a tree from a tree in the VPred layout (see Node.h)
+ *
+ * @param arena Arena that holds the nodes
+ * @param nodes Tree structure
+ * @param index Index of the current node
+ * @return New node
+ */
+Object* createObjectFromNodes(Arena* arena, Node* nodes, int index) {
+  Object* node = new (arena) Object(index, nodes[index].fid, nodes[index].theta);
+  // Leaves point to themselves
+  if(nodes[index].children[0] != index) {
+    node->left = createObjectFromNodes(arena, nodes, nodes[index].children[0]);
+    node->right = createObjectFromNodes(arena, nodes, nodes[index].children[1]);
+  }
+  return node;
+}
+
 #endif
@@ -0,0 +1,363 @@
+#ifndef OBLIVIOUS_H_GUARD
+#define OBLIVIOUS_H_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+#include "Node.h"
+#include "VPredKernels.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Lookup tables for shallow trees. A tree is oblivious if all nodes of a
+ * level test the same feature against the same threshold. The outcomes of
+ * its levels then form the bits of an index into a table of 2^levels leaf
+ * values, so a traversal is a fixed number of compares and a single load:
+ *
+ *   idx |= (x[fid[l]] > threshold[l]) << l, for every level l
+ *   score += table[idx]
+ *
+ * Any tree can be rewritten in this form by using each of its distinct
+ * conditions as a level, which duplicates subtrees below conditions that
+ * only some paths test. The leaf of an index is found by walking the
+ * original tree with the outcomes the index encodes; indexes that no
+ * instance can produce (e.g., x > 2 but not x > 1) are filled all the same.
+ * Trees are converted only while the table stays within a budget, a
+ * multiple of their number of leaves; the other trees are evaluated by the
+ * VPred kernels (see VPredKernels.h). Trees are scored in their original
+ * order either way, so scores are the same as with VPred.
+ */
+
+// Levels of a table are limited by the bits of its index
+#define OBLIVIOUS_MAX_LEVELS 16
+
+// Default budget: a table may hold this many entries per leaf of the tree
+#define OBLIVIOUS_DEFAULT_BLOWUP 16
+
+typedef struct ObliviousEnsemble ObliviousEnsemble;
+
+struct ObliviousEnsemble {
+  int numberOfTrees;
+  int numberOfOblivious; // Trees scored by a table
+  int* levels; // Number of levels of each tree, or -1 if it is scored by VPred
+  long* firstLevels; // Index of the first level of each tree in fids and thresholds
+  int* fids; // Feature of every level
+  float* thresholds; // Threshold of every level
+  long* tableOffsets; // Index of the table of each tree in tables
+  float* tables; // Leaf value of every index
+  Node* nodes; // Trees scored by VPred, packed
+  long* offsets; // Index of the root of each tree in nodes
+  long* depths; // Depth of each tree
+};
+
+/**
+ * Collects the distinct conditions of a tree, in pre-order.
+ *
+ * @param tree Tree in the VPred layout
+ * @param size Number of nodes in the tree
+ * @param conditions Output, index of the condition of every internal node
+ * @param fids Output, feature of every condition, up to maxLevels
+ * @param thresholds Output, threshold of every condition
+ * @return Number of conditions, or -1 if there are more than maxLevels
+ */
+int getObliviousLevels(const Node* tree, int size, int maxLevels, int* conditions,
+                       int* fids, float* thresholds) {
+  int levels = 0;
+  int n, l;
+  for(n = 0; n < size; n++) {
+    if(tree[n].children[0] == n) {
+      continue;
+    }
+    for(l = 0; l < levels; l++) {
+      if(fids[l] == tree[n].fid && thresholds[l] == tree[n].theta) {
+        break;
+      }
+    }
+    if(l == levels) {
+      if(levels == maxLevels) {
+        return -1;
+      }
+      fids[levels] = tree[n].fid;
+      thresholds[levels] = tree[n].theta;
+      levels++;
+    }
+    conditions[n] = l;
+  }
+  return levels;
+}
+
+void destroyObliviousEnsemble(ObliviousEnsemble* e) {
+  free(e->levels);
+  free(e->firstLevels);
+  free(e->fids);
+  free(e->thresholds);
+  free(e->tableOffsets);
+  free(e->tables);
+  free(e->nodes);
+  free(e->offsets);
+  free(e->depths);
+  free(e);
+}
+
+/**
+ * Converts the trees that fit the budget to lookup tables, and keeps the
+ * others in the VPred layout.
+ *
+ * @param nodes All trees (see packTrees in VPred.h)
+ * @param offsets Index of the root of each tree in nodes
+ * @param depths Depth of each tree
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ * @param maxBlowup Largest table, in entries per leaf of a tree
+ */
+ObliviousEnsemble* createObliviousEnsemble(const Node* nodes, const long* offsets,
+                                           const long* depths, int nbTrees,
+                                           long numberOfNodes, int maxBlowup) {
+  ObliviousEnsemble* e = (ObliviousEnsemble*) calloc(1, sizeof(ObliviousEnsemble));
+  e->numberOfTrees = nbTrees;
+  e->levels = (int*) malloc((nbTrees + 1) * sizeof(int));
+  e->firstLevels = (long*) calloc(nbTrees + 1, sizeof(long));
+  e->tableOffsets = (long*) calloc(nbTrees + 1, sizeof(long));
+  e->offsets = (long*) calloc(nbTrees + 1, sizeof(long));
+  e->depths = (long*) calloc(nbTrees + 1, sizeof(long));
+
+  // First pass: pick the trees to convert and size the arrays
+  int conditionCapacity = OBLIVIOUS_MAX_LEVELS;
+  int* conditions = (int*) malloc(sizeof(int));
+  int* fids = (int*) malloc(conditionCapacity * sizeof(int));
+  float* thresholds = (float*) malloc(conditionCapacity * sizeof(float));
+  long totalLevels = 0, totalEntries = 0, totalNodes = 0;
+  int largest = 0;
+  int tindex;
+  long n;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    int size = (int) (end - offsets[tindex]);
+    if(size > largest) {
+      largest = size;
+      conditions = (int*) realloc(conditions, size * sizeof(int));
+    }
+    const Node* tree = &nodes[offsets[tindex]];
+    int levels = getObliviousLevels(tree, size, OBLIVIOUS_MAX_LEVELS, conditions,
+                                    fids, thresholds);
+    long leaves = (size + 1) / 2;
+    if(levels >= 0 && (1L << levels) <= (long) maxBlowup * leaves) {
+      e->levels[tindex] = levels;
+      e->firstLevels[tindex] = totalLevels;
+      e->tableOffsets[tindex] = totalEntries;
+      totalLevels += levels;
+      totalEntries += 1L << levels;
+      e->numberOfOblivious++;
+    } else {
+      e->levels[tindex] = -1;
+      e->offsets[tindex] = totalNodes;
+      e->depths[tindex] = depths[tindex];
+      totalNodes += size;
+    }
+  }
+
+  // Second pass: fill the tables and copy the other trees
+  e->fids = (int*) malloc((totalLevels + 1) * sizeof(int));
+  e->thresholds = (float*) malloc((totalLevels + 1) * sizeof(float));
+  e->tables = (float*) malloc((totalEntries + 1) * sizeof(float));
+  e->nodes = (Node*) malloc((totalNodes + 1) * sizeof(Node));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    int size = (int) (end - offsets[tindex]);
+    const Node* tree = &nodes[offsets[tindex]];
+    if(e->levels[tindex] < 0) {
+      memcpy(&e->nodes[e->offsets[tindex]], tree, size * sizeof(Node));
+      continue;
+    }
+    int levels = getObliviousLevels(tree, size, OBLIVIOUS_MAX_LEVELS, conditions,
+                                    &e->fids[e->firstLevels[tindex]],
+                                    &e->thresholds[e->firstLevels[tindex]]);
+    float* table = &e->tables[e->tableOffsets[tindex]];
+    long idx;
+    for(idx = 0; idx < 1L << levels; idx++) {
+      n = 0;
+      while(tree[n].children[0] != n) {
+        n = tree[n].children[(idx >> conditions[n]) & 1];
+      }
+      table[idx] = tree[n].theta;
+    }
+  }
+  free(thresholds);
+  free(fids);
+  free(conditions);
+  return e;
+}
+
+/**
+ * Computes the table index of a single instance.
+ */
+int findTableIndex(int levels, const int* fids, const float* thresholds,
+                   const float* features) {
+  int idx = 0;
+  int l;
+  for(l = 0; l < levels; l++) {
+    idx |= (features[fids[l]] > thresholds[l]) << l;
+  }
+  return idx;
+}
+
+/**
+ * Computes the score of one instance.
+ */
+float getObliviousScore(const ObliviousEnsemble* e, const float* features) {
+  float score = 0;
+  int tindex;
+  for(tindex = 0; tindex < e->numberOfTrees; tindex++) {
+    if(e->levels[tindex] >= 0) {
+      long first = e->firstLevels[tindex];
+      score += e->tables[e->tableOffsets[tindex] +
+                         findTableIndex(e->levels[tindex], &e->fids[first],
+                                        &e->thresholds[first], features)];
+    } else {
+      const Node* nodes = &e->nodes[e->offsets[tindex]];
+      int idx = 0;
+      long d;
+      for(d = 0; d < e->depths[tindex]; d++) {
+        idx = NodeTraits<Node>::child(&nodes[idx], features);
+      }
+      score += nodes[idx].theta;
+    }
+  }
+  return score;
+}
+
+/**
+ * Adds the table entries of V instances to their scores. Every level reads
+ * the same feature for all instances.
+ *
+ * @param levels Number of levels of the tree
+ * @param fids Feature of every level
+ * @param thresholds Threshold of every level
+ * @param table Leaf value of every index
+ * @param features V consecutive feature vectors
+ * @param numberOfFeatures Length of a feature vector
+ * @param scores Scores of the V instances
+ */
+void addTableScores(int levels, const int* fids, const float* thresholds, const float* table,
+                    const float* features, int numberOfFeatures, float* scores) {
+  int idx[V];
+  int j, l;
+  for(j = 0; j < V; j++) {
+    idx[j] = 0;
+  }
+  for(l = 0; l < levels; l++) {
+    const float* column = &features[fids[l]];
+    for(j = 0; j < V; j++) {
+      idx[j] |= (column[j * numberOfFeatures] > thresholds[l]) << l;
+    }
+  }
+  for(j = 0; j < V; j++) {
+    scores[j] += table[idx[j]];
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/**
+ * AVX2 variant of addTableScores, 8 instances per instruction.
+ */
+__attribute__((target("avx2")))
+void addTableScoresAvx2(int levels, const int* fids, const float* thresholds,
+                        const float* table, const float* features, int numberOfFeatures,
+                        float* scores) {
+  __m256i rows = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                    _mm256_set1_epi32(numberOfFeatures));
+  int j, l;
+  for(j = 0; j < V; j += 8) {
+    const float* block = &features[(long) j * numberOfFeatures];
+    __m256i idx = _mm256_setzero_si256();
+    for(l = 0; l < levels; l++) {
+      __m256 x = _mm256_i32gather_ps(block + fids[l], rows, 4);
+      __m256 right = _mm256_cmp_ps(x, _mm256_set1_ps(thresholds[l]), _CMP_GT_OQ);
+      idx = _mm256_or_si256(idx, _mm256_and_si256(_mm256_castps_si256(right),
+                                                  _mm256_set1_epi32(1 << l)));
+    }
+    __m256 value = _mm256_i32gather_ps(table, idx, 4);
+    _mm256_storeu_ps(&scores[j], _mm256_add_ps(_mm256_loadu_ps(&scores[j]), value));
+  }
+}
+
+/**
+ * AVX-512 variant of addTableScores, 16 instances per instruction.
+ */
+__attribute__((target("avx512f")))
+void addTableScoresAvx512(int levels, const int* fids, const float* thresholds,
+                          const float* table, const float* features, int numberOfFeatures,
+                          float* scores) {
+  __m512i rows = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                      8, 9, 10, 11, 12, 13, 14, 15),
+                                    _mm512_set1_epi32(numberOfFeatures));
+  int j, l;
+  for(j = 0; j < V; j += 16) {
+    const float* block = &features[(long) j * numberOfFeatures];
+    __m512i idx = _mm512_setzero_si512();
+    for(l = 0; l < levels; l++) {
+      __m512 x = _mm512_i32gather_ps(rows, block + fids[l], 4);
+      __mmask16 right = _mm512_cmp_ps_mask(x, _mm512_set1_ps(thresholds[l]), _CMP_GT_OQ);
+      idx = _mm512_mask_or_epi32(idx, right, idx, _mm512_set1_epi32(1 << l));
+    }
+    __m512 value = _mm512_i32gather_ps(idx, table, 4);
+    _mm512_storeu_ps(&scores[j], _mm512_add_ps(_mm512_loadu_ps(&scores[j]), value));
+  }
+}
+
+#endif
+
+// Signature of addTableScores and its vectorized variants
+typedef void (*AddTableScores)(int levels, const int* fids, const float* thresholds,
+                               const float* table, const float* features,
+                               int numberOfFeatures, float* scores);
+
+/**
+ * Picks the addTableScores kernel for an instruction set.
+ *
+ * @param isa KERNEL_SCALAR, KERNEL_AVX2 or KERNEL_AVX512 (see selectKernelIsa)
+ */
+AddTableScores selectAddTableScores(int isa) {
+#if defined(__x86_64__) || defined(__i386__)
+  if(isa == KERNEL_AVX512) {
+    return &addTableScoresAvx512;
+  }
+  if(isa == KERNEL_AVX2) {
+    return &addTableScoresAvx2;
+  }
+#endif
+  return &addTableScores;
+}
+
+/**
+ * Adds the leaves of trees [first, last) to the scores of V consecutive
+ * instances, with tables where trees were converted and the VPred kernels
+ * elsewhere.
+ *
+ * @param kernel Table kernel (see selectAddTableScores)
+ * @param kernels VPred kernels (see initKernelTable)
+ */
+void addObliviousScores(const ObliviousEnsemble* e, AddTableScores kernel,
+                        const KernelTable<Node>* kernels, const float* features,
+                        int numberOfFeatures, int first, int last, float* scores) {
+  int leaf[V];
+  int tindex, j;
+  for(tindex = first; tindex < last; tindex++) {
+    if(e->levels[tindex] >= 0) {
+      long level = e->firstLevels[tindex];
+      kernel(e->levels[tindex], &e->fids[level], &e->thresholds[level],
+             &e->tables[e->tableOffsets[tindex]], features, numberOfFeatures, scores);
+    } else {
+      const Node* nodes = &e->nodes[e->offsets[tindex]];
+      long depth = e->depths[tindex];
+      getFindLeaves(kernels, depth)((int) depth, leaf, features, numberOfFeatures, nodes);
+      for(j = 0; j < V; j++) {
+        scores[j] += nodes[leaf[j]].theta;
+      }
+    }
+  }
+}
+
+#endif
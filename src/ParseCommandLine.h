@@ -1,6 +1,8 @@
 #ifndef PARSE_COMMAND_LINE_H_GUARD
 #define PARSE_COMMAND_LINE_H_GUARD
 
+#include <string.h>
+
 int isPresentCL(int argc, char** argv, char* flag) {
   int i;
   for(i = 1; i < argc; i++) {
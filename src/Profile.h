@@ -0,0 +1,184 @@
+#ifndef PROFILE_H_GUARD
+#define PROFILE_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Node.h"
+
+/**
+ * Branch profiles of an ensemble. A profile counts, for every internal
+ * node, how many instances of a sample went to its left and to its right
+ * child. Nodes are numbered as packTrees numbers them (see VPred.h):
+ * pre-order with the left subtree first, from the root of the first tree.
+ *
+ * With a profile, StructPlus (compress) and VPred (packTrees) lay out the
+ * child that more instances took right after its parent, and its subtree
+ * before the other one. The hottest path from the root to a leaf then
+ * occupies consecutive nodes, so most traversals touch one or two cache
+ * lines per tree. Children keep their meaning, so scores are unchanged.
+ *
+ * Profiles are written by ProfileEnsemble next to the model, in a text
+ * format: the number of trees, then one line per tree with its number of
+ * nodes followed by the left and right count of every node (zero for
+ * leaves).
+ */
+
+typedef struct BranchProfile BranchProfile;
+
+struct BranchProfile {
+  int numberOfTrees;
+  long numberOfNodes;
+  long* offsets; // Index of the root of each tree
+  long* counts; // Left and right count of every node, 2 * numberOfNodes
+};
+
+/**
+ * Creates a profile with all counts at zero.
+ *
+ * @param offsets Index of the root of each tree (see packTrees)
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ */
+BranchProfile* createBranchProfile(const long* offsets, int nbTrees, long numberOfNodes) {
+  BranchProfile* p = (BranchProfile*) malloc(sizeof(BranchProfile));
+  p->numberOfTrees = nbTrees;
+  p->numberOfNodes = numberOfNodes;
+  p->offsets = (long*) malloc(nbTrees * sizeof(long));
+  memcpy(p->offsets, offsets, nbTrees * sizeof(long));
+  p->counts = (long*) calloc(2 * numberOfNodes, sizeof(long));
+  return p;
+}
+
+void destroyBranchProfile(BranchProfile* p) {
+  free(p->offsets);
+  free(p->counts);
+  free(p);
+}
+
+/**
+ * Runs instances through packed trees and counts the branches they take.
+ * Features that the instances do not have are zero.
+ *
+ * @param nodes All trees, in the order of packTrees (see VPred.h)
+ * @param features Row-major feature matrix
+ */
+void addToBranchProfile(BranchProfile* p, const Node* nodes, const float* features,
+                        int numberOfInstances, int numberOfFeatures) {
+  int iIndex, tindex;
+  for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+    const float* x = &features[(long) iIndex * numberOfFeatures];
+    for(tindex = 0; tindex < p->numberOfTrees; tindex++) {
+      long offset = p->offsets[tindex];
+      const Node* tree = &nodes[offset];
+      int n = 0;
+      // Leaves point to themselves
+      while(tree[n].children[0] != n) {
+        float value = tree[n].fid < numberOfFeatures ? x[tree[n].fid] : 0;
+        int right = !(value <= tree[n].theta);
+        p->counts[2 * (offset + n) + right]++;
+        n = tree[n].children[right];
+      }
+    }
+  }
+}
+
+/**
+ * @return Whether a profile was made for trees of these sizes
+ */
+int matchesBranchProfile(const BranchProfile* p, const long* offsets, int nbTrees,
+                         long numberOfNodes) {
+  return p->numberOfTrees == nbTrees && p->numberOfNodes == numberOfNodes &&
+    memcmp(p->offsets, offsets, nbTrees * sizeof(long)) == 0;
+}
+
+/**
+ * @param tindex Index of a tree
+ * @return Counts of the nodes of the tree, indexed by 2 * node + child
+ */
+const long* getTreeBranchCounts(const BranchProfile* p, int tindex) {
+  return &p->counts[2 * p->offsets[tindex]];
+}
+
+/**
+ * Writes a profile in the text format above.
+ *
+ * @return 0 on success, -1 on error
+ */
+int writeBranchProfile(const char* path, const BranchProfile* p) {
+  FILE* fp = fopen(path, "w");
+  if(!fp) {
+    return -1;
+  }
+  fprintf(fp, "%d\n", p->numberOfTrees);
+  int tindex;
+  long n;
+  for(tindex = 0; tindex < p->numberOfTrees; tindex++) {
+    long end = tindex + 1 < p->numberOfTrees ? p->offsets[tindex + 1] : p->numberOfNodes;
+    fprintf(fp, "%ld", end - p->offsets[tindex]);
+    for(n = p->offsets[tindex]; n < end; n++) {
+      fprintf(fp, " %ld %ld", p->counts[2 * n], p->counts[2 * n + 1]);
+    }
+    fprintf(fp, "\n");
+  }
+  return fclose(fp) == 0 ? 0 : -1;
+}
+
+/**
+ * Reads a profile in the text format above.
+ *
+ * @return Profile, or 0 if the file could not be read
+ */
+BranchProfile* readBranchProfile(const char* path) {
+  FILE* fp = fopen(path, "r");
+  if(!fp) {
+    return 0;
+  }
+  int nbTrees;
+  if(fscanf(fp, "%d", &nbTrees) != 1 || nbTrees < 0) {
+    fclose(fp);
+    return 0;
+  }
+  BranchProfile* p = (BranchProfile*) malloc(sizeof(BranchProfile));
+  p->numberOfTrees = nbTrees;
+  p->numberOfNodes = 0;
+  p->offsets = (long*) malloc(nbTrees * sizeof(long));
+  p->counts = 0;
+  long capacity = 0;
+  int ok = 1;
+  int tindex;
+  long n;
+  for(tindex = 0; tindex < nbTrees && ok; tindex++) {
+    long size;
+    if(fscanf(fp, "%ld", &size) != 1 || size < 1) {
+      ok = 0;
+      break;
+    }
+    p->offsets[tindex] = p->numberOfNodes;
+    p->numberOfNodes += size;
+    if(p->numberOfNodes > capacity) {
+      capacity = 2 * p->numberOfNodes;
+      p->counts = (long*) realloc(p->counts, 2 * capacity * sizeof(long));
+    }
+    for(n = p->offsets[tindex]; n < p->numberOfNodes && ok; n++) {
+      ok = fscanf(fp, "%ld %ld", &p->counts[2 * n], &p->counts[2 * n + 1]) == 2;
+    }
+  }
+  fclose(fp);
+  if(!ok) {
+    destroyBranchProfile(p);
+    return 0;
+  }
+  return p;
+}
+
+/**
+ * @param counts Counts of a tree (see getTreeBranchCounts), or 0
+ * @param position Index of a node in the order of packTrees
+ * @return 1 if more instances went right than left at the node, 0 otherwise
+ */
+int getHotterChild(const long* counts, long position) {
+  return counts && counts[2 * position + 1] > counts[2 * position];
+}
+
+#endif
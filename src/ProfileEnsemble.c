@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Struct.h"
+#include "VPred.h"
+#include "Profile.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
+#include "ParseCommandLine.h"
+
+/**
+ * Runs sample instances through an ensemble and writes the branch profile
+ * of its nodes (see Profile.h), which StructPlus and VPred take with
+ * -profile to lay out the hotter subtree of every node first. Use the
+ * following command to run this tool:
+ *
+ * ./ProfileEnsemble -ensemble <ensemble-path> -instances <sample-instances-path> \
+ *                   -maxLeaves <max-number-of-leaves>
+ *                   [-output <profile-path>] [-threads <number-of-threads>]
+ *
+ * The profile is written to <ensemble-path>.profile unless -output is
+ * given. -instancesBinary <binary-instances-path> may replace -instances.
+ * The sample should follow the distribution of the instances that will be
+ * scored, e.g. a log of recent queries.
+ */
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  int numberOfThreads = isPresentCL(argc, args, (char*) "-threads") ?
+    atoi(getValueCL(argc, args, (char*) "-threads")) : 0;
+  char defaultOutput[4096];
+  snprintf(defaultOutput, sizeof(defaultOutput), "%s.profile", configFile);
+  char* outputFile = isPresentCL(argc, args, (char*) "-output") ?
+    getValueCL(argc, args, (char*) "-output") : defaultOutput;
+
+  // Pack the trees in the order that profiles are indexed by
+  int nbTrees;
+  long* offsets;
+  long numberOfNodes;
+  Node* nodes;
+  BinaryEnsemble* binaryEnsemble = 0;
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    binaryEnsemble = loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", configFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    offsets = binaryEnsemble->offsets;
+    numberOfNodes = binaryEnsemble->numberOfNodes;
+    nodes = binaryEnsemble->nodes;
+  } else {
+    Struct** trees;
+    long* depths;
+    Arena* treeArena = createArena(0);
+    nbTrees = readEnsemble(configFile, maxNumberOfLeaves, treeArena, &trees, &depths);
+    if(nbTrees < 0) {
+      fprintf(stderr, "Could not read %s\n", configFile);
+      return -1;
+    }
+    offsets = (long*) malloc(nbTrees * sizeof(long));
+    nodes = packTrees(trees, nbTrees, offsets, &numberOfNodes, 0);
+    destroyArena(treeArena);
+    free(trees);
+    free(depths);
+  }
+
+  // Read the sample
+  int numberOfInstances, numberOfFeatures;
+  float* features;
+  BinaryInstances* binaryInstances = 0;
+  Arena* arena = createArena(0);
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    features = getRowMajorFeatures(binaryInstances, 1, arena);
+  } else {
+    Instances* instances = readInstances(featureFile, 1, numberOfThreads, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = instances->features;
+  }
+
+  BranchProfile* profile = createBranchProfile(offsets, nbTrees, numberOfNodes);
+  addToBranchProfile(profile, nodes, features, numberOfInstances, numberOfFeatures);
+  int status = writeBranchProfile(outputFile, profile);
+  if(status != 0) {
+    fprintf(stderr, "Could not write %s\n", outputFile);
+  } else {
+    // Share of branches that a hotter-first layout turns into fall-through
+    long hotter = 0, total = 0, n;
+    for(n = 0; n < numberOfNodes; n++) {
+      long left = profile->counts[2 * n], right = profile->counts[2 * n + 1];
+      hotter += left > right ? left : right;
+      total += left + right;
+    }
+    printf("Profiled %d instances over %d trees, %ld nodes\n", numberOfInstances, nbTrees,
+           numberOfNodes);
+    printf("Branches to the hotter child: %.1f%%\n", total > 0 ? 100.0 * hotter / total : 0);
+  }
+
+  destroyBranchProfile(profile);
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
+  }
+  destroyArena(arena);
+  if(binaryEnsemble) {
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    free(nodes);
+    free(offsets);
+  }
+  return status;
+}
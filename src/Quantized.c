@@ -0,0 +1,216 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include <math.h>
+#include "Struct.h"
+#include "VPred.h"
+#include "Quantized.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
+#include "ParseCommandLine.h"
+#include "ThreadPool.h"
+
+/**
+ * Driver that evaluates test instances using the quantized VPred
+ * implementation. Use the following command to run this driver:
+ *
+ * ./Quantized -ensemble <ensemble-path> -instances <test-instances-path> \
+ *             -maxLeaves <max-number-of-leaves> [-print]
+ *             [-threads <number-of-threads>]
+ *
+ * Features are converted to bins once, before scoring, and V instances are
+ * evaluated at a time.
+ *
+ * -instancesBinary <binary-instances-path> may replace -instances to
+ * memory-map instances converted by ConvertInstances.
+ *
+ * With -threads, blocks of instances (multiples of V) are scored by a pool
+ * of threads.
+ */
+
+// Arguments of scoreInstances
+typedef struct ScoreContext ScoreContext;
+
+struct ScoreContext {
+  QuantizedEnsemble* ensemble;
+  char* bins; // Padded to a multiple of V instances
+  long rowSize; // Bytes per row of bins
+  float* scores; // Output, one score per instance
+};
+
+/**
+ * Scores instances [begin, end), where begin is a multiple of V
+ * (see ScoreBlock in ThreadPool.h).
+ */
+void scoreInstances(void* context, int begin, int end, int thread) {
+  ScoreContext* c = (ScoreContext*) context;
+  float scores[V];
+  int iIndex, j;
+  for(iIndex = begin; iIndex < end; iIndex += V) {
+    scoreQuantizedBlock(c->ensemble, &c->bins[iIndex * c->rowSize], scores);
+    for(j = 0; j < V && iIndex + j < end; j++) {
+      c->scores[iIndex + j] = scores[j];
+    }
+  }
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  int printScores = isPresentCL(argc, args, (char*) "-print");
+  int numberOfThreads = 0;
+  if(isPresentCL(argc, args, (char*) "-threads")) {
+    numberOfThreads = atoi(getValueCL(argc, args, (char*) "-threads"));
+  }
+
+  // Quantize the VPred arrays of a compiled or text ensemble
+  int nbTrees;
+  QuantizedEnsemble* ensemble;
+
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    BinaryEnsemble* binaryEnsemble =
+      loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", configFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    ensemble = createQuantizedEnsemble(binaryEnsemble->nodes, binaryEnsemble->offsets,
+                                       binaryEnsemble->depths, nbTrees,
+                                       binaryEnsemble->numberOfNodes);
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    Struct** trees;
+    long* treeDepths;
+    Arena* treeArena = createArena(0);
+    nbTrees = readEnsemble(configFile, maxNumberOfLeaves, treeArena, &trees, &treeDepths);
+    if(nbTrees < 0) {
+      fprintf(stderr, "Could not read %s\n", configFile);
+      return -1;
+    }
+    long totalNodes;
+    long* offsets = (long*) malloc(nbTrees * sizeof(long));
+    Node* nodes = packTrees(trees, nbTrees, offsets, &totalNodes, 0);
+    destroyArena(treeArena);
+    free(trees);
+    ensemble = createQuantizedEnsemble(nodes, offsets, treeDepths, nbTrees, totalNodes);
+    free(nodes);
+    free(offsets);
+    free(treeDepths);
+  }
+  if(!ensemble) {
+    fprintf(stderr, "Feature ids, trees or thresholds per feature of %s "
+            "do not fit in 16 bits\n", configFile);
+    return -1;
+  }
+
+  // Read features (see SvmLight.h), padded to a multiple of V instances
+  int numberOfInstances = 0;
+  int numberOfFeatures = 0;
+  float* features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  // The float features are only needed until they are quantized
+  Arena* featureArena = createArena(0);
+  int iIndex = 0;
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    features = getRowMajorFeatures(binaryInstances, V, featureArena);
+  } else {
+    instances = readInstances(featureFile, V, numberOfThreads, featureArena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = instances->features;
+  }
+
+  // Convert features to bins once; the float features are not needed after
+  int divisibleNumberOfInstances = (numberOfInstances + V - 1) / V * V;
+  char* bins = (char*) quantizeInstances(&ensemble->quantizer, features,
+                                         divisibleNumberOfInstances, numberOfFeatures);
+  long rowSize = (long) ensemble->quantizer.numberOfFeatures * ensemble->quantizer.binSize;
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
+  }
+  destroyArena(featureArena);
+
+  // Compute scores for V instances at a time and measure elapsed time
+  float scores[V];
+  int sum = 0; // Dummy value just so gcc wouldn't optimize the loop out
+  int j = 0;
+  struct timeval start, end;
+
+  if(numberOfThreads > 0) {
+    // Score blocks of instances in parallel into a preallocated array
+    ScoreContext context;
+    context.ensemble = ensemble;
+    context.bins = bins;
+    context.rowSize = rowSize;
+    context.scores = (float*) malloc(numberOfInstances * sizeof(float));
+    ThreadStats* stats = (ThreadStats*) malloc(numberOfThreads * sizeof(ThreadStats));
+    int blockSize = getBlockSize(numberOfInstances, (rowSize + sizeof(float) - 1) / sizeof(float),
+                                 numberOfThreads, V);
+
+    gettimeofday(&start, NULL);
+    scoreInParallel(numberOfThreads, numberOfInstances, blockSize,
+                    &scoreInstances, &context, stats);
+    gettimeofday(&end, NULL);
+
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      if(printScores) {
+        printf("%f\n", context.scores[iIndex]);
+      }
+      sum += context.scores[iIndex];
+    }
+    printThreadStats(stats, numberOfThreads, numberOfInstances,
+                     (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    free(stats);
+    free(context.scores);
+  } else {
+    gettimeofday(&start, NULL);
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex += V) {
+      scoreQuantizedBlock(ensemble, &bins[iIndex * rowSize], scores);
+      for(j = 0; j < V; j++) {
+        // Skip the padding at the end of the last block
+        if(iIndex + j < numberOfInstances) {
+          if(printScores) {
+            printf("%f\n", scores[j]);
+          }
+          sum += scores[j];
+        }
+      }
+    }
+    gettimeofday(&end, NULL);
+  }
+
+  printf("Time per instance (ns): %5.2f\n",
+         (((end.tv_sec * 1000000 + end.tv_usec) -
+           (start.tv_sec * 1000000 + start.tv_usec)) * 1000/((float) numberOfInstances)));
+  printf("Ignore this number: %d\n", sum);
+
+  // Free used memory
+  free(bins);
+  destroyQuantizedEnsemble(ensemble);
+  return 0;
+}
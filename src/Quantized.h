@@ -0,0 +1,331 @@
+#ifndef QUANTIZED_H_GUARD
+#define QUANTIZED_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "Node.h"
+#include "VPred.h"
+
+/**
+ * Quantized VPred. Features are mapped to small integer bins once, and
+ * trees compare bins with integer node thresholds.
+ *
+ * The bin boundaries of a feature are the distinct thresholds that the
+ * ensemble uses for that feature, in ascending order. The bin of a value x
+ * is the number of boundaries smaller than x, and the threshold of a node
+ * is the position of its float threshold among the boundaries, so that
+ *
+ *   x <= boundaries[k]  if and only if  bin(x) <= k
+ *
+ * and every tree takes exactly the same path as with floats. (The integer
+ * <Thresholds> of a jforests ensemble index the histogram bins of its
+ * training set, whose boundaries are not part of the model, so they cannot
+ * be used to quantize new instances.) Bins take one byte if no feature has
+ * more than 255 boundaries, and two bytes otherwise.
+ *
+ * Nodes take 8 bytes instead of 16: feature ids, thresholds and children
+ * are 16-bit, and the regression values are kept in a separate array.
+ */
+
+typedef struct Quantizer Quantizer;
+
+struct Quantizer {
+  int numberOfFeatures; // Length of a row of bins (largest fid + 1)
+  int binSize; // Bytes per bin, 1 or 2
+  long* offsets; // Boundaries of feature f are boundaries[offsets[f]..offsets[f + 1])
+  float* boundaries;
+};
+
+typedef struct QuantizedNode QuantizedNode;
+
+struct QuantizedNode {
+  unsigned short fid;
+  unsigned short threshold; // Bin threshold, or for leaves the index of the
+                            // regression value among the tree's leaves
+  unsigned short children[2]; // Indexes within the tree; leaves point to themselves
+};
+
+typedef struct QuantizedEnsemble QuantizedEnsemble;
+
+struct QuantizedEnsemble {
+  int numberOfTrees;
+  long numberOfNodes;
+  QuantizedNode* nodes; // All trees, in the order of the VPred arrays
+  long* offsets; // Index of the root of each tree in nodes
+  long* depths; // Depth of each tree
+  float* leaves; // Regression values
+  long* leafOffsets; // Index of the first regression value of each tree in leaves
+  Quantizer quantizer;
+};
+
+int compareFloats(const void* a, const void* b) {
+  float x = *(const float*) a;
+  float y = *(const float*) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * @return Number of boundaries of feature f that are smaller than x
+ */
+int getBin(const Quantizer* q, int f, float x) {
+  const float* boundaries = &q->boundaries[q->offsets[f]];
+  int low = 0;
+  int high = (int) (q->offsets[f + 1] - q->offsets[f]);
+  while(low < high) {
+    int middle = (low + high) / 2;
+    if(boundaries[middle] < x) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+  return low;
+}
+
+/**
+ * Converts one feature vector to bins. Features that the vector does not
+ * have are treated as zero.
+ *
+ * @param q Quantizer
+ * @param features Feature vector
+ * @param numberOfFeatures Length of the feature vector
+ * @param bins Output, q->numberOfFeatures bins of q->binSize bytes
+ */
+void quantizeInstance(const Quantizer* q, const float* features, int numberOfFeatures,
+                      void* bins) {
+  int f;
+  for(f = 0; f < q->numberOfFeatures; f++) {
+    int bin = getBin(q, f, f < numberOfFeatures ? features[f] : 0);
+    if(q->binSize == 1) {
+      ((unsigned char*) bins)[f] = (unsigned char) bin;
+    } else {
+      ((unsigned short*) bins)[f] = (unsigned short) bin;
+    }
+  }
+}
+
+/**
+ * Converts a row-major feature matrix to a row-major matrix of bins.
+ *
+ * @return Bins, numberOfRows * q->numberOfFeatures * q->binSize bytes
+ */
+void* quantizeInstances(const Quantizer* q, const float* features, long numberOfRows,
+                        int numberOfFeatures) {
+  long rowSize = (long) q->numberOfFeatures * q->binSize;
+  char* bins = (char*) malloc(numberOfRows * rowSize + 1);
+  long i;
+  for(i = 0; i < numberOfRows; i++) {
+    quantizeInstance(q, &features[i * numberOfFeatures], numberOfFeatures, &bins[i * rowSize]);
+  }
+  return bins;
+}
+
+void destroyQuantizedEnsemble(QuantizedEnsemble* e) {
+  free(e->nodes);
+  free(e->offsets);
+  free(e->depths);
+  free(e->leaves);
+  free(e->leafOffsets);
+  free(e->quantizer.offsets);
+  free(e->quantizer.boundaries);
+  free(e);
+}
+
+/**
+ * Creates a quantized ensemble from trees in the VPred layout.
+ *
+ * @param nodes All trees (see packTrees in VPred.h)
+ * @param offsets Index of the root of each tree in nodes
+ * @param depths Depth of each tree
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ * @return Quantized ensemble, or 0 if a feature id, a tree, or the number
+ *         of boundaries of a feature does not fit in 16 bits
+ */
+QuantizedEnsemble* createQuantizedEnsemble(Node* nodes, long* offsets, long* depths,
+                                           int nbTrees, long numberOfNodes) {
+  QuantizedEnsemble* e = (QuantizedEnsemble*) calloc(1, sizeof(QuantizedEnsemble));
+  Quantizer* q = &e->quantizer;
+  e->numberOfTrees = nbTrees;
+  e->numberOfNodes = numberOfNodes;
+  int ok = 1;
+  int tindex;
+  long n;
+
+  // Count the thresholds of every feature
+  int maxFid = 0;
+  for(n = 0; n < numberOfNodes; n++) {
+    if(nodes[n].fid > maxFid) {
+      maxFid = nodes[n].fid;
+    }
+  }
+  q->numberOfFeatures = maxFid + 1;
+  q->offsets = (long*) calloc(q->numberOfFeatures + 1, sizeof(long));
+  long numberOfLeaves = 0;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    for(n = offsets[tindex]; n < end; n++) {
+      if(nodes[n].children[0] == n - offsets[tindex]) {
+        numberOfLeaves++;
+      } else {
+        q->offsets[nodes[n].fid + 1]++;
+      }
+    }
+    ok = ok && end - offsets[tindex] <= 0x10000;
+  }
+  ok = ok && maxFid <= 0xffff;
+  int f;
+  for(f = 0; f < q->numberOfFeatures; f++) {
+    q->offsets[f + 1] += q->offsets[f];
+  }
+
+  // Collect, sort and deduplicate the thresholds of every feature
+  q->boundaries = (float*) malloc((q->offsets[q->numberOfFeatures] + 1) * sizeof(float));
+  long* next = (long*) malloc(q->numberOfFeatures * sizeof(long));
+  memcpy(next, q->offsets, q->numberOfFeatures * sizeof(long));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    for(n = offsets[tindex]; n < end; n++) {
+      if(nodes[n].children[0] != n - offsets[tindex]) {
+        q->boundaries[next[nodes[n].fid]++] = nodes[n].theta;
+      }
+    }
+  }
+  free(next);
+  long size = 0;
+  int maxBoundaries = 0;
+  for(f = 0; f < q->numberOfFeatures; f++) {
+    long begin = q->offsets[f];
+    long end = q->offsets[f + 1];
+    qsort(&q->boundaries[begin], end - begin, sizeof(float), compareFloats);
+    q->offsets[f] = size;
+    for(n = begin; n < end; n++) {
+      if(n == begin || q->boundaries[n] != q->boundaries[n - 1]) {
+        q->boundaries[size++] = q->boundaries[n];
+      }
+    }
+    if(size - q->offsets[f] > maxBoundaries) {
+      maxBoundaries = size - q->offsets[f];
+    }
+  }
+  q->offsets[q->numberOfFeatures] = size;
+  q->binSize = maxBoundaries <= 0xff ? 1 : 2;
+  ok = ok && maxBoundaries <= 0xffff;
+
+  e->nodes = (QuantizedNode*) malloc((numberOfNodes + 1) * sizeof(QuantizedNode));
+  e->offsets = (long*) malloc((nbTrees + 1) * sizeof(long));
+  e->depths = (long*) malloc((nbTrees + 1) * sizeof(long));
+  e->leaves = (float*) malloc((numberOfLeaves + 1) * sizeof(float));
+  e->leafOffsets = (long*) malloc((nbTrees + 1) * sizeof(long));
+  long leaf = 0;
+  for(tindex = 0; tindex < nbTrees && ok; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    e->offsets[tindex] = offsets[tindex];
+    e->depths[tindex] = depths[tindex];
+    e->leafOffsets[tindex] = leaf;
+    for(n = offsets[tindex]; n < end; n++) {
+      QuantizedNode* node = &e->nodes[n];
+      node->children[0] = (unsigned short) nodes[n].children[0];
+      node->children[1] = (unsigned short) nodes[n].children[1];
+      if(nodes[n].children[0] == n - offsets[tindex]) {
+        node->fid = 0;
+        node->threshold = (unsigned short) (leaf - e->leafOffsets[tindex]);
+        e->leaves[leaf++] = nodes[n].theta;
+      } else {
+        // The threshold is a boundary, so its bin is its position
+        node->fid = (unsigned short) nodes[n].fid;
+        node->threshold = (unsigned short) getBin(q, nodes[n].fid, nodes[n].theta);
+      }
+    }
+  }
+
+  if(!ok) {
+    destroyQuantizedEnsemble(e);
+    return 0;
+  }
+  return e;
+}
+
+/**
+ * Generates the traversal functions for one bin type:
+ *
+ * findLeavesQuantized<suffix>: finds the leaves of V instances in a tree,
+ *   advancing all instances one level at a time (see VPred.h)
+ * getQuantizedScore<suffix>: computes the score of one instance
+ * scoreQuantizedBlock<suffix>: computes the scores of V instances
+ */
+#define QUANTIZED_KERNELS(BinType, suffix) \
+void findLeavesQuantized##suffix(long depth, int* leaves, const BinType* bins, \
+                                 int numberOfFeatures, const QuantizedNode* nodes) { \
+  int j; \
+  long d; \
+  for(j = 0; j < V; j++) { \
+    leaves[j] = 0; \
+  } \
+  for(d = 0; d < depth; d++) { \
+    for(j = 0; j < V; j++) { \
+      const QuantizedNode* node = &nodes[leaves[j]]; \
+      leaves[j] = node->children[bins[j * numberOfFeatures + node->fid] > node->threshold]; \
+    } \
+  } \
+} \
+\
+float getQuantizedScore##suffix(const QuantizedEnsemble* e, const BinType* bins) { \
+  float score = 0; \
+  int tindex; \
+  long d; \
+  for(tindex = 0; tindex < e->numberOfTrees; tindex++) { \
+    const QuantizedNode* nodes = &e->nodes[e->offsets[tindex]]; \
+    int idx = 0; \
+    for(d = 0; d < e->depths[tindex]; d++) { \
+      idx = nodes[idx].children[bins[nodes[idx].fid] > nodes[idx].threshold]; \
+    } \
+    score += e->leaves[e->leafOffsets[tindex] + nodes[idx].threshold]; \
+  } \
+  return score; \
+} \
+\
+void scoreQuantizedBlock##suffix(const QuantizedEnsemble* e, const BinType* bins, \
+                                 float* scores) { \
+  int leaf[V]; \
+  int tindex, j; \
+  for(j = 0; j < V; j++) { \
+    scores[j] = 0; \
+  } \
+  for(tindex = 0; tindex < e->numberOfTrees; tindex++) { \
+    const QuantizedNode* nodes = &e->nodes[e->offsets[tindex]]; \
+    const float* leaves = &e->leaves[e->leafOffsets[tindex]]; \
+    findLeavesQuantized##suffix(e->depths[tindex], leaf, bins, \
+                                e->quantizer.numberOfFeatures, nodes); \
+    for(j = 0; j < V; j++) { \
+      scores[j] += leaves[nodes[leaf[j]].threshold]; \
+    } \
+  } \
+}
+
+QUANTIZED_KERNELS(unsigned char, 8)
+QUANTIZED_KERNELS(unsigned short, 16)
+
+/**
+ * Computes the score of one instance from its bins.
+ */
+float getQuantizedScore(const QuantizedEnsemble* e, const void* bins) {
+  if(e->quantizer.binSize == 1) {
+    return getQuantizedScore8(e, (const unsigned char*) bins);
+  }
+  return getQuantizedScore16(e, (const unsigned short*) bins);
+}
+
+/**
+ * Computes the scores of V consecutive instances from their bins.
+ */
+void scoreQuantizedBlock(const QuantizedEnsemble* e, const void* bins, float* scores) {
+  if(e->quantizer.binSize == 1) {
+    scoreQuantizedBlock8(e, (const unsigned char*) bins, scores);
+  } else {
+    scoreQuantizedBlock16(e, (const unsigned short*) bins, scores);
+  }
+}
+
+#endif
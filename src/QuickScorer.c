@@ -0,0 +1,296 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <math.h>
+#include "Struct.h"
+#include "QuickScorer.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
+#include "ParseCommandLine.h"
+#include "ThreadPool.h"
+
+/**
+ * Driver that evaluates test instances using the QuickScorer
+ * implementation. Use the following command to run this driver:
+ *
+ * ./QuickScorer -ensemble <ensemble-path> -instances <test-instances-path> \
+ *               -maxLeaves <max-number-of-leaves> [-print]
+ *               [-threads <number-of-threads>] [-hugePages]
+ *
+ * Trees may have at most 64 leaves.
+ *
+ * -instancesBinary <binary-instances-path> may replace -instances to
+ * memory-map instances converted by ConvertInstances.
+ *
+ * With -threads, instances are scored in blocks by a pool of threads.
+ */
+
+// Arguments of scoreInstances
+typedef struct ScoreContext ScoreContext;
+
+struct ScoreContext {
+  QuickScorer* qs;
+  float** features;
+  unsigned long long** v; // Bitvectors, one array per thread
+  float* scores; // Output, one score per instance
+};
+
+/**
+ * Scores instances [begin, end) (see ScoreBlock in ThreadPool.h).
+ */
+void scoreInstances(void* context, int begin, int end, int thread) {
+  ScoreContext* c = (ScoreContext*) context;
+  int iIndex;
+  for(iIndex = begin; iIndex < end; iIndex++) {
+    c->scores[iIndex] = getScore(c->qs, c->features[iIndex], c->v[thread]);
+  }
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  int printScores = isPresentCL(argc, args, (char*) "-print");
+  int numberOfThreads = 0;
+  if(isPresentCL(argc, args, (char*) "-threads")) {
+    numberOfThreads = atoi(getValueCL(argc, args, (char*) "-threads"));
+  }
+  // Features are allocated in an arena, freed at once
+  Arena* arena = createArena(isPresentCL(argc, args, (char*) "-hugePages"));
+
+  FILE *fp;
+  int nbTrees;
+  // Features read by a compiled or jforests ensemble, not checked for text ones
+  int ensembleFeatures = 0;
+  // Array of pointers to tree roots, one per tree in the ensemble
+  Struct** trees;
+  // The trees are temporary and have their own arena
+  Arena* treeArena = createArena(0);
+  int tindex = 0;
+
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    // Create the trees from a compiled or jforests ensemble, without parsing
+    // the text format
+    BinaryEnsemble* binaryEnsemble =
+      loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", configFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    trees = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      trees[tindex] = createStructFromNodes(
+        treeArena, &binaryEnsemble->nodes[binaryEnsemble->offsets[tindex]], 0);
+    }
+    ensembleFeatures = binaryEnsemble->numberOfFeatures;
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    // Read ensemble
+    fp = fopen(configFile, "r");
+    fscanf(fp, "%d", &nbTrees);
+
+    trees = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    // Number of nodes in a tree does not exceed (maxLeaves * 2)
+    int maxTreeSize = 2 * maxNumberOfLeaves;
+
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      long treeSize;
+      fscanf(fp, "%ld", &treeSize);
+
+      Struct** pointers = (Struct**) malloc(maxTreeSize * sizeof(Struct*));
+      char text[20];
+      long line = 0;
+      for(line = 0; line < maxTreeSize; line++) pointers[line] = 0;
+
+      // There are three types of nodes in the ensemble file:
+      //   root
+      //   node (intermediate node)
+      //   leaf (terminal node)
+      // "end" indicates the end of a tree
+      int curIndex = 0;
+      fscanf(fp, "%s", text);
+      while(strcmp(text, "end") != 0) {
+        long id;
+        fscanf(fp, "%ld", &id);
+
+        // A "root" node contains a feature id and a threshold
+        if(strcmp(text, "root") == 0) {
+          int fid;
+          float threshold;
+          fscanf(fp, "%d %f", &fid, &threshold);
+          trees[tindex] = createNode(treeArena, id, fid, threshold);
+          // Set the root pointer
+          pointers[curIndex++] = trees[tindex];
+        } else if(strcmp(text, "node") == 0) {
+          int fid;
+          long pid;
+          float threshold;
+          int leftChild = 0;
+          // Read Id of the parent node, feature id, subtree (left or right),
+          // and threshold
+          fscanf(fp, "%ld %d %d %f", &pid, &fid, &leftChild, &threshold);
+
+          // Find the parent node, based in parent id
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
+            if(pointers[parentIndex]->id == pid) {
+              break;
+            }
+          }
+          // Add the new node
+          if(pointers[pid]->fid >= 0) {
+            pointers[curIndex++] = addNode(treeArena, pointers[parentIndex], id, leftChild,
+                                           fid, threshold);
+          }
+        } else if(strcmp(text, "leaf") == 0) {
+          long pid;
+          int leftChild = 0;
+          float value;
+          fscanf(fp, "%ld %d %f", &pid, &leftChild, &value);
+
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
+            if(pointers[parentIndex]->id == pid) {
+              break;
+            }
+          }
+          if(pointers[pid]->fid >= 0) {
+            pointers[curIndex++] = addNode(treeArena, pointers[parentIndex], id, leftChild,
+                                           0, value);
+          }
+        }
+        fscanf(fp, "%s", text);
+      }
+      free(pointers);
+    }
+    fclose(fp);
+  }
+
+  // Create the interleaved representation and free the temporary trees
+  QuickScorer* qs = createQuickScorer(trees, nbTrees, maxNumberOfLeaves);
+  destroyArena(treeArena);
+  free(trees);
+  if(!qs) {
+    fprintf(stderr, "QuickScorer supports trees with at most 64 leaves\n");
+    return -1;
+  }
+
+  // Read instances, either mapped from a binary instance file (see
+  // BinaryInstances.h) or parsed from SVM Light format (see SvmLight.h)
+  int numberOfFeatures = 0;
+  int numberOfInstances = 0;
+  float** features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  int i = 0, iIndex = 0;
+
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    float* matrix = getRowMajorFeatures(binaryInstances, 1, arena);
+    features = getFeatureRows(matrix, numberOfInstances, numberOfFeatures, arena);
+  } else {
+    instances = readInstances(featureFile, 1, numberOfThreads, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = getFeatureRows(instances->features, numberOfInstances, numberOfFeatures, arena);
+  }
+
+  // Rows must hold every feature that a compiled or jforests ensemble reads
+  if(numberOfFeatures < ensembleFeatures) {
+    fprintf(stderr, "Instances have %d features, but the ensemble reads %d\n", numberOfFeatures,
+            ensembleFeatures);
+    return -1;
+  }
+
+  // Compute scores for instances using the ensemble and
+  // measure elapsed time
+  int sum = 0; // Dummy value just so gcc wouldn't optimize the loop out
+  float score;
+  unsigned long long* v =
+    (unsigned long long*) malloc(nbTrees * sizeof(unsigned long long));
+  struct timeval start, end;
+
+  if(numberOfThreads > 0) {
+    // Score blocks of instances in parallel into a preallocated array
+    ScoreContext context;
+    context.qs = qs;
+    context.features = features;
+    context.v = (unsigned long long**) malloc(numberOfThreads * sizeof(unsigned long long*));
+    for(i = 0; i < numberOfThreads; i++) {
+      context.v[i] = (unsigned long long*) malloc(nbTrees * sizeof(unsigned long long));
+    }
+    context.scores = (float*) malloc(numberOfInstances * sizeof(float));
+    ThreadStats* stats = (ThreadStats*) malloc(numberOfThreads * sizeof(ThreadStats));
+    int blockSize = getBlockSize(numberOfInstances, numberOfFeatures, numberOfThreads, 1);
+
+    gettimeofday(&start, NULL);
+    scoreInParallel(numberOfThreads, numberOfInstances, blockSize,
+                    &scoreInstances, &context, stats);
+    gettimeofday(&end, NULL);
+
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      if(printScores) {
+        printf("%f\n", context.scores[iIndex]);
+      }
+      sum += context.scores[iIndex];
+    }
+    printThreadStats(stats, numberOfThreads, numberOfInstances,
+                     (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    free(stats);
+    free(context.scores);
+    for(i = 0; i < numberOfThreads; i++) {
+      free(context.v[i]);
+    }
+    free(context.v);
+  } else {
+    gettimeofday(&start, NULL);
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      score = getScore(qs, features[iIndex], v);
+      if(printScores) {
+        printf("%f\n", score);
+      }
+      sum += score;
+    }
+    gettimeofday(&end, NULL);
+  }
+
+  printf("Time per instance (ns): %5.2f\n",
+         (((end.tv_sec * 1000000 + end.tv_usec) -
+           (start.tv_sec * 1000000 + start.tv_usec))*1000/((float) numberOfInstances)));
+  printf("Ignore this number: %d\n", sum);
+  if(arena->hugePages) {
+    printArenaStats(arena);
+  }
+
+  // Free used memory
+  free(v);
+  destroyQuickScorer(qs);
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
+  }
+  destroyArena(arena);
+  return 0;
+}
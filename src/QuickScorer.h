@@ -0,0 +1,232 @@
+#ifndef QUICK_SCORER_H_GUARD
+#define QUICK_SCORER_H_GUARD
+
+#include<stdlib.h>
+#include<string.h>
+#include "Struct.h"
+
+typedef struct QuickScorer QuickScorer;
+
+/**
+ * Interleaved bitvector representation of an ensemble (QuickScorer).
+ *
+ * Every tree with at most 64 leaves is summarized by a 64-bit vector
+ * whose i-th bit represents the i-th leaf from the left. Internal nodes
+ * are grouped by feature id and sorted by threshold. For an internal
+ * node, "bitvectors" holds a mask in which the leaves of its left
+ * subtree are cleared; ANDing the masks of all nodes whose test fails
+ * leaves the exit leaf as the lowest set bit of the tree's vector.
+ */
+struct QuickScorer {
+  int numberOfTrees;
+  int numberOfFeatures; // Largest feature id used by the ensemble + 1
+  int maxLeaves; // Stride of the "leaves" array
+  long* offsets; // Nodes of feature f are in [offsets[f], offsets[f + 1])
+  float* thresholds; // Node thresholds, sorted per feature
+  int* treeIds; // Tree that each node belongs to
+  unsigned long long* bitvectors; // Node masks
+  float* leaves; // Regression values, numberOfTrees * maxLeaves
+};
+
+/**
+ * Assigns leaf indices from left to right and records a mask for every
+ * internal node of the tree.
+ *
+ * @param node Current node
+ * @param tindex Tree id
+ * @param qs QuickScorer structure to fill in
+ * @param nodeFids Feature ids of internal nodes (in visiting order)
+ * @param nodeCount Number of internal nodes recorded so far
+ * @param leafIndex Index of the next leaf
+ * @return Updated leaf index
+ */
+int collectNodes(Struct* node, int tindex, QuickScorer* qs,
+                 int* nodeFids, long* nodeCount, int leafIndex) {
+  if(!node->left && !node->right) {
+    if(leafIndex < qs->maxLeaves) {
+      qs->leaves[tindex * qs->maxLeaves + leafIndex] = node->threshold;
+    }
+    return leafIndex + 1;
+  }
+  long nindex = (*nodeCount)++;
+  int first = leafIndex;
+  leafIndex = collectNodes(node->left, tindex, qs, nodeFids, nodeCount, leafIndex);
+
+  // Clear the bits of all leaves in the left subtree
+  unsigned long long mask = 0;
+  int leaf;
+  for(leaf = first; leaf < leafIndex && leaf < 64; leaf++) {
+    mask |= 1ULL << leaf;
+  }
+  nodeFids[nindex] = node->fid;
+  qs->thresholds[nindex] = node->threshold;
+  qs->treeIds[nindex] = tindex;
+  qs->bitvectors[nindex] = ~mask;
+
+  return collectNodes(node->right, tindex, qs, nodeFids, nodeCount, leafIndex);
+}
+
+/**
+ * Counts the number of internal nodes in the tree
+ *
+ * @param root Root of the tree
+ * @return Number of internal nodes
+ */
+long countInternalNodes(Struct* root) {
+  if(!root->left && !root->right) {
+    return 0;
+  }
+  return 1 + countInternalNodes(root->left) + countInternalNodes(root->right);
+}
+
+// Data used by compareNodes, as qsort does not take a context argument
+float* sortThresholds;
+
+int compareNodes(const void* a, const void* b) {
+  float ta = sortThresholds[*(const long*) a];
+  float tb = sortThresholds[*(const long*) b];
+  return (ta > tb) - (ta < tb);
+}
+
+/**
+ * Builds the interleaved representation of an ensemble.
+ *
+ * @param trees Roots of the trees in the ensemble
+ * @param nbTrees Number of trees
+ * @param maxLeaves Maximum number of leaves in a tree (at most 64)
+ * @return QuickScorer structure, or 0 if a tree has more than 64 leaves
+ */
+QuickScorer* createQuickScorer(Struct** trees, int nbTrees, int maxLeaves) {
+  if(maxLeaves > 64) {
+    return 0;
+  }
+
+  long totalNodes = 0;
+  int tindex;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    totalNodes += countInternalNodes(trees[tindex]);
+  }
+
+  QuickScorer* qs = (QuickScorer*) malloc(sizeof(QuickScorer));
+  qs->numberOfTrees = nbTrees;
+  qs->maxLeaves = maxLeaves;
+  qs->leaves = (float*) calloc(nbTrees * maxLeaves, sizeof(float));
+
+  // Nodes in tree order
+  int* fids = (int*) malloc(totalNodes * sizeof(int));
+  float* thresholds = (float*) malloc(totalNodes * sizeof(float));
+  int* treeIds = (int*) malloc(totalNodes * sizeof(int));
+  unsigned long long* bitvectors =
+    (unsigned long long*) malloc(totalNodes * sizeof(unsigned long long));
+  qs->thresholds = thresholds;
+  qs->treeIds = treeIds;
+  qs->bitvectors = bitvectors;
+
+  long nodeCount = 0;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    if(collectNodes(trees[tindex], tindex, qs, fids, &nodeCount, 0) > maxLeaves) {
+      free(fids);
+      free(thresholds);
+      free(treeIds);
+      free(bitvectors);
+      free(qs->leaves);
+      free(qs);
+      return 0;
+    }
+  }
+
+  int maxFid = -1;
+  long n;
+  for(n = 0; n < totalNodes; n++) {
+    if(fids[n] > maxFid) {
+      maxFid = fids[n];
+    }
+  }
+  qs->numberOfFeatures = maxFid + 1;
+
+  // Group nodes by feature id (counting sort), then sort each group by threshold
+  qs->offsets = (long*) calloc(qs->numberOfFeatures + 1, sizeof(long));
+  for(n = 0; n < totalNodes; n++) {
+    qs->offsets[fids[n] + 1]++;
+  }
+  int f;
+  for(f = 0; f < qs->numberOfFeatures; f++) {
+    qs->offsets[f + 1] += qs->offsets[f];
+  }
+  long* order = (long*) malloc(totalNodes * sizeof(long));
+  long* next = (long*) malloc(qs->numberOfFeatures * sizeof(long));
+  memcpy(next, qs->offsets, qs->numberOfFeatures * sizeof(long));
+  for(n = 0; n < totalNodes; n++) {
+    order[next[fids[n]]++] = n;
+  }
+  sortThresholds = thresholds;
+  for(f = 0; f < qs->numberOfFeatures; f++) {
+    qsort(&order[qs->offsets[f]], qs->offsets[f + 1] - qs->offsets[f],
+          sizeof(long), compareNodes);
+  }
+
+  qs->thresholds = (float*) malloc(totalNodes * sizeof(float));
+  qs->treeIds = (int*) malloc(totalNodes * sizeof(int));
+  qs->bitvectors = (unsigned long long*) malloc(totalNodes * sizeof(unsigned long long));
+  for(n = 0; n < totalNodes; n++) {
+    qs->thresholds[n] = thresholds[order[n]];
+    qs->treeIds[n] = treeIds[order[n]];
+    qs->bitvectors[n] = bitvectors[order[n]];
+  }
+
+  free(next);
+  free(order);
+  free(fids);
+  free(thresholds);
+  free(treeIds);
+  free(bitvectors);
+  return qs;
+}
+
+void destroyQuickScorer(QuickScorer* qs) {
+  free(qs->offsets);
+  free(qs->thresholds);
+  free(qs->treeIds);
+  free(qs->bitvectors);
+  free(qs->leaves);
+  free(qs);
+}
+
+/**
+ * Computes the score of an instance. Features are visited one at a time
+ * and, for each feature, nodes are scanned in increasing order of
+ * threshold until the first node whose test holds.
+ *
+ * @param qs QuickScorer structure
+ * @param featureVector Test instance
+ * @param v Scratch space for numberOfTrees bitvectors
+ * @return Score of the instance
+ */
+float getScore(QuickScorer* qs, float* featureVector, unsigned long long* v) {
+  int tindex;
+  for(tindex = 0; tindex < qs->numberOfTrees; tindex++) {
+    v[tindex] = ~0ULL;
+  }
+
+  int f;
+  for(f = 0; f < qs->numberOfFeatures; f++) {
+    float x = featureVector[f];
+    long n = qs->offsets[f];
+    long end = qs->offsets[f + 1];
+    while(n < end && x > qs->thresholds[n]) {
+      v[qs->treeIds[n]] &= qs->bitvectors[n];
+      n++;
+    }
+  }
+
+  // The exit leaf of each tree is the lowest set bit
+  float score = 0;
+  float* leaves = qs->leaves;
+  for(tindex = 0; tindex < qs->numberOfTrees; tindex++) {
+    score += leaves[__builtin_ctzll(v[tindex])];
+    leaves += qs->maxLeaves;
+  }
+  return score;
+}
+
+#endif
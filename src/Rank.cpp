@@ -0,0 +1,278 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+#include <math.h>
+#include "Struct.h"
+#include "VPred.h"
+#include "Compact.h"
+#include "VPredKernels.h"
+#include "Ranking.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
+#include "ParseCommandLine.h"
+#include "ThreadPool.h"
+
+/**
+ * Driver that ranks the documents of every query and returns the top k,
+ * skipping the remaining trees for documents that can no longer make the
+ * top k (see Ranking.h). Use the following command to run this driver:
+ *
+ * ./Rank -ensemble <ensemble-path> -instances <test-instances-path> \
+ *        -maxLeaves <max-number-of-leaves> [-k <documents-per-query>]
+ *        [-stage <trees-per-stage>] [-print] [-scalar]
+ *        [-threads <number-of-threads>] [-hugePages]
+ *
+ * Instances are grouped by their qid. Trees are evaluated in stages of
+ * -stage trees (100 by default) on the compact layout of Compact.h, and
+ * the top -k documents (10 by default) of each query are kept. A -stage
+ * of at least the number of trees disables early exit.
+ *
+ * With -print, every ranked document is printed as
+ *
+ *   <qid> <rank> <instance> <score>
+ *
+ * where ranks start at 1 and instances are numbered from 0 in input order.
+ *
+ * -instancesBinary <binary-instances-path> may replace -instances to
+ * memory-map instances converted by ConvertInstances.
+ *
+ * With -threads, queries are ranked by a pool of threads.
+ */
+
+// Arguments of rankQueries
+typedef struct RankContext RankContext;
+
+struct RankContext {
+  CompactEnsemble* ensemble;
+  const KernelTable<CompactNode>* kernels;
+  RankingStages* stages;
+  Queries* queries;
+  float* features;
+  int numberOfFeatures;
+  int k;
+  RankingScratch** scratch; // One per thread
+  RankedDocument* ranked; // Output, query q starts at queries->starts[q]
+  int* counts; // Output, number of ranked documents of each query
+  long* evaluations; // Output, tree evaluations of each thread
+};
+
+/**
+ * Ranks queries [begin, end) (see ScoreBlock in ThreadPool.h).
+ */
+void rankQueries(void* context, int begin, int end, int thread) {
+  RankContext* c = (RankContext*) context;
+  Queries* queries = c->queries;
+  int q;
+  for(q = begin; q < end; q++) {
+    int start = queries->starts[q];
+    int size = queries->starts[q + 1] - start;
+    c->evaluations[thread] +=
+      rankQuery(c->ensemble, c->kernels, c->stages, c->features, c->numberOfFeatures,
+                &queries->instances[start], size, c->k, c->scratch[thread],
+                &c->ranked[start]);
+    c->counts[q] = size < c->k ? size : c->k;
+  }
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  int printScores = isPresentCL(argc, args, (char*) "-print");
+  int numberOfThreads = 0;
+  if(isPresentCL(argc, args, (char*) "-threads")) {
+    numberOfThreads = atoi(getValueCL(argc, args, (char*) "-threads"));
+  }
+  int k = 10;
+  if(isPresentCL(argc, args, (char*) "-k")) {
+    k = atoi(getValueCL(argc, args, (char*) "-k"));
+  }
+  int stageSize = 100;
+  if(isPresentCL(argc, args, (char*) "-stage")) {
+    stageSize = atoi(getValueCL(argc, args, (char*) "-stage"));
+  }
+  if(k < 1 || stageSize < 1) {
+    fprintf(stderr,
+            "-k takes a positive number of documents and -stage a positive number of trees\n");
+    return -1;
+  }
+  KernelTable<CompactNode> kernels;
+  initKernelTable<V>(&kernels, selectKernelIsa<V>(isPresentCL(argc, args, (char*) "-scalar")));
+
+  // Convert the VPred arrays of a compiled, jforests or text ensemble to the compact layout
+  int nbTrees;
+  // Features read by a compiled or jforests ensemble, not checked for text ones
+  int ensembleFeatures = 0;
+  CompactEnsemble* ensemble;
+
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    BinaryEnsemble* binaryEnsemble =
+      loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", configFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    ensemble = createCompactEnsemble(binaryEnsemble->nodes, binaryEnsemble->offsets, nbTrees,
+                                     binaryEnsemble->numberOfNodes, COMPACT_BREADTH_FIRST);
+    ensembleFeatures = binaryEnsemble->numberOfFeatures;
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    Struct** trees;
+    long* treeDepths;
+    Arena* treeArena = createArena(0);
+    nbTrees = readEnsemble(configFile, maxNumberOfLeaves, treeArena, &trees, &treeDepths);
+    if(nbTrees < 0) {
+      fprintf(stderr, "Could not read %s\n", configFile);
+      return -1;
+    }
+    long totalNodes;
+    long* offsets = (long*) malloc(nbTrees * sizeof(long));
+    Node* nodes = packTrees(trees, nbTrees, offsets, &totalNodes, 0);
+    destroyArena(treeArena);
+    free(trees);
+    ensemble = createCompactEnsemble(nodes, offsets, nbTrees, totalNodes, COMPACT_BREADTH_FIRST);
+    free(nodes);
+    free(offsets);
+    free(treeDepths);
+  }
+  if(!ensemble) {
+    fprintf(stderr, "Feature ids or tree sizes of %s do not fit in 16 bits\n", configFile);
+    return -1;
+  }
+  RankingStages* stages = createRankingStages(ensemble, stageSize);
+
+  // Read features and query ids (see SvmLight.h)
+  int numberOfInstances = 0;
+  int numberOfFeatures = 0;
+  float* features;
+  int* qids;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  // Features are allocated in an arena, freed at once
+  Arena* arena = createArena(isPresentCL(argc, args, (char*) "-hugePages"));
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    features = getRowMajorFeatures(binaryInstances, 1, arena);
+    qids = binaryInstances->qids;
+  } else {
+    instances = readInstances(featureFile, 1, numberOfThreads, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = instances->features;
+    qids = instances->qids;
+  }
+
+  // Rows must hold every feature that a compiled or jforests ensemble reads
+  if(numberOfFeatures < ensembleFeatures) {
+    fprintf(stderr, "Instances have %d features, but the ensemble reads %d\n", numberOfFeatures,
+            ensembleFeatures);
+    return -1;
+  }
+
+  Queries* queries = groupByQuery(qids, numberOfInstances);
+
+  // Rank every query and measure elapsed time
+  int poolSize = numberOfThreads > 0 ? numberOfThreads : 1;
+  int maxQuerySize = 0;
+  int q, t;
+  for(q = 0; q < queries->numberOfQueries; q++) {
+    if(queries->starts[q + 1] - queries->starts[q] > maxQuerySize) {
+      maxQuerySize = queries->starts[q + 1] - queries->starts[q];
+    }
+  }
+  RankContext context;
+  context.ensemble = ensemble;
+  context.kernels = &kernels;
+  context.stages = stages;
+  context.queries = queries;
+  context.features = features;
+  context.numberOfFeatures = numberOfFeatures;
+  context.k = k;
+  context.scratch = (RankingScratch**) malloc(poolSize * sizeof(RankingScratch*));
+  context.evaluations = (long*) calloc(poolSize, sizeof(long));
+  for(t = 0; t < poolSize; t++) {
+    context.scratch[t] = createRankingScratch(maxQuerySize, numberOfFeatures);
+  }
+  context.ranked = (RankedDocument*) malloc((numberOfInstances + 1) * sizeof(RankedDocument));
+  context.counts = (int*) malloc((queries->numberOfQueries + 1) * sizeof(int));
+  ThreadStats* stats = (ThreadStats*) malloc(poolSize * sizeof(ThreadStats));
+  struct timeval start, end;
+
+  gettimeofday(&start, NULL);
+  if(numberOfThreads > 0) {
+    scoreInParallel(numberOfThreads, queries->numberOfQueries, 1,
+                    &rankQueries, &context, stats);
+  } else {
+    rankQueries(&context, 0, queries->numberOfQueries, 0);
+  }
+  gettimeofday(&end, NULL);
+
+  float sum = 0; // Dummy value just so gcc wouldn't optimize the loop out
+  long evaluations = 0;
+  int r;
+  for(q = 0; q < queries->numberOfQueries; q++) {
+    RankedDocument* ranked = &context.ranked[queries->starts[q]];
+    for(r = 0; r < context.counts[q]; r++) {
+      if(printScores) {
+        printf("%d %d %d %f\n", queries->qids[q], r + 1, ranked[r].instance, ranked[r].score);
+      }
+      sum += ranked[r].score;
+    }
+  }
+  for(t = 0; t < poolSize; t++) {
+    evaluations += context.evaluations[t];
+  }
+  if(numberOfThreads > 0) {
+    printThreadStats(stats, numberOfThreads, numberOfInstances,
+                     (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+  }
+  printf("Queries: %d, trees evaluated per instance: %.1f of %d\n", queries->numberOfQueries,
+         numberOfInstances > 0 ? (double) evaluations / numberOfInstances : 0, nbTrees);
+  printf("Time per instance (ns): %5.2f\n",
+         (((end.tv_sec * 1000000 + end.tv_usec) -
+           (start.tv_sec * 1000000 + start.tv_usec)) * 1000/((float) numberOfInstances)));
+  printf("Ignore this number: %d\n", (int) sum);
+  if(arena->hugePages) {
+    printArenaStats(arena);
+  }
+
+  // Free used memory
+  for(t = 0; t < poolSize; t++) {
+    destroyRankingScratch(context.scratch[t]);
+  }
+  free(context.scratch);
+  free(context.evaluations);
+  free(context.ranked);
+  free(context.counts);
+  free(stats);
+  destroyQueries(queries);
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
+  }
+  destroyArena(arena);
+  destroyRankingStages(stages);
+  destroyCompactEnsemble(ensemble);
+  return 0;
+}
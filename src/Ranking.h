@@ -0,0 +1,284 @@
+#ifndef RANKING_H_GUARD
+#define RANKING_H_GUARD
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include "Compact.h"
+#include "VPredKernels.h"
+
+/**
+ * Per-query top-k ranking with early exit. Instances are grouped by query
+ * id, and the trees of the ensemble are evaluated in stages separated by
+ * sentinel trees. After each stage, every document of a query has a
+ * partial score p, and its final score lies within
+ *
+ *   [p + minRemaining, p + maxRemaining]
+ *
+ * where minRemaining and maxRemaining are the sums of the smallest and
+ * largest leaf values of the trees that are left. A document whose upper
+ * bound is below the k-th largest lower bound can no longer make the top k
+ * and is dropped. The top k documents and their scores are the same as
+ * with exhaustive evaluation: the trees of a document are added in
+ * ensemble order, and the bounds are widened by the worst-case rounding
+ * error of the float sums.
+ */
+
+typedef struct Queries Queries;
+
+struct Queries {
+  int numberOfQueries;
+  int* instances; // Instance indexes, grouped by query in ascending order of qid
+  int* starts; // Query q holds instances[starts[q]..starts[q + 1])
+  int* qids; // Query id of each query
+};
+
+// Qids of the instances being grouped, for compareByQuery
+static const int* groupedQids;
+
+int compareByQuery(const void* a, const void* b) {
+  int x = *(const int*) a;
+  int y = *(const int*) b;
+  if(groupedQids[x] != groupedQids[y]) {
+    return groupedQids[x] < groupedQids[y] ? -1 : 1;
+  }
+  return (x > y) - (x < y);
+}
+
+/**
+ * Groups instances by query id. Within a query, instances keep their
+ * input order.
+ *
+ * @param qids Query id of each instance
+ * @param numberOfInstances Number of instances
+ */
+Queries* groupByQuery(const int* qids, int numberOfInstances) {
+  Queries* queries = (Queries*) malloc(sizeof(Queries));
+  queries->instances = (int*) malloc((numberOfInstances + 1) * sizeof(int));
+  int i;
+  for(i = 0; i < numberOfInstances; i++) {
+    queries->instances[i] = i;
+  }
+  groupedQids = qids;
+  qsort(queries->instances, numberOfInstances, sizeof(int), compareByQuery);
+
+  queries->starts = (int*) malloc((numberOfInstances + 1) * sizeof(int));
+  queries->qids = (int*) malloc((numberOfInstances + 1) * sizeof(int));
+  int q = 0;
+  for(i = 0; i < numberOfInstances; i++) {
+    if(i == 0 || qids[queries->instances[i]] != qids[queries->instances[i - 1]]) {
+      queries->starts[q] = i;
+      queries->qids[q] = qids[queries->instances[i]];
+      q++;
+    }
+  }
+  queries->starts[q] = numberOfInstances;
+  queries->numberOfQueries = q;
+  return queries;
+}
+
+void destroyQueries(Queries* queries) {
+  free(queries->instances);
+  free(queries->starts);
+  free(queries->qids);
+  free(queries);
+}
+
+typedef struct RankingStages RankingStages;
+
+struct RankingStages {
+  int numberOfStages;
+  int* sentinels; // Stage s evaluates trees [sentinels[s], sentinels[s + 1])
+  double* maxRemaining; // Sum of the largest leaf values of trees t.. (nbTrees + 1 entries)
+  double* minRemaining; // Sum of the smallest leaf values of trees t..
+  double slack; // Worst-case rounding error of a float score
+};
+
+/**
+ * Computes the stages and score bounds of an ensemble.
+ *
+ * @param e Compact ensemble
+ * @param stageSize Number of trees per stage
+ */
+RankingStages* createRankingStages(const CompactEnsemble* e, int stageSize) {
+  RankingStages* stages = (RankingStages*) malloc(sizeof(RankingStages));
+  int nbTrees = e->numberOfTrees;
+  if(stageSize < 1) {
+    stageSize = 1;
+  }
+  stages->numberOfStages = nbTrees > 0 ? (nbTrees + stageSize - 1) / stageSize : 0;
+  stages->sentinels = (int*) malloc((stages->numberOfStages + 1) * sizeof(int));
+  int s;
+  for(s = 0; s < stages->numberOfStages; s++) {
+    stages->sentinels[s] = s * stageSize;
+  }
+  stages->sentinels[stages->numberOfStages] = nbTrees;
+
+  stages->maxRemaining = (double*) malloc((nbTrees + 1) * sizeof(double));
+  stages->minRemaining = (double*) malloc((nbTrees + 1) * sizeof(double));
+  stages->maxRemaining[nbTrees] = 0;
+  stages->minRemaining[nbTrees] = 0;
+  double sumOfMagnitudes = 0;
+  int tindex;
+  for(tindex = nbTrees - 1; tindex >= 0; tindex--) {
+    long begin = e->offsets[tindex];
+    long end = tindex + 1 < nbTrees ? e->offsets[tindex + 1] : e->numberOfNodes;
+    float largest = -FLT_MAX;
+    float smallest = FLT_MAX;
+    long n;
+    for(n = begin; n < end; n++) {
+      // Leaves point to themselves; padding nodes point to the root
+      if(e->nodes[n].left == n - begin) {
+        if(e->values[n] > largest) {
+          largest = e->values[n];
+        }
+        if(e->values[n] < smallest) {
+          smallest = e->values[n];
+        }
+      }
+    }
+    stages->maxRemaining[tindex] = stages->maxRemaining[tindex + 1] + largest;
+    stages->minRemaining[tindex] = stages->minRemaining[tindex + 1] + smallest;
+    sumOfMagnitudes += largest > -smallest ? largest : -smallest;
+  }
+  // Each addition rounds by at most half an ulp of the running sum
+  stages->slack = 2.0 * nbTrees * FLT_EPSILON * sumOfMagnitudes;
+  return stages;
+}
+
+void destroyRankingStages(RankingStages* stages) {
+  free(stages->sentinels);
+  free(stages->maxRemaining);
+  free(stages->minRemaining);
+  free(stages);
+}
+
+typedef struct RankedDocument RankedDocument;
+
+struct RankedDocument {
+  int instance;
+  float score;
+};
+
+int compareRankedDocuments(const void* a, const void* b) {
+  const RankedDocument* x = (const RankedDocument*) a;
+  const RankedDocument* y = (const RankedDocument*) b;
+  if(x->score != y->score) {
+    return x->score > y->score ? -1 : 1;
+  }
+  return (x->instance > y->instance) - (x->instance < y->instance);
+}
+
+int compareFloatsDescending(const void* a, const void* b) {
+  float x = *(const float*) a;
+  float y = *(const float*) b;
+  return (x < y) - (x > y);
+}
+
+typedef struct RankingScratch RankingScratch;
+
+// Buffers of one thread, sized for the largest query
+struct RankingScratch {
+  float* block; // V feature vectors
+  float* partial; // Partial score of each document that is left
+  float* sorted;
+  RankedDocument* documents;
+};
+
+RankingScratch* createRankingScratch(int maxQuerySize, int numberOfFeatures) {
+  RankingScratch* scratch = (RankingScratch*) malloc(sizeof(RankingScratch));
+  scratch->block = (float*) malloc((long) V * numberOfFeatures * sizeof(float));
+  scratch->partial = (float*) malloc((maxQuerySize + 1) * sizeof(float));
+  scratch->sorted = (float*) malloc((maxQuerySize + 1) * sizeof(float));
+  scratch->documents = (RankedDocument*) malloc((maxQuerySize + 1) * sizeof(RankedDocument));
+  return scratch;
+}
+
+void destroyRankingScratch(RankingScratch* scratch) {
+  free(scratch->block);
+  free(scratch->partial);
+  free(scratch->sorted);
+  free(scratch->documents);
+  free(scratch);
+}
+
+/**
+ * Ranks the documents of one query.
+ *
+ * @param e Compact ensemble
+ * @param kernels Compact node kernels (see initKernelTable)
+ * @param stages Stages and bounds of the ensemble
+ * @param features Row-major feature matrix
+ * @param numberOfFeatures Length of a feature vector
+ * @param instances Instances of the query
+ * @param numberOfDocuments Number of instances of the query
+ * @param k Number of documents to return
+ * @param scratch Buffers of the calling thread
+ * @param ranked Output, the top min(k, numberOfDocuments) documents by
+ *               descending score (ties by instance index)
+ * @return Number of tree evaluations
+ */
+long rankQuery(const CompactEnsemble* e, const KernelTable<CompactNode>* kernels,
+               const RankingStages* stages, const float* features, int numberOfFeatures,
+               const int* instances, int numberOfDocuments, int k,
+               RankingScratch* scratch, RankedDocument* ranked) {
+  RankedDocument* documents = scratch->documents;
+  float* partial = scratch->partial;
+  int left = numberOfDocuments;
+  long evaluations = 0;
+  int i, j, s;
+  for(i = 0; i < numberOfDocuments; i++) {
+    documents[i].instance = instances[i];
+    partial[i] = 0;
+  }
+
+  for(s = 0; s < stages->numberOfStages && left > 0; s++) {
+    int first = stages->sentinels[s];
+    int last = stages->sentinels[s + 1];
+    // Gather the remaining documents into blocks of V; the last block is
+    // padded with copies of its last document
+    for(i = 0; i < left; i += V) {
+      float scores[V];
+      for(j = 0; j < V; j++) {
+        int d = i + j < left ? i + j : left - 1;
+        memcpy(&scratch->block[(long) j * numberOfFeatures],
+               &features[(long) documents[d].instance * numberOfFeatures],
+               numberOfFeatures * sizeof(float));
+        scores[j] = partial[d];
+      }
+      addTreeScores<V>(kernels, e->nodes, e->values, e->offsets, e->depths, first, last,
+                       scratch->block, numberOfFeatures, scores);
+      for(j = 0; j < V && i + j < left; j++) {
+        partial[i + j] = scores[j];
+      }
+    }
+    evaluations += (long) left * (last - first);
+
+    // Drop the documents that can no longer reach the k-th best
+    if(last < e->numberOfTrees && left > k && k > 0) {
+      memcpy(scratch->sorted, partial, left * sizeof(float));
+      qsort(scratch->sorted, left, sizeof(float), compareFloatsDescending);
+      double threshold = (double) scratch->sorted[k - 1] + stages->minRemaining[last] -
+        stages->slack;
+      int kept = 0;
+      for(i = 0; i < left; i++) {
+        if((double) partial[i] + stages->maxRemaining[last] >= threshold) {
+          documents[kept] = documents[i];
+          partial[kept] = partial[i];
+          kept++;
+        }
+      }
+      left = kept;
+    }
+  }
+
+  for(i = 0; i < left; i++) {
+    documents[i].score = partial[i];
+  }
+  qsort(documents, left, sizeof(RankedDocument), compareRankedDocuments);
+  int count = left < k ? left : k;
+  memcpy(ranked, documents, count * sizeof(RankedDocument));
+  return evaluations;
+}
+
+#endif
@@ -5,7 +5,12 @@
 #include <time.h>
 #include <math.h>
 #include "Struct.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
 #include "ParseCommandLine.h"
+#include "ThreadPool.h"
 
 /**
  * Driver that evaluates test instances using the Struct
@@ -13,125 +18,251 @@
  *
  * ./Struct -ensemble <ensemble-path> -instances <test-instances-path> \
  *          -maxLeaves <max-number-of-leaves> [-print]
+ *          [-threads <number-of-threads>] [-predicated] [-hugePages]
+ *          [-interleave <group-size>]
  *
+ * With -predicated, trees are traversed by getLeafPredicated, which
+ * selects children without branching on the feature values.
+ *
+ * With -interleave, each instance keeps <group-size> traversals of
+ * different trees in flight and prefetches their next nodes, so that their
+ * cache misses overlap (see Interleave.h). Scores are unchanged.
+ *
+ * -instancesBinary <binary-instances-path> may replace -instances to
+ * memory-map instances converted by ConvertInstances.
+ *
+ * With -threads, instances are scored in blocks by a pool of threads.
+ */
+
+// Arguments of scoreInstances
+typedef struct ScoreContext ScoreContext;
+
+struct ScoreContext {
+  Struct** trees;
+  long* depths; // Depth of each tree, if traversed by getLeafPredicated
+  int groupSize; // Traversals in flight, if traversed by getScoreInterleaved
+  int nbTrees;
+  float** features;
+  float* scores; // Output, one score per instance
+};
+
+/**
+ * Computes the score of one instance.
+ *
+ * @param depths Depth of each tree to use getLeafPredicated, or 0 to use getLeaf
+ * @param groupSize Traversals in flight to use getScoreInterleaved, or 0
+ */
+float getEnsembleScore(Struct** trees, long* depths, int groupSize, int nbTrees,
+                       float* featureVector) {
+  float score = 0;
+  int tindex;
+  if(groupSize > 0) {
+    score = getScoreInterleaved(trees, nbTrees, featureVector, groupSize);
+  } else if(depths) {
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      score += getLeafPredicated(trees[tindex], featureVector, depths[tindex])->threshold;
+    }
+  } else {
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      score += getLeaf(trees[tindex], featureVector)->threshold;
+    }
+  }
+  return score;
+}
+
+/**
+ * Scores instances [begin, end) (see ScoreBlock in ThreadPool.h).
  */
+void scoreInstances(void* context, int begin, int end, int thread) {
+  ScoreContext* c = (ScoreContext*) context;
+  int iIndex;
+  for(iIndex = begin; iIndex < end; iIndex++) {
+    c->scores[iIndex] = getEnsembleScore(c->trees, c->depths, c->groupSize, c->nbTrees,
+                                         c->features[iIndex]);
+  }
+}
 
 int main(int argc, char** args) {
   if(!isPresentCL(argc, args, (char*) "-ensemble") ||
-     !isPresentCL(argc, args, (char*) "-instances") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
      !isPresentCL(argc, args, (char*) "-maxLeaves")) {
     return -1;
   }
 
   char* configFile = getValueCL(argc, args, (char*) "-ensemble");
   char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
   int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
   int printScores = isPresentCL(argc, args, (char*) "-print");
+  int numberOfThreads = 0;
+  if(isPresentCL(argc, args, (char*) "-threads")) {
+    numberOfThreads = atoi(getValueCL(argc, args, (char*) "-threads"));
+  }
+  int predicated = isPresentCL(argc, args, (char*) "-predicated");
+  int groupSize = 0;
+  if(isPresentCL(argc, args, (char*) "-interleave")) {
+    groupSize = atoi(getValueCL(argc, args, (char*) "-interleave"));
+    if(groupSize < 1 || predicated) {
+      fprintf(stderr, "-interleave takes a positive group size and excludes -predicated\n");
+      return -1;
+    }
+    groupSize = clampInterleaveGroup(groupSize);
+  }
+  // Trees and features are allocated in one arena, freed at once
+  Arena* arena = createArena(isPresentCL(argc, args, (char*) "-hugePages"));
 
-  // Read ensemble
-  FILE *fp = fopen(configFile, "r");
+  FILE *fp;
   int nbTrees;
-  fscanf(fp, "%d", &nbTrees);
-
+  // Features read by a compiled or jforests ensemble, not checked for text ones
+  int ensembleFeatures = 0;
   // Array of pointers to tree roots, one per tree in the ensemble
-  Struct** trees = (Struct**) malloc(nbTrees * sizeof(Struct*));
+  Struct** trees;
   int tindex = 0;
 
-  // Number of nodes in a tree does not exceed (maxLeaves * 2)
-  int maxTreeSize = 2 * maxNumberOfLeaves;
-
-  for(tindex = 0; tindex < nbTrees; tindex++) {
-    long treeSize;
-    fscanf(fp, "%ld", &treeSize);
-
-    Struct** pointers = (Struct**) malloc(maxTreeSize * sizeof(Struct*));
-    char text[20];
-    long line = 0;
-    for(line = 0; line < maxTreeSize; line++) pointers[line] = 0;
-
-    // There are three types of nodes in the ensemble file:
-    //   root
-    //   node (intermediate node)
-    //   leaf (terminal node)
-    // "end" indicates the end of a tree
-    int curIndex = 0;
-    fscanf(fp, "%s", text);
-    while(strcmp(text, "end") != 0) {
-      long id;
-      fscanf(fp, "%ld", &id);
-
-      // A "root" node contains a feature id and a threshold
-      if(strcmp(text, "root") == 0) {
-        int fid;
-        float threshold;
-        fscanf(fp, "%d %f", &fid, &threshold);
-        trees[tindex] = createNode(id, fid, threshold);
-        // Set the root pointer
-        pointers[curIndex++] = trees[tindex];
-      } else if(strcmp(text, "node") == 0) {
-        int fid;
-        long pid;
-        float threshold;
-        int leftChild = 0;
-        // Read Id of the parent node, feature id, subtree (left or right),
-        // and threshold
-        fscanf(fp, "%ld %d %d %f", &pid, &fid, &leftChild, &threshold);
-
-        // Find the parent node, based in parent id
-        int parentIndex = 0;
-        for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
-          if(pointers[parentIndex]->id == pid) {
-            break;
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    // Create the trees from a compiled or jforests ensemble, without parsing
+    // the text format
+    BinaryEnsemble* binaryEnsemble =
+      loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", configFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    trees = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      trees[tindex] = createStructFromNodes(
+        arena, &binaryEnsemble->nodes[binaryEnsemble->offsets[tindex]], 0);
+    }
+    ensembleFeatures = binaryEnsemble->numberOfFeatures;
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    // Read ensemble
+    fp = fopen(configFile, "r");
+    fscanf(fp, "%d", &nbTrees);
+
+    trees = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    // Number of nodes in a tree does not exceed (maxLeaves * 2)
+    int maxTreeSize = 2 * maxNumberOfLeaves;
+
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      long treeSize;
+      fscanf(fp, "%ld", &treeSize);
+
+      Struct** pointers = (Struct**) malloc(maxTreeSize * sizeof(Struct*));
+      char text[20];
+      long line = 0;
+      for(line = 0; line < maxTreeSize; line++) pointers[line] = 0;
+
+      // There are three types of nodes in the ensemble file:
+      //   root
+      //   node (intermediate node)
+      //   leaf (terminal node)
+      // "end" indicates the end of a tree
+      int curIndex = 0;
+      fscanf(fp, "%s", text);
+      while(strcmp(text, "end") != 0) {
+        long id;
+        fscanf(fp, "%ld", &id);
+
+        // A "root" node contains a feature id and a threshold
+        if(strcmp(text, "root") == 0) {
+          int fid;
+          float threshold;
+          fscanf(fp, "%d %f", &fid, &threshold);
+          trees[tindex] = createNode(arena, id, fid, threshold);
+          // Set the root pointer
+          pointers[curIndex++] = trees[tindex];
+        } else if(strcmp(text, "node") == 0) {
+          int fid;
+          long pid;
+          float threshold;
+          int leftChild = 0;
+          // Read Id of the parent node, feature id, subtree (left or right),
+          // and threshold
+          fscanf(fp, "%ld %d %d %f", &pid, &fid, &leftChild, &threshold);
+
+          // Find the parent node, based in parent id
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
+            if(pointers[parentIndex]->id == pid) {
+              break;
+            }
           }
-        }
-        // Add the new node
-        if(pointers[pid]->fid >= 0) {
-          pointers[curIndex++] = addNode(pointers[parentIndex], id, leftChild, fid, threshold);
-        }
-      } else if(strcmp(text, "leaf") == 0) {
-        long pid;
-        int leftChild = 0;
-        float value;
-        fscanf(fp, "%ld %d %f", &pid, &leftChild, &value);
-
-        int parentIndex = 0;
-        for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
-          if(pointers[parentIndex]->id == pid) {
-            break;
+          // Add the new node
+          if(pointers[pid]->fid >= 0) {
+            pointers[curIndex++] = addNode(arena, pointers[parentIndex], id, leftChild,
+                                           fid, threshold);
+          }
+        } else if(strcmp(text, "leaf") == 0) {
+          long pid;
+          int leftChild = 0;
+          float value;
+          fscanf(fp, "%ld %d %f", &pid, &leftChild, &value);
+
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
+            if(pointers[parentIndex]->id == pid) {
+              break;
+            }
+          }
+          if(pointers[pid]->fid >= 0) {
+            pointers[curIndex++] = addNode(arena, pointers[parentIndex], id, leftChild,
+                                           0, value);
           }
         }
-        if(pointers[pid]->fid >= 0) {
-          pointers[curIndex++] = addNode(pointers[parentIndex], id, leftChild, 0, value);
-        }
+        fscanf(fp, "%s", text);
       }
-      fscanf(fp, "%s", text);
+      free(pointers);
     }
-    free(pointers);
+    fclose(fp);
   }
-  fclose(fp);
 
-  // Read instances (SVM Light format)
+  // Depths bound the steps of getLeafPredicated
+  long* depths = 0;
+  if(predicated) {
+    depths = (long*) malloc(nbTrees * sizeof(long));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      depths[tindex] = getDepth(trees[tindex]);
+    }
+  }
+
+  // Read instances, either mapped from a binary instance file (see
+  // BinaryInstances.h) or parsed from SVM Light format (see SvmLight.h)
   int numberOfFeatures = 0;
   int numberOfInstances = 0;
+  float** features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  int iIndex = 0;
 
-  fp = fopen(featureFile, "r");
-  fscanf(fp, "%d %d", &numberOfInstances, &numberOfFeatures);
-  float** features = (float**) malloc(numberOfInstances * sizeof(float*));
-  int i = 0;
-  for(i = 0; i < numberOfInstances; i++) {
-    features[i] = (float*) malloc(numberOfFeatures * sizeof(float));
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    float* matrix = getRowMajorFeatures(binaryInstances, 1, arena);
+    features = getFeatureRows(matrix, numberOfInstances, numberOfFeatures, arena);
+  } else {
+    instances = readInstances(featureFile, 1, numberOfThreads, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = getFeatureRows(instances->features, numberOfInstances, numberOfFeatures, arena);
   }
 
-  float fvalue;
-  int fIndex = 0, iIndex = 0;
-  int ignore;
-  char text[20];
-  for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
-    fscanf(fp, "%d %[^:]:%d", &ignore, text, &ignore);
-    for(fIndex = 0; fIndex < numberOfFeatures; fIndex++) {
-      fscanf(fp, "%[^:]:%f", text, &fvalue);
-      features[iIndex][fIndex] = fvalue;
-    }
+  // Rows must hold every feature that a compiled or jforests ensemble reads
+  if(numberOfFeatures < ensembleFeatures) {
+    fprintf(stderr, "Instances have %d features, but the ensemble reads %d\n", numberOfFeatures,
+            ensembleFeatures);
+    return -1;
   }
 
   // Compute scores for instances using the ensemble and
@@ -140,33 +271,62 @@ int main(int argc, char** args) {
   float score;
   struct timeval start, end;
 
-  gettimeofday(&start, NULL);
-  for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
-    score = 0;
-    for(tindex = 0; tindex < nbTrees; tindex++) {
-      score += getLeaf(trees[tindex], features[iIndex])->threshold;
+  if(numberOfThreads > 0) {
+    // Score blocks of instances in parallel into a preallocated array
+    ScoreContext context;
+    context.trees = trees;
+    context.depths = depths;
+    context.groupSize = groupSize;
+    context.nbTrees = nbTrees;
+    context.features = features;
+    context.scores = (float*) malloc(numberOfInstances * sizeof(float));
+    ThreadStats* stats = (ThreadStats*) malloc(numberOfThreads * sizeof(ThreadStats));
+    int blockSize = getBlockSize(numberOfInstances, numberOfFeatures, numberOfThreads, 1);
+
+    gettimeofday(&start, NULL);
+    scoreInParallel(numberOfThreads, numberOfInstances, blockSize,
+                    &scoreInstances, &context, stats);
+    gettimeofday(&end, NULL);
+
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      if(printScores) {
+        printf("%f\n", context.scores[iIndex]);
+      }
+      sum += context.scores[iIndex];
     }
-    if(printScores) {
-      printf("%f\n", score);
+    printThreadStats(stats, numberOfThreads, numberOfInstances,
+                     (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    free(stats);
+    free(context.scores);
+  } else {
+    gettimeofday(&start, NULL);
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      score = getEnsembleScore(trees, depths, groupSize, nbTrees, features[iIndex]);
+      if(printScores) {
+        printf("%f\n", score);
+      }
+      sum += score;
     }
-    sum += score;
+    gettimeofday(&end, NULL);
   }
-  gettimeofday(&end, NULL);
 
   printf("Time per instance (ns): %5.2f\n",
          (((end.tv_sec * 1000000 + end.tv_usec) -
            (start.tv_sec * 1000000 + start.tv_usec))*1000/((float) numberOfInstances)));
   printf("Ignore this number: %d\n", sum);
+  if(groupSize > 0) {
+    printf("Interleaved traversals per instance: %d\n", groupSize);
+  }
+  if(arena->hugePages) {
+    printArenaStats(arena);
+  }
 
   // Free used memory
-  for(tindex = 0; tindex < nbTrees; tindex++) {
-    destroyTree(trees[tindex]);
-  }
   free(trees);
-  for(i = 0; i < numberOfInstances; i++) {
-    free(features[i]);
+  free(depths);
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
   }
-  free(features);
-  fclose(fp);
+  destroyArena(arena);
   return 0;
 }
@@ -1,13 +1,20 @@
 #ifndef STRUCT_H_GUARD
 #define STRUCT_H_GUARD
 
+#include<stdio.h>
 #include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include "Node.h"
+#include "Arena.h"
+#include "Interleave.h"
 
 typedef struct Struct Struct;
 
 /**
  * Similar to the Object implementation, but in C
- * and using structs.
+ * and using structs. Nodes are allocated in an arena (see Arena.h) and
+ * freed with it.
  */
 struct Struct {
   Struct* right; // Right node
@@ -20,12 +27,13 @@ struct Struct {
 /**
  * Creates a new node
  *
+ * @param arena Arena that holds the node
  * @param id Node id
  * @param fid Feature id that the node conditions on
  * @param threshold Threshold/Regression value
  */
-Struct* createNode(unsigned long id, int fid, float threshold) {
-  Struct* node = (Struct*) malloc(sizeof(Struct));
+Struct* createNode(Arena* arena, unsigned long id, int fid, float threshold) {
+  Struct* node = (Struct*) allocateInArena(arena, sizeof(Struct));
   node->id = id;
   node->fid = fid;
   node->threshold = threshold;
@@ -35,23 +43,10 @@ Struct* createNode(unsigned long id, int fid, float threshold) {
   return node;
 }
 
-// Destructor
-void destroyTree(Struct* node) {
-  if(node->right != 0) {
-    destroyTree(node->right);
-    free(node->right);
-    node->right = 0;
-  }
-  if(node->left != 0) {
-    destroyTree(node->left);
-    free(node->left);
-    node->left = 0;
-  }
-}
-
 /**
  * Inserts a new node to the left or right of "node"
  *
+ * @param arena Arena that holds the node
  * @param node Parent node
  * @param id Node id
  * @param leftChild Whether to insert the current node to the left of parent node or not
@@ -59,12 +54,13 @@ void destroyTree(Struct* node) {
  * @param threshold Threshold/Regression value
  * @return A new node
  */
-Struct* addNode(Struct* node, unsigned long id, int leftChild, int featureId, float threshold) {
+Struct* addNode(Arena* arena, Struct* node, unsigned long id, int leftChild, int featureId,
+                float threshold) {
   if(leftChild) {
-    node->left = createNode(id, featureId, threshold);
+    node->left = createNode(arena, id, featureId, threshold);
     return node->left;
   } else {
-    node->right = createNode(id, featureId, threshold);
+    node->right = createNode(arena, id, featureId, threshold);
     return node->right;
   }
 }
@@ -88,4 +84,226 @@ Struct* getLeaf(Struct* pThis, float* featureVector) {
   }
 }
 
+/**
+ * Iterative variant of getLeaf without data-dependent branches, for trees
+ * whose comparisons are hard to predict. Each step picks the child with a
+ * mask computed from the comparison instead of a branch, and a leaf, which
+ * has no children, selects itself, so the loop always runs "depth" steps.
+ *
+ * @param root Root of the tree
+ * @param featureVector Feature vector
+ * @param depth Depth of the tree (see getDepth)
+ * @return Pointer to a terminal node
+ */
+Struct* getLeafPredicated(Struct* root, float* featureVector, long depth) {
+  uintptr_t node = (uintptr_t) root;
+  long d;
+  for(d = 0; d < depth; d++) {
+    Struct* p = (Struct*) node;
+    // All ones if the instance goes right; NaN goes right, as in getLeaf
+    uintptr_t right = -(uintptr_t) !(featureVector[p->fid] <= p->threshold);
+    uintptr_t child = ((uintptr_t) p->left & ~right) | ((uintptr_t) p->right & right);
+    uintptr_t leaf = -(uintptr_t) (child == 0);
+    node = (child & ~leaf) | (node & leaf);
+  }
+  return (Struct*) node;
+}
+
+/**
+ * Computes the score of one instance with interleaved traversals of the
+ * trees (see Interleave.h).
+ *
+ * @param trees Roots of the trees
+ * @param nbTrees Number of trees
+ * @param featureVector Feature vector
+ * @param groupSize Number of traversals in flight (see clampInterleaveGroup)
+ * @return Sum of the leaves, added in tree order
+ */
+float getScoreInterleaved(Struct** trees, int nbTrees, float* featureVector, int groupSize) {
+  Struct* nodes[INTERLEAVE_MAX_GROUP];
+  int treeOf[INTERLEAVE_MAX_GROUP];
+  float values[INTERLEAVE_WINDOW];
+  char finished[INTERLEAVE_WINDOW];
+  float score = 0;
+  int started = 0, added = 0, g;
+  groupSize = clampInterleaveGroup(groupSize);
+  memset(finished, 0, sizeof(finished));
+  for(g = 0; g < groupSize; g++) {
+    nodes[g] = 0;
+  }
+
+  while(added < nbTrees) {
+    for(g = 0; g < groupSize; g++) {
+      Struct* node = nodes[g];
+      if(node) {
+        if(!node->left && !node->right) {
+          values[treeOf[g] % INTERLEAVE_WINDOW] = node->threshold;
+          finished[treeOf[g] % INTERLEAVE_WINDOW] = 1;
+          node = 0;
+        } else if(featureVector[node->fid] <= node->threshold) {
+          node = node->left;
+        } else {
+          node = node->right;
+        }
+      }
+      if(!node && started < nbTrees && started < added + INTERLEAVE_WINDOW) {
+        node = trees[started];
+        treeOf[g] = started++;
+      }
+      if(node) {
+        __builtin_prefetch(node);
+      }
+      nodes[g] = node;
+    }
+    while(added < started && finished[added % INTERLEAVE_WINDOW]) {
+      finished[added % INTERLEAVE_WINDOW] = 0;
+      score += values[added % INTERLEAVE_WINDOW];
+      added++;
+    }
+  }
+  return score;
+}
+
+/**
+ * @return Number of edges on the longest path from root to a leaf
+ */
+long getDepth(Struct* root) {
+  if(!root->left && !root->right) {
+    return 0;
+  }
+  long left = getDepth(root->left);
+  long right = getDepth(root->right);
+  return 1 + (left > right ? left : right);
+}
+
+/**
+ * Reads an ensemble in the OptTrees text format. Unlike the drivers, node
+ * ids are used to index the parent nodes directly, and the input is
+ * validated.
+ *
+ * @param path Path to the ensemble file
+ * @param maxLeaves Maximum number of leaves in a tree
+ * @param arena Arena that holds the nodes
+ * @param trees Output, array of tree roots
+ * @param depths Output, array of tree depths
+ * @return Number of trees, or -1 on error
+ */
+int readEnsemble(const char* path, int maxLeaves, Arena* arena, Struct*** trees,
+                 long** depths) {
+  FILE *fp = fopen(path, "r");
+  if(!fp) {
+    return -1;
+  }
+  int nbTrees;
+  if(fscanf(fp, "%d", &nbTrees) != 1 || nbTrees < 0) {
+    fclose(fp);
+    return -1;
+  }
+
+  *trees = (Struct**) calloc(nbTrees, sizeof(Struct*));
+  *depths = (long*) malloc(nbTrees * sizeof(long));
+
+  // Number of nodes in a tree does not exceed (maxLeaves * 2). Node ids
+  // are assigned sequentially, so they index the pointers array directly.
+  int maxTreeSize = 2 * maxLeaves;
+  Struct** pointers = (Struct**) malloc(maxTreeSize * sizeof(Struct*));
+  int tindex;
+  int ok = 1;
+
+  for(tindex = 0; tindex < nbTrees && ok; tindex++) {
+    if(fscanf(fp, "%ld", &(*depths)[tindex]) != 1) {
+      ok = 0;
+      break;
+    }
+    memset(pointers, 0, maxTreeSize * sizeof(Struct*));
+
+    char text[20];
+    if(fscanf(fp, "%19s", text) != 1) {
+      ok = 0;
+      break;
+    }
+    while(strcmp(text, "end") != 0) {
+      long id;
+      long pid = 0;
+      int fid = 0;
+      int leftChild = 0;
+      float threshold;
+
+      if(fscanf(fp, "%ld", &id) != 1 || id < 0 || id >= maxTreeSize) {
+        ok = 0;
+        break;
+      }
+      if(strcmp(text, "root") == 0) {
+        if(fscanf(fp, "%d %f", &fid, &threshold) != 2) {
+          ok = 0;
+          break;
+        }
+        (*trees)[tindex] = createNode(arena, id, fid, threshold);
+        pointers[id] = (*trees)[tindex];
+      } else {
+        if(strcmp(text, "node") == 0) {
+          ok = fscanf(fp, "%ld %d %d %f", &pid, &fid, &leftChild, &threshold) == 4;
+        } else if(strcmp(text, "leaf") == 0) {
+          ok = fscanf(fp, "%ld %d %f", &pid, &leftChild, &threshold) == 3;
+        } else {
+          ok = 0;
+        }
+        if(!ok || pid < 0 || pid >= maxTreeSize || !pointers[pid]) {
+          ok = 0;
+          break;
+        }
+        pointers[id] = addNode(arena, pointers[pid], id, leftChild, fid, threshold);
+      }
+      if(fscanf(fp, "%19s", text) != 1) {
+        ok = 0;
+        break;
+      }
+    }
+    if(!(*trees)[tindex]) {
+      ok = 0;
+    }
+  }
+  free(pointers);
+  fclose(fp);
+
+  if(!ok) {
+    // Nodes that were read stay in the arena until it is destroyed
+    free(*trees);
+    free(*depths);
+    return -1;
+  }
+  return nbTrees;
+}
+
+/**
+ * Counts the number of nodes in the tree
+ *
+ * @param root Root of the tree
+ * @return Number of nodes in the tree
+ */
+long countNodes(Struct* root) {
+  if(!root->left && !root->right) {
+    return 1;
+  }
+  return 1 + countNodes(root->left) + countNodes(root->right);
+}
+
+/**
+ * Creates a tree from a tree in the VPred layout (see Node.h).
+ *
+ * @param arena Arena that holds the nodes
+ * @param nodes Tree structure
+ * @param index Index of the current node
+ * @return New node
+ */
+Struct* createStructFromNodes(Arena* arena, Node* nodes, int index) {
+  Struct* node = createNode(arena, index, nodes[index].fid, nodes[index].theta);
+  // Leaves point to themselves
+  if(nodes[index].children[0] != index) {
+    node->left = createStructFromNodes(arena, nodes, nodes[index].children[0]);
+    node->right = createStructFromNodes(arena, nodes, nodes[index].children[1]);
+  }
+  return node;
+}
+
 #endif
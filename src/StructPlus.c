@@ -5,7 +5,15 @@
 #include <time.h>
 #include <math.h>
 #include "StructPlus.h"
+#include "Compact.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
 #include "ParseCommandLine.h"
+#include "ThreadPool.h"
+#include "Profile.h"
+#include "TreeStats.h"
 
 /**
  * Driver that evaluates test instances using the StructPlus
@@ -13,118 +21,381 @@
  *
  * ./StructPlus -ensemble <ensemble-path> -instances <test-instances-path> \
  *              -maxLeaves <max-number-of-leaves> [-print]
+ *              [-threads <number-of-threads>] [-compact bfs|veb] [-predicated]
+ *              [-hugePages] [-interleave <group-size>] [-profile <profile-path>]
+ *              [-stats <dump-path>]
  *
+ * With -predicated, trees are traversed by getLeafPredicated, which
+ * selects children without branching on the feature values.
+ *
+ * With -interleave, each instance keeps <group-size> traversals of
+ * different trees in flight and prefetches their next nodes, so that their
+ * cache misses overlap (see Interleave.h). Scores are unchanged.
+ *
+ * With -profile, every tree is laid out with the child that more sample
+ * instances took right after its parent, using a profile written by
+ * ProfileEnsemble (see Profile.h). The hottest paths then run through
+ * consecutive nodes. Scores are unchanged.
+ *
+ * With -stats, leaf hits and the time spent in every chunk of trees are
+ * recorded while scoring, and dumped as JSON (see TreeStats.h). -stats is
+ * only available when built with make STATS=1, and excludes -predicated,
+ * -interleave and -compact.
+ *
+ * With -compact, trees are converted to the 8-byte nodes of Compact.h,
+ * stored breadth-first (bfs) or in van Emde Boas order (veb).
+ *
+ * -instancesBinary <binary-instances-path> may replace -instances to
+ * memory-map instances converted by ConvertInstances.
+ *
+ * With -threads, instances are scored in blocks by a pool of threads.
+ */
+
+// Arguments of scoreInstances
+typedef struct ScoreContext ScoreContext;
+
+struct ScoreContext {
+  StructPlus** trees;
+  long* depths; // Depth of each tree, if traversed by getLeafPredicated
+  int groupSize; // Traversals in flight, if traversed by getScoreInterleaved
+  int nbTrees;
+  CompactEnsemble* compact; // Used instead of trees if set
+  float** features;
+  float* scores; // Output, one score per instance
+#ifdef TREE_STATS
+  TreeStats* stats; // Recorded while scoring if set
+  long* offsets; // Index of the root of each tree, counting nodes of all trees
+#endif
+};
+
+/**
+ * Computes the score of one instance.
+ *
+ * @param depths Depth of each tree to use getLeafPredicated, or 0 to use getLeaf
+ * @param groupSize Traversals in flight to use getScoreInterleaved, or 0
+ */
+float getEnsembleScore(StructPlus** trees, long* depths, int groupSize, int nbTrees,
+                       float* featureVector) {
+  float score = 0;
+  int tindex;
+  if(groupSize > 0) {
+    score = getScoreInterleaved(trees, nbTrees, featureVector, groupSize);
+  } else if(depths) {
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      score += getLeafPredicated(trees[tindex], featureVector, depths[tindex])->threshold;
+    }
+  } else {
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      score += getLeaf(trees[tindex], featureVector)->threshold;
+    }
+  }
+  return score;
+}
+
+#ifdef TREE_STATS
+/**
+ * Computes the score of one instance as getEnsembleScore with getLeaf,
+ * timing every chunk of trees and counting the leaves reached (see
+ * TreeStats.h).
+ *
+ * @param offsets Index of the root of each tree, counting nodes of all trees
+ */
+float getRecordedScore(StructPlus** trees, int nbTrees, const long* offsets, TreeStats* stats,
+                       float* featureVector) {
+  StructPlus* leaves[TREE_STATS_CHUNK];
+  float score = 0;
+  int chunk, tindex;
+  for(chunk = 0; chunk < nbTrees; chunk = getChunkEnd(chunk, nbTrees)) {
+    int last = getChunkEnd(chunk, nbTrees);
+    long start = getStatsTime();
+    for(tindex = chunk; tindex < last; tindex++) {
+      leaves[tindex - chunk] = getLeaf(trees[tindex], featureVector);
+      score += leaves[tindex - chunk]->threshold;
+    }
+    recordChunkTime(stats, chunk, getStatsTime() - start);
+    for(tindex = chunk; tindex < last; tindex++) {
+      recordLeaf(stats, offsets[tindex] + (leaves[tindex - chunk] - trees[tindex]));
+    }
+  }
+  return score;
+}
+#endif
+
+/**
+ * Scores instances [begin, end) (see ScoreBlock in ThreadPool.h).
  */
+void scoreInstances(void* context, int begin, int end, int thread) {
+  ScoreContext* c = (ScoreContext*) context;
+  int iIndex;
+  for(iIndex = begin; iIndex < end; iIndex++) {
+    if(c->compact) {
+      c->scores[iIndex] = getCompactScore(c->compact, c->features[iIndex]);
+      continue;
+    }
+#ifdef TREE_STATS
+    if(c->stats) {
+      c->scores[iIndex] = getRecordedScore(c->trees, c->nbTrees, c->offsets, c->stats,
+                                           c->features[iIndex]);
+      continue;
+    }
+#endif
+    c->scores[iIndex] = getEnsembleScore(c->trees, c->depths, c->groupSize, c->nbTrees,
+                                         c->features[iIndex]);
+  }
+}
 
 int main(int argc, char** args) {
   if(!isPresentCL(argc, args, (char*) "-ensemble") ||
-     !isPresentCL(argc, args, (char*) "-instances") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
      !isPresentCL(argc, args, (char*) "-maxLeaves")) {
     return -1;
   }
 
   char* configFile = getValueCL(argc, args, (char*) "-ensemble");
   char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
   int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
   int printScores = isPresentCL(argc, args, (char*) "-print");
+  int numberOfThreads = 0;
+  if(isPresentCL(argc, args, (char*) "-threads")) {
+    numberOfThreads = atoi(getValueCL(argc, args, (char*) "-threads"));
+  }
+  int predicated = isPresentCL(argc, args, (char*) "-predicated");
+  // Trees and features are allocated in one arena, freed at once
+  Arena* arena = createArena(isPresentCL(argc, args, (char*) "-hugePages"));
+  int compactOrder = -1;
+  if(isPresentCL(argc, args, (char*) "-compact")) {
+    compactOrder = parseCompactOrder(getValueCL(argc, args, (char*) "-compact"));
+    if(compactOrder < 0) {
+      fprintf(stderr, "Unknown node order, expected bfs or veb\n");
+      return -1;
+    }
+  }
+  int groupSize = 0;
+  if(isPresentCL(argc, args, (char*) "-interleave")) {
+    groupSize = atoi(getValueCL(argc, args, (char*) "-interleave"));
+    if(groupSize < 1 || predicated || compactOrder >= 0) {
+      fprintf(stderr, "-interleave takes a positive group size and excludes -predicated "
+              "and -compact\n");
+      return -1;
+    }
+    groupSize = clampInterleaveGroup(groupSize);
+  }
+  char* statsFile = getValueCL(argc, args, (char*) "-stats");
+#ifndef TREE_STATS
+  if(statsFile) {
+    fprintf(stderr, "-stats needs a build with make STATS=1\n");
+    return -1;
+  }
+#endif
+  if(statsFile && (predicated || groupSize > 0 || compactOrder >= 0)) {
+    fprintf(stderr, "-stats excludes -predicated, -interleave and -compact\n");
+    return -1;
+  }
+  BranchProfile* profile = 0;
+  if(isPresentCL(argc, args, (char*) "-profile")) {
+    profile = readBranchProfile(getValueCL(argc, args, (char*) "-profile"));
+    if(!profile) {
+      fprintf(stderr, "Could not read %s\n", getValueCL(argc, args, (char*) "-profile"));
+      return -1;
+    }
+  }
 
-  // Read ensemble
-  FILE *fp = fopen(configFile, "r");
+  FILE *fp;
   int nbTrees;
-  fscanf(fp, "%d", &nbTrees);
-
+  // Features read by a compiled or jforests ensemble, not checked for text ones
+  int ensembleFeatures = 0;
   // Array of pointers to tree roots, one per tree in the ensemble
-  StructPlus** trees = (StructPlus**) malloc(nbTrees * sizeof(StructPlus*));
+  StructPlus** trees;
   int tindex = 0;
 
-  // Number of nodes in a tree does not exceed (maxLeaves * 2)
-  int maxTreeSize = 2 * maxNumberOfLeaves;
-  long treeSize;
-
-  for(tindex = 0; tindex < nbTrees; tindex++) {
-    fscanf(fp, "%ld", &treeSize);
-
-    trees[tindex] = createNodes(maxTreeSize);
-
-    char text[20];
-    long line = 0;
-    fscanf(fp, "%s", text);
-    while(strcmp(text, "end") != 0) {
-      long id;
-      fscanf(fp, "%ld", &id);
-
-      // A "root" node contains a feature id and a threshold
-      if(strcmp(text, "root") == 0) {
-        int fid;
-        float threshold;
-        fscanf(fp, "%d %f", &fid, &threshold);
-        setRoot(trees[tindex], id, fid, threshold);
-      } else if(strcmp(text, "node") == 0) {
-        int fid;
-        long pid;
-        float threshold;
-        int leftChild = 0;
-        // Read Id of the parent node, feature id, subtree (left or right),
-        // and threshold
-        fscanf(fp, "%ld %d %d %f", &pid, &fid, &leftChild, &threshold);
-
-        // Find the parent node, based in parent id
-        int parentIndex = 0;
-        for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
-          if(trees[tindex][parentIndex].id == pid) {
-            break;
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    // Create the trees from a compiled or jforests ensemble, without parsing
+    // the text format. Both layouts store nodes in the same order.
+    BinaryEnsemble* binaryEnsemble =
+      loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", configFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    trees = (StructPlus**) malloc(nbTrees * sizeof(StructPlus*));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      long begin = binaryEnsemble->offsets[tindex];
+      long end = tindex + 1 < nbTrees ?
+        binaryEnsemble->offsets[tindex + 1] : binaryEnsemble->numberOfNodes;
+      trees[tindex] = createStructPlusFromNodes(arena, &binaryEnsemble->nodes[begin],
+                                                end - begin);
+    }
+    ensembleFeatures = binaryEnsemble->numberOfFeatures;
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    // Read ensemble
+    fp = fopen(configFile, "r");
+    fscanf(fp, "%d", &nbTrees);
+
+    trees = (StructPlus**) malloc(nbTrees * sizeof(StructPlus*));
+    // Number of nodes in a tree does not exceed (maxLeaves * 2)
+    int maxTreeSize = 2 * maxNumberOfLeaves;
+    long treeSize;
+    // Every tree is parsed into the same scratch array, then compressed
+    StructPlus* scratch = createNodes(arena, maxTreeSize);
+
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      fscanf(fp, "%ld", &treeSize);
+
+      trees[tindex] = scratch;
+
+      char text[20];
+      long line = 0;
+      fscanf(fp, "%s", text);
+      while(strcmp(text, "end") != 0) {
+        long id;
+        fscanf(fp, "%ld", &id);
+
+        // A "root" node contains a feature id and a threshold
+        if(strcmp(text, "root") == 0) {
+          int fid;
+          float threshold;
+          fscanf(fp, "%d %f", &fid, &threshold);
+          setRoot(trees[tindex], id, fid, threshold);
+        } else if(strcmp(text, "node") == 0) {
+          int fid;
+          long pid;
+          float threshold;
+          int leftChild = 0;
+          // Read Id of the parent node, feature id, subtree (left or right),
+          // and threshold
+          fscanf(fp, "%ld %d %d %f", &pid, &fid, &leftChild, &threshold);
+
+          // Find the parent node, based in parent id
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
+            if(trees[tindex][parentIndex].id == pid) {
+              break;
+            }
           }
-        }
-        // Add the new node
-        if(trees[tindex][parentIndex].fid >= 0) {
-          addNode(trees[tindex], parentIndex, line, id, leftChild, fid, threshold);
-        }
-      } else if(strcmp(text, "leaf") == 0) {
-        long pid;
-        int leftChild = 0;
-        float value;
-        fscanf(fp, "%ld %d %f", &pid, &leftChild, &value);
-
-        int parentIndex = 0;
-        for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
-          if(trees[tindex][parentIndex].id == pid) {
-            break;
+          // Add the new node
+          if(trees[tindex][parentIndex].fid >= 0) {
+            addNode(trees[tindex], parentIndex, line, id, leftChild, fid, threshold);
+          }
+        } else if(strcmp(text, "leaf") == 0) {
+          long pid;
+          int leftChild = 0;
+          float value;
+          fscanf(fp, "%ld %d %f", &pid, &leftChild, &value);
+
+          int parentIndex = 0;
+          for(parentIndex = 0; parentIndex < maxTreeSize; parentIndex++) {
+            if(trees[tindex][parentIndex].id == pid) {
+              break;
+            }
+          }
+          if(trees[tindex][parentIndex].fid >= 0) {
+            addNode(trees[tindex], parentIndex, line, id, leftChild, 0, value);
           }
         }
-        if(trees[tindex][parentIndex].fid >= 0) {
-          addNode(trees[tindex], parentIndex, line, id, leftChild, 0, value);
-        }
+        line++;
+        fscanf(fp, "%s", text);
       }
-      line++;
-      fscanf(fp, "%s", text);
+      // Re-organize tree memory layout
+      trees[tindex] = compress(arena, trees[tindex], 0);
+    }
+    fclose(fp);
+  }
+
+  // Lay out the hotter subtree of every node first
+  if(profile) {
+    long* offsets = (long*) malloc(nbTrees * sizeof(long));
+    long numberOfNodes = 0;
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      offsets[tindex] = numberOfNodes;
+      numberOfNodes += countNodes(trees[tindex]);
+    }
+    if(!matchesBranchProfile(profile, offsets, nbTrees, numberOfNodes)) {
+      fprintf(stderr, "Profile does not match the trees of %s\n", configFile);
+      return -1;
+    }
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      trees[tindex] = compress(arena, trees[tindex], getTreeBranchCounts(profile, tindex));
+    }
+    free(offsets);
+    destroyBranchProfile(profile);
+  }
+
+  // Convert the trees to the compact layout
+  CompactEnsemble* compact = 0;
+  if(compactOrder >= 0) {
+    long numberOfNodes;
+    long* offsets = (long*) malloc(nbTrees * sizeof(long));
+    Node* nodes = packStructPlusTrees(trees, nbTrees, offsets, &numberOfNodes);
+    compact = createCompactEnsemble(nodes, offsets, nbTrees, numberOfNodes, compactOrder);
+    free(nodes);
+    free(offsets);
+    if(!compact) {
+      fprintf(stderr, "Feature ids or tree sizes of %s do not fit in 16 bits\n", configFile);
+      return -1;
+    }
+  }
+
+  // Depths bound the steps of getLeafPredicated
+  long* depths = 0;
+  if(predicated) {
+    depths = (long*) malloc(nbTrees * sizeof(long));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      depths[tindex] = getDepth(trees[tindex]);
     }
-    // Re-organize tree memory layout
-    trees[tindex] = compress(trees[tindex]);
   }
-  fclose(fp);
 
-  // Read instances (SVM Light format
+#ifdef TREE_STATS
+  // The dump describes the trees packed as they are laid out
+  TreeStats* stats = 0;
+  Node* statsNodes = 0;
+  long* statsOffsets = 0;
+  if(statsFile) {
+    long numberOfNodes;
+    statsOffsets = (long*) malloc(nbTrees * sizeof(long));
+    statsNodes = packStructPlusTrees(trees, nbTrees, statsOffsets, &numberOfNodes);
+    stats = createTreeStats(nbTrees, numberOfNodes);
+  }
+#endif
+
+  // Read instances, either mapped from a binary instance file (see
+  // BinaryInstances.h) or parsed from SVM Light format (see SvmLight.h)
   int numberOfFeatures = 0;
   int numberOfInstances = 0;
+  float** features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  int iIndex = 0;
 
-  fp = fopen(featureFile, "r");
-  fscanf(fp, "%d %d", &numberOfInstances, &numberOfFeatures);
-  float** features = (float**) malloc(numberOfInstances * sizeof(float*));
-  int i = 0;
-  for(i = 0; i < numberOfInstances; i++) {
-    features[i] = (float*) malloc(numberOfFeatures * sizeof(float));
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    float* matrix = getRowMajorFeatures(binaryInstances, 1, arena);
+    features = getFeatureRows(matrix, numberOfInstances, numberOfFeatures, arena);
+  } else {
+    instances = readInstances(featureFile, 1, numberOfThreads, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = getFeatureRows(instances->features, numberOfInstances, numberOfFeatures, arena);
   }
 
-  float fvalue;
-  int fIndex = 0, iIndex = 0;
-  int ignore;
-  char text[20];
-  for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
-    fscanf(fp, "%d %[^:]:%d", &ignore, text, &ignore);
-    for(fIndex = 0; fIndex < numberOfFeatures; fIndex++) {
-      fscanf(fp, "%[^:]:%f", text, &fvalue);
-      features[iIndex][fIndex] = fvalue;
-    }
+  // Rows must hold every feature that a compiled or jforests ensemble reads
+  if(numberOfFeatures < ensembleFeatures) {
+    fprintf(stderr, "Instances have %d features, but the ensemble reads %d\n", numberOfFeatures,
+            ensembleFeatures);
+    return -1;
   }
 
   // Compute scores for instances using the ensemble and
@@ -133,33 +404,88 @@ int main(int argc, char** args) {
   float score;
   struct timeval start, end;
 
-  gettimeofday(&start, NULL);
-  for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
-    score = 0;
-    for(tindex = 0; tindex < nbTrees; tindex++) {
-      score += getLeaf(trees[tindex], features[iIndex])->threshold;
+  if(numberOfThreads > 0) {
+    // Score blocks of instances in parallel into a preallocated array
+    ScoreContext context;
+    context.trees = trees;
+    context.depths = depths;
+    context.groupSize = groupSize;
+    context.nbTrees = nbTrees;
+    context.compact = compact;
+    context.features = features;
+    context.scores = (float*) malloc(numberOfInstances * sizeof(float));
+#ifdef TREE_STATS
+    context.stats = stats;
+    context.offsets = statsOffsets;
+#endif
+    ThreadStats* stats = (ThreadStats*) malloc(numberOfThreads * sizeof(ThreadStats));
+    int blockSize = getBlockSize(numberOfInstances, numberOfFeatures, numberOfThreads, 1);
+
+    gettimeofday(&start, NULL);
+    scoreInParallel(numberOfThreads, numberOfInstances, blockSize,
+                    &scoreInstances, &context, stats);
+    gettimeofday(&end, NULL);
+
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      if(printScores) {
+        printf("%f\n", context.scores[iIndex]);
+      }
+      sum += context.scores[iIndex];
     }
-    if(printScores) {
-      printf("%f\n", score);
+    printThreadStats(stats, numberOfThreads, numberOfInstances,
+                     (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    free(stats);
+    free(context.scores);
+  } else {
+    gettimeofday(&start, NULL);
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      if(compact) {
+        score = getCompactScore(compact, features[iIndex]);
+#ifdef TREE_STATS
+      } else if(stats) {
+        score = getRecordedScore(trees, nbTrees, statsOffsets, stats, features[iIndex]);
+#endif
+      } else {
+        score = getEnsembleScore(trees, depths, groupSize, nbTrees, features[iIndex]);
+      }
+      if(printScores) {
+        printf("%f\n", score);
+      }
+      sum += score;
     }
-    sum += score;
+    gettimeofday(&end, NULL);
   }
-  gettimeofday(&end, NULL);
 
   printf("Time per instance (ns): %5.2f\n",
          (((end.tv_sec * 1000000 + end.tv_usec) -
            (start.tv_sec * 1000000 + start.tv_usec))*1000/((float) numberOfInstances)));
   printf("Ignore this number: %d\n", sum);
+  if(groupSize > 0) {
+    printf("Interleaved traversals per instance: %d\n", groupSize);
+  }
+  if(arena->hugePages) {
+    printArenaStats(arena);
+  }
+#ifdef TREE_STATS
+  if(stats) {
+    if(writeTreeStats(statsFile, stats, statsNodes, statsOffsets, numberOfInstances, 0) != 0) {
+      fprintf(stderr, "Could not write %s\n", statsFile);
+    }
+    destroyTreeStats(stats);
+    free(statsNodes);
+    free(statsOffsets);
+  }
+#endif
 
   // Free used memory
-  for(tindex = 0; tindex < nbTrees; tindex++) {
-    destroyTree(trees[tindex]);
-  }
   free(trees);
-  for(i = 0; i < numberOfInstances; i++) {
-    free(features[i]);
+  free(depths);
+  if(compact) {
+    destroyCompactEnsemble(compact);
+  }
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
   }
-  free(features);
-  fclose(fp);
+  destroyArena(arena);
   return 0;
 }
@@ -2,12 +2,19 @@
 #define STRUCT_PLUS_H_GUARD
 
 #include<stdlib.h>
+#include<stdint.h>
+#include<string.h>
+#include "Node.h"
+#include "Arena.h"
+#include "Interleave.h"
+#include "Profile.h"
 
 typedef struct StructPlus StructPlus;
 
 /**
  * Similar to Struct, however the memory layout is done
- * manually.
+ * manually. Trees are allocated in an arena (see Arena.h) and freed with
+ * it.
  */
 struct StructPlus {
   StructPlus* right;
@@ -20,23 +27,46 @@ struct StructPlus {
 /**
  * Creates an array of nodes.
  *
+ * @param arena Arena that holds the nodes
  * @param size Initial number of nodes in the tree
  * @return Pointer to array of nodes
  */
-StructPlus* createNodes(long size) {
-  StructPlus* tree = (StructPlus*) calloc(size, sizeof(StructPlus));
+StructPlus* createNodes(Arena* arena, long size) {
+  StructPlus* tree = (StructPlus*) allocateInArena(arena, size * sizeof(StructPlus));
   return tree;
 }
 
 /**
- * Removes empty nodes from the array, and re-organizes the array
+ * Counts the number of nodes in the tree
+ *
+ * @param root Root of the tree
+ * @return Number of nodes in the tree
+ */
+long countNodes(StructPlus* root) {
+  long count = 1;
+  if(!root->left && !root->right) {
+    return count;
+  }
+  count += countNodes(root->left);
+  count += countNodes(root->right);
+  return count;
+}
+
+/**
+ * Removes empty nodes from the array, and re-organizes the array. Without
+ * a profile, the left subtree comes first; with one, the subtree that more
+ * instances reached (see Profile.h).
  *
  * @param array New array
  * @param old Old array
  * @param index Next available node in the array
+ * @param counts Branch counts of the tree (see getTreeBranchCounts), or 0
+ * @param position Index of old with the left subtree first, which indexes
+ *        counts
  * @return Updated index
  */
-long compressNodes(StructPlus* array, StructPlus* old, long index) {
+long compressNodes(StructPlus* array, StructPlus* old, long index, const long* counts,
+                   long position) {
   // Copy information from the old node to the new node
   array[index].id = old->id;
   array[index].fid = old->fid;
@@ -45,11 +75,22 @@ long compressNodes(StructPlus* array, StructPlus* old, long index) {
   // If the current node has left and right subtrees, repeat this process
   if(old->right || old->left) {
     long pindex = index;
-    index = compressNodes(array, old->left, index + 1);
-    array[pindex].left = &array[pindex + 1];
+    if(getHotterChild(counts, position)) {
+      // The right subtree comes after the left one in the order of counts
+      long rightPosition = position + 1 + countNodes(old->left);
+      index = compressNodes(array, old->right, index + 1, counts, rightPosition);
+      array[pindex].right = &array[pindex + 1];
 
-    array[pindex].right = &array[index + 1];
-    index = compressNodes(array, old->right, index + 1);
+      array[pindex].left = &array[index + 1];
+      index = compressNodes(array, old->left, index + 1, counts, position + 1);
+    } else {
+      index = compressNodes(array, old->left, index + 1, counts, position + 1);
+      array[pindex].left = &array[pindex + 1];
+
+      // The left subtree took nodes pindex + 1 to index
+      array[pindex].right = &array[index + 1];
+      index = compressNodes(array, old->right, index + 1, counts, position + 1 + index - pindex);
+    }
   } else {
     array[index].right = 0;
     array[index].left = 0;
@@ -58,40 +99,22 @@ long compressNodes(StructPlus* array, StructPlus* old, long index) {
   return index;
 }
 
-/**
- * Counts the number of nodes in the tree
- *
- * @param root Root of the tree
- * @return Number of nodes in the tree
- */
-long countNodes(StructPlus* root) {
-  long count = 1;
-  if(!root->left && !root->right) {
-    return count;
-  }
-  count += countNodes(root->left);
-  count += countNodes(root->right);
-  return count;
-}
-
 /**
  * Re-organizes a tree by removing empty nodes from the memory layout
  *
+ * @param arena Arena that holds the new tree
  * @param root Root of the tree
+ * @param counts Branch counts of the tree to put hotter subtrees first
+ *        (see getTreeBranchCounts), or 0 to put left subtrees first
  * @return New tree structure that is more compact
  */
-StructPlus* compress(StructPlus* root) {
+StructPlus* compress(Arena* arena, StructPlus* root, const long* counts) {
   long validNodes = countNodes(root);
-  StructPlus* tree = (StructPlus*) calloc(validNodes, sizeof(StructPlus));
-  long index = compressNodes(tree, root, 0);
+  StructPlus* tree = createNodes(arena, validNodes);
+  compressNodes(tree, root, 0, counts, 0);
   return tree;
 }
 
-void destroyTree(StructPlus* tree) {
-  free(tree);
-  tree = 0;
-}
-
 /**
  * Sets the root of the tree
  */
@@ -148,4 +171,163 @@ StructPlus* getLeaf(StructPlus* pThis, float* featureVector) {
   }
 }
 
+/**
+ * Iterative variant of getLeaf without data-dependent branches, for trees
+ * whose comparisons are hard to predict. Each step picks the child with a
+ * mask computed from the comparison instead of a branch, and a leaf, which
+ * has no children, selects itself, so the loop always runs "depth" steps.
+ *
+ * @param root Root of the tree
+ * @param featureVector Feature vector
+ * @param depth Depth of the tree (see getDepth)
+ * @return Pointer to a terminal node
+ */
+StructPlus* getLeafPredicated(StructPlus* root, float* featureVector, long depth) {
+  uintptr_t node = (uintptr_t) root;
+  long d;
+  for(d = 0; d < depth; d++) {
+    StructPlus* p = (StructPlus*) node;
+    // All ones if the instance goes right; NaN goes right, as in getLeaf
+    uintptr_t right = -(uintptr_t) !(featureVector[p->fid] <= p->threshold);
+    uintptr_t child = ((uintptr_t) p->left & ~right) | ((uintptr_t) p->right & right);
+    uintptr_t leaf = -(uintptr_t) (child == 0);
+    node = (child & ~leaf) | (node & leaf);
+  }
+  return (StructPlus*) node;
+}
+
+/**
+ * Computes the score of one instance with interleaved traversals of the
+ * trees (see Interleave.h).
+ *
+ * @param trees Roots of the trees
+ * @param nbTrees Number of trees
+ * @param featureVector Feature vector
+ * @param groupSize Number of traversals in flight (see clampInterleaveGroup)
+ * @return Sum of the leaves, added in tree order
+ */
+float getScoreInterleaved(StructPlus** trees, int nbTrees, float* featureVector, int groupSize) {
+  StructPlus* nodes[INTERLEAVE_MAX_GROUP];
+  int treeOf[INTERLEAVE_MAX_GROUP];
+  float values[INTERLEAVE_WINDOW];
+  char finished[INTERLEAVE_WINDOW];
+  float score = 0;
+  int started = 0, added = 0, g;
+  groupSize = clampInterleaveGroup(groupSize);
+  memset(finished, 0, sizeof(finished));
+  for(g = 0; g < groupSize; g++) {
+    nodes[g] = 0;
+  }
+
+  while(added < nbTrees) {
+    for(g = 0; g < groupSize; g++) {
+      StructPlus* node = nodes[g];
+      if(node) {
+        if(!node->left && !node->right) {
+          values[treeOf[g] % INTERLEAVE_WINDOW] = node->threshold;
+          finished[treeOf[g] % INTERLEAVE_WINDOW] = 1;
+          node = 0;
+        } else if(featureVector[node->fid] <= node->threshold) {
+          node = node->left;
+        } else {
+          node = node->right;
+        }
+      }
+      if(!node && started < nbTrees && started < added + INTERLEAVE_WINDOW) {
+        node = trees[started];
+        treeOf[g] = started++;
+      }
+      if(node) {
+        __builtin_prefetch(node);
+      }
+      nodes[g] = node;
+    }
+    while(added < started && finished[added % INTERLEAVE_WINDOW]) {
+      finished[added % INTERLEAVE_WINDOW] = 0;
+      score += values[added % INTERLEAVE_WINDOW];
+      added++;
+    }
+  }
+  return score;
+}
+
+/**
+ * @return Number of edges on the longest path from root to a leaf
+ */
+long getDepth(StructPlus* root) {
+  if(!root->left && !root->right) {
+    return 0;
+  }
+  long left = getDepth(root->left);
+  long right = getDepth(root->right);
+  return 1 + (left > right ? left : right);
+}
+
+/**
+ * Creates a tree from a tree in the VPred layout (see Node.h). Nodes keep
+ * their index, so a tree packed with the left or the hotter subtree first
+ * keeps that order.
+ *
+ * @param arena Arena that holds the nodes
+ * @param nodes Tree structure
+ * @param size Number of nodes in the tree
+ * @return New tree structure
+ */
+StructPlus* createStructPlusFromNodes(Arena* arena, Node* nodes, long size) {
+  StructPlus* tree = createNodes(arena, size);
+  long i;
+  for(i = 0; i < size; i++) {
+    tree[i].id = i;
+    tree[i].fid = nodes[i].fid;
+    tree[i].threshold = nodes[i].theta;
+    // Leaves point to themselves
+    if(nodes[i].children[0] != i) {
+      tree[i].left = &tree[nodes[i].children[0]];
+      tree[i].right = &tree[nodes[i].children[1]];
+    }
+  }
+  return tree;
+}
+
+/**
+ * Packs trees into a single array in the VPred layout (see Node.h), which
+ * is the inverse of createStructPlusFromNodes.
+ *
+ * @param trees Trees created by compress
+ * @param nbTrees Number of trees
+ * @param offsets Output, index of the root of each tree in the array
+ * @param numberOfNodes Output, total number of nodes
+ * @return Array of nodes
+ */
+Node* packStructPlusTrees(StructPlus** trees, int nbTrees, long* offsets,
+                          long* numberOfNodes) {
+  long totalNodes = 0;
+  int tindex;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    offsets[tindex] = totalNodes;
+    totalNodes += countNodes(trees[tindex]);
+  }
+  Node* nodes = (Node*) malloc(totalNodes * sizeof(Node));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    StructPlus* tree = trees[tindex];
+    long size = (tindex + 1 < nbTrees ? offsets[tindex + 1] : totalNodes) - offsets[tindex];
+    long i;
+    for(i = 0; i < size; i++) {
+      Node* node = &nodes[offsets[tindex] + i];
+      node->fid = abs(tree[i].fid);
+      node->theta = tree[i].threshold;
+      // Leaves point to themselves
+      if(tree[i].left || tree[i].right) {
+        node->children[0] = (int) (tree[i].left - tree);
+        node->children[1] = (int) (tree[i].right - tree);
+      } else {
+        node->children[0] = (int) i;
+        node->children[1] = (int) i;
+      }
+    }
+  }
+  *numberOfNodes = totalNodes;
+  return nodes;
+}
+
 #endif
@@ -0,0 +1,463 @@
+#ifndef SVM_LIGHT_H_GUARD
+#define SVM_LIGHT_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ThreadPool.h"
+#include "Arena.h"
+
+/**
+ * Parallel reader for instance files in SVM Light format (see README.md).
+ *
+ * The file is memory-mapped and split into byte ranges (chunks) that start
+ * at line boundaries. A first parallel pass counts the instances in every
+ * chunk, which gives the index of the first instance of each chunk, and a
+ * second parallel pass parses every chunk straight into its rows of a
+ * dense, row-major feature matrix. Chunks are distributed by the
+ * work-stealing pool of ThreadPool.h.
+ *
+ * Pairs "fid:value" may be sparse and in any order: feature "k:" is stored
+ * at index k - 1, missing features are zero, and features outside
+ * [1, numberOfFeatures] are ignored. A reader may also keep a subset of
+ * the features only (see FeatureProjection.h). Numbers are parsed by hand; the
+ * result is identical to strtof, which is used for the rare inputs the
+ * fast path cannot round correctly.
+ */
+
+// Chunks are at most this many bytes, and there are at least
+// SVM_LIGHT_CHUNKS_PER_THREAD chunks per thread
+#define SVM_LIGHT_CHUNK_SIZE (8L << 20)
+#define SVM_LIGHT_CHUNKS_PER_THREAD 4
+
+typedef struct Instances Instances;
+
+struct Instances {
+  int numberOfInstances;
+  int numberOfFeatures;
+  long numberOfRows; // Number of rows, padded with zero rows
+  float* features; // Row-major, numberOfRows * numberOfFeatures, 64-byte aligned
+  int* labels; // Relevance label of each instance
+  int* qids; // Query id of each instance
+};
+
+const double POWERS_OF_TEN[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+int isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+/**
+ * Parses a float with strtof, for inputs the fast path does not handle.
+ */
+int parseFloatSlow(const char** position, const char* end, float* value) {
+  char buffer[64];
+  const char* p = *position;
+  int length = 0;
+  while(p + length < end && !isSpace(p[length]) && length < 63) {
+    buffer[length] = p[length];
+    length++;
+  }
+  buffer[length] = 0;
+  char* last;
+  *value = strtof(buffer, &last);
+  if(last == buffer) {
+    return 0;
+  }
+  *position = p + (last - buffer);
+  return 1;
+}
+
+/**
+ * Parses a decimal float in [*position, end) and advances *position past
+ * it. Numbers with at most 19 significant digits and a small decimal
+ * exponent are computed with a single double operation, which is exact up
+ * to the final rounding to float. That rounding only differs from strtof
+ * when the double falls exactly halfway between two floats, in which case
+ * strtof decides.
+ *
+ * @return 1 if a number was parsed, 0 otherwise
+ */
+int parseFloat(const char** position, const char* end, float* value) {
+  const char* p = *position;
+  int negative = 0;
+  if(p < end && (*p == '-' || *p == '+')) {
+    negative = *p == '-';
+    p++;
+  }
+
+  unsigned long long mantissa = 0;
+  int digits = 0; // Significant digits in the mantissa
+  int exponent = 0;
+  int seenDigit = 0;
+  for(; p < end && *p >= '0' && *p <= '9'; p++) {
+    seenDigit = 1;
+    mantissa = mantissa * 10 + (*p - '0');
+    digits += mantissa != 0;
+  }
+  if(p < end && *p == '.') {
+    for(p++; p < end && *p >= '0' && *p <= '9'; p++) {
+      seenDigit = 1;
+      mantissa = mantissa * 10 + (*p - '0');
+      digits += mantissa != 0;
+      exponent--;
+    }
+  }
+  if(!seenDigit || digits > 19) {
+    return parseFloatSlow(position, end, value);
+  }
+  if(p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    int negativeExponent = 0;
+    if(p < end && (*p == '-' || *p == '+')) {
+      negativeExponent = *p == '-';
+      p++;
+    }
+    if(p >= end || *p < '0' || *p > '9') {
+      return parseFloatSlow(position, end, value);
+    }
+    int e = 0;
+    for(; p < end && *p >= '0' && *p <= '9'; p++) {
+      if(e < 10000) {
+        e = e * 10 + (*p - '0');
+      }
+    }
+    exponent += negativeExponent ? -e : e;
+  }
+  if(mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) {
+    return parseFloatSlow(position, end, value);
+  }
+
+  double d = exponent < 0 ? mantissa / POWERS_OF_TEN[-exponent]
+                          : mantissa * POWERS_OF_TEN[exponent];
+  float f = (float) d;
+  if((double) f != d) {
+    // Find the float on the other side of d and check for a tie
+    unsigned int bits;
+    memcpy(&bits, &f, sizeof(float));
+    bits += d > f ? 1 : -1;
+    float g;
+    memcpy(&g, &bits, sizeof(float));
+    if(((double) f + (double) g) * 0.5 == d) {
+      return parseFloatSlow(position, end, value);
+    }
+  }
+  *value = negative ? -f : f;
+  *position = p;
+  return 1;
+}
+
+/**
+ * Parses a non-negative integer in [*position, end) and advances
+ * *position past it.
+ *
+ * @return 1 if a number was parsed, 0 otherwise
+ */
+int parseInteger(const char** position, const char* end, long* value) {
+  const char* p = *position;
+  long v = 0;
+  for(; p < end && *p >= '0' && *p <= '9'; p++) {
+    v = v * 10 + (*p - '0');
+  }
+  if(p == *position) {
+    return 0;
+  }
+  *value = v;
+  *position = p;
+  return 1;
+}
+
+/**
+ * Parses one SVM Light line in [p, end), "label [qid:<qid>] <fid>:<value>
+ * ... [# comment]", into a feature vector. The vector must be zero-filled
+ * by the caller.
+ *
+ * @param p Start of the line
+ * @param end End of the line
+ * @param features Output, feature vector
+ * @param numberOfFeatures Number of features of the file
+ * @param columns Index in "features" of each feature (-1 to skip it), or 0
+ *        to store feature "k:" at index k - 1
+ * @param label Output, relevance label
+ * @param qid Output, query id (0 if absent)
+ * @return 0 on success, -1 if the line is malformed
+ */
+int parseSvmLightLine(const char* p, const char* end, float* features,
+                      int numberOfFeatures, const int* columns, int* label, int* qid) {
+  float value;
+  long fid;
+  while(p < end && isSpace(*p)) p++;
+  if(!parseFloat(&p, end, &value)) {
+    return -1;
+  }
+  *label = (int) value;
+
+  *qid = 0;
+  while(p < end && isSpace(*p)) p++;
+  if(end - p >= 4 && memcmp(p, "qid:", 4) == 0) {
+    p += 4;
+    if(!parseInteger(&p, end, &fid)) {
+      return -1;
+    }
+    *qid = (int) fid;
+  }
+
+  while(1) {
+    while(p < end && isSpace(*p)) p++;
+    if(p == end || *p == '#') {
+      return 0;
+    }
+    if(!parseInteger(&p, end, &fid) || p == end || *p != ':') {
+      return -1;
+    }
+    p++;
+    if(!parseFloat(&p, end, &value)) {
+      return -1;
+    }
+    if(fid >= 1 && fid <= numberOfFeatures) {
+      if(!columns) {
+        features[fid - 1] = value;
+      } else if(columns[fid - 1] >= 0) {
+        features[columns[fid - 1]] = value;
+      }
+    }
+  }
+}
+
+/**
+ * @return End of the line starting at p (the newline, or end)
+ */
+const char* findLineEnd(const char* p, const char* end) {
+  const char* newline = (const char*) memchr(p, '\n', end - p);
+  return newline ? newline : end;
+}
+
+int isBlankLine(const char* p, const char* end) {
+  while(p < end && isSpace(*p)) p++;
+  return p == end;
+}
+
+typedef struct ParseContext ParseContext;
+
+// Arguments of countChunks and parseChunks
+struct ParseContext {
+  const char* data; // Mapped file
+  long* chunkStarts; // Byte offset of each chunk, plus the end of the file
+  long* chunkInstances; // Instances per chunk, then index of the first one
+  Instances* instances;
+  long numberOfFileFeatures; // From the header of the file
+  const int* columns; // See parseSvmLightLine
+  int errors;
+};
+
+/**
+ * Counts the instances in chunks [begin, end) (see ScoreBlock in
+ * ThreadPool.h).
+ */
+void countChunks(void* context, int begin, int end, int thread) {
+  ParseContext* c = (ParseContext*) context;
+  int chunk;
+  for(chunk = begin; chunk < end; chunk++) {
+    const char* p = c->data + c->chunkStarts[chunk];
+    const char* last = c->data + c->chunkStarts[chunk + 1];
+    long count = 0;
+    while(p < last) {
+      const char* lineEnd = findLineEnd(p, last);
+      count += !isBlankLine(p, lineEnd);
+      p = lineEnd + 1;
+    }
+    c->chunkInstances[chunk] = count;
+  }
+}
+
+/**
+ * Parses chunks [begin, end) into their rows (see ScoreBlock in
+ * ThreadPool.h).
+ */
+void parseChunks(void* context, int begin, int end, int thread) {
+  ParseContext* c = (ParseContext*) context;
+  Instances* instances = c->instances;
+  long numberOfFeatures = instances->numberOfFeatures;
+  int chunk;
+  for(chunk = begin; chunk < end; chunk++) {
+    const char* p = c->data + c->chunkStarts[chunk];
+    const char* last = c->data + c->chunkStarts[chunk + 1];
+    long row = c->chunkInstances[chunk];
+    while(p < last && row < instances->numberOfInstances) {
+      const char* lineEnd = findLineEnd(p, last);
+      if(!isBlankLine(p, lineEnd)) {
+        float* features = &instances->features[row * numberOfFeatures];
+        memset(features, 0, numberOfFeatures * sizeof(float));
+        if(parseSvmLightLine(p, lineEnd, features, c->numberOfFileFeatures, c->columns,
+                             &instances->labels[row], &instances->qids[row]) != 0) {
+          __atomic_add_fetch(&c->errors, 1, __ATOMIC_RELAXED);
+        }
+        row++;
+      }
+      p = lineEnd + 1;
+    }
+  }
+}
+
+/**
+ * Reads a subset of the features of an instance file in SVM Light format
+ * in parallel.
+ *
+ * @param path Path to the file
+ * @param multiple The feature matrix is padded with zero rows to a
+ *        multiple of this number of rows (e.g., V for VPred)
+ * @param numberOfThreads Number of threads, or 0 for one per online CPU
+ * @param columns Column of each feature index (-1 to skip it), or 0 to
+ *        keep all features of the file
+ * @param numberOfMapped Number of entries in "columns"; later features
+ *        are skipped
+ * @param numberOfColumns Length of a stored feature vector, if columns is
+ *        set
+ * @param arena Arena that holds the instances and their feature matrix
+ * @return Instances, or 0 if the file could not be read or is malformed
+ */
+Instances* readSelectedInstances(const char* path, int multiple, int numberOfThreads,
+                                 const int* columns, int numberOfMapped,
+                                 int numberOfColumns, Arena* arena) {
+  int fd = open(path, O_RDONLY);
+  if(fd < 0) {
+    return 0;
+  }
+  struct stat st;
+  if(fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+  long size = st.st_size;
+  const char* data = (const char*) mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(data == (const char*) MAP_FAILED) {
+    return 0;
+  }
+
+  // First line: number of instances and number of features
+  const char* p = data;
+  const char* end = data + size;
+  long numberOfInstances, numberOfFeatures;
+  while(p < end && isSpace(*p)) p++;
+  int ok = parseInteger(&p, end, &numberOfInstances);
+  while(p < end && isSpace(*p) && *p != '\n') p++;
+  ok = ok && parseInteger(&p, end, &numberOfFeatures);
+  if(!ok || numberOfFeatures <= 0 || numberOfInstances > 0x7fffffff ||
+     numberOfFeatures > 0x7fffffff) {
+    fprintf(stderr, "Invalid header in %s\n", path);
+    munmap((void*) data, size);
+    return 0;
+  }
+  const char* body = findLineEnd(p, end);
+  long bodyStart = body < end ? body - data + 1 : size;
+
+  if(numberOfThreads <= 0) {
+    numberOfThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(numberOfThreads < 1) {
+      numberOfThreads = 1;
+    }
+  }
+  long numberOfChunks = (size - bodyStart) / SVM_LIGHT_CHUNK_SIZE + 1;
+  if(numberOfChunks < numberOfThreads * SVM_LIGHT_CHUNKS_PER_THREAD) {
+    numberOfChunks = numberOfThreads * SVM_LIGHT_CHUNKS_PER_THREAD;
+  }
+
+  // Move every chunk boundary to the start of the next line
+  ParseContext context;
+  context.data = data;
+  context.errors = 0;
+  context.numberOfFileFeatures = numberOfFeatures;
+  context.columns = columns;
+  if(columns) {
+    // Features beyond the mapped ones are skipped like those beyond the file's
+    if(numberOfFeatures > numberOfMapped) {
+      context.numberOfFileFeatures = numberOfMapped;
+    }
+    numberOfFeatures = numberOfColumns;
+  }
+  context.chunkStarts = (long*) malloc((numberOfChunks + 1) * sizeof(long));
+  context.chunkInstances = (long*) malloc(numberOfChunks * sizeof(long));
+  context.chunkStarts[0] = bodyStart;
+  context.chunkStarts[numberOfChunks] = size;
+  long chunk;
+  for(chunk = 1; chunk < numberOfChunks; chunk++) {
+    long position = bodyStart + (size - bodyStart) * chunk / numberOfChunks;
+    if(position < context.chunkStarts[chunk - 1]) {
+      position = context.chunkStarts[chunk - 1];
+    }
+    if(position > bodyStart && data[position - 1] != '\n') {
+      position = findLineEnd(data + position, end) - data;
+      position = position < size ? position + 1 : size;
+    }
+    context.chunkStarts[chunk] = position;
+  }
+
+  Instances* instances = (Instances*) allocateInArena(arena, sizeof(Instances));
+  instances->numberOfInstances = numberOfInstances;
+  instances->numberOfFeatures = numberOfFeatures;
+  instances->numberOfRows = (numberOfInstances + multiple - 1) / multiple * multiple;
+  instances->labels = (int*) allocateInArena(arena, numberOfInstances * sizeof(int));
+  instances->qids = (int*) allocateInArena(arena, numberOfInstances * sizeof(int));
+  instances->features = (float*) allocateInArena(
+      arena, instances->numberOfRows * numberOfFeatures * sizeof(float));
+  context.instances = instances;
+
+  ThreadStats* stats = (ThreadStats*) malloc(numberOfThreads * sizeof(ThreadStats));
+  long found = 0;
+  if(instances->features) {
+    scoreInParallel(numberOfThreads, numberOfChunks, 1, &countChunks, &context, stats);
+    for(chunk = 0; chunk < numberOfChunks; chunk++) {
+      long count = context.chunkInstances[chunk];
+      context.chunkInstances[chunk] = found;
+      found += count;
+    }
+  }
+  if(!instances->features) {
+    fprintf(stderr, "Could not allocate features for %s\n", path);
+    ok = 0;
+  } else if(found < numberOfInstances) {
+    fprintf(stderr, "Expected %ld instances in %s, found %ld\n",
+            numberOfInstances, path, found);
+    ok = 0;
+  } else {
+    // Rows are zero-filled by the threads that parse them
+    scoreInParallel(numberOfThreads, numberOfChunks, 1, &parseChunks, &context, stats);
+    memset(&instances->features[numberOfInstances * numberOfFeatures], 0,
+           (instances->numberOfRows - numberOfInstances) * numberOfFeatures * sizeof(float));
+    if(context.errors > 0) {
+      fprintf(stderr, "%d malformed instances in %s\n", context.errors, path);
+      ok = 0;
+    }
+  }
+
+  free(stats);
+  free(context.chunkInstances);
+  free(context.chunkStarts);
+  munmap((void*) data, size);
+  // On failure, the instances stay in the arena until it is destroyed
+  return ok ? instances : 0;
+}
+
+/**
+ * Reads an instance file in SVM Light format in parallel.
+ *
+ * @param path Path to the file
+ * @param multiple The feature matrix is padded with zero rows to a
+ *        multiple of this number of rows (e.g., V for VPred)
+ * @param numberOfThreads Number of threads, or 0 for one per online CPU
+ * @param arena Arena that holds the instances and their feature matrix
+ * @return Instances, or 0 if the file could not be read or is malformed
+ */
+Instances* readInstances(const char* path, int multiple, int numberOfThreads, Arena* arena) {
+  return readSelectedInstances(path, multiple, numberOfThreads, 0, 0, 0, arena);
+}
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef THREAD_POOL_H_GUARD
+#define THREAD_POOL_H_GUARD
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+/**
+ * Work-stealing execution of a scoring function over blocks of instances.
+ *
+ * The instances are split into blocks, and every thread starts with a
+ * contiguous range of blocks. A thread takes blocks from the front of its
+ * own range; once it runs out, it steals the back half of another thread's
+ * range. A range is stored as a single 64-bit word (next block in the low
+ * half, end in the high half) that is updated with compare-and-swap, so
+ * no locks are taken.
+ */
+
+// Scores instances [begin, end). "thread" identifies the calling thread,
+// e.g., to select per-thread scratch space.
+typedef void (*ScoreBlock)(void* context, int begin, int end, int thread);
+
+typedef struct ThreadStats ThreadStats;
+
+struct ThreadStats {
+  long instances; // Number of instances scored by the thread
+  long blocks; // Number of blocks scored by the thread
+  long steals; // Number of successful steals
+  double seconds; // Time spent by the thread, from start to exit
+};
+
+typedef struct ThreadPool ThreadPool;
+
+struct ThreadPool {
+  int numberOfThreads;
+  int numberOfInstances;
+  int blockSize;
+  ScoreBlock scoreBlock;
+  void* context;
+  unsigned long long* ranges; // One range of blocks per thread
+  ThreadStats* stats;
+};
+
+typedef struct Worker Worker;
+
+// Argument of a thread
+struct Worker {
+  ThreadPool* pool;
+  int thread;
+};
+
+unsigned long long packRange(unsigned int next, unsigned int end) {
+  return ((unsigned long long) end << 32) | next;
+}
+
+double elapsedSeconds(struct timespec* start, struct timespec* end) {
+  return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * Takes the next block from the thread's own range.
+ *
+ * @return Block index, or -1 if the range is empty
+ */
+long popBlock(unsigned long long* range) {
+  unsigned long long word = __atomic_load_n(range, __ATOMIC_ACQUIRE);
+  while(1) {
+    unsigned int next = (unsigned int) word;
+    unsigned int end = (unsigned int) (word >> 32);
+    if(next >= end) {
+      return -1;
+    }
+    if(__atomic_compare_exchange_n(range, &word, packRange(next + 1, end), 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      return next;
+    }
+  }
+}
+
+/**
+ * Moves the back half of a victim's range to the thief's (empty) range.
+ *
+ * The victim always keeps the front block. As only the owner takes the
+ * front block, a range never returns to a value it had before, which rules
+ * out ABA problems in the compare-and-swap.
+ *
+ * @return 1 if blocks were stolen, 0 otherwise
+ */
+int stealBlocks(unsigned long long* victim, unsigned long long* thief) {
+  unsigned long long word = __atomic_load_n(victim, __ATOMIC_ACQUIRE);
+  while(1) {
+    unsigned int next = (unsigned int) word;
+    unsigned int end = (unsigned int) (word >> 32);
+    if(next + 1 >= end) {
+      return 0;
+    }
+    unsigned int split = end - (end - next) / 2;
+    if(__atomic_compare_exchange_n(victim, &word, packRange(next, split), 0,
+                                   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+      __atomic_store_n(thief, packRange(split, end), __ATOMIC_RELEASE);
+      return 1;
+    }
+  }
+}
+
+void* runWorker(void* argument) {
+  Worker* worker = (Worker*) argument;
+  ThreadPool* pool = worker->pool;
+  int thread = worker->thread;
+  ThreadStats* stats = &pool->stats[thread];
+  struct timespec start, end;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while(1) {
+    long block = popBlock(&pool->ranges[thread]);
+    if(block < 0) {
+      // Look for work at the other threads, starting with the next one
+      int k;
+      int stolen = 0;
+      for(k = 1; k < pool->numberOfThreads && !stolen; k++) {
+        int victim = (thread + k) % pool->numberOfThreads;
+        stolen = stealBlocks(&pool->ranges[victim], &pool->ranges[thread]);
+      }
+      if(!stolen) {
+        break;
+      }
+      stats->steals++;
+      continue;
+    }
+    int begin = (int) (block * pool->blockSize);
+    int last = begin + pool->blockSize;
+    if(last > pool->numberOfInstances) {
+      last = pool->numberOfInstances;
+    }
+    pool->scoreBlock(pool->context, begin, last, thread);
+    stats->instances += last - begin;
+    stats->blocks++;
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  stats->seconds = elapsedSeconds(&start, &end);
+  return 0;
+}
+
+/**
+ * Picks a block size such that a block of feature vectors fits in a
+ * 256KB (L2-sized) cache and every thread gets several blocks.
+ *
+ * @param numberOfInstances Number of instances
+ * @param numberOfFeatures Length of a feature vector
+ * @param numberOfThreads Number of threads
+ * @param multiple Block sizes are rounded up to a multiple of this value
+ * @return Number of instances per block
+ */
+int getBlockSize(int numberOfInstances, int numberOfFeatures,
+                 int numberOfThreads, int multiple) {
+  int blockSize = (256 * 1024) / (numberOfFeatures * sizeof(float));
+  int perThread = (numberOfInstances + 4 * numberOfThreads - 1) / (4 * numberOfThreads);
+  if(blockSize > perThread) {
+    blockSize = perThread;
+  }
+  if(blockSize < 1) {
+    blockSize = 1;
+  }
+  return (blockSize + multiple - 1) / multiple * multiple;
+}
+
+/**
+ * Scores all instances with numberOfThreads threads. Each instance is
+ * scored exactly once, so a scoring function that writes to
+ * scores[instance] fills a preallocated array in input order.
+ *
+ * @param numberOfThreads Number of threads
+ * @param numberOfInstances Number of instances
+ * @param blockSize Number of instances per block
+ * @param scoreBlock Scoring function
+ * @param context Argument passed to scoreBlock
+ * @param stats Output, one entry per thread
+ */
+void scoreInParallel(int numberOfThreads, int numberOfInstances, int blockSize,
+                     ScoreBlock scoreBlock, void* context, ThreadStats* stats) {
+  ThreadPool pool;
+  pool.numberOfThreads = numberOfThreads;
+  pool.numberOfInstances = numberOfInstances;
+  pool.blockSize = blockSize;
+  pool.scoreBlock = scoreBlock;
+  pool.context = context;
+  pool.stats = stats;
+  pool.ranges = (unsigned long long*) malloc(numberOfThreads * sizeof(unsigned long long));
+
+  // Initially, blocks are split evenly among threads
+  int numberOfBlocks = (numberOfInstances + blockSize - 1) / blockSize;
+  int t;
+  for(t = 0; t < numberOfThreads; t++) {
+    pool.ranges[t] = packRange((long) numberOfBlocks * t / numberOfThreads,
+                               (long) numberOfBlocks * (t + 1) / numberOfThreads);
+    stats[t].instances = 0;
+    stats[t].blocks = 0;
+    stats[t].steals = 0;
+    stats[t].seconds = 0;
+  }
+
+  pthread_t* threads = (pthread_t*) malloc(numberOfThreads * sizeof(pthread_t));
+  Worker* workers = (Worker*) malloc(numberOfThreads * sizeof(Worker));
+  for(t = 0; t < numberOfThreads; t++) {
+    workers[t].pool = &pool;
+    workers[t].thread = t;
+    pthread_create(&threads[t], NULL, &runWorker, &workers[t]);
+  }
+  for(t = 0; t < numberOfThreads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+
+  free(workers);
+  free(threads);
+  free(pool.ranges);
+}
+
+/**
+ * Prints per-thread and aggregate throughput.
+ *
+ * @param stats Per-thread statistics
+ * @param numberOfThreads Number of threads
+ * @param numberOfInstances Number of instances
+ * @param seconds Wall-clock time of the parallel run
+ */
+void printThreadStats(ThreadStats* stats, int numberOfThreads,
+                      int numberOfInstances, double seconds) {
+  int t;
+  for(t = 0; t < numberOfThreads; t++) {
+    printf("Thread %d: %ld instances, %ld blocks, %ld steals, "
+           "throughput (instances/s): %.0f\n",
+           t, stats[t].instances, stats[t].blocks, stats[t].steals,
+           stats[t].seconds > 0 ? stats[t].instances / stats[t].seconds : 0);
+  }
+  printf("Aggregate throughput (instances/s): %.0f\n",
+         seconds > 0 ? numberOfInstances / seconds : 0);
+}
+
+#endif
@@ -0,0 +1,221 @@
+#ifndef TREE_STATS_H_GUARD
+#define TREE_STATS_H_GUARD
+
+/**
+ * Instrumentation of the drivers, for a view of how an ensemble behaves on
+ * real instances: dead subtrees, unused features and trees that cost far
+ * more than others. It is compiled only with -DTREE_STATS (make STATS=1);
+ * otherwise this header is empty and the drivers reject -stats.
+ *
+ * While scoring, a driver counts the leaf that every instance reaches in
+ * every tree, and times every chunk of TREE_STATS_CHUNK consecutive trees.
+ * As the path to a leaf is fixed, the other statistics are derived from
+ * the leaf counts when the dump is written: visits of every node, average
+ * path length of every tree and accesses to every feature. Counters are
+ * updated atomically, so threads share one TreeStats.
+ *
+ * writeTreeStats dumps the statistics as JSON:
+ *
+ *   {"instances": <n>, "treeChunk": <TREE_STATS_CHUNK>,
+ *    "trees": [{"tree": <index>, "nodes": <n>, "averagePathLength": <x>,
+ *               "unvisitedNodes": <n>, "visits": [<visits of every node>],
+ *               "leafHits": [[<node>, <hits>], ...]}, ...],
+ *    "features": [{"feature": <id>, "accesses": <n>}, ...],
+ *    "treeChunks": [{"firstTree": <index>, "lastTree": <index>,
+ *                    "nanoseconds": <n>, "nanosecondsPerInstance": <x>}, ...]}
+ *
+ * Trees are numbered in the order they are scored and nodes in the order
+ * of their packed trees (see Node.h). "leafHits" lists leaves that were
+ * reached; every feature up to the largest one in use is listed, so unused
+ * features have no accesses. Chunk times include the instruction overhead
+ * of timing, and are meant to be compared with each other.
+ */
+
+#ifdef TREE_STATS
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "Node.h"
+
+// Number of consecutive trees timed together
+#define TREE_STATS_CHUNK 64
+
+typedef struct TreeStats TreeStats;
+
+struct TreeStats {
+  int numberOfTrees;
+  long numberOfNodes;
+  long* leafHits; // Instances that reached every node as their leaf
+  int numberOfChunks;
+  long* chunkNanoseconds; // Time spent in every chunk of trees
+};
+
+/**
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes of the packed trees
+ */
+TreeStats* createTreeStats(int nbTrees, long numberOfNodes) {
+  TreeStats* s = (TreeStats*) malloc(sizeof(TreeStats));
+  s->numberOfTrees = nbTrees;
+  s->numberOfNodes = numberOfNodes;
+  s->leafHits = (long*) calloc(numberOfNodes, sizeof(long));
+  s->numberOfChunks = (nbTrees + TREE_STATS_CHUNK - 1) / TREE_STATS_CHUNK;
+  s->chunkNanoseconds = (long*) calloc(s->numberOfChunks + 1, sizeof(long));
+  return s;
+}
+
+void destroyTreeStats(TreeStats* s) {
+  free(s->leafHits);
+  free(s->chunkNanoseconds);
+  free(s);
+}
+
+/**
+ * @return Monotonic time in nanoseconds
+ */
+long getStatsTime() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/**
+ * Counts an instance that reached a leaf.
+ *
+ * @param node Index of the leaf in the packed trees
+ */
+void recordLeaf(TreeStats* s, long node) {
+  __atomic_add_fetch(&s->leafHits[node], 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Adds time spent in the chunk of a tree.
+ *
+ * @param tindex Index of any tree of the chunk
+ */
+void recordChunkTime(TreeStats* s, int tindex, long nanoseconds) {
+  __atomic_add_fetch(&s->chunkNanoseconds[tindex / TREE_STATS_CHUNK], nanoseconds,
+                     __ATOMIC_RELAXED);
+}
+
+/**
+ * @return Index of the last tree of the chunk that starts at tree first,
+ *         plus one, and at most last
+ */
+int getChunkEnd(int first, int last) {
+  int end = (first / TREE_STATS_CHUNK + 1) * TREE_STATS_CHUNK;
+  return end < last ? end : last;
+}
+
+/**
+ * Computes the visits of the nodes of a subtree from the leaf hits.
+ *
+ * @param tree Root of the packed tree
+ * @param n Index of the root of the subtree, relative to tree
+ * @param leafHits Leaf hits of the tree
+ * @param depth Depth of n
+ * @param visits Output, visits of every node of the tree
+ * @param pathLength Output, sum of the path lengths of the instances
+ * @return Visits of n
+ */
+long addSubtreeVisits(const Node* tree, int n, const long* leafHits, long depth,
+                      long* visits, double* pathLength) {
+  if(tree[n].children[0] == n) {
+    visits[n] = leafHits[n];
+    *pathLength += (double) depth * leafHits[n];
+  } else {
+    visits[n] = addSubtreeVisits(tree, tree[n].children[0], leafHits, depth + 1, visits,
+                                 pathLength) +
+      addSubtreeVisits(tree, tree[n].children[1], leafHits, depth + 1, visits, pathLength);
+  }
+  return visits[n];
+}
+
+/**
+ * Writes the statistics as JSON (see above).
+ *
+ * @param nodes Trees that were scored, packed (see Node.h)
+ * @param offsets Index of the root of each tree in nodes
+ * @param numberOfInstances Number of instances scored
+ * @param featureIds Original id of every feature id of the nodes, or 0 if
+ *        they are not renumbered (see FeatureProjection.h)
+ * @return 0 on success, -1 on error
+ */
+int writeTreeStats(const char* path, const TreeStats* s, const Node* nodes, const long* offsets,
+                   long numberOfInstances, const int* featureIds) {
+  FILE* fp = fopen(path, "w");
+  if(!fp) {
+    return -1;
+  }
+  long* visits = (long*) malloc(s->numberOfNodes * sizeof(long));
+  int maxFeature = -1;
+  int tindex;
+  long n;
+  fprintf(fp, "{\"instances\": %ld, \"treeChunk\": %d,\n \"trees\": [", numberOfInstances,
+          TREE_STATS_CHUNK);
+  for(tindex = 0; tindex < s->numberOfTrees; tindex++) {
+    long offset = offsets[tindex];
+    long size = (tindex + 1 < s->numberOfTrees ? offsets[tindex + 1] : s->numberOfNodes) - offset;
+    double pathLength = 0;
+    long unvisited = 0;
+    addSubtreeVisits(&nodes[offset], 0, &s->leafHits[offset], 0, &visits[offset], &pathLength);
+    fprintf(fp, "%s\n  {\"tree\": %d, \"nodes\": %ld, \"averagePathLength\": %.4f",
+            tindex == 0 ? "" : ",", tindex, size,
+            numberOfInstances > 0 ? pathLength / numberOfInstances : 0);
+    for(n = offset; n < offset + size; n++) {
+      unvisited += visits[n] == 0;
+      if(nodes[n].children[0] != n - offset && nodes[n].fid > maxFeature) {
+        maxFeature = nodes[n].fid;
+      }
+    }
+    fprintf(fp, ", \"unvisitedNodes\": %ld,\n   \"visits\": [", unvisited);
+    for(n = offset; n < offset + size; n++) {
+      fprintf(fp, "%s%ld", n == offset ? "" : ", ", visits[n]);
+    }
+    fprintf(fp, "],\n   \"leafHits\": [");
+    int first = 1;
+    for(n = offset; n < offset + size; n++) {
+      if(nodes[n].children[0] == n - offset && s->leafHits[n] > 0) {
+        fprintf(fp, "%s[%ld, %ld]", first ? "" : ", ", n - offset, s->leafHits[n]);
+        first = 0;
+      }
+    }
+    fprintf(fp, "]}");
+  }
+  fprintf(fp, "\n ],\n");
+
+  // Internal nodes read their feature once per visit
+  long* accesses = (long*) calloc(maxFeature + 2, sizeof(long));
+  for(tindex = 0; tindex < s->numberOfTrees; tindex++) {
+    long end = tindex + 1 < s->numberOfTrees ? offsets[tindex + 1] : s->numberOfNodes;
+    for(n = offsets[tindex]; n < end; n++) {
+      if(nodes[n].children[0] != n - offsets[tindex]) {
+        accesses[nodes[n].fid] += visits[n];
+      }
+    }
+  }
+  int f;
+  fprintf(fp, " \"features\": [");
+  for(f = 0; f <= maxFeature; f++) {
+    fprintf(fp, "%s\n  {\"feature\": %d, \"accesses\": %ld}", f == 0 ? "" : ",",
+            featureIds ? featureIds[f] : f, accesses[f]);
+  }
+  fprintf(fp, "\n ],\n \"treeChunks\": [");
+  int c;
+  for(c = 0; c < s->numberOfChunks; c++) {
+    int last = getChunkEnd(c * TREE_STATS_CHUNK, s->numberOfTrees);
+    fprintf(fp, "%s\n  {\"firstTree\": %d, \"lastTree\": %d, \"nanoseconds\": %ld, "
+            "\"nanosecondsPerInstance\": %.1f}", c == 0 ? "" : ",", c * TREE_STATS_CHUNK,
+            last - 1, s->chunkNanoseconds[c],
+            numberOfInstances > 0 ? (double) s->chunkNanoseconds[c] / numberOfInstances : 0);
+  }
+  fprintf(fp, "\n ]}\n");
+  free(accesses);
+  free(visits);
+  return fclose(fp) == 0 ? 0 : -1;
+}
+
+#endif
+
+#endif
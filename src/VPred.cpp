@@ -0,0 +1,695 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include <math.h>
+#include "Struct.h"
+#include "VPred.h"
+#include "Compact.h"
+#include "VPredKernels.h"
+#include "Oblivious.h"
+#include "FixedPoint.h"
+#include "Blocking.h"
+#include "BinaryEnsemble.h"
+#include "JforestsEnsemble.h"
+#include "BinaryInstances.h"
+#include "SvmLight.h"
+#include "FeatureProjection.h"
+#include "ParseCommandLine.h"
+#include "ThreadPool.h"
+#include "TreeStats.h"
+
+/**
+ * Driver that evaluates test instances using the VPred
+ * implementation. Use the following command to run this driver:
+ *
+ * ./VPred -ensemble <ensemble-path> -instances <test-instances-path> \
+ *         -maxLeaves <max-number-of-leaves> [-print] [-scalar]
+ *         [-threads <number-of-threads>] [-compact bfs|veb]
+ *         [-oblivious [-obliviousBlowup <factor>]] [-fixedPoint 16|32]
+ *         [-hugePages] [-profile <profile-path>] [-stats <dump-path>]
+ *
+ * Trees are traversed by kernels that are generated for every tree depth
+ * (see VPredKernels.h). If the CPU supports AVX2 or AVX-512, they use
+ * gathers unless -scalar is given.
+ *
+ * With -groupDepths, trees are reordered so that trees of equal depth are
+ * consecutive, and each run of them is evaluated by a single loop instead
+ * of one kernel call per tree. Trees are then added to the scores in a
+ * different order, which may change their last bits.
+ *
+ * With -compact, trees are converted to the 8-byte nodes of Compact.h,
+ * stored breadth-first (bfs) or in van Emde Boas order (veb).
+ *
+ * With -oblivious, trees whose oblivious form needs at most <factor>
+ * (default 16) table entries per leaf are scored by a table lookup, and the
+ * other trees by the kernels above (see Oblivious.h).
+ *
+ * With -fixedPoint, leaf values are rounded to 16- or 32-bit fixed point
+ * and scores are summed as integers (see FixedPoint.h), which makes them
+ * independent of -threads, -blocked and -groupDepths.
+ *
+ * -instancesBinary <binary-instances-path> may replace -instances to
+ * memory-map instances converted by ConvertInstances.
+ *
+ * With -threads, blocks of instances (multiples of V) are scored by a pool
+ * of threads.
+ *
+ * With -blocked, trees are split into blocks of half the L2 cache and
+ * every block of instances runs through one block of trees after another
+ * (see Blocking.h). -treeBlock <KB> and -instanceBlock <instances> set the
+ * block sizes instead of picking them from the cache sizes, and imply
+ * -blocked.
+ *
+ * With -projectFeatures, feature ids are renumbered to the features the
+ * ensemble uses, and only those columns of the instances are stored (see
+ * FeatureProjection.h). Binary instances that were projected for the same
+ * ensemble by ConvertInstances -ensemble are used in place.
+ *
+ * With -hugePages, the features and a copy of the nodes are allocated in
+ * an arena backed by 2 MB pages (see Arena.h).
+ *
+ * With -profile, the nodes are packed with the child that more sample
+ * instances took right after its parent, using a profile written by
+ * ProfileEnsemble (see Profile.h). Scores are unchanged.
+ *
+ * With -stats, leaf hits and the time spent in every chunk of trees are
+ * recorded while scoring, and dumped as JSON with the node visits, path
+ * lengths and feature accesses derived from them (see TreeStats.h).
+ * Instances are then scored in blocks, as with -blocked. -stats is only
+ * available when built with make STATS=1.
+ */
+
+// Arguments of scoreInstances
+typedef struct ScoreContext ScoreContext;
+
+struct ScoreContext {
+  Node* nodes; // All trees
+  long* offsets; // Index of the root of each tree in "nodes"
+  long* depths; // Depth of each tree
+  int nbTrees;
+  float* features; // Padded to a multiple of V instances
+  int numberOfFeatures;
+  KernelTable<Node>* kernels;
+  CompactEnsemble* compact; // Used instead of nodes if set
+  KernelTable<CompactNode>* compactKernels;
+  ObliviousEnsemble* oblivious; // Used instead of nodes if set
+  AddTableScores tableKernel;
+  FixedPointLeaves* fixedPoint; // Leaf values, indexed by the ordinals in the leaves of nodes
+  AddFixedPointLeaves fixedPointKernel;
+  int groupDepths; // Whether runs of trees of equal depth are scored by one kernel
+  int* firstTrees; // Block k holds trees [firstTrees[k], firstTrees[k + 1])
+  int numberOfTreeBlocks;
+  int blockSize; // Instances per block
+  float* partials; // Partial scores, blockSize per thread
+  int32_t* fixedPartials; // Partial fixed-point scores, blockSize per thread
+  float* scores; // Output, one score per instance
+#ifdef TREE_STATS
+  TreeStats* stats; // Recorded while scoring if set
+#endif
+};
+
+/**
+ * Adds the leaves of trees [first, last) to the scores of V instances.
+ */
+void addScores(ScoreContext* c, float* block, int first, int last, float* scores) {
+  if(c->compact) {
+    CompactEnsemble* e = c->compact;
+    if(c->groupDepths) {
+      addGroupedScores(c->compactKernels, e->nodes, e->values, e->offsets, e->depths,
+                       first, last, block, c->numberOfFeatures, scores);
+    } else {
+      addTreeScores<V>(c->compactKernels, e->nodes, e->values, e->offsets, e->depths,
+                       first, last, block, c->numberOfFeatures, scores);
+    }
+    return;
+  }
+  if(c->oblivious) {
+    addObliviousScores(c->oblivious, c->tableKernel, c->kernels, block, c->numberOfFeatures,
+                       first, last, scores);
+    return;
+  }
+  if(c->groupDepths) {
+    addGroupedScores(c->kernels, c->nodes, (float*) 0, c->offsets, c->depths,
+                     first, last, block, c->numberOfFeatures, scores);
+  } else {
+    addTreeScores<V>(c->kernels, c->nodes, (float*) 0, c->offsets, c->depths,
+                     first, last, block, c->numberOfFeatures, scores);
+  }
+}
+
+#ifdef TREE_STATS
+/**
+ * Adds the leaves of trees [first, last) to the scores of V instances, as
+ * addScores or, with fixed-point scores, addFixedPointScores. Every chunk
+ * of trees is timed, and the leaves of the first count instances are
+ * counted (see TreeStats.h).
+ *
+ * @param fixedScores Fixed-point scores of the V instances, or 0 to add to
+ *        scores
+ */
+void addRecordedScores(ScoreContext* c, float* block, int first, int last, int count,
+                       float* scores, int32_t* fixedScores) {
+  int leaf[V];
+  int chunk, tindex, j;
+  for(chunk = first; chunk < last; chunk = getChunkEnd(chunk, last)) {
+    long start = getStatsTime();
+    if(fixedScores) {
+      addFixedPointScores(c->kernels, c->fixedPointKernel, c->fixedPoint, c->nodes, c->offsets,
+                          c->depths, chunk, getChunkEnd(chunk, last), block,
+                          c->numberOfFeatures, fixedScores);
+    } else {
+      addScores(c, block, chunk, getChunkEnd(chunk, last), scores);
+    }
+    recordChunkTime(c->stats, chunk, getStatsTime() - start);
+  }
+  for(tindex = first; tindex < last; tindex++) {
+    long offset = c->offsets[tindex];
+    getFindLeaves(c->kernels, c->depths[tindex])((int) c->depths[tindex], leaf, block,
+                                                 c->numberOfFeatures, &c->nodes[offset]);
+    for(j = 0; j < count; j++) {
+      recordLeaf(c->stats, offset + leaf[j]);
+    }
+  }
+}
+#endif
+
+/**
+ * Scores instances [begin, end) with fixed-point leaves, as scoreInstances.
+ */
+void scoreFixedPointInstances(ScoreContext* c, int begin, int end, int thread) {
+  int32_t* partial = &c->fixedPartials[(long) thread * c->blockSize];
+  int iIndex, k;
+  memset(partial, 0, (end - begin + V - 1) / V * V * sizeof(int32_t));
+  for(k = 0; k < c->numberOfTreeBlocks; k++) {
+    for(iIndex = begin; iIndex < end; iIndex += V) {
+      if(iIndex + V < end) {
+        prefetchFeatures(&c->features[(long) (iIndex + V) * c->numberOfFeatures],
+                         V * c->numberOfFeatures);
+      }
+#ifdef TREE_STATS
+      if(c->stats) {
+        // Padding after the last instance is not recorded
+        int count = end - iIndex < V ? end - iIndex : V;
+        addRecordedScores(c, &c->features[(long) iIndex * c->numberOfFeatures],
+                          c->firstTrees[k], c->firstTrees[k + 1], count,
+                          0, &partial[iIndex - begin]);
+        continue;
+      }
+#endif
+      addFixedPointScores(c->kernels, c->fixedPointKernel, c->fixedPoint, c->nodes, c->offsets,
+                          c->depths, c->firstTrees[k], c->firstTrees[k + 1],
+                          &c->features[(long) iIndex * c->numberOfFeatures],
+                          c->numberOfFeatures, &partial[iIndex - begin]);
+    }
+  }
+  for(iIndex = begin; iIndex < end; iIndex++) {
+    c->scores[iIndex] = getFixedPointScore(c->fixedPoint, partial[iIndex - begin]);
+  }
+}
+
+/**
+ * Scores instances [begin, end), where begin is a multiple of V
+ * (see ScoreBlock in ThreadPool.h). The instances run through one block of
+ * trees after another, accumulating into the partial scores of the thread.
+ * The features of the next V instances are prefetched while a block is
+ * scored.
+ */
+void scoreInstances(void* context, int begin, int end, int thread) {
+  ScoreContext* c = (ScoreContext*) context;
+  if(c->fixedPoint) {
+    scoreFixedPointInstances(c, begin, end, thread);
+    return;
+  }
+  float* partial = &c->partials[(long) thread * c->blockSize];
+  int iIndex, k;
+  for(iIndex = begin; iIndex < end; iIndex += V) {
+    memset(&partial[iIndex - begin], 0, V * sizeof(float));
+  }
+  for(k = 0; k < c->numberOfTreeBlocks; k++) {
+    for(iIndex = begin; iIndex < end; iIndex += V) {
+      if(iIndex + V < end) {
+        prefetchFeatures(&c->features[(long) (iIndex + V) * c->numberOfFeatures],
+                         V * c->numberOfFeatures);
+      }
+#ifdef TREE_STATS
+      if(c->stats) {
+        // Padding after the last instance is not recorded
+        int count = end - iIndex < V ? end - iIndex : V;
+        addRecordedScores(c, &c->features[(long) iIndex * c->numberOfFeatures],
+                          c->firstTrees[k], c->firstTrees[k + 1], count,
+                          &partial[iIndex - begin], 0);
+        continue;
+      }
+#endif
+      addScores(c, &c->features[(long) iIndex * c->numberOfFeatures],
+                c->firstTrees[k], c->firstTrees[k + 1], &partial[iIndex - begin]);
+    }
+  }
+  for(iIndex = begin; iIndex < end; iIndex++) {
+    c->scores[iIndex] = partial[iIndex - begin];
+  }
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  int printScores = isPresentCL(argc, args, (char*) "-print");
+  int numberOfThreads = 0;
+  if(isPresentCL(argc, args, (char*) "-threads")) {
+    numberOfThreads = atoi(getValueCL(argc, args, (char*) "-threads"));
+  }
+  int isa = selectKernelIsa<V>(isPresentCL(argc, args, (char*) "-scalar"));
+  int groupDepths = isPresentCL(argc, args, (char*) "-groupDepths");
+  int compactOrder = -1;
+  if(isPresentCL(argc, args, (char*) "-compact")) {
+    compactOrder = parseCompactOrder(getValueCL(argc, args, (char*) "-compact"));
+    if(compactOrder < 0) {
+      fprintf(stderr, "Unknown node order, expected bfs or veb\n");
+      return -1;
+    }
+  }
+  int obliviousBlowup = 0;
+  if(isPresentCL(argc, args, (char*) "-oblivious")) {
+    obliviousBlowup = OBLIVIOUS_DEFAULT_BLOWUP;
+    if(isPresentCL(argc, args, (char*) "-obliviousBlowup")) {
+      obliviousBlowup = atoi(getValueCL(argc, args, (char*) "-obliviousBlowup"));
+    }
+    if(compactOrder >= 0 || obliviousBlowup < 1) {
+      fprintf(stderr, "-oblivious takes a positive -obliviousBlowup and excludes -compact\n");
+      return -1;
+    }
+  }
+  int fixedPointBits = 0;
+  if(isPresentCL(argc, args, (char*) "-fixedPoint")) {
+    fixedPointBits = atoi(getValueCL(argc, args, (char*) "-fixedPoint"));
+    if((fixedPointBits != 16 && fixedPointBits != 32) || compactOrder >= 0 ||
+       obliviousBlowup > 0) {
+      fprintf(stderr, "-fixedPoint takes 16 or 32 and excludes -compact and -oblivious\n");
+      return -1;
+    }
+  }
+  int blocked = isPresentCL(argc, args, (char*) "-blocked") ||
+    isPresentCL(argc, args, (char*) "-treeBlock") ||
+    isPresentCL(argc, args, (char*) "-instanceBlock");
+  long treeBlockBytes = getCacheSize(2) / 2;
+  if(isPresentCL(argc, args, (char*) "-treeBlock")) {
+    treeBlockBytes = atol(getValueCL(argc, args, (char*) "-treeBlock")) * 1024;
+  }
+  int instanceBlockSize = 0;
+  if(isPresentCL(argc, args, (char*) "-instanceBlock")) {
+    instanceBlockSize = atoi(getValueCL(argc, args, (char*) "-instanceBlock"));
+  }
+  int projectFeatures = isPresentCL(argc, args, (char*) "-projectFeatures");
+  char* statsFile = getValueCL(argc, args, (char*) "-stats");
+#ifndef TREE_STATS
+  if(statsFile) {
+    fprintf(stderr, "-stats needs a build with make STATS=1\n");
+    return -1;
+  }
+#endif
+  BranchProfile* profile = 0;
+  if(isPresentCL(argc, args, (char*) "-profile")) {
+    profile = readBranchProfile(getValueCL(argc, args, (char*) "-profile"));
+    if(!profile) {
+      fprintf(stderr, "Could not read %s\n", getValueCL(argc, args, (char*) "-profile"));
+      return -1;
+    }
+  }
+  // Features (and, with -hugePages, the nodes scored) are allocated in one
+  // arena, freed at once
+  Arena* arena = createArena(isPresentCL(argc, args, (char*) "-hugePages"));
+
+  int nbTrees;
+  // Features read by a compiled or jforests ensemble, not checked for text ones
+  int ensembleFeatures = 0;
+  // Index of the root of each tree in all_nodes
+  long* nodeSizes;
+  // Depth of trees in ensemble
+  long* treeDepths;
+  // All trees packed into a single array
+  Node* all_nodes;
+  long numberOfNodes;
+  BinaryEnsemble* binaryEnsemble = 0;
+
+  if(isBinaryEnsemble(configFile) || isJforestsEnsemble(configFile)) {
+    // Score directly from the arrays of a compiled or jforests ensemble
+    binaryEnsemble = loadPackedEnsemble(configFile, maxNumberOfLeaves, numberOfThreads);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", configFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    nodeSizes = binaryEnsemble->offsets;
+    treeDepths = binaryEnsemble->depths;
+    all_nodes = binaryEnsemble->nodes;
+    numberOfNodes = binaryEnsemble->numberOfNodes;
+    ensembleFeatures = binaryEnsemble->numberOfFeatures;
+  } else {
+    // Read ensemble into a temporary tree structure, then pack all trees
+    Struct** trees;
+    Arena* treeArena = createArena(0);
+    nbTrees = readEnsemble(configFile, maxNumberOfLeaves, treeArena, &trees, &treeDepths);
+    if(nbTrees < 0) {
+      fprintf(stderr, "Could not read %s\n", configFile);
+      return -1;
+    }
+    nodeSizes = (long*) malloc(nbTrees * sizeof(long));
+    all_nodes = packTrees(trees, nbTrees, nodeSizes, &numberOfNodes, profile);
+    destroyArena(treeArena);
+    free(trees);
+    if(!all_nodes) {
+      fprintf(stderr, "Profile does not match the trees of %s\n", configFile);
+      return -1;
+    }
+  }
+
+  // Repack the trees of a compiled or jforests ensemble by the profile
+  if(profile && binaryEnsemble) {
+    Struct** trees = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    Arena* treeArena = createArena(0);
+    int tindex;
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      trees[tindex] = createStructFromNodes(treeArena, &all_nodes[nodeSizes[tindex]], 0);
+    }
+    nodeSizes = (long*) malloc(nbTrees * sizeof(long));
+    all_nodes = packTrees(trees, nbTrees, nodeSizes, &numberOfNodes, profile);
+    destroyArena(treeArena);
+    free(trees);
+    if(!all_nodes) {
+      fprintf(stderr, "Profile does not match the trees of %s\n", configFile);
+      return -1;
+    }
+    treeDepths = (long*) malloc(nbTrees * sizeof(long));
+    memcpy(treeDepths, binaryEnsemble->depths, nbTrees * sizeof(long));
+    unmapBinaryEnsemble(binaryEnsemble);
+    binaryEnsemble = 0;
+  }
+  if(profile) {
+    destroyBranchProfile(profile);
+  }
+
+  // Renumber the features of the nodes to the columns in use
+  FeatureProjection* projection = 0;
+  Node* packedNodes = all_nodes;
+  if(projectFeatures) {
+    projection = createFeatureProjection(all_nodes, nodeSizes, nbTrees, numberOfNodes);
+    all_nodes = projectNodes(projection, all_nodes, nodeSizes, nbTrees, numberOfNodes);
+  }
+
+  // Make trees of equal depth consecutive
+  Node* ungroupedNodes = all_nodes;
+  long* ungroupedOffsets = nodeSizes;
+  long* ungroupedDepths = treeDepths;
+  if(groupDepths) {
+    nodeSizes = (long*) malloc(nbTrees * sizeof(long));
+    treeDepths = (long*) malloc(nbTrees * sizeof(long));
+    all_nodes = groupTreesByDepth(ungroupedNodes, ungroupedOffsets, ungroupedDepths, nbTrees,
+                                  numberOfNodes, nodeSizes, treeDepths, 0);
+  }
+
+  // Convert the packed trees to the compact layout
+  CompactEnsemble* compact = 0;
+  if(compactOrder >= 0) {
+    compact = createCompactEnsemble(all_nodes, nodeSizes, nbTrees, numberOfNodes, compactOrder);
+    if(!compact) {
+      fprintf(stderr, "Feature ids or tree sizes of %s do not fit in 16 bits\n", configFile);
+      return -1;
+    }
+  }
+
+  // Convert shallow trees to lookup tables
+  ObliviousEnsemble* oblivious = 0;
+  if(obliviousBlowup > 0) {
+    oblivious = createObliviousEnsemble(all_nodes, nodeSizes, treeDepths, nbTrees,
+                                        numberOfNodes, obliviousBlowup);
+  }
+
+  // Round the leaves to fixed point, in a copy of the nodes whose leaves
+  // hold their ordinals
+  FixedPointLeaves* fixedPoint = 0;
+  Node* unfixedNodes = all_nodes;
+  if(fixedPointBits > 0) {
+    all_nodes = (Node*) malloc(numberOfNodes * sizeof(Node));
+    memcpy(all_nodes, unfixedNodes, numberOfNodes * sizeof(Node));
+    fixedPoint = createFixedPointLeaves(all_nodes, nodeSizes, nbTrees, numberOfNodes,
+                                        fixedPointBits);
+    if(!fixedPoint) {
+      fprintf(stderr, "-fixedPoint takes trees of fewer than %ld leaves\n",
+              FIXED_POINT_MAX_LEAVES);
+      return -1;
+    }
+  }
+
+  // Score from a copy of the nodes on huge pages
+  Node* heapNodes = all_nodes;
+  if(arena->hugePages) {
+    all_nodes = (Node*) copyToArena(arena, all_nodes, numberOfNodes * sizeof(Node));
+  }
+
+  // Split the trees into blocks; without -blocked, all trees form one block
+  int* firstTrees = (int*) malloc((nbTrees + 1) * sizeof(int));
+  int numberOfTreeBlocks;
+  if(compact) {
+    numberOfTreeBlocks = partitionTrees(compact->offsets, nbTrees, compact->numberOfNodes,
+                                        sizeof(CompactNode), blocked ? treeBlockBytes : 0,
+                                        firstTrees);
+  } else {
+    numberOfTreeBlocks = partitionTrees(nodeSizes, nbTrees, numberOfNodes, sizeof(Node),
+                                        blocked ? treeBlockBytes : 0, firstTrees);
+  }
+
+  // Read features into a flat array, padded to a multiple of V instances
+  // (see SvmLight.h). Features of a binary instance file are used in place
+  // when its padding is a multiple of V.
+  int numberOfInstances = 0;
+  int numberOfFeatures = 0;
+  float* features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  int iIndex = 0;
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    if(projection) {
+      numberOfFeatures = projection->numberOfColumns;
+      features = getProjectedFeatures(binaryInstances, projection, V, arena);
+    } else {
+      numberOfFeatures = binaryInstances->numberOfFeatures;
+      features = getRowMajorFeatures(binaryInstances, V, arena);
+    }
+  } else {
+    instances = projection ?
+      readProjectedInstances(featureFile, projection, V, numberOfThreads, arena) :
+      readInstances(featureFile, V, numberOfThreads, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = instances->features;
+  }
+
+  // Rows must hold every feature that a compiled or jforests ensemble reads
+  if(!projection && numberOfFeatures < ensembleFeatures) {
+    fprintf(stderr, "Instances have %d features, but the ensemble reads %d\n", numberOfFeatures,
+            ensembleFeatures);
+    return -1;
+  }
+
+  // Compute scores for V instances at a time and measure elapsed time
+  float scores[V] = {0};
+  int32_t fixedScores[V] = {0};
+  int sum = 0; // Dummy value just so gcc wouldn't optimize the loop out
+  int j = 0;
+  struct timeval start, end;
+
+  KernelTable<Node> kernels;
+  KernelTable<CompactNode> compactKernels;
+  initKernelTable<V>(&kernels, isa);
+  initKernelTable<V>(&compactKernels, isa);
+  ScoreContext context;
+  context.nodes = all_nodes;
+  context.offsets = nodeSizes;
+  context.depths = treeDepths;
+  context.nbTrees = nbTrees;
+  context.features = features;
+  context.numberOfFeatures = numberOfFeatures;
+  context.kernels = &kernels;
+  context.compact = compact;
+  context.compactKernels = &compactKernels;
+  context.oblivious = oblivious;
+  context.tableKernel = selectAddTableScores(isa);
+  context.fixedPoint = fixedPoint;
+  context.fixedPointKernel = selectAddFixedPointLeaves(isa);
+  context.groupDepths = groupDepths;
+  context.firstTrees = firstTrees;
+  context.numberOfTreeBlocks = numberOfTreeBlocks;
+#ifdef TREE_STATS
+  context.stats = statsFile ? createTreeStats(nbTrees, numberOfNodes) : 0;
+#endif
+
+  if(numberOfThreads > 0 || blocked || statsFile) {
+    // Score blocks of instances into a preallocated array, in parallel
+    // with -threads
+    context.scores = (float*) malloc(numberOfInstances * sizeof(float));
+    int poolSize = numberOfThreads > 0 ? numberOfThreads : 1;
+    ThreadStats* stats = (ThreadStats*) malloc(poolSize * sizeof(ThreadStats));
+    int blockSize;
+    if(!blocked) {
+      blockSize = getBlockSize(numberOfInstances, numberOfFeatures, poolSize, V);
+    } else if(instanceBlockSize > 0) {
+      blockSize = (instanceBlockSize + V - 1) / V * V;
+    } else {
+      blockSize = getInstanceBlockSize(numberOfInstances, numberOfFeatures, poolSize, V);
+    }
+    context.blockSize = blockSize;
+    context.partials = (float*) malloc((long) poolSize * blockSize * sizeof(float));
+    context.fixedPartials = (int32_t*) malloc((long) poolSize * blockSize * sizeof(int32_t));
+
+    gettimeofday(&start, NULL);
+    if(numberOfThreads > 0) {
+      scoreInParallel(numberOfThreads, numberOfInstances, blockSize,
+                      &scoreInstances, &context, stats);
+    } else {
+      for(iIndex = 0; iIndex < numberOfInstances; iIndex += blockSize) {
+        scoreInstances(&context, iIndex, iIndex + blockSize < numberOfInstances ?
+                       iIndex + blockSize : numberOfInstances, 0);
+      }
+    }
+    gettimeofday(&end, NULL);
+
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      if(printScores) {
+        printf("%f\n", context.scores[iIndex]);
+      }
+      sum += context.scores[iIndex];
+    }
+    if(blocked) {
+      printf("Tree blocks: %d, instances per block: %d\n", numberOfTreeBlocks, blockSize);
+    }
+    if(numberOfThreads > 0) {
+      printThreadStats(stats, numberOfThreads, numberOfInstances,
+                       (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6);
+    }
+    free(stats);
+    free(context.partials);
+    free(context.fixedPartials);
+    free(context.scores);
+  } else {
+    gettimeofday(&start, NULL);
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex+=V) {
+      if(iIndex + V < numberOfInstances) {
+        prefetchFeatures(&features[(long) (iIndex + V) * numberOfFeatures], V * numberOfFeatures);
+      }
+      if(fixedPoint) {
+        addFixedPointScores(&kernels, context.fixedPointKernel, fixedPoint, all_nodes, nodeSizes,
+                            treeDepths, 0, nbTrees, &features[iIndex * numberOfFeatures],
+                            numberOfFeatures, fixedScores);
+        for(j = 0; j < V; j++) {
+          scores[j] = getFixedPointScore(fixedPoint, fixedScores[j]);
+          fixedScores[j] = 0;
+        }
+      } else {
+        addScores(&context, &features[iIndex * numberOfFeatures], 0, nbTrees, scores);
+      }
+      for(j = 0; j < V; j++) {
+        // Skip the padding at the end of the last block
+        if(iIndex + j < numberOfInstances) {
+          if(printScores) {
+            printf("%f\n", scores[j]);
+          }
+          sum+=scores[j];
+        }
+        scores[j] = 0;
+      }
+    }
+    gettimeofday(&end, NULL);
+  }
+
+  printf("Time per instance (ns): %5.2f\n",
+         (((end.tv_sec * 1000000 + end.tv_usec) -
+           (start.tv_sec * 1000000 + start.tv_usec)) * 1000/((float) numberOfInstances)));
+  printf("Ignore this number: %d\n", sum);
+
+  if(projection) {
+    printf("Projected features: %d columns\n", projection->numberOfColumns);
+  }
+  if(fixedPoint) {
+    printf("Fixed point: %d bits, scale 2^%d, error at most %g\n", fixedPoint->bits,
+           fixedPoint->shift, getFixedPointError(fixedPoint));
+  }
+  if(oblivious) {
+    printf("Oblivious trees: %d of %d\n", oblivious->numberOfOblivious, nbTrees);
+  }
+
+  if(arena->hugePages) {
+    printArenaStats(arena);
+  }
+#ifdef TREE_STATS
+  if(context.stats) {
+    if(writeTreeStats(statsFile, context.stats, all_nodes, nodeSizes, numberOfInstances,
+                      projection ? projection->features : 0) != 0) {
+      fprintf(stderr, "Could not write %s\n", statsFile);
+    }
+    destroyTreeStats(context.stats);
+  }
+#endif
+
+  // Free used memory
+  free(firstTrees);
+  all_nodes = heapNodes;
+  if(fixedPoint) {
+    free(all_nodes);
+    all_nodes = unfixedNodes;
+  }
+  if(groupDepths) {
+    free(all_nodes);
+    free(nodeSizes);
+    free(treeDepths);
+    all_nodes = ungroupedNodes;
+    nodeSizes = ungroupedOffsets;
+    treeDepths = ungroupedDepths;
+  }
+  if(projection) {
+    free(all_nodes);
+    all_nodes = packedNodes;
+    destroyFeatureProjection(projection);
+  }
+  if(compact) {
+    destroyCompactEnsemble(compact);
+  }
+  if(oblivious) {
+    destroyObliviousEnsemble(oblivious);
+  }
+  if(fixedPoint) {
+    destroyFixedPointLeaves(fixedPoint);
+  }
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
+  }
+  destroyArena(arena);
+  if(binaryEnsemble) {
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    free(all_nodes);
+    free(treeDepths);
+    free(nodeSizes);
+  }
+  return 0;
+}
@@ -0,0 +1,175 @@
+#ifndef VPRED_H_GUARD
+#define VPRED_H_GUARD
+
+#include<stdlib.h>
+#include<string.h>
+#include "Struct.h"
+#include "Node.h"
+#include "Profile.h"
+
+// Number of instances that are evaluated together. Can be overridden
+// at compile time with -DV=<n>; the vectorized kernels are used when V is
+// a multiple of 8 (AVX2) or 16 (AVX-512).
+#ifndef V
+#define V 16
+#endif
+
+/**
+ * Organizes a tree with a depth-first traversal. Without a profile, the
+ * left subtree comes first; with one, the subtree that more instances
+ * reached (see Profile.h).
+ *
+ * @param root Root of the tree
+ * @param i Index of the next available node in the new array
+ * @param nodes New node array
+ * @param counts Branch counts of the tree (see getTreeBranchCounts), or 0
+ * @param position Index of root with the left subtree first, which
+ *        indexes counts
+ * @return Updated index
+ */
+int createNodes(Struct* root, long i, Node* nodes, const long* counts, long position) {
+  // Copy information from old node to current node at index i
+  nodes[i].fid = root->fid;
+  nodes[i].theta = root->threshold;
+
+  // If left and right subtrees do not exist, create a self-loop
+  // and point the node to itself.
+  if(!root->left && !root->right) {
+    nodes[i].children[0] = i;
+    nodes[i].children[1] = i;
+  } else {
+    //otherwise, first pack the hotter subtree, then the other one. The
+    //position of the right subtree takes the size of the left one, which
+    //is counted only if the right subtree goes first (never without a profile)
+    Struct* children[2] = {root->left, root->right};
+    int first = getHotterChild(counts, position);
+    long positions[2] = {position + 1, first ? position + 1 + countNodes(root->left) : 0};
+    nodes[i].children[first] = i + 1;
+    int last = createNodes(children[first], i + 1, nodes, counts, positions[first]);
+    if(!first) {
+      positions[1] = position + 1 + last - i;
+    }
+    nodes[i].children[1 - first] = last + 1;
+    i = createNodes(children[1 - first], last + 1, nodes, counts, positions[1 - first]);
+  }
+  return i;
+}
+
+/**
+ * Packs all trees into a single array, thereby avoiding two-D arrays.
+ *
+ * @param trees Roots of the trees
+ * @param nbTrees Number of trees
+ * @param offsets Output, index of the root of each tree in the array
+ * @param numberOfNodes Output, total number of nodes
+ * @param profile Branch profile to order the subtrees by, or 0 to put
+ *        left subtrees first
+ * @return Array of nodes, or 0 if the profile was made for other trees
+ */
+Node* packTrees(Struct** trees, int nbTrees, long* offsets, long* numberOfNodes,
+                const BranchProfile* profile) {
+  long totalNodes = 0;
+  int tindex;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    offsets[tindex] = totalNodes;
+    totalNodes += countNodes(trees[tindex]);
+  }
+  if(profile && !matchesBranchProfile(profile, offsets, nbTrees, totalNodes)) {
+    return 0;
+  }
+  Node* nodes = (Node*) malloc(totalNodes * sizeof(Node));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    createNodes(trees[tindex], 0, &nodes[offsets[tindex]],
+                profile ? getTreeBranchCounts(profile, tindex) : 0, 0);
+  }
+  long n;
+  for(n = 0; n < totalNodes; n++) {
+    nodes[n].fid = abs(nodes[n].fid);
+  }
+  *numberOfNodes = totalNodes;
+  return nodes;
+}
+
+/**
+ * Reorders packed trees by depth, so that trees of equal depth are
+ * consecutive and can be evaluated by one kernel in a single loop (see
+ * VPredKernels.h). Trees of equal depth keep their order, but the scores
+ * add the trees in the new order, which may change their last bits.
+ *
+ * @param nodes Packed trees (see packTrees)
+ * @param offsets Index of the root of each tree in nodes
+ * @param depths Depth of each tree
+ * @param nbTrees Number of trees
+ * @param numberOfNodes Total number of nodes
+ * @param groupedOffsets Output, index of the root of each tree in the new array
+ * @param groupedDepths Output, depth of each tree in the new order
+ * @param order Output, original index of each tree in the new order, or 0
+ * @return New node array
+ */
+Node* groupTreesByDepth(const Node* nodes, const long* offsets, const long* depths,
+                        int nbTrees, long numberOfNodes, long* groupedOffsets,
+                        long* groupedDepths, int* order) {
+  long maxDepth = 0;
+  int tindex;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    if(depths[tindex] > maxDepth) {
+      maxDepth = depths[tindex];
+    }
+  }
+  // Counting sort, stable within a depth
+  long* firsts = (long*) calloc(maxDepth + 2, sizeof(long));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    firsts[depths[tindex] + 1]++;
+  }
+  long d;
+  for(d = 1; d <= maxDepth + 1; d++) {
+    firsts[d] += firsts[d - 1];
+  }
+
+  Node* grouped = (Node*) malloc((numberOfNodes + 1) * sizeof(Node));
+  int* positions = (int*) malloc(nbTrees * sizeof(int));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    positions[tindex] = (int) firsts[depths[tindex]]++;
+  }
+  long* sizes = (long*) malloc(nbTrees * sizeof(long));
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+    sizes[positions[tindex]] = end - offsets[tindex];
+    groupedDepths[positions[tindex]] = depths[tindex];
+    if(order) {
+      order[positions[tindex]] = tindex;
+    }
+  }
+  long offset = 0;
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    groupedOffsets[tindex] = offset;
+    offset += sizes[tindex];
+  }
+  // Children are relative to the root, so trees are copied as they are
+  for(tindex = 0; tindex < nbTrees; tindex++) {
+    memcpy(&grouped[groupedOffsets[positions[tindex]]], &nodes[offsets[tindex]],
+           sizes[positions[tindex]] * sizeof(Node));
+  }
+  free(sizes);
+  free(positions);
+  free(firsts);
+  return grouped;
+}
+
+/**
+ * Prefetches the feature rows of a block of instances, one cache line at
+ * a time, so that they load while the previous block is scored.
+ *
+ * @param rows Features of the block
+ * @param count Number of floats in the block
+ */
+void prefetchFeatures(const float* rows, long count) {
+  const char* p = (const char*) rows;
+  long bytes = count * sizeof(float);
+  long b;
+  for(b = 0; b < bytes; b += 64) {
+    __builtin_prefetch(p + b);
+  }
+}
+
+#endif
@@ -0,0 +1,462 @@
+#ifndef VPRED_KERNELS_H_GUARD
+#define VPRED_KERNELS_H_GUARD
+
+#include <utility>
+#include "Node.h"
+#include "VPred.h"
+#include "Compact.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/**
+ * VPred traversal kernels, generated at compile time. A kernel finds the
+ * leaves of Width instances in a tree, advancing all instances one level
+ * at a time, so that the loads of different instances are independent of
+ * each other. Kernels are templates on the depth of the tree, the number
+ * of instances and the node type (Node, or the CompactNode of Compact.h),
+ * and are instantiated for every depth up to MAX_UNROLLED_DEPTH, with
+ * the levels fully unrolled. Deeper trees use the instantiation for
+ * depth 0, which reads the depth at run time.
+ *
+ * There are two ways of calling them:
+ *
+ *   findLeaves[depth] evaluates one tree, through one indirect call per
+ *     tree and block of instances.
+ *   addGroupScores[depth] evaluates a run of consecutive trees of the same
+ *     depth in a single loop, with the traversal inlined. Trees are
+ *     grouped that way by groupTreesByDepth in VPred.h.
+ *
+ * Each kernel exists for plain C++ (KERNEL_SCALAR), and for AVX2 and
+ * AVX-512, where a level takes one gather per node field and one for the
+ * features of the instances.
+ */
+
+// Deepest tree whose kernel is unrolled
+#define MAX_UNROLLED_DEPTH 16
+
+// Instruction sets of the kernels
+#define KERNEL_SCALAR 0
+#define KERNEL_AVX2 1
+#define KERNEL_AVX512 2
+
+/**
+ * Access to the fields of a node type, for one instance (child) or for 8
+ * and 16 instances at a time (step).
+ */
+template<typename NodeType>
+struct NodeTraits;
+
+template<>
+struct NodeTraits<Node> {
+  static inline int child(const Node* node, const float* features) {
+    return node->children[features[node->fid] > node->theta];
+  }
+
+  // Leaves hold their regression value in theta
+  static inline float value(const Node* nodes, const float* values, long leaf) {
+    return nodes[leaf].theta;
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  /**
+   * Moves 8 instances to the children of their nodes. Each Node is 4
+   * ints: fid, theta, children[0], children[1].
+   *
+   * @param rows Offset of the feature vector of each instance
+   */
+  __attribute__((target("avx2")))
+  static inline __m256i step(const Node* nodes, __m256i idx, const float* features,
+                             __m256i rows) {
+    const int* fields = (const int*) nodes;
+    __m256i base = _mm256_slli_epi32(idx, 2);
+    __m256i fid = _mm256_i32gather_epi32(fields, base, 4);
+    __m256 theta = _mm256_i32gather_ps((const float*) fields + 1, base, 4);
+    __m256 x = _mm256_i32gather_ps(features, _mm256_add_epi32(rows, fid), 4);
+    // All ones (-1) where x > theta, which moves the index to children[1]
+    __m256i right = _mm256_castps_si256(_mm256_cmp_ps(x, theta, _CMP_GT_OQ));
+    return _mm256_i32gather_epi32(
+      fields, _mm256_sub_epi32(_mm256_add_epi32(base, _mm256_set1_epi32(2)), right), 4);
+  }
+
+  __attribute__((target("avx512f")))
+  static inline __m512i step(const Node* nodes, __m512i idx, const float* features,
+                             __m512i rows) {
+    const int* fields = (const int*) nodes;
+    __m512i base = _mm512_slli_epi32(idx, 2);
+    __m512i fid = _mm512_i32gather_epi32(base, fields, 4);
+    __m512 theta = _mm512_i32gather_ps(base, (const float*) fields + 1, 4);
+    __m512 x = _mm512_i32gather_ps(_mm512_add_epi32(rows, fid), features, 4);
+    __mmask16 right = _mm512_cmp_ps_mask(x, theta, _CMP_GT_OQ);
+    __m512i child = _mm512_add_epi32(base, _mm512_set1_epi32(2));
+    child = _mm512_mask_add_epi32(child, right, child, _mm512_set1_epi32(1));
+    return _mm512_i32gather_epi32(child, fields, 4);
+  }
+#endif
+};
+
+template<>
+struct NodeTraits<CompactNode> {
+  static inline int child(const CompactNode* node, const float* features) {
+    return node->left + (features[node->fid] > node->threshold);
+  }
+
+  static inline float value(const CompactNode* nodes, const float* values, long leaf) {
+    return values[leaf];
+  }
+
+#if defined(__x86_64__) || defined(__i386__)
+  /**
+   * Moves 8 instances to the children of their nodes. A node is two
+   * ints, the threshold and fid | left << 16.
+   */
+  __attribute__((target("avx2")))
+  static inline __m256i step(const CompactNode* nodes, __m256i idx, const float* features,
+                             __m256i rows) {
+    const int* fields = (const int*) nodes;
+    __m256i base = _mm256_slli_epi32(idx, 1);
+    __m256 theta = _mm256_i32gather_ps((const float*) fields, base, 4);
+    __m256i packed = _mm256_i32gather_epi32(fields + 1, base, 4);
+    __m256i fid = _mm256_and_si256(packed, _mm256_set1_epi32(0xffff));
+    __m256 x = _mm256_i32gather_ps(features, _mm256_add_epi32(rows, fid), 4);
+    __m256i right = _mm256_castps_si256(_mm256_cmp_ps(x, theta, _CMP_GT_OQ));
+    return _mm256_sub_epi32(_mm256_srli_epi32(packed, 16), right);
+  }
+
+  __attribute__((target("avx512f")))
+  static inline __m512i step(const CompactNode* nodes, __m512i idx, const float* features,
+                             __m512i rows) {
+    const int* fields = (const int*) nodes;
+    __m512i base = _mm512_slli_epi32(idx, 1);
+    __m512 theta = _mm512_i32gather_ps(base, (const float*) fields, 4);
+    __m512i packed = _mm512_i32gather_epi32(base, fields + 1, 4);
+    __m512i fid = _mm512_and_si512(packed, _mm512_set1_epi32(0xffff));
+    __m512 x = _mm512_i32gather_ps(_mm512_add_epi32(rows, fid), features, 4);
+    __mmask16 right = _mm512_cmp_ps_mask(x, theta, _CMP_GT_OQ);
+    __m512i left = _mm512_srli_epi32(packed, 16);
+    return _mm512_mask_add_epi32(left, right, left, _mm512_set1_epi32(1));
+  }
+#endif
+};
+
+/**
+ * Kernels of one instruction set. Each specialization provides
+ *
+ *   traverse<Depth>: the inlined traversal of one tree
+ *   findLeaves<Depth>: traverse as a function
+ *   addGroupScores<Depth>: the leaves of trees [first, last), added to the
+ *     scores of Width instances
+ *
+ * where Depth 0 stands for the depth argument.
+ */
+template<int Width, typename NodeType, int Isa>
+struct VPredKernels;
+
+template<int Width, typename NodeType>
+struct VPredKernels<Width, NodeType, KERNEL_SCALAR> {
+  // Advances all instances by Levels levels, unrolled
+  template<int Levels>
+  static inline __attribute__((always_inline))
+  void descend(int* leaves, const float* features, int numberOfFeatures,
+               const NodeType* nodes) {
+    if constexpr(Levels > 0) {
+      int j;
+#pragma GCC unroll 4
+      for(j = 0; j < Width; j++) {
+        leaves[j] = NodeTraits<NodeType>::child(&nodes[leaves[j]],
+                                                &features[j * numberOfFeatures]);
+      }
+      descend<Levels - 1>(leaves, features, numberOfFeatures, nodes);
+    }
+  }
+
+  template<int Depth>
+  static inline __attribute__((always_inline))
+  void traverse(int depth, int* leaves, const float* features, int numberOfFeatures,
+                const NodeType* nodes) {
+    int j, d;
+    for(j = 0; j < Width; j++) {
+      leaves[j] = 0;
+    }
+    if constexpr(Depth > 0) {
+      descend<Depth>(leaves, features, numberOfFeatures, nodes);
+    } else {
+      for(d = 0; d < depth; d++) {
+        descend<1>(leaves, features, numberOfFeatures, nodes);
+      }
+    }
+  }
+
+  template<int Depth>
+  static void findLeaves(int depth, int* leaves, const float* features, int numberOfFeatures,
+                         const NodeType* nodes) {
+    traverse<Depth>(depth, leaves, features, numberOfFeatures, nodes);
+  }
+
+  template<int Depth>
+  static void addGroupScores(int depth, const NodeType* nodes, const float* values,
+                             const long* offsets, int first, int last, const float* features,
+                             int numberOfFeatures, float* scores) {
+    int leaf[Width];
+    int tindex, j;
+    for(tindex = first; tindex < last; tindex++) {
+      long offset = offsets[tindex];
+      traverse<Depth>(depth, leaf, features, numberOfFeatures, &nodes[offset]);
+      for(j = 0; j < Width; j++) {
+        scores[j] += NodeTraits<NodeType>::value(nodes, values, offset + leaf[j]);
+      }
+    }
+  }
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+
+template<int Width, typename NodeType>
+struct VPredKernels<Width, NodeType, KERNEL_AVX2> {
+  template<int Levels>
+  static inline __attribute__((always_inline, target("avx2")))
+  __m256i descend(const NodeType* nodes, __m256i idx, const float* features, __m256i rows) {
+    if constexpr(Levels > 0) {
+      return descend<Levels - 1>(nodes, NodeTraits<NodeType>::step(nodes, idx, features, rows),
+                                 features, rows);
+    }
+    return idx;
+  }
+
+  template<int Depth>
+  static inline __attribute__((always_inline, target("avx2")))
+  void traverse(int depth, int* leaves, const float* features, int numberOfFeatures,
+                const NodeType* nodes) {
+    __m256i rows = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                      _mm256_set1_epi32(numberOfFeatures));
+    int j, d;
+    for(j = 0; j + 8 <= Width; j += 8) {
+      const float* block = &features[j * numberOfFeatures];
+      __m256i idx = _mm256_setzero_si256();
+      if constexpr(Depth > 0) {
+        idx = descend<Depth>(nodes, idx, block, rows);
+      } else {
+        for(d = 0; d < depth; d++) {
+          idx = NodeTraits<NodeType>::step(nodes, idx, block, rows);
+        }
+      }
+      _mm256_storeu_si256((__m256i*) &leaves[j], idx);
+    }
+  }
+
+  template<int Depth>
+  __attribute__((target("avx2")))
+  static void findLeaves(int depth, int* leaves, const float* features, int numberOfFeatures,
+                         const NodeType* nodes) {
+    traverse<Depth>(depth, leaves, features, numberOfFeatures, nodes);
+  }
+
+  template<int Depth>
+  __attribute__((target("avx2")))
+  static void addGroupScores(int depth, const NodeType* nodes, const float* values,
+                             const long* offsets, int first, int last, const float* features,
+                             int numberOfFeatures, float* scores) {
+    int leaf[Width];
+    int tindex, j;
+    for(tindex = first; tindex < last; tindex++) {
+      long offset = offsets[tindex];
+      traverse<Depth>(depth, leaf, features, numberOfFeatures, &nodes[offset]);
+      for(j = 0; j < Width; j++) {
+        scores[j] += NodeTraits<NodeType>::value(nodes, values, offset + leaf[j]);
+      }
+    }
+  }
+};
+
+template<int Width, typename NodeType>
+struct VPredKernels<Width, NodeType, KERNEL_AVX512> {
+  template<int Levels>
+  static inline __attribute__((always_inline, target("avx512f")))
+  __m512i descend(const NodeType* nodes, __m512i idx, const float* features, __m512i rows) {
+    if constexpr(Levels > 0) {
+      return descend<Levels - 1>(nodes, NodeTraits<NodeType>::step(nodes, idx, features, rows),
+                                 features, rows);
+    }
+    return idx;
+  }
+
+  template<int Depth>
+  static inline __attribute__((always_inline, target("avx512f")))
+  void traverse(int depth, int* leaves, const float* features, int numberOfFeatures,
+                const NodeType* nodes) {
+    __m512i rows = _mm512_mullo_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                        8, 9, 10, 11, 12, 13, 14, 15),
+                                      _mm512_set1_epi32(numberOfFeatures));
+    int j, d;
+    for(j = 0; j + 16 <= Width; j += 16) {
+      const float* block = &features[j * numberOfFeatures];
+      __m512i idx = _mm512_setzero_si512();
+      if constexpr(Depth > 0) {
+        idx = descend<Depth>(nodes, idx, block, rows);
+      } else {
+        for(d = 0; d < depth; d++) {
+          idx = NodeTraits<NodeType>::step(nodes, idx, block, rows);
+        }
+      }
+      _mm512_storeu_si512((void*) &leaves[j], idx);
+    }
+  }
+
+  template<int Depth>
+  __attribute__((target("avx512f")))
+  static void findLeaves(int depth, int* leaves, const float* features, int numberOfFeatures,
+                         const NodeType* nodes) {
+    traverse<Depth>(depth, leaves, features, numberOfFeatures, nodes);
+  }
+
+  template<int Depth>
+  __attribute__((target("avx512f")))
+  static void addGroupScores(int depth, const NodeType* nodes, const float* values,
+                             const long* offsets, int first, int last, const float* features,
+                             int numberOfFeatures, float* scores) {
+    int leaf[Width];
+    int tindex, j;
+    for(tindex = first; tindex < last; tindex++) {
+      long offset = offsets[tindex];
+      traverse<Depth>(depth, leaf, features, numberOfFeatures, &nodes[offset]);
+      for(j = 0; j < Width; j++) {
+        scores[j] += NodeTraits<NodeType>::value(nodes, values, offset + leaf[j]);
+      }
+    }
+  }
+};
+
+#endif
+
+/**
+ * Kernels for all depths of one node type and instruction set. Entry 0
+ * takes trees of any depth.
+ */
+template<typename NodeType>
+struct KernelTable {
+  typedef void (*FindLeaves)(int depth, int* leaves, const float* features,
+                             int numberOfFeatures, const NodeType* nodes);
+  typedef void (*AddGroupScores)(int depth, const NodeType* nodes, const float* values,
+                                 const long* offsets, int first, int last,
+                                 const float* features, int numberOfFeatures, float* scores);
+
+  int isa;
+  FindLeaves findLeaves[MAX_UNROLLED_DEPTH + 1];
+  AddGroupScores addGroupScores[MAX_UNROLLED_DEPTH + 1];
+};
+
+template<typename Kernels, typename NodeType, int... Depths>
+void fillKernelTable(KernelTable<NodeType>* table, std::integer_sequence<int, Depths...>) {
+  typename KernelTable<NodeType>::FindLeaves findLeaves[] = {
+    &Kernels::template findLeaves<Depths>...
+  };
+  typename KernelTable<NodeType>::AddGroupScores addGroupScores[] = {
+    &Kernels::template addGroupScores<Depths>...
+  };
+  int d;
+  for(d = 0; d <= MAX_UNROLLED_DEPTH; d++) {
+    table->findLeaves[d] = findLeaves[d];
+    table->addGroupScores[d] = addGroupScores[d];
+  }
+}
+
+/**
+ * Picks the widest instruction set supported by the CPU for Width
+ * instances.
+ *
+ * @param scalar Whether to use the scalar kernels regardless of the CPU
+ */
+template<int Width>
+int selectKernelIsa(int scalar) {
+#if defined(__x86_64__) || defined(__i386__)
+  if(!scalar) {
+    __builtin_cpu_init();
+    if(Width % 16 == 0 && __builtin_cpu_supports("avx512f")) {
+      return KERNEL_AVX512;
+    }
+    if(Width % 8 == 0 && __builtin_cpu_supports("avx2")) {
+      return KERNEL_AVX2;
+    }
+  }
+#endif
+  return KERNEL_SCALAR;
+}
+
+/**
+ * Fills a kernel table for Width instances.
+ *
+ * @param isa KERNEL_SCALAR, KERNEL_AVX2 or KERNEL_AVX512 (see selectKernelIsa)
+ */
+template<int Width, typename NodeType>
+void initKernelTable(KernelTable<NodeType>* table, int isa) {
+  typedef std::make_integer_sequence<int, MAX_UNROLLED_DEPTH + 1> Depths;
+  table->isa = isa;
+#if defined(__x86_64__) || defined(__i386__)
+  if(isa == KERNEL_AVX512) {
+    fillKernelTable<VPredKernels<Width, NodeType, KERNEL_AVX512> >(table, Depths());
+    return;
+  }
+  if(isa == KERNEL_AVX2) {
+    fillKernelTable<VPredKernels<Width, NodeType, KERNEL_AVX2> >(table, Depths());
+    return;
+  }
+#endif
+  table->isa = KERNEL_SCALAR;
+  fillKernelTable<VPredKernels<Width, NodeType, KERNEL_SCALAR> >(table, Depths());
+}
+
+/**
+ * @return Kernel for one tree of the given depth
+ */
+template<typename NodeType>
+inline typename KernelTable<NodeType>::FindLeaves getFindLeaves(const KernelTable<NodeType>* table,
+                                                               long depth) {
+  return table->findLeaves[depth <= MAX_UNROLLED_DEPTH ? depth : 0];
+}
+
+/**
+ * Adds the leaves of trees [first, last) to the scores of Width instances,
+ * one tree at a time.
+ *
+ * @param values Leaf values for CompactNode, ignored for Node
+ */
+template<int Width, typename NodeType>
+void addTreeScores(const KernelTable<NodeType>* table, const NodeType* nodes,
+                   const float* values, const long* offsets, const long* depths,
+                   int first, int last, const float* features, int numberOfFeatures,
+                   float* scores) {
+  int leaf[Width];
+  int tindex, j;
+  for(tindex = first; tindex < last; tindex++) {
+    long offset = offsets[tindex];
+    getFindLeaves(table, depths[tindex])((int) depths[tindex], leaf, features,
+                                         numberOfFeatures, &nodes[offset]);
+    for(j = 0; j < Width; j++) {
+      scores[j] += NodeTraits<NodeType>::value(nodes, values, offset + leaf[j]);
+    }
+  }
+}
+
+/**
+ * Adds the leaves of trees [first, last) to the scores of Width instances,
+ * with one call per run of consecutive trees of equal depth. Trees are
+ * added in the same order as by addTreeScores.
+ */
+template<typename NodeType>
+void addGroupedScores(const KernelTable<NodeType>* table, const NodeType* nodes,
+                      const float* values, const long* offsets, const long* depths,
+                      int first, int last, const float* features, int numberOfFeatures,
+                      float* scores) {
+  while(first < last) {
+    long depth = depths[first];
+    int end = first + 1;
+    while(end < last && depths[end] == depth) {
+      end++;
+    }
+    table->addGroupScores[depth <= MAX_UNROLLED_DEPTH ? depth : 0](
+      (int) depth, nodes, values, offsets, first, end, features, numberOfFeatures, scores);
+    first = end;
+  }
+}
+
+#endif
@@ -0,0 +1,415 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "../BinaryInstances.h"
+#include "../SvmLight.h"
+#include "../ParseCommandLine.h"
+#include "../Interleave.h"
+#include "OptTrees.h"
+
+/**
+ * Benchmark harness that runs every implementation of libopttrees over the
+ * same ensemble and instances. Use the following command to run it:
+ *
+ * ./Benchmark -ensemble <ensemble-path> -instances <test-instances-path> \
+ *             -maxLeaves <max-number-of-leaves>
+ *             [-instancesBinary <binary-instances-path>]
+ *             [-layouts <name,name,...>] [-warmup <runs>]
+ *             [-repetitions <runs>] [-batchSize <instances>]
+ *             [-cpu <cpu, or -1 to not pin>] [-format text|json|csv]
+ *             [-hugePages] [-interleaveGroup <traversals>]
+ *
+ * For every layout, the instances are scored -warmup times without
+ * measurement, and then -repetitions times in two modes: one instance at a
+ * time with scoreInstance, and in batches of -batchSize instances with
+ * scoreBatch. Every call is timed with CLOCK_MONOTONIC, and the median and
+ * 99th percentile of the per-instance and per-batch latencies are
+ * reported. -batchSize is lowered to the number of instances if it is
+ * larger, and a last, partial batch is scored but left out of the batch
+ * latencies, so that they all cover batches of the same size. Where
+ * perf_event_open is available, cycles, instructions, branch misses and
+ * LLC misses of the batch runs are reported per instance. -interleaveGroup
+ * sets the number of traversals kept in flight by the interleaved layouts
+ * (see Interleave.h).
+ */
+
+typedef struct Layout Layout;
+
+struct Layout {
+  const char* name;
+  OptTreesLayout layout;
+};
+
+const Layout LAYOUTS[] = {
+  {"object", OPT_TREES_OBJECT},
+  {"struct", OPT_TREES_STRUCT},
+  {"structplus", OPT_TREES_STRUCT_PLUS},
+  {"vpred", OPT_TREES_VPRED},
+  {"quickscorer", OPT_TREES_QUICK_SCORER},
+  {"quantized", OPT_TREES_QUANTIZED},
+  {"compact", OPT_TREES_COMPACT},
+  {"compact-veb", OPT_TREES_COMPACT_VEB},
+  {"vpred-grouped", OPT_TREES_VPRED_GROUPED},
+  {"struct-predicated", OPT_TREES_STRUCT_PREDICATED},
+  {"structplus-predicated", OPT_TREES_STRUCT_PLUS_PREDICATED},
+  {"oblivious", OPT_TREES_OBLIVIOUS},
+  {"vpred-fixed16", OPT_TREES_VPRED_FIXED16},
+  {"vpred-fixed32", OPT_TREES_VPRED_FIXED32},
+  {"struct-interleaved", OPT_TREES_STRUCT_INTERLEAVED},
+  {"structplus-interleaved", OPT_TREES_STRUCT_PLUS_INTERLEAVED}
+};
+#define NUMBER_OF_LAYOUTS ((int) (sizeof(LAYOUTS) / sizeof(Layout)))
+
+// Hardware counters, in the order of COUNTER_NAMES
+#define NUMBER_OF_COUNTERS 4
+const char* COUNTER_NAMES[NUMBER_OF_COUNTERS] = {
+  "cycles", "instructions", "branchMisses", "llcMisses"
+};
+const unsigned long long COUNTER_CONFIGS[NUMBER_OF_COUNTERS] = {
+  PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES
+};
+
+typedef struct Result Result;
+
+struct Result {
+  const char* layout;
+  int numberOfTrees;
+  double instanceMedian; // Latency of scoreInstance (ns)
+  double instanceP99;
+  double batchMedian; // Latency of scoreBatch (ns)
+  double batchP99;
+  double batchPerInstanceMedian; // Median of the batch latencies per instance (ns)
+  double counters[NUMBER_OF_COUNTERS]; // Per instance, negative if unavailable
+  double checksum; // Sum of all scores of one run
+};
+
+double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+int compareDoubles(const void* a, const void* b) {
+  double x = *(const double*) a;
+  double y = *(const double*) b;
+  return (x > y) - (x < y);
+}
+
+/**
+ * Nearest-rank percentile of an array, which is sorted in place.
+ */
+double percentile(double* values, long n, double p) {
+  qsort(values, n, sizeof(double), compareDoubles);
+  long rank = (long) (p * n + 0.999999);
+  if(rank < 1) {
+    rank = 1;
+  }
+  return values[rank - 1];
+}
+
+/**
+ * Opens a counter for the calling thread, disabled until enableCounters.
+ *
+ * @return File descriptor, or -1 if the counter is not available
+ */
+int openCounter(unsigned long long config) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+void enableCounters(int* fds, int enable) {
+  int c;
+  for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+    if(fds[c] >= 0) {
+      if(enable) {
+        ioctl(fds[c], PERF_EVENT_IOC_RESET, 0);
+      }
+      ioctl(fds[c], enable ? PERF_EVENT_IOC_ENABLE : PERF_EVENT_IOC_DISABLE, 0);
+    }
+  }
+}
+
+/**
+ * Reads a counter, scaled up if the kernel multiplexed it.
+ *
+ * @return Counter value, or -1 if not available
+ */
+double readCounter(int fd) {
+  unsigned long long values[3]; // Value, time enabled, time running
+  if(fd < 0 || read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+    return -1;
+  }
+  return (double) values[0] * values[1] / values[2];
+}
+
+void printResults(Result* results, int numberOfResults, const char* format,
+                  int numberOfInstances, int repetitions, int batchSize, int cpu,
+                  int interleaveGroup) {
+  int r, c;
+  if(!strcmp(format, "json")) {
+    printf("{\"instances\": %d, \"repetitions\": %d, \"batchSize\": %d, \"cpu\": %d,\n"
+           " \"interleaveGroup\": %d, \"results\": [\n", numberOfInstances, repetitions,
+           batchSize, cpu, interleaveGroup);
+    for(r = 0; r < numberOfResults; r++) {
+      Result* x = &results[r];
+      printf("  {\"layout\": \"%s\", \"trees\": %d, "
+             "\"instanceMedianNs\": %.1f, \"instanceP99Ns\": %.1f, "
+             "\"batchMedianNs\": %.1f, \"batchP99Ns\": %.1f, "
+             "\"batchPerInstanceMedianNs\": %.1f",
+             x->layout, x->numberOfTrees, x->instanceMedian, x->instanceP99,
+             x->batchMedian, x->batchP99, x->batchPerInstanceMedian);
+      for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        if(x->counters[c] >= 0) {
+          printf(", \"%sPerInstance\": %.1f", COUNTER_NAMES[c], x->counters[c]);
+        } else {
+          printf(", \"%sPerInstance\": null", COUNTER_NAMES[c]);
+        }
+      }
+      printf(", \"checksum\": %.6g}%s\n", x->checksum, r + 1 < numberOfResults ? "," : "");
+    }
+    printf(" ]}\n");
+  } else if(!strcmp(format, "csv")) {
+    printf("layout,trees,instances,repetitions,batchSize,interleaveGroup,"
+           "instanceMedianNs,instanceP99Ns,"
+           "batchMedianNs,batchP99Ns,batchPerInstanceMedianNs");
+    for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+      printf(",%sPerInstance", COUNTER_NAMES[c]);
+    }
+    printf(",checksum\n");
+    for(r = 0; r < numberOfResults; r++) {
+      Result* x = &results[r];
+      printf("%s,%d,%d,%d,%d,%d,%.1f,%.1f,%.1f,%.1f,%.1f", x->layout, x->numberOfTrees,
+             numberOfInstances, repetitions, batchSize, interleaveGroup, x->instanceMedian,
+             x->instanceP99, x->batchMedian, x->batchP99, x->batchPerInstanceMedian);
+      for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        if(x->counters[c] >= 0) {
+          printf(",%.1f", x->counters[c]);
+        } else {
+          printf(",");
+        }
+      }
+      printf(",%.6g\n", x->checksum);
+    }
+  } else {
+    printf("%-22s %14s %14s %14s %14s %12s %12s %12s %12s\n", "layout",
+           "instance p50", "instance p99", "batch p50", "batch p99",
+           "cycles/inst", "instr/inst", "brmiss/inst", "llcmiss/inst");
+    for(r = 0; r < numberOfResults; r++) {
+      Result* x = &results[r];
+      printf("%-22s %14.1f %14.1f %14.1f %14.1f", x->layout, x->instanceMedian,
+             x->instanceP99, x->batchMedian, x->batchP99);
+      for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+        if(x->counters[c] >= 0) {
+          printf(" %12.1f", x->counters[c]);
+        } else {
+          printf(" %12s", "n/a");
+        }
+      }
+      printf("\n");
+    }
+    printf("Latencies in ns; %d instances, %d repetitions, batches of %d, "
+           "interleaved groups of %d\n", numberOfInstances, repetitions, batchSize,
+           interleaveGroup);
+  }
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  // All layouts unless -layouts is given
+  const char* layouts = isPresentCL(argc, args, (char*) "-layouts") ?
+    getValueCL(argc, args, (char*) "-layouts") : 0;
+  int warmup = isPresentCL(argc, args, (char*) "-warmup") ?
+    atoi(getValueCL(argc, args, (char*) "-warmup")) : 2;
+  int repetitions = isPresentCL(argc, args, (char*) "-repetitions") ?
+    atoi(getValueCL(argc, args, (char*) "-repetitions")) : 10;
+  int batchSize = isPresentCL(argc, args, (char*) "-batchSize") ?
+    atoi(getValueCL(argc, args, (char*) "-batchSize")) : 256;
+  int cpu = isPresentCL(argc, args, (char*) "-cpu") ?
+    atoi(getValueCL(argc, args, (char*) "-cpu")) : 0;
+  int interleaveGroup = isPresentCL(argc, args, (char*) "-interleaveGroup") ?
+    atoi(getValueCL(argc, args, (char*) "-interleaveGroup")) : INTERLEAVE_DEFAULT_GROUP;
+  const char* format = isPresentCL(argc, args, (char*) "-format") ?
+    getValueCL(argc, args, (char*) "-format") : "text";
+  if(repetitions < 1 || batchSize < 1 || warmup < 0 || interleaveGroup < 1) {
+    fprintf(stderr, "Invalid -repetitions, -warmup, -batchSize or -interleaveGroup\n");
+    return -1;
+  }
+
+  // Read instances into a row-major matrix
+  int numberOfInstances, numberOfFeatures;
+  float* features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  Arena* arena = createArena(isPresentCL(argc, args, (char*) "-hugePages"));
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    features = getRowMajorFeatures(binaryInstances, 1, arena);
+  } else {
+    instances = readInstances(featureFile, 1, 0, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = instances->features;
+  }
+  if(numberOfInstances == 0) {
+    fprintf(stderr, "No instances in %s\n", featureFile ? featureFile : binaryFeatureFile);
+    return -1;
+  }
+
+  // Pin after reading, which uses all CPUs
+  if(cpu >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if(sched_setaffinity(0, sizeof(set), &set) != 0) {
+      fprintf(stderr, "Could not pin to CPU %d\n", cpu);
+      return -1;
+    }
+  }
+
+  int fds[NUMBER_OF_COUNTERS];
+  int c;
+  for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+    fds[c] = openCounter(COUNTER_CONFIGS[c]);
+  }
+
+  if(batchSize > numberOfInstances) {
+    batchSize = numberOfInstances;
+  }
+  int numberOfBatches = (numberOfInstances + batchSize - 1) / batchSize;
+  // Batches of batchSize instances, which are timed
+  int fullBatches = numberOfInstances / batchSize;
+  float* scores = (float*) malloc(numberOfInstances * sizeof(float));
+  double* instanceTimes = (double*) malloc((long) repetitions * numberOfInstances * sizeof(double));
+  double* batchTimes = (double*) malloc((long) repetitions * fullBatches * sizeof(double));
+  Result* results = (Result*) malloc(NUMBER_OF_LAYOUTS * sizeof(Result));
+  int numberOfResults = 0;
+  int status = 0;
+
+  int l;
+  for(l = 0; l < NUMBER_OF_LAYOUTS; l++) {
+    // Match whole names in the comma-separated list
+    const char* p = layouts ? strstr(layouts, LAYOUTS[l].name) : LAYOUTS[l].name;
+    size_t length = strlen(LAYOUTS[l].name);
+    while(layouts && p &&
+          ((p != layouts && p[-1] != ',') || (p[length] != 0 && p[length] != ','))) {
+      p = strstr(p + 1, LAYOUTS[l].name);
+    }
+    if(!p) {
+      continue;
+    }
+
+    OptTreesScorer* scorer = loadScorer(configFile, maxNumberOfLeaves, LAYOUTS[l].layout);
+    if(!scorer) {
+      fprintf(stderr, "Could not load %s with layout %s\n", configFile, LAYOUTS[l].name);
+      status = -1;
+      continue;
+    }
+    setInterleaveGroup(scorer, interleaveGroup);
+    if(getInterleaveGroup(scorer) > 0) {
+      // Report the group size after clamping
+      interleaveGroup = getInterleaveGroup(scorer);
+    }
+
+    Result* result = &results[numberOfResults++];
+    result->layout = LAYOUTS[l].name;
+    result->numberOfTrees = getNumberOfTrees(scorer);
+    int run, i, b;
+    for(run = 0; run < warmup; run++) {
+      scoreBatch(scorer, features, numberOfInstances, numberOfFeatures, scores);
+    }
+
+    // One instance at a time
+    result->checksum = 0;
+    for(run = 0; run < repetitions; run++) {
+      for(i = 0; i < numberOfInstances; i++) {
+        double start = now();
+        scores[i] = scoreInstance(scorer, &features[(long) i * numberOfFeatures]);
+        instanceTimes[(long) run * numberOfInstances + i] = now() - start;
+      }
+    }
+    for(i = 0; i < numberOfInstances; i++) {
+      result->checksum += scores[i];
+    }
+
+    // Batches, with counters enabled
+    enableCounters(fds, 1);
+    for(run = 0; run < repetitions; run++) {
+      for(b = 0; b < numberOfBatches; b++) {
+        int first = b * batchSize;
+        int count = numberOfInstances - first < batchSize ? numberOfInstances - first : batchSize;
+        double start = now();
+        scoreBatch(scorer, &features[(long) first * numberOfFeatures], count,
+                   numberOfFeatures, &scores[first]);
+        if(b < fullBatches) {
+          batchTimes[(long) run * fullBatches + b] = now() - start;
+        }
+      }
+    }
+    enableCounters(fds, 0);
+    for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+      double value = readCounter(fds[c]);
+      result->counters[c] = value < 0 ? -1 : value / ((double) repetitions * numberOfInstances);
+    }
+
+    result->instanceMedian = percentile(instanceTimes, (long) repetitions * numberOfInstances, 0.5);
+    result->instanceP99 = percentile(instanceTimes, (long) repetitions * numberOfInstances, 0.99);
+    result->batchMedian = percentile(batchTimes, (long) repetitions * fullBatches, 0.5);
+    result->batchP99 = percentile(batchTimes, (long) repetitions * fullBatches, 0.99);
+    result->batchPerInstanceMedian = result->batchMedian / batchSize;
+    destroyScorer(scorer);
+  }
+
+  printResults(results, numberOfResults, format, numberOfInstances, repetitions,
+               batchSize, cpu, interleaveGroup);
+
+  for(c = 0; c < NUMBER_OF_COUNTERS; c++) {
+    if(fds[c] >= 0) {
+      close(fds[c]);
+    }
+  }
+  free(results);
+  free(batchTimes);
+  free(instanceTimes);
+  free(scores);
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
+  }
+  destroyArena(arena);
+  return status;
+}
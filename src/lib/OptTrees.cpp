@@ -0,0 +1,600 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <alloca.h>
+#include <pthread.h>
+#include "../Object.h"
+#include "../Struct.h"
+#include "../StructPlus.h"
+#include "../VPred.h"
+#include "../VPredKernels.h"
+#include "../QuickScorer.h"
+#include "../Quantized.h"
+#include "../Compact.h"
+#include "../Oblivious.h"
+#include "../FixedPoint.h"
+#include "../Blocking.h"
+#include "../BinaryEnsemble.h"
+#include "../JforestsEnsemble.h"
+#include "../Epoch.h"
+#include "OptTrees.h"
+
+/**
+ * Implementation of libopttrees. The ensemble is either read from a text
+ * file or mapped from a compiled ensemble (see BinaryEnsemble.h), and then
+ * converted to the requested layout. VPred uses a mapped file in place.
+ */
+
+// Number of trees per QuickScorer block. The bitvectors of a block are
+// kept on the stack while scoring, so that scoring does not allocate.
+#define QUICK_SCORER_BLOCK 1024
+
+// Maximum size of the bins of V instances in scoreBatch for the quantized
+// layout, which are kept on the stack
+#define QUANTIZED_BATCH_BYTES (64 * 1024)
+
+struct OptTreesScorer {
+  OptTreesLayout layout;
+  int numberOfTrees;
+  int numberOfFeatures; // 1 + the largest feature id of any node
+
+  // Nodes of the Object, Struct and StructPlus layouts
+  Arena* arena;
+
+  // Object layout
+  Object** objects;
+
+  // Struct layout
+  Struct** structs;
+
+  // StructPlus layout
+  StructPlus** structPlus;
+
+  // Traversals in flight per instance of the interleaved layouts
+  int groupSize;
+
+  // VPred layout
+  Node* nodes; // All trees packed into a single array
+  long* offsets; // Index of the root of each tree in "nodes"
+  long* depths; // Depth of each tree, also for the predicated Struct layouts
+  KernelTable<Node> kernels;
+  int* treeOrder; // Index of each tree in the file, if reordered by depth
+  BinaryEnsemble* binaryEnsemble; // Set if the arrays are mapped or imported from a file
+  FixedPointLeaves* fixedPoint; // Leaf values of the fixed-point layouts
+  AddFixedPointLeaves addFixedPointLeaves;
+
+  // QuickScorer layout, one structure per block of trees
+  QuickScorer** blocks;
+  int numberOfBlocks;
+
+  // Quantized layout
+  QuantizedEnsemble* quantized;
+
+  // Compact layouts
+  CompactEnsemble* compact;
+  KernelTable<CompactNode> compactKernels;
+
+  // Oblivious layout, with kernels for the trees it leaves to VPred
+  ObliviousEnsemble* oblivious;
+  AddTableScores addTableScores;
+
+  // Blocks of trees that fit in L2, for scoreBatch with VPred, the compact
+  // and the oblivious layouts (see Blocking.h)
+  int* firstTrees;
+  int numberOfTreeBlocks;
+};
+
+/**
+ * Walks a single instance down a VPred tree.
+ */
+static inline int findLeafVPred(const Node* nodes, long depth, const float* features) {
+  int idx = 0;
+  long d;
+  for(d = 0; d < depth; d++) {
+    idx = nodes[idx].children[features[nodes[idx].fid] > nodes[idx].theta];
+  }
+  return idx;
+}
+
+OptTreesScorer* loadScorer(const char* ensemblePath, int maxLeaves, OptTreesLayout layout) {
+  // All layouts are created from the flat VPred arrays, which are either
+  // mapped from a compiled ensemble, imported from a jforests ensemble or
+  // packed from a text ensemble
+  BinaryEnsemble* binaryEnsemble = 0;
+  Node* nodes;
+  long* offsets;
+  long* depths;
+  long numberOfNodes;
+  int nbTrees;
+
+  if(isBinaryEnsemble(ensemblePath) || isJforestsEnsemble(ensemblePath)) {
+    binaryEnsemble = loadPackedEnsemble(ensemblePath, maxLeaves,
+                                        (int) sysconf(_SC_NPROCESSORS_ONLN));
+    if(!binaryEnsemble) {
+      return 0;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    numberOfNodes = binaryEnsemble->numberOfNodes;
+    maxLeaves = binaryEnsemble->maxLeaves;
+    nodes = binaryEnsemble->nodes;
+    offsets = binaryEnsemble->offsets;
+    depths = binaryEnsemble->depths;
+  } else {
+    Struct** trees;
+    Arena* treeArena = createArena(0);
+    nbTrees = readEnsemble(ensemblePath, maxLeaves, treeArena, &trees, &depths);
+    if(nbTrees < 0) {
+      destroyArena(treeArena);
+      return 0;
+    }
+    offsets = (long*) malloc(nbTrees * sizeof(long));
+    nodes = packTrees(trees, nbTrees, offsets, &numberOfNodes, 0);
+    destroyArena(treeArena);
+    free(trees);
+  }
+
+  if(nbTrees < 0) {
+    return 0;
+  }
+
+  OptTreesScorer* scorer = (OptTreesScorer*) calloc(1, sizeof(OptTreesScorer));
+  scorer->layout = layout;
+  scorer->numberOfTrees = nbTrees;
+  scorer->numberOfFeatures = getRequiredFeatures(nodes, numberOfNodes);
+  if(layout == OPT_TREES_STRUCT_INTERLEAVED || layout == OPT_TREES_STRUCT_PLUS_INTERLEAVED) {
+    scorer->groupSize = INTERLEAVE_DEFAULT_GROUP;
+  }
+  int tindex;
+  int ok = 1;
+
+  switch(layout) {
+  case OPT_TREES_OBJECT:
+    scorer->arena = createArena(0);
+    scorer->objects = new Object*[nbTrees];
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      scorer->objects[tindex] = createObjectFromNodes(scorer->arena, &nodes[offsets[tindex]], 0);
+    }
+    break;
+  case OPT_TREES_STRUCT:
+  case OPT_TREES_STRUCT_PREDICATED:
+  case OPT_TREES_STRUCT_INTERLEAVED:
+    scorer->arena = createArena(0);
+    scorer->structs = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      scorer->structs[tindex] = createStructFromNodes(scorer->arena, &nodes[offsets[tindex]], 0);
+    }
+    if(layout == OPT_TREES_STRUCT_PREDICATED) {
+      scorer->depths = (long*) malloc(nbTrees * sizeof(long));
+      for(tindex = 0; tindex < nbTrees; tindex++) {
+        scorer->depths[tindex] = getDepth(scorer->structs[tindex]);
+      }
+    }
+    break;
+  case OPT_TREES_STRUCT_PLUS:
+  case OPT_TREES_STRUCT_PLUS_PREDICATED:
+  case OPT_TREES_STRUCT_PLUS_INTERLEAVED:
+    scorer->arena = createArena(0);
+    scorer->structPlus = (StructPlus**) malloc(nbTrees * sizeof(StructPlus*));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      long end = tindex + 1 < nbTrees ? offsets[tindex + 1] : numberOfNodes;
+      scorer->structPlus[tindex] = createStructPlusFromNodes(scorer->arena, &nodes[offsets[tindex]],
+                                                             end - offsets[tindex]);
+    }
+    if(layout == OPT_TREES_STRUCT_PLUS_PREDICATED) {
+      scorer->depths = (long*) malloc(nbTrees * sizeof(long));
+      for(tindex = 0; tindex < nbTrees; tindex++) {
+        scorer->depths[tindex] = getDepth(scorer->structPlus[tindex]);
+      }
+    }
+    break;
+  case OPT_TREES_VPRED:
+    // The arrays are used in place
+    scorer->nodes = nodes;
+    scorer->offsets = offsets;
+    scorer->depths = depths;
+    scorer->binaryEnsemble = binaryEnsemble;
+    nodes = 0;
+    offsets = 0;
+    depths = 0;
+    binaryEnsemble = 0;
+    initKernelTable<V>(&scorer->kernels, selectKernelIsa<V>(0));
+    break;
+  case OPT_TREES_VPRED_FIXED16:
+  case OPT_TREES_VPRED_FIXED32:
+    // The leaves of the copied nodes hold their ordinals
+    scorer->nodes = (Node*) malloc(numberOfNodes * sizeof(Node));
+    scorer->offsets = (long*) malloc(nbTrees * sizeof(long));
+    scorer->depths = (long*) malloc(nbTrees * sizeof(long));
+    memcpy(scorer->nodes, nodes, numberOfNodes * sizeof(Node));
+    memcpy(scorer->offsets, offsets, nbTrees * sizeof(long));
+    memcpy(scorer->depths, depths, nbTrees * sizeof(long));
+    scorer->fixedPoint = createFixedPointLeaves(scorer->nodes, offsets, nbTrees, numberOfNodes,
+                                                layout == OPT_TREES_VPRED_FIXED16 ? 16 : 32);
+    initKernelTable<V>(&scorer->kernels, selectKernelIsa<V>(0));
+    scorer->addFixedPointLeaves = selectAddFixedPointLeaves(scorer->kernels.isa);
+    ok = scorer->fixedPoint != 0;
+    break;
+  case OPT_TREES_VPRED_GROUPED:
+    scorer->offsets = (long*) malloc(nbTrees * sizeof(long));
+    scorer->depths = (long*) malloc(nbTrees * sizeof(long));
+    scorer->treeOrder = (int*) malloc(nbTrees * sizeof(int));
+    scorer->nodes = groupTreesByDepth(nodes, offsets, depths, nbTrees, numberOfNodes,
+                                      scorer->offsets, scorer->depths, scorer->treeOrder);
+    initKernelTable<V>(&scorer->kernels, selectKernelIsa<V>(0));
+    break;
+  case OPT_TREES_QUICK_SCORER: {
+    Arena* treeArena = createArena(0);
+    Struct** trees = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      trees[tindex] = createStructFromNodes(treeArena, &nodes[offsets[tindex]], 0);
+    }
+    scorer->numberOfBlocks = (nbTrees + QUICK_SCORER_BLOCK - 1) / QUICK_SCORER_BLOCK;
+    scorer->blocks = (QuickScorer**) calloc(scorer->numberOfBlocks, sizeof(QuickScorer*));
+    int b;
+    for(b = 0; b < scorer->numberOfBlocks && ok; b++) {
+      int first = b * QUICK_SCORER_BLOCK;
+      int count = nbTrees - first < QUICK_SCORER_BLOCK ? nbTrees - first : QUICK_SCORER_BLOCK;
+      scorer->blocks[b] = createQuickScorer(&trees[first], count, maxLeaves);
+      ok = scorer->blocks[b] != 0;
+    }
+    destroyArena(treeArena);
+    free(trees);
+    break;
+  }
+  case OPT_TREES_QUANTIZED:
+    scorer->quantized = createQuantizedEnsemble(nodes, offsets, depths, nbTrees, numberOfNodes);
+    ok = scorer->quantized != 0;
+    break;
+  case OPT_TREES_COMPACT:
+  case OPT_TREES_COMPACT_VEB:
+    scorer->compact = createCompactEnsemble(nodes, offsets, nbTrees, numberOfNodes,
+                                            layout == OPT_TREES_COMPACT ?
+                                            COMPACT_BREADTH_FIRST : COMPACT_VAN_EMDE_BOAS);
+    initKernelTable<V>(&scorer->compactKernels, selectKernelIsa<V>(0));
+    ok = scorer->compact != 0;
+    break;
+  case OPT_TREES_OBLIVIOUS:
+    scorer->oblivious = createObliviousEnsemble(nodes, offsets, depths, nbTrees, numberOfNodes,
+                                                OBLIVIOUS_DEFAULT_BLOWUP);
+    initKernelTable<V>(&scorer->kernels, selectKernelIsa<V>(0));
+    scorer->addTableScores = selectAddTableScores(scorer->kernels.isa);
+    break;
+  default:
+    ok = 0;
+  }
+
+  if(ok && (scorer->nodes || scorer->compact || scorer->oblivious)) {
+    scorer->firstTrees = (int*) malloc((nbTrees + 1) * sizeof(int));
+    // Fixed-point sums of V instances are kept on the stack while all trees
+    // are added, so those layouts use a single block
+    long treeBlockBytes = scorer->fixedPoint ? 0 : getCacheSize(2) / 2;
+    if(scorer->compact) {
+      scorer->numberOfTreeBlocks =
+        partitionTrees(scorer->compact->offsets, nbTrees, scorer->compact->numberOfNodes,
+                       sizeof(CompactNode), treeBlockBytes, scorer->firstTrees);
+    } else {
+      // Oblivious trees are blocked by the size of their nodes
+      scorer->numberOfTreeBlocks =
+        partitionTrees(scorer->oblivious ? offsets : scorer->offsets, nbTrees, numberOfNodes,
+                       sizeof(Node), treeBlockBytes, scorer->firstTrees);
+    }
+  }
+
+  if(binaryEnsemble) {
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    free(nodes);
+    free(offsets);
+    free(depths);
+  }
+
+  if(!ok) {
+    destroyScorer(scorer);
+    return 0;
+  }
+  return scorer;
+}
+
+float scoreInstance(const OptTreesScorer* scorer, const float* features) {
+  float* featureVector = (float*) features;
+  float score = 0;
+  int tindex;
+
+  switch(scorer->layout) {
+  case OPT_TREES_OBJECT:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      score += scorer->objects[tindex]->getLeaf(featureVector, 0);
+    }
+    break;
+  case OPT_TREES_STRUCT:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      score += getLeaf(scorer->structs[tindex], featureVector)->threshold;
+    }
+    break;
+  case OPT_TREES_STRUCT_PLUS:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      score += getLeaf(scorer->structPlus[tindex], featureVector)->threshold;
+    }
+    break;
+  case OPT_TREES_STRUCT_PREDICATED:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      score += getLeafPredicated(scorer->structs[tindex], featureVector,
+                                 scorer->depths[tindex])->threshold;
+    }
+    break;
+  case OPT_TREES_STRUCT_PLUS_PREDICATED:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      score += getLeafPredicated(scorer->structPlus[tindex], featureVector,
+                                 scorer->depths[tindex])->threshold;
+    }
+    break;
+  case OPT_TREES_STRUCT_INTERLEAVED:
+    score = getScoreInterleaved(scorer->structs, scorer->numberOfTrees, featureVector,
+                                scorer->groupSize);
+    break;
+  case OPT_TREES_STRUCT_PLUS_INTERLEAVED:
+    score = getScoreInterleaved(scorer->structPlus, scorer->numberOfTrees, featureVector,
+                                scorer->groupSize);
+    break;
+  case OPT_TREES_VPRED:
+  case OPT_TREES_VPRED_GROUPED:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      const Node* nodes = &scorer->nodes[scorer->offsets[tindex]];
+      score += nodes[findLeafVPred(nodes, scorer->depths[tindex], features)].theta;
+    }
+    break;
+  case OPT_TREES_QUICK_SCORER: {
+    unsigned long long v[QUICK_SCORER_BLOCK];
+    int b;
+    for(b = 0; b < scorer->numberOfBlocks; b++) {
+      score += getScore(scorer->blocks[b], featureVector, v);
+    }
+    break;
+  }
+  case OPT_TREES_QUANTIZED: {
+    // Features beyond the largest fid of the ensemble are never read
+    const Quantizer* q = &scorer->quantized->quantizer;
+    void* bins = alloca((long) q->numberOfFeatures * q->binSize);
+    quantizeInstance(q, features, q->numberOfFeatures, bins);
+    score = getQuantizedScore(scorer->quantized, bins);
+    break;
+  }
+  case OPT_TREES_COMPACT:
+  case OPT_TREES_COMPACT_VEB:
+    score = getCompactScore(scorer->compact, features);
+    break;
+  case OPT_TREES_OBLIVIOUS:
+    score = getObliviousScore(scorer->oblivious, features);
+    break;
+  case OPT_TREES_VPRED_FIXED16:
+  case OPT_TREES_VPRED_FIXED32: {
+    int32_t sum = 0;
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      const Node* tree = &scorer->nodes[scorer->offsets[tindex]];
+      sum += getFixedPointLeaf(scorer->fixedPoint, tindex,
+                               &tree[findLeafVPred(tree, scorer->depths[tindex], features)]);
+    }
+    score = getFixedPointScore(scorer->fixedPoint, sum);
+    break;
+  }
+  }
+  return score;
+}
+
+/**
+ * Adds the leaves of trees [first, last) to the scores of V instances, for
+ * VPred, the compact and the oblivious layouts.
+ */
+static void addBlockScores(const OptTreesScorer* scorer, const float* features,
+                           int numberOfFeatures, int first, int last, float* scores) {
+  if(scorer->compact) {
+    CompactEnsemble* e = scorer->compact;
+    addTreeScores<V>(&scorer->compactKernels, e->nodes, e->values, e->offsets, e->depths,
+                     first, last, features, numberOfFeatures, scores);
+    return;
+  }
+  if(scorer->fixedPoint) {
+    int32_t sums[V] = {0};
+    int j;
+    addFixedPointScores(&scorer->kernels, scorer->addFixedPointLeaves, scorer->fixedPoint,
+                        scorer->nodes, scorer->offsets, scorer->depths, first, last, features,
+                        numberOfFeatures, sums);
+    for(j = 0; j < V; j++) {
+      scores[j] += getFixedPointScore(scorer->fixedPoint, sums[j]);
+    }
+    return;
+  }
+  if(scorer->oblivious) {
+    addObliviousScores(scorer->oblivious, scorer->addTableScores, &scorer->kernels, features,
+                       numberOfFeatures, first, last, scores);
+    return;
+  }
+  if(scorer->layout == OPT_TREES_VPRED_GROUPED) {
+    addGroupedScores(&scorer->kernels, scorer->nodes, (float*) 0, scorer->offsets,
+                     scorer->depths, first, last, features, numberOfFeatures, scores);
+  } else {
+    addTreeScores<V>(&scorer->kernels, scorer->nodes, (float*) 0, scorer->offsets,
+                     scorer->depths, first, last, features, numberOfFeatures, scores);
+  }
+}
+
+void scoreBatch(const OptTreesScorer* scorer, const float* features,
+                int numberOfInstances, int numberOfFeatures, float* scores) {
+  int iIndex = 0;
+
+  // VPred, the compact and the oblivious layouts evaluate V instances at a
+  // time; the remainder is scored below. Blocks of instances whose features
+  // fit in L3 run through one block of trees after another, accumulating
+  // into scores. The features of the next V instances are prefetched while
+  // a block is scored.
+  if(scorer->firstTrees) {
+    int numberOfBlocked = numberOfInstances / V * V;
+    int blockSize = getInstanceBlockSize(numberOfBlocked, numberOfFeatures, 1, V);
+    int begin, k;
+    for(begin = 0; begin < numberOfBlocked; begin += blockSize) {
+      int end = begin + blockSize < numberOfBlocked ? begin + blockSize : numberOfBlocked;
+      memset(&scores[begin], 0, (end - begin) * sizeof(float));
+      for(k = 0; k < scorer->numberOfTreeBlocks; k++) {
+        for(iIndex = begin; iIndex < end; iIndex += V) {
+          if(iIndex + V < end) {
+            prefetchFeatures(&features[(long) (iIndex + V) * numberOfFeatures],
+                             V * numberOfFeatures);
+          }
+          addBlockScores(scorer, &features[(long) iIndex * numberOfFeatures], numberOfFeatures,
+                         scorer->firstTrees[k], scorer->firstTrees[k + 1], &scores[iIndex]);
+        }
+      }
+    }
+    iIndex = numberOfBlocked;
+  }
+
+  // The quantized layout converts V instances at a time to bins on the
+  // stack, unless that takes more than QUANTIZED_BATCH_BYTES
+  if(scorer->layout == OPT_TREES_QUANTIZED) {
+    const Quantizer* q = &scorer->quantized->quantizer;
+    long rowSize = (long) q->numberOfFeatures * q->binSize;
+    if(rowSize * V <= QUANTIZED_BATCH_BYTES) {
+      char* bins = (char*) alloca(rowSize * V);
+      int j;
+      for(; iIndex + V <= numberOfInstances; iIndex += V) {
+        for(j = 0; j < V; j++) {
+          quantizeInstance(q, &features[(long) (iIndex + j) * numberOfFeatures],
+                           numberOfFeatures, &bins[j * rowSize]);
+        }
+        scoreQuantizedBlock(scorer->quantized, bins, &scores[iIndex]);
+      }
+    }
+  }
+
+  for(; iIndex < numberOfInstances; iIndex++) {
+    scores[iIndex] = scoreInstance(scorer, &features[(long) iIndex * numberOfFeatures]);
+  }
+}
+
+int getBatchMultiple(const OptTreesScorer* scorer) {
+  switch(scorer->layout) {
+  case OPT_TREES_VPRED:
+  case OPT_TREES_VPRED_GROUPED:
+  case OPT_TREES_QUANTIZED:
+  case OPT_TREES_COMPACT:
+  case OPT_TREES_COMPACT_VEB:
+  case OPT_TREES_OBLIVIOUS:
+  case OPT_TREES_VPRED_FIXED16:
+  case OPT_TREES_VPRED_FIXED32:
+    return V;
+  default:
+    return 1;
+  }
+}
+
+int getNumberOfTrees(const OptTreesScorer* scorer) {
+  return scorer->numberOfTrees;
+}
+
+int getNumberOfFeatures(const OptTreesScorer* scorer) {
+  return scorer->numberOfFeatures;
+}
+
+void setInterleaveGroup(OptTreesScorer* scorer, int groupSize) {
+  if(scorer->groupSize > 0) {
+    scorer->groupSize = clampInterleaveGroup(groupSize);
+  }
+}
+
+int getInterleaveGroup(const OptTreesScorer* scorer) {
+  return scorer->groupSize;
+}
+
+void destroyScorer(OptTreesScorer* scorer) {
+  if(scorer->arena) {
+    destroyArena(scorer->arena);
+  }
+  delete[] scorer->objects;
+  free(scorer->structs);
+  free(scorer->structPlus);
+  if(scorer->binaryEnsemble) {
+    unmapBinaryEnsemble(scorer->binaryEnsemble);
+  } else {
+    free(scorer->nodes);
+    free(scorer->offsets);
+    free(scorer->depths);
+  }
+  if(scorer->blocks) {
+    int b;
+    for(b = 0; b < scorer->numberOfBlocks; b++) {
+      if(scorer->blocks[b]) {
+        destroyQuickScorer(scorer->blocks[b]);
+      }
+    }
+    free(scorer->blocks);
+  }
+  if(scorer->quantized) {
+    destroyQuantizedEnsemble(scorer->quantized);
+  }
+  if(scorer->compact) {
+    destroyCompactEnsemble(scorer->compact);
+  }
+  if(scorer->oblivious) {
+    destroyObliviousEnsemble(scorer->oblivious);
+  }
+  if(scorer->fixedPoint) {
+    destroyFixedPointLeaves(scorer->fixedPoint);
+  }
+  free(scorer->treeOrder);
+  free(scorer->firstTrees);
+  free(scorer);
+}
+
+struct OptTreesModel {
+  EpochPointer scorer;
+  pthread_mutex_t swapLock; // Serializes writers only
+};
+
+OptTreesModel* createModel(OptTreesScorer* scorer) {
+  OptTreesModel* model;
+  if(posix_memalign((void**) &model, 64, sizeof(OptTreesModel)) != 0) {
+    return 0;
+  }
+  initEpochPointer(&model->scorer, scorer);
+  pthread_mutex_init(&model->swapLock, NULL);
+  return model;
+}
+
+int registerReader(OptTreesModel* model) {
+  return registerEpochReader(&model->scorer);
+}
+
+void unregisterReader(OptTreesModel* model, int reader) {
+  unregisterEpochReader(&model->scorer, reader);
+}
+
+const OptTreesScorer* acquireScorer(OptTreesModel* model, int reader) {
+  return (const OptTreesScorer*) enterEpoch(&model->scorer, reader);
+}
+
+void releaseScorer(OptTreesModel* model, int reader) {
+  exitEpoch(&model->scorer, reader);
+}
+
+void swapScorer(OptTreesModel* model, OptTreesScorer* scorer) {
+  pthread_mutex_lock(&model->swapLock);
+  OptTreesScorer* old = (OptTreesScorer*) publishEpochPointer(&model->scorer, scorer);
+  pthread_mutex_unlock(&model->swapLock);
+  destroyScorer(old);
+}
+
+int reloadModel(OptTreesModel* model, const char* ensemblePath, int maxLeaves,
+                OptTreesLayout layout) {
+  OptTreesScorer* scorer = loadScorer(ensemblePath, maxLeaves, layout);
+  if(!scorer) {
+    return 0;
+  }
+  swapScorer(model, scorer);
+  return 1;
+}
+
+void destroyModel(OptTreesModel* model) {
+  destroyScorer((OptTreesScorer*) model->scorer.value);
+  pthread_mutex_destroy(&model->swapLock);
+  free(model);
+}
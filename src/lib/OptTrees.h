@@ -0,0 +1,178 @@
+#ifndef OPT_TREES_H_GUARD
+#define OPT_TREES_H_GUARD
+
+/**
+ * Public interface of libopttrees, which exposes the tree ensemble
+ * implementations in src/ behind a single scorer type.
+ *
+ * A scorer is created once from an ensemble file and is read-only
+ * afterwards: scoring functions do not allocate memory and may be called
+ * concurrently on the same scorer.
+ *
+ * Feature vectors use the same indexing as the drivers, i.e., the value of
+ * feature "1:" in an SVM Light file is stored at index 0.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+#define OPT_TREES_API __attribute__((visibility("default")))
+#else
+#define OPT_TREES_API
+#endif
+
+typedef struct OptTreesScorer OptTreesScorer;
+
+// Memory layouts that can back a scorer
+typedef enum {
+  OPT_TREES_OBJECT = 0,
+  OPT_TREES_STRUCT = 1,
+  OPT_TREES_STRUCT_PLUS = 2,
+  OPT_TREES_VPRED = 3,
+  OPT_TREES_QUICK_SCORER = 4,
+  OPT_TREES_QUANTIZED = 5, // VPred on integer feature bins (see Quantized.h)
+  OPT_TREES_COMPACT = 6, // 8-byte nodes in breadth-first order (see Compact.h)
+  OPT_TREES_COMPACT_VEB = 7, // 8-byte nodes in van Emde Boas order
+  OPT_TREES_VPRED_GROUPED = 8, // VPred with trees of equal depth scored by one kernel
+  OPT_TREES_STRUCT_PREDICATED = 9, // Struct traversed without branches (getLeafPredicated)
+  OPT_TREES_STRUCT_PLUS_PREDICATED = 10, // StructPlus traversed without branches
+  OPT_TREES_OBLIVIOUS = 11, // Lookup tables for shallow trees, VPred for the others
+  OPT_TREES_VPRED_FIXED16 = 12, // VPred with 16-bit fixed-point leaves (see FixedPoint.h)
+  OPT_TREES_VPRED_FIXED32 = 13, // VPred with 32-bit fixed-point leaves
+  OPT_TREES_STRUCT_INTERLEAVED = 14, // Struct with interleaved traversals (see Interleave.h)
+  OPT_TREES_STRUCT_PLUS_INTERLEAVED = 15 // StructPlus with interleaved traversals
+} OptTreesLayout;
+
+/**
+ * Loads an ensemble in the OptTrees text format (see README.md), a
+ * compiled binary ensemble (see BinaryEnsemble.h) or a jforests XML
+ * ensemble (see JforestsEnsemble.h). The format is detected from the file.
+ *
+ * @param ensemblePath Path to the ensemble file
+ * @param maxLeaves Maximum number of leaves in a tree
+ * @param layout Memory layout used for scoring
+ * @return A new scorer, or 0 if the file could not be read or the
+ *         layout does not support the ensemble
+ */
+OPT_TREES_API OptTreesScorer* loadScorer(const char* ensemblePath, int maxLeaves,
+                                         OptTreesLayout layout);
+
+/**
+ * Computes the score of one instance.
+ *
+ * @param scorer Scorer
+ * @param features Feature vector
+ * @return Sum of the regression values of all trees
+ */
+OPT_TREES_API float scoreInstance(const OptTreesScorer* scorer, const float* features);
+
+/**
+ * Computes the scores of a batch of instances.
+ *
+ * @param scorer Scorer
+ * @param features Row-major matrix, numberOfInstances * numberOfFeatures
+ * @param numberOfInstances Number of instances in the batch
+ * @param numberOfFeatures Length of a feature vector
+ * @param scores Output, one score per instance
+ */
+OPT_TREES_API void scoreBatch(const OptTreesScorer* scorer, const float* features,
+                              int numberOfInstances, int numberOfFeatures,
+                              float* scores);
+
+/**
+ * @return Number of instances that scoreBatch evaluates together; batches
+ *         that are a multiple of it are scored without a remainder
+ */
+OPT_TREES_API int getBatchMultiple(const OptTreesScorer* scorer);
+
+/**
+ * @return Number of trees in the ensemble
+ */
+OPT_TREES_API int getNumberOfTrees(const OptTreesScorer* scorer);
+
+/**
+ * @return Number of features that the ensemble reads, 1 + its largest
+ *         feature id. Feature vectors passed to scoreInstance and
+ *         scoreBatch must be at least this long.
+ */
+OPT_TREES_API int getNumberOfFeatures(const OptTreesScorer* scorer);
+
+/**
+ * Sets the number of traversals in flight per instance of the interleaved
+ * layouts (8 by default, at most 32). It has no effect on other layouts,
+ * and must not be called while the scorer is in use.
+ */
+OPT_TREES_API void setInterleaveGroup(OptTreesScorer* scorer, int groupSize);
+
+/**
+ * @return Number of traversals in flight per instance of the interleaved
+ *         layouts, or 0 for other layouts
+ */
+OPT_TREES_API int getInterleaveGroup(const OptTreesScorer* scorer);
+
+/**
+ * Frees all memory held by the scorer.
+ */
+OPT_TREES_API void destroyScorer(OptTreesScorer* scorer);
+
+/**
+ * A model holds the scorer that a long-running process currently serves,
+ * and lets a new scorer replace it while other threads keep scoring.
+ * Readers take no locks: each reader thread registers once, and brackets
+ * every use of the scorer with acquireScorer and releaseScorer. A replaced
+ * scorer is destroyed once every reader that acquired it has released it.
+ */
+typedef struct OptTreesModel OptTreesModel;
+
+/**
+ * @param scorer Initial scorer, which the model takes ownership of
+ * @return A new model
+ */
+OPT_TREES_API OptTreesModel* createModel(OptTreesScorer* scorer);
+
+/**
+ * Registers the calling thread as a reader.
+ *
+ * @return Reader id, or -1 if too many readers are registered
+ */
+OPT_TREES_API int registerReader(OptTreesModel* model);
+
+OPT_TREES_API void unregisterReader(OptTreesModel* model, int reader);
+
+/**
+ * @return Current scorer, which stays valid until releaseScorer
+ */
+OPT_TREES_API const OptTreesScorer* acquireScorer(OptTreesModel* model, int reader);
+
+OPT_TREES_API void releaseScorer(OptTreesModel* model, int reader);
+
+/**
+ * Publishes a new scorer, waits until no reader holds the old one, and
+ * destroys it. Must not be called between acquireScorer and releaseScorer
+ * of the same thread.
+ *
+ * @param scorer New scorer, which the model takes ownership of
+ */
+OPT_TREES_API void swapScorer(OptTreesModel* model, OptTreesScorer* scorer);
+
+/**
+ * Loads a new scorer (see loadScorer) in the calling thread and swaps it
+ * in. The current scorer is kept if loading fails.
+ *
+ * @return 1 if the new scorer was published, 0 otherwise
+ */
+OPT_TREES_API int reloadModel(OptTreesModel* model, const char* ensemblePath, int maxLeaves,
+                              OptTreesLayout layout);
+
+/**
+ * Destroys the model and its scorer. No reader may hold the scorer.
+ */
+OPT_TREES_API void destroyModel(OptTreesModel* model);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
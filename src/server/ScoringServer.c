@@ -0,0 +1,550 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../ParseCommandLine.h"
+#include "OptTrees.h"
+
+/**
+ * Long-running scoring server. The ensemble is loaded once, and scoring
+ * requests are read from a Unix domain socket or from stdin. Use the
+ * following command to run the server:
+ *
+ * ./ScoringServer -ensemble <ensemble-path> -maxLeaves <max-number-of-leaves>
+ *                 [-socket <socket-path>] [-layout <name>]
+ *                 [-batchSize <instances>] [-maxWait <microseconds>]
+ *                 [-threads <number-of-threads>]
+ *
+ * Without -socket, requests are read from stdin and responses are written
+ * to stdout until stdin is closed. With -socket, any number of clients may
+ * connect, and each connection carries a stream of requests. Requests and
+ * responses are framed in native byte order:
+ *
+ *   request:  int numberOfInstances, int numberOfFeatures,
+ *             float features[numberOfInstances * numberOfFeatures] (row-major)
+ *   response: int numberOfInstances, float scores[numberOfInstances]
+ *
+ * Feature vectors use the same indexing as the library (see OptTrees.h).
+ * Vectors shorter than the ensemble reads (see getNumberOfFeatures) are
+ * padded with zeros.
+ * A client may send several requests before reading the responses, which
+ * come back in request order. A malformed request closes the connection.
+ *
+ * Requests from all connections are queued and grouped into micro-batches
+ * of up to -batchSize instances (256 by default, rounded up to a multiple
+ * of getBatchMultiple, e.g., V for VPred). A batch is scored as soon as it
+ * is full, or once its oldest request has waited -maxWait microseconds
+ * (1000 by default). -threads batches (1 by default) are scored at a
+ * time. -layout selects the layout of the scorer (vpred by default).
+ *
+ * On SIGHUP, the ensemble is loaded again from the same path in the
+ * background and swapped in without pausing traffic (see OptTreesModel).
+ * Batches that started before the swap finish with the old ensemble.
+ */
+
+typedef struct Layout Layout;
+
+struct Layout {
+  const char* name;
+  OptTreesLayout layout;
+};
+
+const Layout LAYOUTS[] = {
+  {"object", OPT_TREES_OBJECT},
+  {"struct", OPT_TREES_STRUCT},
+  {"structplus", OPT_TREES_STRUCT_PLUS},
+  {"vpred", OPT_TREES_VPRED},
+  {"quickscorer", OPT_TREES_QUICK_SCORER},
+  {"quantized", OPT_TREES_QUANTIZED},
+  {"compact", OPT_TREES_COMPACT},
+  {"compact-veb", OPT_TREES_COMPACT_VEB},
+  {"vpred-grouped", OPT_TREES_VPRED_GROUPED},
+  {"struct-predicated", OPT_TREES_STRUCT_PREDICATED},
+  {"structplus-predicated", OPT_TREES_STRUCT_PLUS_PREDICATED},
+  {"oblivious", OPT_TREES_OBLIVIOUS},
+  {"vpred-fixed16", OPT_TREES_VPRED_FIXED16},
+  {"vpred-fixed32", OPT_TREES_VPRED_FIXED32},
+  {"struct-interleaved", OPT_TREES_STRUCT_INTERLEAVED},
+  {"structplus-interleaved", OPT_TREES_STRUCT_PLUS_INTERLEAVED}
+};
+#define NUMBER_OF_LAYOUTS ((int) (sizeof(LAYOUTS) / sizeof(Layout)))
+
+// Largest request that is accepted, in floats
+#define MAX_REQUEST_FLOATS (1L << 28)
+
+typedef struct Connection Connection;
+typedef struct Request Request;
+
+struct Request {
+  Connection* connection;
+  int numberOfInstances;
+  int numberOfFeatures;
+  float* features;
+  float* scores;
+  double arrival; // Time the request was queued (ns)
+  int done;
+  Request* next; // In the batch queue
+  Request* nextPending; // In the connection's list of pending requests
+};
+
+struct Connection {
+  int in;
+  int out;
+  pthread_mutex_t lock;
+  pthread_cond_t completed;
+  Request* pending; // Requests that have not been answered, in order
+  Request* lastPending;
+  int readerDone;
+};
+
+typedef struct Server Server;
+
+struct Server {
+  OptTreesModel* model;
+  const char* ensemblePath; // For reloads
+  int maxLeaves;
+  OptTreesLayout layout;
+  int batchSize;
+  int multiple;
+  double maxWait; // ns
+  pthread_mutex_t lock;
+  pthread_cond_t queued;
+  Request* head; // Batch queue
+  Request* tail;
+  long queuedInstances;
+  int shutdown;
+  long batches; // Statistics
+  long requests;
+  long instances;
+};
+
+Server server;
+
+double now() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/**
+ * @return 1 if all bytes were read, 0 on end of file or error
+ */
+int readFully(int fd, void* buffer, size_t size) {
+  char* p = (char*) buffer;
+  while(size > 0) {
+    ssize_t n = read(fd, p, size);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      return 0;
+    }
+    p += n;
+    size -= n;
+  }
+  return 1;
+}
+
+int writeFully(int fd, const void* buffer, size_t size) {
+  const char* p = (const char*) buffer;
+  while(size > 0) {
+    ssize_t n = write(fd, p, size);
+    if(n < 0 && errno == EINTR) {
+      continue;
+    }
+    if(n <= 0) {
+      return 0;
+    }
+    p += n;
+    size -= n;
+  }
+  return 1;
+}
+
+void enqueueRequest(Request* request) {
+  pthread_mutex_lock(&server.lock);
+  request->arrival = now();
+  request->next = 0;
+  if(server.tail) {
+    server.tail->next = request;
+  } else {
+    server.head = request;
+  }
+  server.tail = request;
+  server.queuedInstances += request->numberOfInstances;
+  pthread_cond_broadcast(&server.queued);
+  pthread_mutex_unlock(&server.lock);
+}
+
+/**
+ * Reads requests from a connection and queues them.
+ */
+void* readRequests(void* argument) {
+  Connection* connection = (Connection*) argument;
+  while(1) {
+    int header[2];
+    if(!readFully(connection->in, header, sizeof(header))) {
+      break;
+    }
+    if(header[0] < 0 || header[1] < 0 ||
+       (long) header[0] * header[1] > MAX_REQUEST_FLOATS) {
+      fprintf(stderr, "Invalid request of %d instances, %d features\n", header[0], header[1]);
+      break;
+    }
+    Request* request = (Request*) calloc(1, sizeof(Request));
+    request->connection = connection;
+    request->numberOfInstances = header[0];
+    request->numberOfFeatures = header[1];
+    long size = (long) header[0] * header[1];
+    request->features = (float*) malloc((size + 1) * sizeof(float));
+    request->scores = (float*) malloc((header[0] + 1) * sizeof(float));
+    if(!readFully(connection->in, request->features, size * sizeof(float))) {
+      free(request->features);
+      free(request->scores);
+      free(request);
+      break;
+    }
+
+    pthread_mutex_lock(&connection->lock);
+    if(connection->lastPending) {
+      connection->lastPending->nextPending = request;
+    } else {
+      connection->pending = request;
+    }
+    connection->lastPending = request;
+    pthread_mutex_unlock(&connection->lock);
+
+    if(request->numberOfInstances == 0) {
+      // Nothing to score
+      pthread_mutex_lock(&connection->lock);
+      request->done = 1;
+      pthread_cond_signal(&connection->completed);
+      pthread_mutex_unlock(&connection->lock);
+    } else {
+      enqueueRequest(request);
+    }
+  }
+
+  pthread_mutex_lock(&connection->lock);
+  connection->readerDone = 1;
+  pthread_cond_signal(&connection->completed);
+  pthread_mutex_unlock(&connection->lock);
+  return 0;
+}
+
+/**
+ * Writes the responses of a connection in request order, and frees the
+ * connection once the reader is done and all requests are answered.
+ */
+void* writeResponses(void* argument) {
+  Connection* connection = (Connection*) argument;
+  int ok = 1;
+  while(1) {
+    pthread_mutex_lock(&connection->lock);
+    while(!(connection->pending && connection->pending->done) &&
+          !(connection->readerDone && !connection->pending)) {
+      pthread_cond_wait(&connection->completed, &connection->lock);
+    }
+    Request* request = connection->pending;
+    if(!request) {
+      pthread_mutex_unlock(&connection->lock);
+      break;
+    }
+    connection->pending = request->nextPending;
+    if(!connection->pending) {
+      connection->lastPending = 0;
+    }
+    pthread_mutex_unlock(&connection->lock);
+
+    // Keep answering (and dropping) requests if the client went away, so
+    // that queued requests are not orphaned
+    ok = ok && writeFully(connection->out, &request->numberOfInstances, sizeof(int));
+    ok = ok && writeFully(connection->out, request->scores,
+                          request->numberOfInstances * sizeof(float));
+    free(request->features);
+    free(request->scores);
+    free(request);
+  }
+
+  if(connection->in != STDIN_FILENO) {
+    close(connection->in);
+  }
+  pthread_mutex_destroy(&connection->lock);
+  pthread_cond_destroy(&connection->completed);
+  free(connection);
+  return 0;
+}
+
+/**
+ * Starts the reader and writer threads of a connection.
+ *
+ * @return Writer thread, which exits after the connection is closed
+ */
+pthread_t openConnection(int in, int out) {
+  Connection* connection = (Connection*) calloc(1, sizeof(Connection));
+  connection->in = in;
+  connection->out = out;
+  pthread_mutex_init(&connection->lock, NULL);
+  pthread_cond_init(&connection->completed, NULL);
+  pthread_t reader, writer;
+  pthread_create(&reader, NULL, &readRequests, connection);
+  pthread_detach(reader);
+  pthread_create(&writer, NULL, &writeResponses, connection);
+  return writer;
+}
+
+/**
+ * Takes the requests of the next batch from the queue, waiting until the
+ * batch is full or the oldest request reaches the deadline.
+ *
+ * @return First request of the batch, linked through "next", or 0 on shutdown
+ */
+Request* takeBatch() {
+  pthread_mutex_lock(&server.lock);
+  while(!server.head && !server.shutdown) {
+    pthread_cond_wait(&server.queued, &server.lock);
+  }
+  while(server.head && server.queuedInstances < server.batchSize && !server.shutdown) {
+    double deadline = server.head->arrival + server.maxWait;
+    double remaining = deadline - now();
+    if(remaining <= 0) {
+      break;
+    }
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    long nanoseconds = until.tv_nsec + (long) remaining;
+    until.tv_sec += nanoseconds / 1000000000L;
+    until.tv_nsec = nanoseconds % 1000000000L;
+    pthread_cond_timedwait(&server.queued, &server.lock, &until);
+  }
+
+  // Take whole requests up to the batch size, and at least one
+  Request* first = server.head;
+  Request* last = 0;
+  long instances = 0;
+  while(server.head &&
+        (!last || instances + server.head->numberOfInstances <= server.batchSize)) {
+    last = server.head;
+    instances += last->numberOfInstances;
+    server.head = last->next;
+  }
+  if(last) {
+    last->next = 0;
+    if(!server.head) {
+      server.tail = 0;
+    }
+    server.queuedInstances -= instances;
+  }
+  pthread_mutex_unlock(&server.lock);
+  return last ? first : 0;
+}
+
+/**
+ * Scores batches until shutdown.
+ */
+void* scoreBatches(void* argument) {
+  long capacity = 0;
+  float* matrix = 0;
+  float* scores = 0;
+  Request* batch;
+  int reader = registerReader(server.model);
+  if(reader < 0) {
+    fprintf(stderr, "Too many threads\n");
+    exit(-1);
+  }
+  while((batch = takeBatch())) {
+    // Copy the requests into one matrix as wide as the widest request and
+    // at least as wide as the ensemble reads; missing features are zero,
+    // and rows are padded to a multiple
+    const OptTreesScorer* scorer = acquireScorer(server.model, reader);
+    Request* r;
+    long rows = 0;
+    int width = getNumberOfFeatures(scorer);
+    for(r = batch; r; r = r->next) {
+      rows += r->numberOfInstances;
+      if(r->numberOfFeatures > width) {
+        width = r->numberOfFeatures;
+      }
+    }
+    long paddedRows = (rows + server.multiple - 1) / server.multiple * server.multiple;
+    if(paddedRows * width > capacity) {
+      capacity = paddedRows * width;
+      free(matrix);
+      free(scores);
+      matrix = (float*) malloc(capacity * sizeof(float));
+      scores = (float*) malloc(capacity * sizeof(float));
+    }
+    memset(matrix, 0, paddedRows * width * sizeof(float));
+    long row = 0;
+    int i;
+    for(r = batch; r; r = r->next) {
+      for(i = 0; i < r->numberOfInstances; i++) {
+        memcpy(&matrix[(row + i) * width], &r->features[(long) i * r->numberOfFeatures],
+               r->numberOfFeatures * sizeof(float));
+      }
+      row += r->numberOfInstances;
+    }
+
+    scoreBatch(scorer, matrix, (int) paddedRows, width, scores);
+    releaseScorer(server.model, reader);
+
+    row = 0;
+    int count = 0;
+    for(r = batch; r; ) {
+      Request* next = r->next;
+      memcpy(r->scores, &scores[row], r->numberOfInstances * sizeof(float));
+      row += r->numberOfInstances;
+      count++;
+      Connection* connection = r->connection;
+      pthread_mutex_lock(&connection->lock);
+      r->done = 1;
+      pthread_cond_signal(&connection->completed);
+      pthread_mutex_unlock(&connection->lock);
+      r = next;
+    }
+    __atomic_add_fetch(&server.batches, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&server.requests, count, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&server.instances, rows, __ATOMIC_RELAXED);
+  }
+  unregisterReader(server.model, reader);
+  free(matrix);
+  free(scores);
+  return 0;
+}
+
+/**
+ * Reloads the ensemble on every SIGHUP, which is blocked in all threads.
+ */
+void* reloadOnSignal(void* argument) {
+  sigset_t* signals = (sigset_t*) argument;
+  int received;
+  while(sigwait(signals, &received) == 0) {
+    if(reloadModel(server.model, server.ensemblePath, server.maxLeaves, server.layout)) {
+      fprintf(stderr, "Reloaded %s\n", server.ensemblePath);
+    } else {
+      fprintf(stderr, "Could not reload %s, keeping the current ensemble\n",
+              server.ensemblePath);
+    }
+  }
+  return 0;
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  char* socketPath = getValueCL(argc, args, (char*) "-socket");
+  const char* layoutName = isPresentCL(argc, args, (char*) "-layout") ?
+    getValueCL(argc, args, (char*) "-layout") : "vpred";
+  int batchSize = isPresentCL(argc, args, (char*) "-batchSize") ?
+    atoi(getValueCL(argc, args, (char*) "-batchSize")) : 256;
+  long maxWait = isPresentCL(argc, args, (char*) "-maxWait") ?
+    atol(getValueCL(argc, args, (char*) "-maxWait")) : 1000;
+  int numberOfThreads = isPresentCL(argc, args, (char*) "-threads") ?
+    atoi(getValueCL(argc, args, (char*) "-threads")) : 1;
+  if(batchSize < 1 || maxWait < 0 || numberOfThreads < 1) {
+    fprintf(stderr, "Invalid -batchSize, -maxWait or -threads\n");
+    return -1;
+  }
+
+  int l;
+  for(l = 0; l < NUMBER_OF_LAYOUTS && strcmp(LAYOUTS[l].name, layoutName); l++);
+  if(l == NUMBER_OF_LAYOUTS) {
+    fprintf(stderr, "Unknown layout %s\n", layoutName);
+    return -1;
+  }
+  OptTreesScorer* scorer = loadScorer(configFile, maxNumberOfLeaves, LAYOUTS[l].layout);
+  if(!scorer) {
+    fprintf(stderr, "Could not load %s with layout %s\n", configFile, layoutName);
+    return -1;
+  }
+
+  memset(&server, 0, sizeof(server));
+  server.ensemblePath = configFile;
+  server.maxLeaves = maxNumberOfLeaves;
+  server.layout = LAYOUTS[l].layout;
+  server.multiple = getBatchMultiple(scorer);
+  server.batchSize = (batchSize + server.multiple - 1) / server.multiple * server.multiple;
+  server.maxWait = maxWait * 1e3;
+  pthread_mutex_init(&server.lock, NULL);
+  pthread_cond_init(&server.queued, NULL);
+  int numberOfTrees = getNumberOfTrees(scorer);
+  server.model = createModel(scorer);
+  // Clients that disconnect must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  static sigset_t reloadSignals;
+  sigemptyset(&reloadSignals);
+  sigaddset(&reloadSignals, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &reloadSignals, NULL);
+  pthread_t reloader;
+  pthread_create(&reloader, NULL, &reloadOnSignal, &reloadSignals);
+  pthread_detach(reloader);
+
+  pthread_t* batchers = (pthread_t*) malloc(numberOfThreads * sizeof(pthread_t));
+  int t;
+  for(t = 0; t < numberOfThreads; t++) {
+    pthread_create(&batchers[t], NULL, &scoreBatches, 0);
+  }
+
+  int status = 0;
+  if(socketPath) {
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(listener < 0 || strlen(socketPath) >= sizeof(address.sun_path)) {
+      fprintf(stderr, "Could not create socket %s\n", socketPath);
+      return -1;
+    }
+    strcpy(address.sun_path, socketPath);
+    unlink(socketPath);
+    if(bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+       listen(listener, 64) != 0) {
+      fprintf(stderr, "Could not listen on %s\n", socketPath);
+      return -1;
+    }
+    fprintf(stderr, "Listening on %s (%d trees, batches of %d, max wait %ld us)\n",
+            socketPath, numberOfTrees, server.batchSize, maxWait);
+    while(1) {
+      int client = accept(listener, NULL, NULL);
+      if(client < 0) {
+        if(errno == EINTR || errno == ECONNABORTED) {
+          continue;
+        }
+        fprintf(stderr, "Could not accept connections on %s\n", socketPath);
+        status = -1;
+        break;
+      }
+      pthread_detach(openConnection(client, client));
+    }
+    close(listener);
+    unlink(socketPath);
+  } else {
+    // A single connection on stdin and stdout; stop once it is closed
+    pthread_join(openConnection(STDIN_FILENO, STDOUT_FILENO), NULL);
+  }
+
+  pthread_mutex_lock(&server.lock);
+  server.shutdown = 1;
+  pthread_cond_broadcast(&server.queued);
+  pthread_mutex_unlock(&server.lock);
+  for(t = 0; t < numberOfThreads; t++) {
+    pthread_join(batchers[t], NULL);
+  }
+  fprintf(stderr, "Scored %ld requests, %ld instances in %ld batches\n",
+          server.requests, server.instances, server.batches);
+
+  free(batchers);
+  destroyModel(server.model);
+  return status;
+}
@@ -0,0 +1,583 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "../lib/OptTrees.cpp"
+#include "../BinaryInstances.h"
+#include "../SvmLight.h"
+#include "../ParseCommandLine.h"
+
+/**
+ * Checks that every implementation computes the same scores as the
+ * reference, i.e., Struct trees built directly from the ensemble file.
+ * Use the following command to run this tool:
+ *
+ * ./CheckEquivalence -ensemble <ensemble-path> -instances <test-instances-path> \
+ *                    -maxLeaves <max-number-of-leaves>
+ *                    [-instancesBinary <binary-instances-path>]
+ *                    [-ulps <max-ulps>] [-epsilon <max-absolute-difference>]
+ *                    [-reference <reference-ensemble-path>]
+ *
+ * The ensemble is loaded through every layout of libopttrees, and the
+ * scores of scoreInstance and scoreBatch are compared with the reference.
+ * Scores match if they are at most -ulps units in the last place apart
+ * (default 4), or at most -epsilon apart (default 1e-5); the fixed-point
+ * layouts may also differ by their rounding error (see FixedPoint.h). For the first
+ * instance that does not match, the tool reports the first tree whose
+ * leaf differs and the path the instance takes in both trees.
+ *
+ * With -reference, the reference trees are read from another file, e.g.,
+ * the text conversion of a jforests ensemble that is loaded with -ensemble.
+ *
+ * This file includes the library implementation so that it can walk the
+ * trees of each layout. The exit status is 0 if all scores match.
+ */
+
+// Layouts are checked in this order; "vpred-batch", "compact-batch",
+// "vpred-grouped", "oblivious-batch" and the fixed-point layouts are the
+// V-instance kernel paths of scoreBatch, the others use scoreInstance
+const char* LAYOUT_NAMES[] = {
+  "object", "struct", "structplus", "vpred", "vpred-batch", "quickscorer", "quantized",
+  "compact", "compact-veb", "compact-batch", "vpred-grouped", "struct-predicated",
+  "structplus-predicated", "oblivious", "oblivious-batch", "vpred-fixed16", "vpred-fixed32",
+  "struct-interleaved", "structplus-interleaved"
+};
+const OptTreesLayout LAYOUTS[] = {
+  OPT_TREES_OBJECT, OPT_TREES_STRUCT, OPT_TREES_STRUCT_PLUS, OPT_TREES_VPRED,
+  OPT_TREES_VPRED, OPT_TREES_QUICK_SCORER, OPT_TREES_QUANTIZED, OPT_TREES_COMPACT,
+  OPT_TREES_COMPACT_VEB, OPT_TREES_COMPACT, OPT_TREES_VPRED_GROUPED,
+  OPT_TREES_STRUCT_PREDICATED, OPT_TREES_STRUCT_PLUS_PREDICATED, OPT_TREES_OBLIVIOUS,
+  OPT_TREES_OBLIVIOUS, OPT_TREES_VPRED_FIXED16, OPT_TREES_VPRED_FIXED32,
+  OPT_TREES_STRUCT_INTERLEAVED, OPT_TREES_STRUCT_PLUS_INTERLEAVED
+};
+#define NUMBER_OF_LAYOUTS 19
+#define VPRED_BATCH 4
+#define COMPACT_BATCH 9
+#define VPRED_GROUPED 10
+#define OBLIVIOUS_BATCH 14
+#define VPRED_FIXED16 15
+#define VPRED_FIXED32 16
+
+int isBatchLayout(int layoutIndex) {
+  return layoutIndex == VPRED_BATCH || layoutIndex == COMPACT_BATCH ||
+    layoutIndex == VPRED_GROUPED || layoutIndex == OBLIVIOUS_BATCH ||
+    layoutIndex == VPRED_FIXED16 || layoutIndex == VPRED_FIXED32;
+}
+
+/**
+ * @return Position of a tree of the ensemble file in the scorer, which
+ *         differs from the file when trees are grouped by depth
+ */
+int getTreePosition(OptTreesScorer* scorer, int tindex) {
+  int t;
+  for(t = 0; scorer->treeOrder && t < scorer->numberOfTrees; t++) {
+    if(scorer->treeOrder[t] == tindex) {
+      return t;
+    }
+  }
+  return tindex;
+}
+
+/**
+ * @return Distance between two floats in units in the last place
+ */
+long ulpDistance(float a, float b) {
+  if(a == b) {
+    return 0;
+  }
+  if(isnan(a) || isnan(b)) {
+    return 0x7fffffffL;
+  }
+  // Map floats onto a monotonic integer scale
+  int x, y;
+  memcpy(&x, &a, sizeof(float));
+  memcpy(&y, &b, sizeof(float));
+  long lx = x < 0 ? (long) (int) 0x80000000 - x : x;
+  long ly = y < 0 ? (long) (int) 0x80000000 - y : y;
+  return lx > ly ? lx - ly : ly - lx;
+}
+
+int isEquivalent(float a, float b, long maxUlps, double epsilon) {
+  return ulpDistance(a, b) <= maxUlps || fabs((double) a - b) <= epsilon;
+}
+
+/**
+ * Prints the path of an instance through a pointer-based tree. Struct and
+ * StructPlus index features by fid, Object by abs(fid).
+ */
+template<typename T>
+void printPath(const char* name, T* node, float* features, bool absoluteFid) {
+  printf("    %-22s", name);
+  while(node->left || node->right) {
+    int fid = absoluteFid ? abs(node->fid) : node->fid;
+    bool left = features[fid] <= node->threshold;
+    printf(" [%lu] f%d=%g %s %g ->", (unsigned long) node->id, node->fid,
+           features[fid], left ? "<=" : ">", node->threshold);
+    node = left ? node->left : node->right;
+  }
+  printf(" leaf [%lu] %g\n", (unsigned long) node->id, node->threshold);
+}
+
+void printCompactPath(const char* name, CompactNode* nodes, float* values, float* features) {
+  printf("    %-22s", name);
+  int idx = 0;
+  while(nodes[idx].left != idx) {
+    bool right = features[nodes[idx].fid] > nodes[idx].threshold;
+    printf(" [%d] f%d=%g %s %g ->", idx, nodes[idx].fid, features[nodes[idx].fid],
+           right ? ">" : "<=", nodes[idx].threshold);
+    idx = nodes[idx].left + right;
+  }
+  printf(" leaf [%d] %g\n", idx, values[idx]);
+}
+
+void printVPredPath(const char* name, Node* nodes, long depth, float* features) {
+  printf("    %-22s", name);
+  int idx = 0;
+  long d;
+  for(d = 0; d < depth && nodes[idx].children[0] != idx; d++) {
+    bool right = features[nodes[idx].fid] > nodes[idx].theta;
+    printf(" [%d] f%d=%g %s %g ->", idx, nodes[idx].fid, features[nodes[idx].fid],
+           right ? ">" : "<=", nodes[idx].theta);
+    idx = nodes[idx].children[right];
+  }
+  printf(" leaf [%d] %g\n", idx, nodes[idx].theta);
+}
+
+/**
+ * Computes the bins of an instance for the quantized layout.
+ *
+ * @return One bin per feature of the quantizer, to be freed by the caller
+ */
+int* getBins(QuantizedEnsemble* e, float* features, int numberOfFeatures) {
+  const Quantizer* q = &e->quantizer;
+  int* bins = (int*) malloc(q->numberOfFeatures * sizeof(int));
+  int f;
+  for(f = 0; f < q->numberOfFeatures; f++) {
+    bins[f] = getBin(q, f, f < numberOfFeatures ? features[f] : 0);
+  }
+  return bins;
+}
+
+/**
+ * Computes the leaf value of every tree for one instance, as the given
+ * layout of the scorer computes it.
+ *
+ * @param block Start of the V-instance block of the instance, for batch layouts
+ * @param lane Position of the instance in its block, for batch layouts
+ */
+void getLeafValues(OptTreesScorer* scorer, int layoutIndex, float* features,
+                   float* block, int lane, int numberOfFeatures, float* values) {
+  int tindex;
+  switch(scorer->layout) {
+  case OPT_TREES_OBJECT:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      values[tindex] = scorer->objects[tindex]->getLeaf(features, 0);
+    }
+    break;
+  case OPT_TREES_STRUCT:
+  case OPT_TREES_STRUCT_INTERLEAVED:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      values[tindex] = getLeaf(scorer->structs[tindex], features)->threshold;
+    }
+    break;
+  case OPT_TREES_STRUCT_PLUS:
+  case OPT_TREES_STRUCT_PLUS_INTERLEAVED:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      values[tindex] = getLeaf(scorer->structPlus[tindex], features)->threshold;
+    }
+    break;
+  case OPT_TREES_STRUCT_PREDICATED:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      values[tindex] = getLeafPredicated(scorer->structs[tindex], features,
+                                         scorer->depths[tindex])->threshold;
+    }
+    break;
+  case OPT_TREES_STRUCT_PLUS_PREDICATED:
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      values[tindex] = getLeafPredicated(scorer->structPlus[tindex], features,
+                                         scorer->depths[tindex])->threshold;
+    }
+    break;
+  case OPT_TREES_VPRED:
+  case OPT_TREES_VPRED_GROUPED:
+  case OPT_TREES_VPRED_FIXED16:
+  case OPT_TREES_VPRED_FIXED32:
+    // Values are stored at the index of the tree in the ensemble file. The
+    // leaves of the fixed-point layouts hold ordinals, so these report the
+    // rounded value of the leaf they reached
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      Node* nodes = &scorer->nodes[scorer->offsets[tindex]];
+      long depth = scorer->depths[tindex];
+      int t = scorer->treeOrder ? scorer->treeOrder[tindex] : tindex;
+      int leaf[V];
+      if(isBatchLayout(layoutIndex) && block) {
+        getFindLeaves(&scorer->kernels, depth)((int) depth, leaf, block, numberOfFeatures, nodes);
+      } else {
+        leaf[lane] = findLeafVPred(nodes, depth, features);
+      }
+      if(scorer->fixedPoint) {
+        values[t] = getFixedPointScore(scorer->fixedPoint,
+                                       getFixedPointLeaf(scorer->fixedPoint, tindex,
+                                                         &nodes[leaf[lane]]));
+      } else {
+        values[t] = nodes[leaf[lane]].theta;
+      }
+    }
+    break;
+  case OPT_TREES_QUICK_SCORER: {
+    unsigned long long v[QUICK_SCORER_BLOCK];
+    int b, t;
+    for(b = 0; b < scorer->numberOfBlocks; b++) {
+      QuickScorer* qs = scorer->blocks[b];
+      getScore(qs, features, v);
+      for(t = 0; t < qs->numberOfTrees; t++) {
+        values[b * QUICK_SCORER_BLOCK + t] =
+          qs->leaves[(long) t * qs->maxLeaves + __builtin_ctzll(v[t])];
+      }
+    }
+    break;
+  }
+  case OPT_TREES_QUANTIZED: {
+    QuantizedEnsemble* e = scorer->quantized;
+    int* bins = getBins(e, features, numberOfFeatures);
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      QuantizedNode* nodes = &e->nodes[e->offsets[tindex]];
+      int idx = 0;
+      long d;
+      for(d = 0; d < e->depths[tindex]; d++) {
+        idx = nodes[idx].children[bins[nodes[idx].fid] > nodes[idx].threshold];
+      }
+      values[tindex] = e->leaves[e->leafOffsets[tindex] + nodes[idx].threshold];
+    }
+    free(bins);
+    break;
+  }
+  case OPT_TREES_COMPACT:
+  case OPT_TREES_COMPACT_VEB: {
+    CompactEnsemble* e = scorer->compact;
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      long offset = e->offsets[tindex];
+      if(layoutIndex == COMPACT_BATCH && block) {
+        int leaf[V];
+        long depth = e->depths[tindex];
+        getFindLeaves(&scorer->compactKernels, depth)((int) depth, leaf, block, numberOfFeatures,
+                                                      &e->nodes[offset]);
+        values[tindex] = e->values[offset + leaf[lane]];
+      } else {
+        values[tindex] = e->values[offset + findLeafCompact(&e->nodes[offset], features)];
+      }
+    }
+    break;
+  }
+  case OPT_TREES_OBLIVIOUS: {
+    ObliviousEnsemble* e = scorer->oblivious;
+    for(tindex = 0; tindex < scorer->numberOfTrees; tindex++) {
+      if(layoutIndex == OBLIVIOUS_BATCH && block) {
+        float scores[V] = {0};
+        addObliviousScores(e, scorer->addTableScores, &scorer->kernels, block,
+                           numberOfFeatures, tindex, tindex + 1, scores);
+        values[tindex] = scores[lane];
+      } else if(e->levels[tindex] >= 0) {
+        long level = e->firstLevels[tindex];
+        values[tindex] = e->tables[e->tableOffsets[tindex] +
+                                   findTableIndex(e->levels[tindex], &e->fids[level],
+                                                  &e->thresholds[level], features)];
+      } else {
+        Node* nodes = &e->nodes[e->offsets[tindex]];
+        values[tindex] = nodes[findLeafVPred(nodes, e->depths[tindex], features)].theta;
+      }
+    }
+    break;
+  }
+  }
+}
+
+/**
+ * Prints the path of an instance through one tree of a layout.
+ */
+void printLayoutPath(OptTreesScorer* scorer, int layoutIndex, int tindex,
+                     float* features, float* block, int lane) {
+  const char* name = LAYOUT_NAMES[layoutIndex];
+  switch(scorer->layout) {
+  case OPT_TREES_OBJECT:
+    printPath(name, scorer->objects[tindex], features, true);
+    break;
+  case OPT_TREES_STRUCT:
+  case OPT_TREES_STRUCT_PREDICATED:
+  case OPT_TREES_STRUCT_INTERLEAVED:
+    printPath(name, scorer->structs[tindex], features, false);
+    break;
+  case OPT_TREES_STRUCT_PLUS:
+  case OPT_TREES_STRUCT_PLUS_PREDICATED:
+  case OPT_TREES_STRUCT_PLUS_INTERLEAVED:
+    printPath(name, scorer->structPlus[tindex], features, false);
+    break;
+  case OPT_TREES_VPRED:
+  case OPT_TREES_VPRED_GROUPED:
+  case OPT_TREES_VPRED_FIXED16:
+  case OPT_TREES_VPRED_FIXED32: {
+    int t = getTreePosition(scorer, tindex);
+    printVPredPath(name, &scorer->nodes[scorer->offsets[t]], scorer->depths[t], features);
+    if(scorer->fixedPoint) {
+      printf("    (the leaf holds its ordinal in the fixed-point leaves of the tree)\n");
+    }
+    if(isBatchLayout(layoutIndex) && block) {
+      printf("    (V-instance kernel %s, lane %d)\n",
+             scorer->kernels.isa != KERNEL_SCALAR ? "with SIMD gathers" : "scalar", lane);
+    }
+    break;
+  }
+  case OPT_TREES_QUICK_SCORER: {
+    // QuickScorer has no paths; report the exit leaf of the tree
+    unsigned long long v[QUICK_SCORER_BLOCK];
+    QuickScorer* qs = scorer->blocks[tindex / QUICK_SCORER_BLOCK];
+    int t = tindex % QUICK_SCORER_BLOCK;
+    getScore(qs, features, v);
+    printf("    %-22s exit leaf %d (bitvector %016llx) %g\n", name,
+           __builtin_ctzll(v[t]), v[t],
+           qs->leaves[(long) t * qs->maxLeaves + __builtin_ctzll(v[t])]);
+    break;
+  }
+  case OPT_TREES_QUANTIZED: {
+    QuantizedEnsemble* e = scorer->quantized;
+    QuantizedNode* nodes = &e->nodes[e->offsets[tindex]];
+    int* bins = getBins(e, features, e->quantizer.numberOfFeatures);
+    printf("    %-22s", name);
+    int idx = 0;
+    long d;
+    for(d = 0; d < e->depths[tindex] && nodes[idx].children[0] != idx; d++) {
+      bool right = bins[nodes[idx].fid] > nodes[idx].threshold;
+      printf(" [%d] f%d=%g bin %d %s %d ->", idx, nodes[idx].fid, features[nodes[idx].fid],
+             bins[nodes[idx].fid], right ? ">" : "<=", nodes[idx].threshold);
+      idx = nodes[idx].children[right];
+    }
+    printf(" leaf [%d] %g\n", idx, e->leaves[e->leafOffsets[tindex] + nodes[idx].threshold]);
+    free(bins);
+    break;
+  }
+  case OPT_TREES_OBLIVIOUS: {
+    ObliviousEnsemble* e = scorer->oblivious;
+    if(e->levels[tindex] < 0) {
+      printVPredPath(name, &e->nodes[e->offsets[tindex]], e->depths[tindex], features);
+      break;
+    }
+    long level = e->firstLevels[tindex];
+    int l;
+    printf("    %-22s", name);
+    for(l = 0; l < e->levels[tindex]; l++) {
+      int fid = e->fids[level + l];
+      printf(" f%d=%g %s %g ->", fid, features[fid],
+             features[fid] > e->thresholds[level + l] ? ">" : "<=", e->thresholds[level + l]);
+    }
+    int idx = findTableIndex(e->levels[tindex], &e->fids[level], &e->thresholds[level],
+                             features);
+    printf(" entry [%d] %g\n", idx, e->tables[e->tableOffsets[tindex] + idx]);
+    if(layoutIndex == OBLIVIOUS_BATCH && block) {
+      printf("    (V-instance kernel %s, lane %d)\n",
+             scorer->kernels.isa != KERNEL_SCALAR ? "with SIMD gathers" : "scalar", lane);
+    }
+    break;
+  }
+  case OPT_TREES_COMPACT:
+  case OPT_TREES_COMPACT_VEB: {
+    CompactEnsemble* e = scorer->compact;
+    long offset = e->offsets[tindex];
+    printCompactPath(name, &e->nodes[offset], &e->values[offset], features);
+    if(layoutIndex == COMPACT_BATCH && block) {
+      printf("    (V-instance kernel %s, lane %d)\n",
+             scorer->compactKernels.isa != KERNEL_SCALAR ? "with SIMD gathers" : "scalar",
+             lane);
+    }
+    break;
+  }
+  }
+}
+
+int main(int argc, char** args) {
+  if(!isPresentCL(argc, args, (char*) "-ensemble") ||
+     (!isPresentCL(argc, args, (char*) "-instances") &&
+      !isPresentCL(argc, args, (char*) "-instancesBinary")) ||
+     !isPresentCL(argc, args, (char*) "-maxLeaves")) {
+    return -1;
+  }
+
+  char* configFile = getValueCL(argc, args, (char*) "-ensemble");
+  char* referenceFile = isPresentCL(argc, args, (char*) "-reference") ?
+    getValueCL(argc, args, (char*) "-reference") : configFile;
+  char* featureFile = getValueCL(argc, args, (char*) "-instances");
+  char* binaryFeatureFile = getValueCL(argc, args, (char*) "-instancesBinary");
+  int maxNumberOfLeaves = atoi(getValueCL(argc, args, (char*) "-maxLeaves"));
+  long maxUlps = isPresentCL(argc, args, (char*) "-ulps") ?
+    atol(getValueCL(argc, args, (char*) "-ulps")) : 4;
+  double epsilon = isPresentCL(argc, args, (char*) "-epsilon") ?
+    atof(getValueCL(argc, args, (char*) "-epsilon")) : 1e-5;
+
+  // Read instances, padded to a multiple of V for the VPred kernels
+  int numberOfInstances, numberOfFeatures;
+  float* features;
+  BinaryInstances* binaryInstances = 0;
+  Instances* instances = 0;
+  // Features and reference trees
+  Arena* arena = createArena(0);
+  if(binaryFeatureFile) {
+    binaryInstances = mapBinaryInstances(binaryFeatureFile);
+    if(!binaryInstances) {
+      fprintf(stderr, "Could not map %s\n", binaryFeatureFile);
+      return -1;
+    }
+    numberOfInstances = binaryInstances->numberOfInstances;
+    numberOfFeatures = binaryInstances->numberOfFeatures;
+    features = getRowMajorFeatures(binaryInstances, V, arena);
+  } else {
+    instances = readInstances(featureFile, V, 0, arena);
+    if(!instances) {
+      fprintf(stderr, "Could not read %s\n", featureFile);
+      return -1;
+    }
+    numberOfInstances = instances->numberOfInstances;
+    numberOfFeatures = instances->numberOfFeatures;
+    features = instances->features;
+  }
+
+  // Reference trees, built from the file without going through the
+  // packed node arrays that all layouts are created from
+  Struct** reference;
+  int nbTrees;
+  int tindex, iIndex;
+  if(isBinaryEnsemble(referenceFile) || isJforestsEnsemble(referenceFile)) {
+    BinaryEnsemble* binaryEnsemble = loadPackedEnsemble(referenceFile, maxNumberOfLeaves, 0);
+    if(!binaryEnsemble) {
+      fprintf(stderr, "Could not load %s\n", referenceFile);
+      return -1;
+    }
+    nbTrees = binaryEnsemble->numberOfTrees;
+    reference = (Struct**) malloc(nbTrees * sizeof(Struct*));
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      reference[tindex] = createStructFromNodes(
+        arena, &binaryEnsemble->nodes[binaryEnsemble->offsets[tindex]], 0);
+    }
+    unmapBinaryEnsemble(binaryEnsemble);
+  } else {
+    long* depths;
+    nbTrees = readEnsemble(referenceFile, maxNumberOfLeaves, arena, &reference, &depths);
+    if(nbTrees < 0) {
+      fprintf(stderr, "Could not read %s\n", referenceFile);
+      return -1;
+    }
+    free(depths);
+  }
+
+  float* expected = (float*) malloc(numberOfInstances * sizeof(float));
+  float* referenceValues = (float*) malloc(nbTrees * sizeof(float));
+  float* values = (float*) malloc(nbTrees * sizeof(float));
+  float* scores = (float*) malloc(numberOfInstances * sizeof(float));
+  for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+    float* fv = &features[(long) iIndex * numberOfFeatures];
+    expected[iIndex] = 0;
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      expected[iIndex] += getLeaf(reference[tindex], fv)->threshold;
+    }
+  }
+
+  printf("Checking %d trees on %d instances (max %ld ulps or %g)\n",
+         nbTrees, numberOfInstances, maxUlps, epsilon);
+  int failures = 0;
+  int l;
+  for(l = 0; l < NUMBER_OF_LAYOUTS; l++) {
+    OptTreesScorer* scorer = loadScorer(configFile, maxNumberOfLeaves, LAYOUTS[l]);
+    if(!scorer) {
+      printf("%-22s not supported by this ensemble, skipped\n", LAYOUT_NAMES[l]);
+      continue;
+    }
+    if(getNumberOfTrees(scorer) != nbTrees) {
+      printf("%-22s FAIL: %d trees, expected %d\n", LAYOUT_NAMES[l],
+             getNumberOfTrees(scorer), nbTrees);
+      failures++;
+      destroyScorer(scorer);
+      continue;
+    }
+
+    if(isBatchLayout(l)) {
+      scoreBatch(scorer, features, numberOfInstances, numberOfFeatures, scores);
+    } else {
+      for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+        scores[iIndex] = scoreInstance(scorer, &features[(long) iIndex * numberOfFeatures]);
+      }
+    }
+
+    double layoutEpsilon = epsilon;
+    if(scorer->fixedPoint) {
+      layoutEpsilon += getFixedPointError(scorer->fixedPoint);
+    }
+    int mismatches = 0;
+    int first = -1;
+    long worstUlps = 0;
+    for(iIndex = 0; iIndex < numberOfInstances; iIndex++) {
+      long ulps = ulpDistance(scores[iIndex], expected[iIndex]);
+      if(ulps > worstUlps) {
+        worstUlps = ulps;
+      }
+      if(!isEquivalent(scores[iIndex], expected[iIndex], maxUlps, layoutEpsilon)) {
+        mismatches++;
+        if(first < 0) {
+          first = iIndex;
+        }
+      }
+    }
+
+    if(mismatches == 0) {
+      printf("%-22s OK (max %ld ulps)\n", LAYOUT_NAMES[l], worstUlps);
+      destroyScorer(scorer);
+      continue;
+    }
+
+    failures++;
+    printf("%-22s FAIL: %d of %d instances differ; first is instance %d: %.9g, expected %.9g (%ld ulps)\n",
+           LAYOUT_NAMES[l], mismatches, numberOfInstances, first, scores[first],
+           expected[first], ulpDistance(scores[first], expected[first]));
+
+    // Find the first tree whose leaf differs from the reference
+    float* fv = &features[(long) first * numberOfFeatures];
+    float* block = 0;
+    int lane = first % V;
+    if(isBatchLayout(l) && first - lane + V <= numberOfInstances) {
+      block = &features[(long) (first - lane) * numberOfFeatures];
+    }
+    getLeafValues(scorer, l, fv, block, lane, numberOfFeatures, values);
+    for(tindex = 0; tindex < nbTrees; tindex++) {
+      referenceValues[tindex] = getLeaf(reference[tindex], fv)->threshold;
+      if(scorer->fixedPoint) {
+        referenceValues[tindex] = getFixedPointScore(scorer->fixedPoint,
+                                                     toFixedPoint(scorer->fixedPoint,
+                                                                  referenceValues[tindex]));
+      }
+    }
+    for(tindex = 0; tindex < nbTrees && values[tindex] == referenceValues[tindex]; tindex++);
+    if(tindex < nbTrees) {
+      printf("  first differing tree is %d: leaf %.9g, expected %.9g\n",
+             tindex, values[tindex], referenceValues[tindex]);
+      printPath("reference", reference[tindex], fv, false);
+      printLayoutPath(scorer, l, tindex, fv, block, lane);
+    } else {
+      printf("  all leaves match; the difference comes from accumulating the scores\n");
+    }
+    destroyScorer(scorer);
+  }
+
+  free(reference);
+  free(scores);
+  free(values);
+  free(referenceValues);
+  free(expected);
+  if(binaryInstances) {
+    unmapBinaryInstances(binaryInstances);
+  }
+  destroyArena(arena);
+
+  if(failures > 0) {
+    printf("%d layouts differ from the reference\n", failures);
+    return 1;
+  }
+  printf("All layouts match the reference\n");
+  return 0;
+}